@@ -37,11 +37,17 @@ struct _GdkVulkanContextPrivate {
 
   int swapchain_width, swapchain_height;
   VkSwapchainKHR swapchain;
-  VkSemaphore draw_semaphore;
+  VkSemaphore acquire_semaphore;
 
   guint n_images;
   VkImage *images;
   cairo_region_t **regions;
+  /* Signaled when the image was acquired and when drawing to it is done.
+   * They are kept per image so that a semaphore is only reused once the
+   * present engine has released the image, which means the previous
+   * submission waiting on or signaling it has completed. */
+  VkSemaphore *draw_semaphores;
+  VkSemaphore *render_semaphores;
 #endif
 
   guint32 draw_index;
@@ -123,31 +129,64 @@ gdk_vulkan_strerror (VkResult result)
   }
 }
 
+static VkSemaphore
+gdk_vulkan_context_create_semaphore (GdkVulkanContext *context)
+{
+  VkSemaphore semaphore;
+
+  GDK_VK_CHECK (vkCreateSemaphore, gdk_vulkan_context_get_device (context),
+                                   &(VkSemaphoreCreateInfo) {
+                                       .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                                   },
+                                   NULL,
+                                   &semaphore);
+
+  return semaphore;
+}
+
 static void
-gdk_vulkan_context_dispose (GObject *gobject)
+gdk_vulkan_context_free_images (GdkVulkanContext *context)
 {
-  GdkVulkanContext *context = GDK_VULKAN_CONTEXT (gobject);
   GdkVulkanContextPrivate *priv = gdk_vulkan_context_get_instance_private (context);
-  GdkDisplay *display;
   VkDevice device;
   guint i;
 
+  device = gdk_vulkan_context_get_device (context);
+
   for (i = 0; i < priv->n_images; i++)
     {
       cairo_region_destroy (priv->regions[i]);
+      vkDestroySemaphore (device, priv->draw_semaphores[i], NULL);
+      vkDestroySemaphore (device, priv->render_semaphores[i], NULL);
     }
   g_clear_pointer (&priv->regions, g_free);
+  g_clear_pointer (&priv->draw_semaphores, g_free);
+  g_clear_pointer (&priv->render_semaphores, g_free);
   g_clear_pointer (&priv->images, g_free);
   priv->n_images = 0;
+}
+
+static void
+gdk_vulkan_context_dispose (GObject *gobject)
+{
+  GdkVulkanContext *context = GDK_VULKAN_CONTEXT (gobject);
+  GdkVulkanContextPrivate *priv = gdk_vulkan_context_get_instance_private (context);
+  GdkDisplay *display;
+  VkDevice device;
 
   device = gdk_vulkan_context_get_device (context);
 
-  if (priv->draw_semaphore != VK_NULL_HANDLE)
+  if (priv->n_images > 0)
+    vkQueueWaitIdle (gdk_vulkan_context_get_queue (context));
+
+  gdk_vulkan_context_free_images (context);
+
+  if (priv->acquire_semaphore != VK_NULL_HANDLE)
     {
       vkDestroySemaphore (device,
-                           priv->draw_semaphore,
+                           priv->acquire_semaphore,
                            NULL);
-      priv->draw_semaphore = VK_NULL_HANDLE;
+      priv->acquire_semaphore = VK_NULL_HANDLE;
     }
 
   if (priv->swapchain != VK_NULL_HANDLE)
@@ -259,16 +298,12 @@ gdk_vulkan_context_check_swapchain (GdkVulkanContext  *context,
 
   if (priv->swapchain != VK_NULL_HANDLE)
     {
+      /* Frames still in flight wait on and signal the old semaphores */
+      vkQueueWaitIdle (gdk_vulkan_context_get_queue (context));
       vkDestroySwapchainKHR (device,
                              priv->swapchain,
                              NULL);
-      for (i = 0; i < priv->n_images; i++)
-        {
-          cairo_region_destroy (priv->regions[i]);
-        }
-      g_clear_pointer (&priv->regions, g_free);
-      g_clear_pointer (&priv->images, g_free);
-      priv->n_images = 0;
+      gdk_vulkan_context_free_images (context);
     }
 
   if (res == VK_SUCCESS)
@@ -287,6 +322,8 @@ gdk_vulkan_context_check_swapchain (GdkVulkanContext  *context,
                                              &priv->n_images,
                                              priv->images);
       priv->regions = g_new (cairo_region_t *, priv->n_images);
+      priv->draw_semaphores = g_new (VkSemaphore, priv->n_images);
+      priv->render_semaphores = g_new (VkSemaphore, priv->n_images);
       for (i = 0; i < priv->n_images; i++)
         {
           priv->regions[i] = cairo_region_create_rectangle (&(cairo_rectangle_int_t) {
@@ -294,6 +331,8 @@ gdk_vulkan_context_check_swapchain (GdkVulkanContext  *context,
                                                                 gdk_window_get_width (window),
                                                                 gdk_window_get_height (window),
                                                             });
+          priv->draw_semaphores[i] = gdk_vulkan_context_create_semaphore (context);
+          priv->render_semaphores[i] = gdk_vulkan_context_create_semaphore (context);
         }
     }
   else
@@ -318,6 +357,8 @@ gdk_vulkan_context_begin_frame (GdkDrawContext *draw_context,
   GdkVulkanContext *context = GDK_VULKAN_CONTEXT (draw_context);
   GdkVulkanContextPrivate *priv = gdk_vulkan_context_get_instance_private (context);
   GError *error = NULL;
+  VkSemaphore semaphore;
+  VkResult res;
   guint i;
 
   if (!gdk_vulkan_context_check_swapchain (context, &error))
@@ -332,12 +373,21 @@ gdk_vulkan_context_begin_frame (GdkDrawContext *draw_context,
       cairo_region_union (priv->regions[i], region);
     }
 
-  GDK_VK_CHECK (vkAcquireNextImageKHR, gdk_vulkan_context_get_device (context),
-                                       priv->swapchain,
-                                       UINT64_MAX,
-                                       priv->draw_semaphore,
-                                       VK_NULL_HANDLE,
-                                       &priv->draw_index);
+  res = GDK_VK_CHECK (vkAcquireNextImageKHR, gdk_vulkan_context_get_device (context),
+                                             priv->swapchain,
+                                             UINT64_MAX,
+                                             priv->acquire_semaphore,
+                                             VK_NULL_HANDLE,
+                                             &priv->draw_index);
+
+  /* We don't know the image before acquiring it, so acquire with a spare
+   * semaphore and swap it with the one of the image. */
+  if (res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR)
+    {
+      semaphore = priv->draw_semaphores[priv->draw_index];
+      priv->draw_semaphores[priv->draw_index] = priv->acquire_semaphore;
+      priv->acquire_semaphore = semaphore;
+    }
 
   cairo_region_union (region, priv->regions[priv->draw_index]);
 }
@@ -355,7 +405,7 @@ gdk_vulkan_context_end_frame (GdkDrawContext *draw_context,
                                        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
                                        .waitSemaphoreCount = 1,
                                        .pWaitSemaphores = (VkSemaphore[]) {
-                                           priv->draw_semaphore
+                                           priv->render_semaphores[priv->draw_index]
                                        },
                                        .swapchainCount = 1,
                                        .pSwapchains = (VkSwapchainKHR[]) { 
@@ -467,12 +517,7 @@ gdk_vulkan_context_real_init (GInitable     *initable,
       if (!gdk_vulkan_context_check_swapchain (context, error))
         goto out_surface;
 
-      GDK_VK_CHECK (vkCreateSemaphore, gdk_vulkan_context_get_device (context),
-                                       &(VkSemaphoreCreateInfo) {
-                                           .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-                                       },
-                                       NULL,
-                                       &priv->draw_semaphore);
+      priv->acquire_semaphore = gdk_vulkan_context_create_semaphore (context);
 
       return TRUE;
     }
@@ -582,7 +627,21 @@ gdk_vulkan_context_get_draw_semaphore (GdkVulkanContext *context)
   g_return_val_if_fail (GDK_IS_VULKAN_CONTEXT (context), VK_NULL_HANDLE);
   g_return_val_if_fail (gdk_draw_context_is_drawing (GDK_DRAW_CONTEXT (context)), VK_NULL_HANDLE);
 
-  return priv->draw_semaphore;
+  return priv->draw_semaphores[priv->draw_index];
+}
+
+/* The semaphore that the draw submission signals and that
+ * presenting the current image waits on. Only GSK needs this.
+ */
+VkSemaphore
+gdk_vulkan_context_get_render_semaphore (GdkVulkanContext *context)
+{
+  GdkVulkanContextPrivate *priv = gdk_vulkan_context_get_instance_private (context);
+
+  g_return_val_if_fail (GDK_IS_VULKAN_CONTEXT (context), VK_NULL_HANDLE);
+  g_return_val_if_fail (gdk_draw_context_is_drawing (GDK_DRAW_CONTEXT (context)), VK_NULL_HANDLE);
+
+  return priv->render_semaphores[priv->draw_index];
 }
 
 static gboolean
@@ -72,6 +72,8 @@ gboolean        gdk_display_ref_vulkan                          (GdkDisplay
                                                                  GError         **error);
 void            gdk_display_unref_vulkan                        (GdkDisplay      *display);
 
+VkSemaphore     gdk_vulkan_context_get_render_semaphore         (GdkVulkanContext *context);
+
 #else /* !GDK_RENDERING_VULKAN */
 
 static inline gboolean
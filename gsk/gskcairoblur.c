@@ -25,6 +25,14 @@
 #include <math.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_BLUR_SIMD 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_BLUR_SIMD 1
+#endif
+
 /*
  * Gets the size for a single box blur.
  *
@@ -156,6 +164,55 @@ blur_rows (guchar *dst_buffer,
     }
 }
 
+#ifdef __SSE2__
+static inline void
+flip_interleave_sse2 (const __m128i in[16],
+                      __m128i       out[16])
+{
+  out[0] = _mm_unpacklo_epi8 (in[0], in[8]);
+  out[1] = _mm_unpackhi_epi8 (in[0], in[8]);
+  out[2] = _mm_unpacklo_epi8 (in[1], in[9]);
+  out[3] = _mm_unpackhi_epi8 (in[1], in[9]);
+  out[4] = _mm_unpacklo_epi8 (in[2], in[10]);
+  out[5] = _mm_unpackhi_epi8 (in[2], in[10]);
+  out[6] = _mm_unpacklo_epi8 (in[3], in[11]);
+  out[7] = _mm_unpackhi_epi8 (in[3], in[11]);
+  out[8] = _mm_unpacklo_epi8 (in[4], in[12]);
+  out[9] = _mm_unpackhi_epi8 (in[4], in[12]);
+  out[10] = _mm_unpacklo_epi8 (in[5], in[13]);
+  out[11] = _mm_unpackhi_epi8 (in[5], in[13]);
+  out[12] = _mm_unpacklo_epi8 (in[6], in[14]);
+  out[13] = _mm_unpackhi_epi8 (in[6], in[14]);
+  out[14] = _mm_unpacklo_epi8 (in[7], in[15]);
+  out[15] = _mm_unpackhi_epi8 (in[7], in[15]);
+}
+
+/* Transposes a block of 16x16 pixels. Interleaving the rows of the
+ * upper and lower half 4 times moves every pixel to its transposed
+ * position, as each round rotates the bits of the pixel index by one.
+ */
+static void
+flip_block_sse2 (guchar       *dst,
+                 int           dst_stride,
+                 const guchar *src,
+                 int           src_stride)
+{
+  __m128i a[16], b[16];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    a[i] = _mm_loadu_si128 ((const __m128i *) (src + i * src_stride));
+
+  flip_interleave_sse2 (a, b);
+  flip_interleave_sse2 (b, a);
+  flip_interleave_sse2 (a, b);
+  flip_interleave_sse2 (b, a);
+
+  for (i = 0; i < 16; i++)
+    _mm_storeu_si128 ((__m128i *) (dst + i * dst_stride), a[i]);
+}
+#endif
+
 /* Swaps width and height.
  */
 static void
@@ -178,6 +235,15 @@ flip_buffer (guchar *dst_buffer,
         int max_i = MIN(i0 + BLOCK_SIZE, width);
         int i, j;
 
+#ifdef __SSE2__
+        if (max_i - i0 == BLOCK_SIZE && max_j - j0 == BLOCK_SIZE)
+          {
+            flip_block_sse2 (dst_buffer + i0 * height + j0, height,
+                             src_buffer + j0 * width + i0, width);
+            continue;
+          }
+#endif
+
         for (i = i0; i < max_i; i++)
           for (j = j0; j < max_j; j++)
             dst_buffer[i * height + j] = src_buffer[j * width + i];
@@ -185,6 +251,307 @@ flip_buffer (guchar *dst_buffer,
 #undef BLOCK_SIZE
 }
 
+#ifdef HAVE_BLUR_SIMD
+
+/* The vectorized blur works on SIMD_COLUMNS adjacent columns at once,
+ * sliding the window down the rows. This way every load and store is
+ * a full vector of neighbouring pixels and no transpose is needed.
+ *
+ * The sums are kept in 32-bit lanes and divided by multiplying with
+ * 1 / d in single precision. Truncating (sum + d / 2 + 0.5) / d gives
+ * the same result as the integer division of blur_xspan() as long as
+ * the rounding error stays below 0.5 / d, which holds for the filter
+ * sizes below SIMD_MAX_BOX_FILTER_SIZE.
+ */
+#define SIMD_COLUMNS 16
+#define SIMD_MAX_BOX_FILTER_SIZE 4096
+
+#if defined(__SSE2__)
+
+typedef struct {
+  __m128i v[4];
+} BlurSums;
+
+static inline void
+blur_sums_widen (const guchar *pixels,
+                 __m128i       wide[4])
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i p, lo, hi;
+
+  p = _mm_loadu_si128 ((const __m128i *) pixels);
+  lo = _mm_unpacklo_epi8 (p, zero);
+  hi = _mm_unpackhi_epi8 (p, zero);
+  wide[0] = _mm_unpacklo_epi16 (lo, zero);
+  wide[1] = _mm_unpackhi_epi16 (lo, zero);
+  wide[2] = _mm_unpacklo_epi16 (hi, zero);
+  wide[3] = _mm_unpackhi_epi16 (hi, zero);
+}
+
+static inline void
+blur_sums_init (BlurSums *sums)
+{
+  sums->v[0] = sums->v[1] = sums->v[2] = sums->v[3] = _mm_setzero_si128 ();
+}
+
+static inline void
+blur_sums_add (BlurSums     *sums,
+               const guchar *pixels)
+{
+  __m128i wide[4];
+
+  blur_sums_widen (pixels, wide);
+  sums->v[0] = _mm_add_epi32 (sums->v[0], wide[0]);
+  sums->v[1] = _mm_add_epi32 (sums->v[1], wide[1]);
+  sums->v[2] = _mm_add_epi32 (sums->v[2], wide[2]);
+  sums->v[3] = _mm_add_epi32 (sums->v[3], wide[3]);
+}
+
+static inline void
+blur_sums_subtract (BlurSums     *sums,
+                    const guchar *pixels)
+{
+  __m128i wide[4];
+
+  blur_sums_widen (pixels, wide);
+  sums->v[0] = _mm_sub_epi32 (sums->v[0], wide[0]);
+  sums->v[1] = _mm_sub_epi32 (sums->v[1], wide[1]);
+  sums->v[2] = _mm_sub_epi32 (sums->v[2], wide[2]);
+  sums->v[3] = _mm_sub_epi32 (sums->v[3], wide[3]);
+}
+
+static inline void
+blur_sums_store (const BlurSums *sums,
+                 guchar         *pixels,
+                 float           bias,
+                 float           scale)
+{
+  const __m128 b = _mm_set1_ps (bias);
+  const __m128 s = _mm_set1_ps (scale);
+  __m128i q0, q1, q2, q3;
+
+  q0 = _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (_mm_cvtepi32_ps (sums->v[0]), b), s));
+  q1 = _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (_mm_cvtepi32_ps (sums->v[1]), b), s));
+  q2 = _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (_mm_cvtepi32_ps (sums->v[2]), b), s));
+  q3 = _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (_mm_cvtepi32_ps (sums->v[3]), b), s));
+
+  _mm_storeu_si128 ((__m128i *) pixels,
+                    _mm_packus_epi16 (_mm_packs_epi32 (q0, q1),
+                                      _mm_packs_epi32 (q2, q3)));
+}
+
+#elif defined(__ARM_NEON)
+
+typedef struct {
+  uint32x4_t v[4];
+} BlurSums;
+
+static inline void
+blur_sums_widen (const guchar *pixels,
+                 uint32x4_t    wide[4])
+{
+  uint8x16_t p;
+  uint16x8_t lo, hi;
+
+  p = vld1q_u8 (pixels);
+  lo = vmovl_u8 (vget_low_u8 (p));
+  hi = vmovl_u8 (vget_high_u8 (p));
+  wide[0] = vmovl_u16 (vget_low_u16 (lo));
+  wide[1] = vmovl_u16 (vget_high_u16 (lo));
+  wide[2] = vmovl_u16 (vget_low_u16 (hi));
+  wide[3] = vmovl_u16 (vget_high_u16 (hi));
+}
+
+static inline void
+blur_sums_init (BlurSums *sums)
+{
+  sums->v[0] = sums->v[1] = sums->v[2] = sums->v[3] = vdupq_n_u32 (0);
+}
+
+static inline void
+blur_sums_add (BlurSums     *sums,
+               const guchar *pixels)
+{
+  uint32x4_t wide[4];
+
+  blur_sums_widen (pixels, wide);
+  sums->v[0] = vaddq_u32 (sums->v[0], wide[0]);
+  sums->v[1] = vaddq_u32 (sums->v[1], wide[1]);
+  sums->v[2] = vaddq_u32 (sums->v[2], wide[2]);
+  sums->v[3] = vaddq_u32 (sums->v[3], wide[3]);
+}
+
+static inline void
+blur_sums_subtract (BlurSums     *sums,
+                    const guchar *pixels)
+{
+  uint32x4_t wide[4];
+
+  blur_sums_widen (pixels, wide);
+  sums->v[0] = vsubq_u32 (sums->v[0], wide[0]);
+  sums->v[1] = vsubq_u32 (sums->v[1], wide[1]);
+  sums->v[2] = vsubq_u32 (sums->v[2], wide[2]);
+  sums->v[3] = vsubq_u32 (sums->v[3], wide[3]);
+}
+
+static inline void
+blur_sums_store (const BlurSums *sums,
+                 guchar         *pixels,
+                 float           bias,
+                 float           scale)
+{
+  const float32x4_t b = vdupq_n_f32 (bias);
+  const float32x4_t s = vdupq_n_f32 (scale);
+  uint16x4_t q0, q1, q2, q3;
+
+  q0 = vmovn_u32 (vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vcvtq_f32_u32 (sums->v[0]), b), s)));
+  q1 = vmovn_u32 (vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vcvtq_f32_u32 (sums->v[1]), b), s)));
+  q2 = vmovn_u32 (vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vcvtq_f32_u32 (sums->v[2]), b), s)));
+  q3 = vmovn_u32 (vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vcvtq_f32_u32 (sums->v[3]), b), s)));
+
+  vst1q_u8 (pixels, vcombine_u8 (vmovn_u16 (vcombine_u16 (q0, q1)),
+                                 vmovn_u16 (vcombine_u16 (q2, q3))));
+}
+
+#endif
+
+/* The vertical equivalent of blur_xspan() for SIMD_COLUMNS columns.
+ * The result is written to dst instead of being copied back.
+ */
+static void
+blur_yspan_simd (const guchar *src,
+                 int           src_stride,
+                 guchar       *dst,
+                 int           dst_stride,
+                 int           height,
+                 int           d,
+                 int           shift)
+{
+  const float bias = d / 2 + 0.5f;
+  const float scale = 1.0f / d;
+  BlurSums sums;
+  int offset;
+  int i;
+
+  if (d % 2 == 1)
+    offset = d / 2;
+  else
+    offset = (d - shift) / 2;
+
+  blur_sums_init (&sums);
+
+  for (i = -d + offset; i < height + offset; i++)
+    {
+      if (i >= 0 && i < height)
+        blur_sums_add (&sums, src + i * src_stride);
+
+      if (i >= offset)
+        {
+          if (i >= d)
+            blur_sums_subtract (&sums, src + (i - d) * src_stride);
+
+          blur_sums_store (&sums, dst + (i - offset) * dst_stride, bias, scale);
+        }
+    }
+}
+
+/* Like blur_yspan_simd(), for a single column */
+static void
+blur_yspan (const guchar *src,
+            int           src_stride,
+            guchar       *dst,
+            int           dst_stride,
+            int           height,
+            int           d,
+            int           shift)
+{
+  int offset;
+  int sum = 0;
+  int i;
+
+  if (d % 2 == 1)
+    offset = d / 2;
+  else
+    offset = (d - shift) / 2;
+
+  for (i = -d + offset; i < height + offset; i++)
+    {
+      if (i >= 0 && i < height)
+        sum += src[i * src_stride];
+
+      if (i >= offset)
+        {
+          if (i >= d)
+            sum -= src[(i - d) * src_stride];
+
+          dst[(i - offset) * dst_stride] = (sum + d / 2) / d;
+        }
+    }
+}
+
+typedef void (* BlurYspanFunc) (const guchar *src,
+                                int           src_stride,
+                                guchar       *dst,
+                                int           dst_stride,
+                                int           height,
+                                int           d,
+                                int           shift);
+
+/* Runs the three passes of blur_rows() over n_columns columns. The
+ * intermediate results go to two packed stripes of n_columns pixels
+ * per row, so they stay in the cache between the passes
+ */
+static void
+blur_column_block (guchar        *column,
+                   int            stride,
+                   int            height,
+                   int            n_columns,
+                   int            d,
+                   guchar        *tmp_stripes,
+                   BlurYspanFunc  blur_yspan_func)
+{
+  guchar *stripe1 = tmp_stripes;
+  guchar *stripe2 = tmp_stripes + n_columns * height;
+
+  if (d % 2 == 1)
+    {
+      blur_yspan_func (column, stride, stripe1, n_columns, height, d, 0);
+      blur_yspan_func (stripe1, n_columns, stripe2, n_columns, height, d, 0);
+      blur_yspan_func (stripe2, n_columns, column, stride, height, d, 0);
+    }
+  else
+    {
+      blur_yspan_func (column, stride, stripe1, n_columns, height, d, 1);
+      blur_yspan_func (stripe1, n_columns, stripe2, n_columns, height, d, -1);
+      blur_yspan_func (stripe2, n_columns, column, stride, height, d + 1, 0);
+    }
+}
+
+/* Blurs the columns of the buffer without flipping it. Columns
+ * that don't fill a whole vector at the right edge are blurred
+ * one at a time. tmp_buffer must hold 2 * SIMD_COLUMNS pixels
+ * per row.
+ */
+static void
+blur_columns (guchar *dst_buffer,
+              guchar *tmp_buffer,
+              int     buffer_width,
+              int     buffer_height,
+              int     d)
+{
+  int i;
+
+  for (i = 0; i + SIMD_COLUMNS <= buffer_width; i += SIMD_COLUMNS)
+    blur_column_block (dst_buffer + i, buffer_width, buffer_height,
+                       SIMD_COLUMNS, d, tmp_buffer, blur_yspan_simd);
+
+  for (; i < buffer_width; i++)
+    blur_column_block (dst_buffer + i, buffer_width, buffer_height,
+                       1, d, tmp_buffer, blur_yspan);
+}
+
+#endif /* HAVE_BLUR_SIMD */
+
 static void
 _boxblur (guchar      *buffer,
           int          width,
@@ -197,6 +564,35 @@ _boxblur (guchar      *buffer,
 
   flipped_buffer = g_malloc (width * height);
 
+#ifdef HAVE_BLUR_SIMD
+  if (d < SIMD_MAX_BOX_FILTER_SIZE)
+    {
+      guchar *tmp_stripes;
+
+      tmp_stripes = g_malloc (2 * SIMD_COLUMNS * MAX (width, height));
+
+      if (flags & GSK_BLUR_Y)
+        {
+          /* Step 1: blur columns in place */
+          blur_columns (buffer, tmp_stripes, width, height, d);
+        }
+
+      if (flags & GSK_BLUR_X)
+        {
+          /* Step 2: swap rows and columns, blur columns (really rows)
+           * and swap back, which is still faster than blur_rows()
+           */
+          flip_buffer (flipped_buffer, buffer, width, height);
+          blur_columns (flipped_buffer, tmp_stripes, height, width, d);
+          flip_buffer (buffer, flipped_buffer, height, width);
+        }
+
+      g_free (tmp_stripes);
+      g_free (flipped_buffer);
+      return;
+    }
+#endif
+
   if (flags & GSK_BLUR_Y)
     {
       /* Step 1: swap rows and columns */
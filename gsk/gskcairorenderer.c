@@ -7,6 +7,14 @@
 #include "gskrendernodeprivate.h"
 #include "gsktextureprivate.h"
 
+#include <math.h>
+
+/* Big redraws are split into tiles of this many device pixels that are
+ * drawn in parallel. Nodes outside of a tile are culled by
+ * gsk_render_node_draw() because of the clip.
+ */
+#define TILE_SIZE 256
+
 #ifdef G_ENABLE_DEBUG
 typedef struct {
   GQuark cpu_time;
@@ -44,6 +52,253 @@ gsk_cairo_renderer_unrealize (GskRenderer *renderer)
 
 }
 
+typedef struct {
+  GskRenderNode *root;
+
+  guchar *data;
+  cairo_format_t format;
+  int stride;
+  double x_scale, y_scale;
+  /* Device position of the user space origin */
+  double origin_x, origin_y;
+
+  /* cairo_rectangle_int_t, in device pixels */
+  GArray *tiles;
+  volatile gint next_tile;
+
+  GMutex lock;
+  GCond cond;
+  guint n_workers;
+} TiledRender;
+
+static void
+tiled_render_draw_tile (TiledRender                 *tiled,
+                        const cairo_rectangle_int_t *tile)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  /* Every tile gets its own surface for its part of the pixels, so
+   * no Cairo object is shared between threads
+   */
+  surface = cairo_image_surface_create_for_data (tiled->data
+                                                 + tile->y * tiled->stride
+                                                 + tile->x * 4,
+                                                 tiled->format,
+                                                 tile->width, tile->height,
+                                                 tiled->stride);
+  cairo_surface_set_device_scale (surface, tiled->x_scale, tiled->y_scale);
+
+  cr = cairo_create (surface);
+  cairo_translate (cr,
+                   (tiled->origin_x - tile->x) / tiled->x_scale,
+                   (tiled->origin_y - tile->y) / tiled->y_scale);
+
+  gsk_render_node_draw (tiled->root, cr);
+
+  cairo_destroy (cr);
+  cairo_surface_finish (surface);
+  cairo_surface_destroy (surface);
+}
+
+static void
+tiled_render_draw_tiles (TiledRender *tiled)
+{
+  guint i;
+
+  while (TRUE)
+    {
+      i = g_atomic_int_add (&tiled->next_tile, 1);
+      if (i >= tiled->tiles->len)
+        break;
+
+      tiled_render_draw_tile (tiled, &g_array_index (tiled->tiles, cairo_rectangle_int_t, i));
+    }
+}
+
+static void
+tiled_render_worker_run (gpointer data,
+                         gpointer user_data)
+{
+  TiledRender *tiled = data;
+
+  tiled_render_draw_tiles (tiled);
+
+  g_mutex_lock (&tiled->lock);
+  tiled->n_workers--;
+  if (tiled->n_workers == 0)
+    g_cond_signal (&tiled->cond);
+  g_mutex_unlock (&tiled->lock);
+}
+
+static GThreadPool *
+get_tile_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (pool == NULL)
+    pool = g_thread_pool_new (tiled_render_worker_run, NULL,
+                              g_get_num_processors (), FALSE,
+                              NULL);
+
+  return pool;
+}
+
+/* Splits @rect into the tiles of the TILE_SIZE grid it touches, so
+ * the tiles of adjacent damage rectangles don't overlap
+ */
+static void
+add_tiles (GArray                      *tiles,
+           const cairo_rectangle_int_t *rect)
+{
+  cairo_rectangle_int_t tile;
+  int x, y;
+
+  for (y = rect->y / TILE_SIZE * TILE_SIZE; y < rect->y + rect->height; y += TILE_SIZE)
+    for (x = rect->x / TILE_SIZE * TILE_SIZE; x < rect->x + rect->width; x += TILE_SIZE)
+      {
+        tile.x = MAX (x, rect->x);
+        tile.y = MAX (y, rect->y);
+        tile.width = MIN (x + TILE_SIZE, rect->x + rect->width) - tile.x;
+        tile.height = MIN (y + TILE_SIZE, rect->y + rect->height) - tile.y;
+        g_array_append_val (tiles, tile);
+      }
+}
+
+/* Collects the tiles covering the clip of @cr, in device pixels of
+ * its target, limited to the given extents
+ */
+static GArray *
+get_clip_tiles (cairo_t *cr,
+                int      width,
+                int      height)
+{
+  cairo_rectangle_list_t *list;
+  cairo_rectangle_int_t rect;
+  GArray *tiles;
+  double x1, y1, x2, y2;
+  int i, n;
+
+  list = cairo_copy_clip_rectangle_list (cr);
+  if (list->status != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_rectangle_list_destroy (list);
+      return NULL;
+    }
+
+  tiles = g_array_new (FALSE, FALSE, sizeof (cairo_rectangle_int_t));
+
+  n = list->num_rectangles;
+  for (i = 0; i < n; i++)
+    {
+      x1 = list->rectangles[i].x;
+      y1 = list->rectangles[i].y;
+      x2 = x1 + list->rectangles[i].width;
+      y2 = y1 + list->rectangles[i].height;
+      cairo_user_to_device (cr, &x1, &y1);
+      cairo_user_to_device (cr, &x2, &y2);
+
+      rect.x = MAX (floor (x1), 0);
+      rect.y = MAX (floor (y1), 0);
+      rect.width = MIN (ceil (x2), width) - rect.x;
+      rect.height = MIN (ceil (y2), height) - rect.y;
+      if (rect.width <= 0 || rect.height <= 0)
+        continue;
+
+      add_tiles (tiles, &rect);
+    }
+
+  cairo_rectangle_list_destroy (list);
+
+  return tiles;
+}
+
+/* Draws @root in tiles on multiple threads, directly into the pixels of
+ * the target of @cr. Returns %FALSE if @cr can't be drawn to this way,
+ * or if the redraw is too small to be worth it.
+ */
+static gboolean
+gsk_cairo_renderer_draw_tiled (cairo_t       *cr,
+                               GskRenderNode *root)
+{
+  cairo_surface_t *target;
+  cairo_matrix_t matrix;
+  TiledRender tiled;
+  guint i, n_workers;
+
+  if (g_get_num_processors () < 2 ||
+      GSK_RENDER_MODE_CHECK (GEOMETRY))
+    return FALSE;
+
+  /* Tiles are drawn into the pixels of the target surface and only
+   * know about translations, rotated or scaled user space and
+   * groups are drawn in one piece
+   */
+  target = cairo_get_target (cr);
+  if (cairo_surface_get_type (target) != CAIRO_SURFACE_TYPE_IMAGE ||
+      target != cairo_get_group_target (cr))
+    return FALSE;
+
+  tiled.format = cairo_image_surface_get_format (target);
+  if (tiled.format != CAIRO_FORMAT_ARGB32 &&
+      tiled.format != CAIRO_FORMAT_RGB24)
+    return FALSE;
+
+  cairo_get_matrix (cr, &matrix);
+  if (matrix.xx != 1 || matrix.yy != 1 || matrix.xy != 0 || matrix.yx != 0)
+    return FALSE;
+
+  tiled.tiles = get_clip_tiles (cr,
+                                cairo_image_surface_get_width (target),
+                                cairo_image_surface_get_height (target));
+  if (tiled.tiles == NULL)
+    return FALSE;
+
+  if (tiled.tiles->len < 2)
+    {
+      g_array_unref (tiled.tiles);
+      return FALSE;
+    }
+
+  tiled.root = root;
+  tiled.stride = cairo_image_surface_get_stride (target);
+  cairo_surface_get_device_scale (target, &tiled.x_scale, &tiled.y_scale);
+  tiled.origin_x = tiled.origin_y = 0;
+  cairo_user_to_device (cr, &tiled.origin_x, &tiled.origin_y);
+  tiled.next_tile = 0;
+
+  cairo_surface_flush (target);
+  tiled.data = cairo_image_surface_get_data (target);
+
+  GSK_NOTE (CAIRO, g_print ("Drawing %u tiles in threads\n", tiled.tiles->len));
+
+  /* The main thread draws tiles, too */
+  n_workers = MIN (tiled.tiles->len, g_get_num_processors ()) - 1;
+
+  g_mutex_init (&tiled.lock);
+  g_cond_init (&tiled.cond);
+  tiled.n_workers = n_workers;
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_pool_push (get_tile_pool (), &tiled, NULL);
+
+  tiled_render_draw_tiles (&tiled);
+
+  g_mutex_lock (&tiled.lock);
+  while (tiled.n_workers > 0)
+    g_cond_wait (&tiled.cond, &tiled.lock);
+  g_mutex_unlock (&tiled.lock);
+
+  g_cond_clear (&tiled.cond);
+  g_mutex_clear (&tiled.lock);
+
+  cairo_surface_mark_dirty (target);
+
+  g_array_unref (tiled.tiles);
+
+  return TRUE;
+}
+
 static void
 gsk_cairo_renderer_do_render (GskRenderer   *renderer,
                               cairo_t       *cr,
@@ -60,7 +315,8 @@ gsk_cairo_renderer_do_render (GskRenderer   *renderer,
   gsk_profiler_timer_begin (profiler, self->profile_timers.cpu_time);
 #endif
 
-  gsk_render_node_draw (root, cr);
+  if (!gsk_cairo_renderer_draw_tiled (cr, root))
+    gsk_render_node_draw (root, cr);
 
 #ifdef G_ENABLE_DEBUG
   cpu_time = gsk_profiler_timer_end (profiler, self->profile_timers.cpu_time);
@@ -7,6 +7,15 @@
 
 #include <gdk/gdk.h>
 #include <epoxy/gl.h>
+#include <string.h>
+
+/* Textures up to this size are packed into shared atlases, so that
+ * small images and icons can be drawn without switching textures
+ */
+#define ATLAS_SIZE              1024
+#define ATLAS_MAX_ITEM_SIZE     128
+#define ATLAS_PADDING           1
+#define MAX_ATLASES             4
 
 typedef struct {
   GLuint texture_id;
@@ -16,9 +25,57 @@ typedef struct {
   GLuint mag_filter;
   GArray *fbos;
   GskTexture *user;
+  /* The cairo surface the texture is an upload of, and the serial of
+   * its contents at the time of the upload
+   */
+  cairo_surface_t *surface;
+  guint surface_serial;
   gboolean in_use : 1;
+  gboolean is_atlas : 1;
+  /* Owned by the renderer, which destroys it explicitly */
+  gboolean permanent : 1;
 } Texture;
 
+/* A row of the atlas; items are added from left to right */
+typedef struct {
+  int y;
+  int height;
+  int x;
+} AtlasShelf;
+
+typedef struct {
+  Texture *texture;
+  int size;
+
+  GArray *shelves;
+  int next_shelf_y;
+
+  GPtrArray *entries;
+  /* Areas, in pixels, of all the entries and of the entries whose
+   * texture was released, used to decide when to compact
+   */
+  int used_area;
+  int dead_area;
+
+  /* The last frame using an entry of the atlas */
+  gint64 last_used;
+} Atlas;
+
+typedef struct {
+  Atlas *atlas;
+  GskTexture *user;
+
+  /* The area of the texture, without the padding */
+  int x;
+  int y;
+  int width;
+  int height;
+
+  graphene_rect_t uv;
+
+  gint64 last_used;
+} AtlasEntry;
+
 typedef struct {
   GLuint vao_id;
   GLuint buffer_id;
@@ -44,6 +101,10 @@ struct _GskGLDriver
 
   GHashTable *textures;
   GHashTable *vaos;
+  GPtrArray *atlases;
+
+  /* Keys the uploads of cairo surfaces made by this driver */
+  cairo_user_data_key_t surface_key;
 
   Texture *bound_source_texture;
   Texture *bound_mask_texture;
@@ -52,6 +113,12 @@ struct _GskGLDriver
 
   int max_texture_size;
 
+  gint64 frame_counter;
+
+  /* Totals over the lifetime of the driver */
+  guint64 n_uploads;
+  guint64 upload_bytes;
+
   gboolean in_frame : 1;
 };
 
@@ -66,6 +133,8 @@ static GParamSpec *gsk_gl_driver_properties[N_PROPS];
 
 G_DEFINE_TYPE (GskGLDriver, gsk_gl_driver, G_TYPE_OBJECT)
 
+static void gsk_gl_driver_compact_atlases (GskGLDriver *driver);
+
 static Texture *
 texture_new (void)
 {
@@ -96,6 +165,29 @@ fbo_clear (gpointer data)
   glDeleteFramebuffers (1, &f->fbo_id);
 }
 
+static void
+atlas_entry_free (gpointer data)
+{
+  AtlasEntry *e = data;
+
+  /* Clearing the render data calls atlas_entry_release() */
+  if (e->user)
+    gsk_texture_clear_render_data (e->user);
+
+  g_slice_free (AtlasEntry, e);
+}
+
+static void
+atlas_free (gpointer data)
+{
+  Atlas *a = data;
+
+  /* The GL texture is owned by the driver's textures */
+  g_clear_pointer (&a->entries, g_ptr_array_unref);
+  g_clear_pointer (&a->shelves, g_array_unref);
+  g_slice_free (Atlas, a);
+}
+
 static Vao *
 vao_new (void)
 {
@@ -118,8 +210,22 @@ gsk_gl_driver_finalize (GObject *gobject)
 {
   GskGLDriver *self = GSK_GL_DRIVER (gobject);
 
+  GHashTableIter iter;
+  gpointer value_p;
+
   gdk_gl_context_make_current (self->gl_context);
 
+  /* Surfaces outliving the driver must not point to its textures */
+  g_hash_table_iter_init (&iter, self->textures);
+  while (g_hash_table_iter_next (&iter, NULL, &value_p))
+    {
+      Texture *t = value_p;
+
+      if (t->surface)
+        cairo_surface_set_user_data (t->surface, &self->surface_key, NULL, NULL);
+    }
+
+  g_clear_pointer (&self->atlases, g_ptr_array_unref);
   g_clear_pointer (&self->textures, g_hash_table_unref);
   g_clear_pointer (&self->vaos, g_hash_table_unref);
 
@@ -191,6 +297,7 @@ gsk_gl_driver_init (GskGLDriver *self)
 {
   self->textures = g_hash_table_new_full (NULL, NULL, NULL, texture_free);
   self->vaos = g_hash_table_new_full (NULL, NULL, NULL, vao_free);
+  self->atlases = g_ptr_array_new_with_free_func (atlas_free);
 
   self->max_texture_size = -1;
 }
@@ -212,6 +319,7 @@ gsk_gl_driver_begin_frame (GskGLDriver *driver)
   g_return_if_fail (!driver->in_frame);
 
   driver->in_frame = TRUE;
+  driver->frame_counter += 1;
 
   if (driver->max_texture_size < 0)
     {
@@ -276,7 +384,7 @@ gsk_gl_driver_collect_textures (GskGLDriver *driver)
     {
       Texture *t = value_p;
 
-      if (t->user)
+      if (t->user || t->surface || t->is_atlas || t->permanent)
         continue;
 
       if (t->in_use)
@@ -288,6 +396,8 @@ gsk_gl_driver_collect_textures (GskGLDriver *driver)
         g_hash_table_iter_remove (&iter);
     }
 
+  gsk_gl_driver_compact_atlases (driver);
+
   return old_size - g_hash_table_size (driver->textures);
 }
 
@@ -331,6 +441,41 @@ gsk_gl_driver_get_max_texture_size (GskGLDriver *driver)
   return driver->max_texture_size;
 }
 
+/*
+ * gsk_gl_driver_get_stats:
+ * @driver: a #GskGLDriver
+ * @n_uploads: (out): the number of texture uploads so far
+ * @upload_bytes: (out): the number of bytes uploaded so far
+ * @texture_memory: (out): the memory used by all textures
+ *   of the driver, in bytes
+ *
+ * Queries the statistics used by the profiler of the renderer.
+ */
+void
+gsk_gl_driver_get_stats (GskGLDriver *driver,
+                         guint64     *n_uploads,
+                         guint64     *upload_bytes,
+                         guint64     *texture_memory)
+{
+  GHashTableIter iter;
+  gpointer value_p = NULL;
+  guint64 memory = 0;
+
+  g_return_if_fail (GSK_IS_GL_DRIVER (driver));
+
+  g_hash_table_iter_init (&iter, driver->textures);
+  while (g_hash_table_iter_next (&iter, NULL, &value_p))
+    {
+      Texture *t = value_p;
+
+      memory += (guint64) t->width * t->height * 4;
+    }
+
+  *n_uploads = driver->n_uploads;
+  *upload_bytes = driver->upload_bytes;
+  *texture_memory = memory;
+}
+
 static Texture *
 gsk_gl_driver_get_texture (GskGLDriver *driver,
                            int          texture_id)
@@ -407,7 +552,7 @@ create_texture (GskGLDriver *driver,
     }
 
   t = find_texture_by_size (driver->textures, width, height);
-  if (t != NULL && !t->in_use && t->user == NULL)
+  if (t != NULL && !t->in_use && t->user == NULL && t->surface == NULL && !t->is_atlas && !t->permanent)
     {
       GSK_NOTE (OPENGL, g_print ("Reusing Texture(%d) for size %dx%d\n",
                                  t->texture_id, t->width, t->height));
@@ -429,6 +574,380 @@ create_texture (GskGLDriver *driver,
   return t;
 }
 
+static void
+gsk_gl_driver_set_texture_parameters (GskGLDriver *driver,
+                                      int          min_filter,
+                                      int          mag_filter)
+{
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static void
+atlas_entry_release (gpointer data)
+{
+  AtlasEntry *e = data;
+
+  e->user = NULL;
+  e->atlas->dead_area += (e->width + 2 * ATLAS_PADDING) * (e->height + 2 * ATLAS_PADDING);
+}
+
+static Atlas *
+atlas_new (GskGLDriver *driver,
+           int          min_filter,
+           int          mag_filter)
+{
+  Atlas *a;
+  int size;
+
+  size = MIN (ATLAS_SIZE, driver->max_texture_size);
+
+  a = g_slice_new0 (Atlas);
+  a->size = size;
+  a->shelves = g_array_new (FALSE, FALSE, sizeof (AtlasShelf));
+  a->entries = g_ptr_array_new_with_free_func (atlas_entry_free);
+
+  a->texture = create_texture (driver, size, size);
+  a->texture->is_atlas = TRUE;
+  a->texture->min_filter = min_filter;
+  a->texture->mag_filter = mag_filter;
+
+  glActiveTexture (GL_TEXTURE0);
+  glBindTexture (GL_TEXTURE_2D, a->texture->texture_id);
+  gsk_gl_driver_set_texture_parameters (driver, min_filter, mag_filter);
+
+  if (gdk_gl_context_get_use_es (driver->gl_context))
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  else
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+
+  glBindTexture (GL_TEXTURE_2D, 0);
+  driver->bound_source_texture = NULL;
+
+  GSK_NOTE (OPENGL, g_print ("New texture atlas %d (%dx%d)\n",
+                             a->texture->texture_id, size, size));
+
+  g_ptr_array_add (driver->atlases, a);
+
+  return a;
+}
+
+static void
+atlas_clear (Atlas *a)
+{
+  g_ptr_array_set_size (a->entries, 0);
+  g_array_set_size (a->shelves, 0);
+  a->next_shelf_y = 0;
+  a->used_area = 0;
+  a->dead_area = 0;
+}
+
+/* Shelf packing: the item goes into the lowest shelf it fits in,
+ * or into a new shelf at the bottom of the atlas
+ */
+static gboolean
+atlas_allocate (Atlas *a,
+                int    width,
+                int    height,
+                int   *x,
+                int   *y)
+{
+  AtlasShelf *best = NULL;
+  guint i;
+
+  for (i = 0; i < a->shelves->len; i++)
+    {
+      AtlasShelf *shelf = &g_array_index (a->shelves, AtlasShelf, i);
+
+      if (shelf->height < height || shelf->x + width > a->size)
+        continue;
+
+      /* Don't waste tall shelves on short items */
+      if (shelf->height > height * 3 / 2)
+        continue;
+
+      if (best == NULL || shelf->height < best->height)
+        best = shelf;
+    }
+
+  if (best == NULL)
+    {
+      AtlasShelf shelf;
+
+      if (a->next_shelf_y + height > a->size)
+        return FALSE;
+
+      shelf.y = a->next_shelf_y;
+      shelf.height = height;
+      shelf.x = 0;
+      g_array_append_val (a->shelves, shelf);
+
+      a->next_shelf_y += height;
+      best = &g_array_index (a->shelves, AtlasShelf, a->shelves->len - 1);
+    }
+
+  *x = best->x;
+  *y = best->y;
+  best->x += width;
+
+  a->used_area += width * height;
+
+  return TRUE;
+}
+
+static void
+atlas_upload_entry (GskGLDriver *driver,
+                    AtlasEntry  *e)
+{
+  cairo_surface_t *surface, *padded;
+  cairo_t *cr;
+  int width, height;
+
+  width = e->width + 2 * ATLAS_PADDING;
+  height = e->height + 2 * ATLAS_PADDING;
+
+  /* Repeat the edges into the padding, so that linear filtering
+   * does not pick up the neighbouring entries
+   */
+  surface = gsk_texture_download_surface (e->user);
+  padded = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cr = cairo_create (padded);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface (cr, surface, ATLAS_PADDING, ATLAS_PADDING);
+  cairo_pattern_set_extend (cairo_get_source (cr), CAIRO_EXTEND_PAD);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
+
+  cairo_surface_flush (padded);
+
+  glActiveTexture (GL_TEXTURE0);
+  glBindTexture (GL_TEXTURE_2D, e->atlas->texture->texture_id);
+
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+
+  /* Cairo image surfaces of this size have no row padding */
+  g_assert (cairo_image_surface_get_stride (padded) == width * 4);
+
+  if (gdk_gl_context_get_use_es (driver->gl_context))
+    glTexSubImage2D (GL_TEXTURE_2D, 0,
+                     e->x - ATLAS_PADDING, e->y - ATLAS_PADDING,
+                     width, height,
+                     GL_RGBA, GL_UNSIGNED_BYTE,
+                     cairo_image_surface_get_data (padded));
+  else
+    glTexSubImage2D (GL_TEXTURE_2D, 0,
+                     e->x - ATLAS_PADDING, e->y - ATLAS_PADDING,
+                     width, height,
+                     GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                     cairo_image_surface_get_data (padded));
+
+  glBindTexture (GL_TEXTURE_2D, 0);
+  driver->bound_source_texture = NULL;
+
+  driver->n_uploads += 1;
+  driver->upload_bytes += width * height * 4;
+
+  cairo_surface_destroy (padded);
+}
+
+static gboolean
+atlas_add_entry (GskGLDriver *driver,
+                 Atlas       *a,
+                 AtlasEntry  *e)
+{
+  int x, y;
+
+  if (!atlas_allocate (a,
+                       e->width + 2 * ATLAS_PADDING,
+                       e->height + 2 * ATLAS_PADDING,
+                       &x, &y))
+    return FALSE;
+
+  e->atlas = a;
+  e->x = x + ATLAS_PADDING;
+  e->y = y + ATLAS_PADDING;
+  graphene_rect_init (&e->uv,
+                      (float) e->x / a->size,
+                      (float) e->y / a->size,
+                      (float) e->width / a->size,
+                      (float) e->height / a->size);
+
+  g_ptr_array_add (a->entries, e);
+
+  atlas_upload_entry (driver, e);
+
+  return TRUE;
+}
+
+/* Returns the least recently used atlas with the given filters, as long
+ * as it is not used by the current frame
+ */
+static Atlas *
+gsk_gl_driver_find_lru_atlas (GskGLDriver *driver,
+                              int          min_filter,
+                              int          mag_filter)
+{
+  Atlas *lru = NULL;
+  guint i;
+
+  for (i = 0; i < driver->atlases->len; i++)
+    {
+      Atlas *a = g_ptr_array_index (driver->atlases, i);
+
+      if (a->last_used == driver->frame_counter)
+        continue;
+
+      if (lru == NULL || a->last_used < lru->last_used)
+        lru = a;
+    }
+
+  if (lru != NULL &&
+      (lru->texture->min_filter != min_filter || lru->texture->mag_filter != mag_filter))
+    {
+      /* Reuse the slot for the requested filters */
+      gsk_gl_driver_destroy_texture (driver, lru->texture->texture_id);
+      g_ptr_array_remove (driver->atlases, lru);
+
+      return atlas_new (driver, min_filter, mag_filter);
+    }
+
+  return lru;
+}
+
+static AtlasEntry *
+gsk_gl_driver_add_to_atlas (GskGLDriver *driver,
+                            GskTexture  *texture,
+                            int          min_filter,
+                            int          mag_filter)
+{
+  AtlasEntry *e;
+  Atlas *a;
+  guint i;
+
+  e = g_slice_new0 (AtlasEntry);
+  e->user = texture;
+  e->width = gsk_texture_get_width (texture);
+  e->height = gsk_texture_get_height (texture);
+
+  for (i = 0; i < driver->atlases->len; i++)
+    {
+      a = g_ptr_array_index (driver->atlases, i);
+
+      if (a->texture->min_filter != min_filter || a->texture->mag_filter != mag_filter)
+        continue;
+
+      if (atlas_add_entry (driver, a, e))
+        return e;
+    }
+
+  if (driver->atlases->len < MAX_ATLASES)
+    a = atlas_new (driver, min_filter, mag_filter);
+  else
+    {
+      a = gsk_gl_driver_find_lru_atlas (driver, min_filter, mag_filter);
+      if (a == NULL)
+        {
+          g_slice_free (AtlasEntry, e);
+          return NULL;
+        }
+
+      GSK_NOTE (OPENGL, g_print ("Evicting %u entries from texture atlas %d\n",
+                                 a->entries->len, a->texture->texture_id));
+
+      atlas_clear (a);
+    }
+
+  if (!atlas_add_entry (driver, a, e))
+    {
+      g_slice_free (AtlasEntry, e);
+      return NULL;
+    }
+
+  return e;
+}
+
+static int
+compare_entry_height (gconstpointer a,
+                      gconstpointer b)
+{
+  const AtlasEntry *ea = *(const AtlasEntry **) a;
+  const AtlasEntry *eb = *(const AtlasEntry **) b;
+
+  return eb->height - ea->height;
+}
+
+/* Drops the atlases that are not used anymore, and repacks the ones
+ * that are mostly made of released textures; this only happens between
+ * frames, so that no render item refers to the old positions
+ */
+static void
+gsk_gl_driver_compact_atlases (GskGLDriver *driver)
+{
+  guint i, j;
+
+  for (i = driver->atlases->len; i > 0; i--)
+    {
+      Atlas *a = g_ptr_array_index (driver->atlases, i - 1);
+      GPtrArray *live;
+
+      if (a->dead_area * 2 <= a->used_area)
+        continue;
+
+      live = g_ptr_array_new ();
+      for (j = 0; j < a->entries->len; j++)
+        {
+          AtlasEntry *e = g_ptr_array_index (a->entries, j);
+
+          if (e->user != NULL)
+            g_ptr_array_add (live, e);
+        }
+
+      if (live->len == 0)
+        {
+          GSK_NOTE (OPENGL, g_print ("Dropping texture atlas %d\n", a->texture->texture_id));
+
+          gsk_gl_driver_destroy_texture (driver, a->texture->texture_id);
+          g_ptr_array_remove_index (driver->atlases, i - 1);
+          g_ptr_array_unref (live);
+          continue;
+        }
+
+      GSK_NOTE (OPENGL, g_print ("Compacting texture atlas %d (%u live entries out of %u)\n",
+                                 a->texture->texture_id, live->len, a->entries->len));
+
+      /* Free the dead entries, and take the live ones out of the atlas */
+      g_ptr_array_set_free_func (a->entries, NULL);
+      for (j = 0; j < a->entries->len; j++)
+        {
+          AtlasEntry *e = g_ptr_array_index (a->entries, j);
+
+          if (e->user == NULL)
+            g_slice_free (AtlasEntry, e);
+        }
+      g_ptr_array_set_size (a->entries, 0);
+      g_ptr_array_set_free_func (a->entries, atlas_entry_free);
+
+      atlas_clear (a);
+
+      /* Tallest first packs shelves more tightly */
+      g_ptr_array_sort (live, compare_entry_height);
+
+      for (j = 0; j < live->len; j++)
+        {
+          AtlasEntry *e = g_ptr_array_index (live, j);
+
+          if (!atlas_add_entry (driver, a, e))
+            atlas_entry_free (e);
+        }
+
+      g_ptr_array_unref (live);
+    }
+}
+
 static void
 gsk_gl_driver_release_texture (gpointer data)
 {
@@ -437,17 +956,53 @@ gsk_gl_driver_release_texture (gpointer data)
   t->user = NULL;
 }
 
+/* Trilinear filtering would sample the neighbouring entries in the
+ * smaller mipmap levels
+ */
+static gboolean
+can_use_atlas (GskGLDriver *driver,
+               GskTexture  *texture,
+               int          min_filter,
+               int          mag_filter)
+{
+  return gsk_texture_get_width (texture) <= ATLAS_MAX_ITEM_SIZE &&
+         gsk_texture_get_height (texture) <= ATLAS_MAX_ITEM_SIZE &&
+         (min_filter == GL_NEAREST || min_filter == GL_LINEAR) &&
+         (mag_filter == GL_NEAREST || mag_filter == GL_LINEAR) &&
+         driver->max_texture_size >= ATLAS_MAX_ITEM_SIZE * 2;
+}
+
+/* If @window is not %NULL, big textures that aren't uploaded yet may
+ * be prepared in a thread, and 0 is returned until they are ready.
+ * See gsk_texture_download_surface_async().
+ */
 int
-gsk_gl_driver_get_texture_for_texture (GskGLDriver *driver,
-                                       GskTexture  *texture,
-                                       int          min_filter,
-                                       int          mag_filter)
+gsk_gl_driver_get_texture_for_texture (GskGLDriver     *driver,
+                                       GskTexture      *texture,
+                                       GdkWindow       *window,
+                                       int              min_filter,
+                                       int              mag_filter,
+                                       graphene_rect_t *uv)
 {
+  AtlasEntry *e;
   Texture *t;
   cairo_surface_t *surface;
 
   g_return_val_if_fail (GSK_IS_GL_DRIVER (driver), -1);
   g_return_val_if_fail (GSK_IS_TEXTURE (texture), -1);
+  g_return_val_if_fail (uv != NULL, -1);
+
+  e = gsk_texture_get_render_data (texture, driver->atlases);
+  if (e != NULL &&
+      e->atlas->texture->min_filter == min_filter &&
+      e->atlas->texture->mag_filter == mag_filter)
+    {
+      e->last_used = e->atlas->last_used = driver->frame_counter;
+      *uv = e->uv;
+      return e->atlas->texture->texture_id;
+    }
+
+  graphene_rect_init (uv, 0, 0, 1, 1);
 
   t = gsk_texture_get_render_data (texture, driver);
 
@@ -456,13 +1011,38 @@ gsk_gl_driver_get_texture_for_texture (GskGLDriver *driver,
       if (t->min_filter == min_filter && t->mag_filter == mag_filter)
         return t->texture_id;
     }
+
+  if (e == NULL && t == NULL && can_use_atlas (driver, texture, min_filter, mag_filter))
+    {
+      e = gsk_gl_driver_add_to_atlas (driver, texture, min_filter, mag_filter);
+      if (e != NULL)
+        {
+          /* If another renderer owns the texture, the entry is only
+           * valid for this frame
+           */
+          if (!gsk_texture_set_render_data (texture, driver->atlases, e, atlas_entry_release))
+            atlas_entry_release (e);
+
+          GSK_NOTE (OPENGL, g_print ("Added %dx%d texture to atlas %d at %d, %d\n",
+                                     e->width, e->height,
+                                     e->atlas->texture->texture_id,
+                                     e->x, e->y));
+
+          e->last_used = e->atlas->last_used = driver->frame_counter;
+          *uv = e->uv;
+          return e->atlas->texture->texture_id;
+        }
+    }
   
+  surface = gsk_texture_download_surface_async (texture, window);
+  if (surface == NULL)
+    return 0;
+
   t = create_texture (driver, gsk_texture_get_width (texture), gsk_texture_get_height (texture));
 
   if (gsk_texture_set_render_data (texture, driver, t, gsk_gl_driver_release_texture))
     t->user = texture;
 
-  surface = gsk_texture_download_surface (texture);
   gsk_gl_driver_bind_source_texture (driver, t->texture_id);
   gsk_gl_driver_init_texture_with_surface (driver,
                                            t->texture_id,
@@ -474,6 +1054,60 @@ gsk_gl_driver_get_texture_for_texture (GskGLDriver *driver,
   return t->texture_id;
 }
 
+static void
+gsk_gl_driver_release_surface_texture (gpointer data)
+{
+  Texture *t = data;
+
+  t->surface = NULL;
+}
+
+/* Cairo nodes are often kept across frames, so the upload of their
+ * surface is kept until the surface goes away or is drawn to again
+ */
+int
+gsk_gl_driver_get_texture_for_surface (GskGLDriver     *driver,
+                                       cairo_surface_t *surface,
+                                       guint            serial,
+                                       int              width,
+                                       int              height,
+                                       int              min_filter,
+                                       int              mag_filter)
+{
+  Texture *t;
+
+  g_return_val_if_fail (GSK_IS_GL_DRIVER (driver), -1);
+  g_return_val_if_fail (surface != NULL, -1);
+
+  t = cairo_surface_get_user_data (surface, &driver->surface_key);
+  if (t != NULL &&
+      t->surface_serial == serial &&
+      t->width == width &&
+      t->height == height &&
+      t->min_filter == min_filter &&
+      t->mag_filter == mag_filter)
+    return t->texture_id;
+
+  t = create_texture (driver, width, height);
+
+  /* Replacing the user data releases the outdated texture */
+  if (cairo_surface_set_user_data (surface, &driver->surface_key,
+                                   t, gsk_gl_driver_release_surface_texture) == CAIRO_STATUS_SUCCESS)
+    {
+      t->surface = surface;
+      t->surface_serial = serial;
+    }
+
+  gsk_gl_driver_bind_source_texture (driver, t->texture_id);
+  gsk_gl_driver_init_texture_with_surface (driver,
+                                           t->texture_id,
+                                           surface,
+                                           min_filter,
+                                           mag_filter);
+
+  return t->texture_id;
+}
+
 int
 gsk_gl_driver_create_texture (GskGLDriver *driver,
                               int          width,
@@ -488,6 +1122,23 @@ gsk_gl_driver_create_texture (GskGLDriver *driver,
   return t->texture_id;
 }
 
+/* Keeps the texture from being collected or reused for another
+ * texture of the same size, until gsk_gl_driver_destroy_texture()
+ * is called
+ */
+void
+gsk_gl_driver_mark_texture_permanent (GskGLDriver *driver,
+                                      int          texture_id)
+{
+  Texture *t;
+
+  g_return_if_fail (GSK_IS_GL_DRIVER (driver));
+
+  t = gsk_gl_driver_get_texture (driver, texture_id);
+  if (t != NULL)
+    t->permanent = TRUE;
+}
+
 static Vao *
 find_vao (GHashTable    *vaos,
           int            position_id,
@@ -780,18 +1431,6 @@ gsk_gl_driver_destroy_vao (GskGLDriver *driver,
   g_hash_table_remove (driver->vaos, GINT_TO_POINTER (vao_id));
 }
 
-static void
-gsk_gl_driver_set_texture_parameters (GskGLDriver *driver,
-                                      int          min_filter,
-                                      int          mag_filter)
-{
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
-
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-}
-
 void
 gsk_gl_driver_init_texture_empty (GskGLDriver *driver,
                                   int          texture_id)
@@ -851,6 +1490,9 @@ gsk_gl_driver_init_texture_with_surface (GskGLDriver     *driver,
 
   gdk_cairo_surface_upload_to_gl (surface, GL_TEXTURE_2D, t->width, t->height, NULL);
 
+  driver->n_uploads += 1;
+  driver->upload_bytes += t->width * t->height * 4;
+
   t->min_filter = min_filter;
   t->mag_filter = mag_filter;
 
@@ -859,3 +1501,65 @@ gsk_gl_driver_init_texture_with_surface (GskGLDriver     *driver,
 
   glBindTexture (GL_TEXTURE_2D, 0);
 }
+
+/* Uploads @area of the image @surface to the same area of the texture,
+ * which must have been initialized with a surface of the same size
+ */
+void
+gsk_gl_driver_update_texture_region (GskGLDriver                 *driver,
+                                     int                          texture_id,
+                                     cairo_surface_t             *surface,
+                                     const cairo_rectangle_int_t *area)
+{
+  Texture *t;
+  const guchar *data;
+  guchar *pixels;
+  int stride, i;
+
+  g_return_if_fail (GSK_IS_GL_DRIVER (driver));
+
+  t = gsk_gl_driver_get_texture (driver, texture_id);
+  if (t == NULL)
+    {
+      g_critical ("No texture %d found.", texture_id);
+      return;
+    }
+
+  if (!(driver->bound_source_texture == t || driver->bound_mask_texture == t))
+    {
+      g_critical ("You must bind the texture before updating it.");
+      return;
+    }
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  /* GL_UNPACK_ROW_LENGTH is not available on OpenGL ES 2.0, so copy
+   * the rows of the area
+   */
+  pixels = g_malloc (area->width * area->height * 4);
+  for (i = 0; i < area->height; i++)
+    memcpy (pixels + i * area->width * 4,
+            data + (area->y + i) * stride + area->x * 4,
+            area->width * 4);
+
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+
+  if (gdk_gl_context_get_use_es (driver->gl_context))
+    glTexSubImage2D (GL_TEXTURE_2D, 0, area->x, area->y, area->width, area->height,
+                     GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  else
+    glTexSubImage2D (GL_TEXTURE_2D, 0, area->x, area->y, area->width, area->height,
+                     GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, pixels);
+
+  g_free (pixels);
+
+  driver->n_uploads += 1;
+  driver->upload_bytes += area->width * area->height * 4;
+
+  if (t->min_filter != GL_NEAREST)
+    glGenerateMipmap (GL_TEXTURE_2D);
+
+  glBindTexture (GL_TEXTURE_2D, 0);
+}
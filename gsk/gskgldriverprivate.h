@@ -21,17 +21,32 @@ typedef struct {
 GskGLDriver *   gsk_gl_driver_new                       (GdkGLContext    *context);
 
 int             gsk_gl_driver_get_max_texture_size      (GskGLDriver     *driver);
+void            gsk_gl_driver_get_stats                 (GskGLDriver     *driver,
+                                                         guint64         *n_uploads,
+                                                         guint64         *upload_bytes,
+                                                         guint64         *texture_memory);
 
 void            gsk_gl_driver_begin_frame               (GskGLDriver     *driver);
 void            gsk_gl_driver_end_frame                 (GskGLDriver     *driver);
 
 int             gsk_gl_driver_get_texture_for_texture   (GskGLDriver     *driver,
                                                          GskTexture      *texture,
+                                                         GdkWindow       *window,
+                                                         int              min_filter,
+                                                         int              mag_filter,
+                                                         graphene_rect_t *uv);
+int             gsk_gl_driver_get_texture_for_surface   (GskGLDriver     *driver,
+                                                         cairo_surface_t *surface,
+                                                         guint            serial,
+                                                         int              width,
+                                                         int              height,
                                                          int              min_filter,
                                                          int              mag_filter);
 int             gsk_gl_driver_create_texture            (GskGLDriver     *driver,
                                                          int              width,
                                                          int              height);
+void            gsk_gl_driver_mark_texture_permanent    (GskGLDriver     *driver,
+                                                         int              texture_id);
 int             gsk_gl_driver_create_vao_for_quad       (GskGLDriver     *driver,
                                                          int              position_id,
                                                          int              uv_id,
@@ -58,6 +73,10 @@ void            gsk_gl_driver_init_texture_with_surface (GskGLDriver     *driver
                                                          cairo_surface_t *surface,
                                                          int              min_filter,
                                                          int              mag_filter);
+void            gsk_gl_driver_update_texture_region     (GskGLDriver     *driver,
+                                                         int              texture_id,
+                                                         cairo_surface_t *surface,
+                                                         const cairo_rectangle_int_t *area);
 
 void            gsk_gl_driver_destroy_texture           (GskGLDriver     *driver,
                                                          int              texture_id);
@@ -5,10 +5,13 @@
 #include "gskdebugprivate.h"
 #include "gskenums.h"
 #include "gskgldriverprivate.h"
+#include "gskglyphcacheprivate.h"
 #include "gskglprofilerprivate.h"
+#include "gskoffscreencacheprivate.h"
 #include "gskprofilerprivate.h"
 #include "gskrendererprivate.h"
 #include "gskrendernodeprivate.h"
+#include "gskroundedrectprivate.h"
 #include "gskshaderbuilderprivate.h"
 #include "gsktextureprivate.h"
 
@@ -21,6 +24,16 @@
 #define SHADER_VERSION_GL3_LEGACY       130
 #define SHADER_VERSION_GL3              150
 
+/* Must match the size of the arrays in linear_gradient.fs.glsl */
+#define MAX_COLOR_STOPS                 8
+
+/* Memory budget for the fallback textures kept across frames */
+#define OFFSCREEN_CACHE_SIZE            (32 * 1024 * 1024)
+
+#define FALLBACK(...) G_STMT_START { \
+  GSK_NOTE (FALLBACK, g_print (__VA_ARGS__)); \
+} G_STMT_END
+
 typedef struct {
   int id;
   /* Common locations (gl_common)*/
@@ -32,65 +45,171 @@ typedef struct {
   int alpha_location;
   int blendMode_location;
 
-  /* Shader-specific locations */
-  union {
-    struct {
-      int color_location;
-    };
-  };
+  /* Clip locations (rounded_rect.fs) */
+  int clip_bounds_location;
+  int clip_widths_location;
+  int clip_heights_location;
+
+  /* Node specific locations */
+  int outline_location;
+  int corner_widths_location;
+  int corner_heights_location;
+  int border_widths_location;
+  int border_colors_location;
+  int gradient_start_location;
+  int gradient_end_location;
+  int gradient_repeating_location;
+  int n_color_stops_location;
+  int color_stop_offsets_location;
+  int color_stops_location;
+  int shadow_color_location;
+  int shadow_offset_location;
+  int shadow_spread_location;
 } Program;
 
+/* The layout of the frame's vertex buffer; the position is in
+ * world coordinates, unless the item needs its own transformation,
+ * and the color is premultiplied
+ */
 typedef struct {
-  int render_target_id;
-  int vao_id;
-  int buffer_id;
-  int texture_id;
-  int program_id;
-
-  Program *program;
-} RenderData;
+  float position[2];
+  float uv[2];
+  float color[4];
+} GskGLVertex;
 
 enum {
   MODE_COLOR = 1,
   MODE_TEXTURE,
+  MODE_BORDER,
+  MODE_LINEAR_GRADIENT,
+  MODE_INSET_SHADOW,
+  MODE_OUTSET_SHADOW,
   N_MODES
 };
 
+typedef enum {
+  CLIP_NONE,
+  CLIP_RECT,
+  CLIP_ROUNDED,
+  CLIP_ALL_CLIPPED
+} ClipType;
+
+/* The state that a node inherits from its ancestors while the
+ * render items are collected
+ */
+typedef struct {
+  graphene_matrix_t modelview;
+
+  /* The clip, in the coordinate space of the render target */
+  ClipType clip_type;
+  GskRoundedRect clip;
+  /* Index of the clip in the renderer's clips, or -1 */
+  int clip_index;
+
+  /* Index in the renderer's render targets */
+  guint render_target;
+
+  /* Applied to the vertex colors */
+  float opacity;
+} RenderState;
+
+/* A texture that render items are drawn into; the first render
+ * target is the frame itself, the other ones are offscreen
+ * textures that are drawn before being used as a source
+ */
+typedef struct {
+  int texture_id;
+  int width;
+  int height;
+
+  /* The area covered by the target, and the MVP mapping it to
+   * the viewport
+   */
+  graphene_rect_t bounds;
+  graphene_matrix_t mvp;
+
+  gboolean cleared;
+} RenderTarget;
+
 typedef struct {
   int mode;
   /* Back pointer to the node, only meant for comparison */
   GskRenderNode *node;
 
-  graphene_point3d_t min;
-  graphene_point3d_t max;
+  const char *name;
 
-  graphene_size_t size;
+  Program *program;
+  int texture_id;
 
-  graphene_matrix_t mvp;
+  guint render_target;
+  /* The rounded clip applied in the fragment shader, or -1 if the
+   * item was clipped when filling the vertex buffer
+   */
+  int clip_index;
 
-  float opacity;
-  float z;
+  /* The range of the item in the frame's vertex buffer */
+  guint vertex_offset;
+  guint n_vertices;
+
+  /* Items with a 2D transformation are transformed when filling the
+   * vertex buffer, and can be drawn with the render target's MVP;
+   * anything else carries its own MVP, and cannot be merged into a
+   * batch
+   */
+  gboolean uses_frame_mvp;
+  graphene_matrix_t mvp;
 
+  /* Uniforms of the node specific programs; the positions are in
+   * the coordinate space of the node, which is passed as the UV
+   */
   union {
     struct {
-      GdkRGBA color;
-    } color_data;
+      float outline[12];
+      float widths[4];
+      float colors[16];
+    } border;
     struct {
-      int a,b;
-    } texture_data;
+      float start[2];
+      float end[2];
+      int repeating;
+      int n_color_stops;
+      float color_stop_offsets[MAX_COLOR_STOPS];
+      float color_stops[MAX_COLOR_STOPS * 4];
+    } linear_gradient;
+    struct {
+      float outline[12];
+      float color[4];
+      float offset[2];
+      float spread;
+    } shadow;
   };
+} RenderItem;
 
-  const char *name;
-
-  GskBlendMode blend_mode;
+/* A run of consecutive render items sharing program, texture, render
+ * target, clip and transformation, drawn with a single glDrawArrays() call
+ */
+typedef struct {
+  Program *program;
+  int texture_id;
+  guint render_target;
+  int clip_index;
 
-  RenderData render_data;
-  RenderData *parent_data;
+  /* The item providing the node specific uniforms */
+  guint first_item;
 
-  GArray *children;
-} RenderItem;
+  gboolean uses_frame_mvp;
+  graphene_matrix_t mvp;
 
+  guint first_vertex;
+  guint n_vertices;
+  guint n_items;
+} RenderBatch;
 
+/* The texture of a glyph cache page, and the serial of its contents */
+typedef struct {
+  int texture_id;
+  guint64 serial;
+} GlyphTexture;
 
 enum {
   MVP,
@@ -98,12 +217,33 @@ enum {
   MASK,
   ALPHA,
   BLEND_MODE,
+  CLIP_BOUNDS,
+  CLIP_WIDTHS,
+  CLIP_HEIGHTS,
+  OUTLINE,
+  CORNER_WIDTHS,
+  CORNER_HEIGHTS,
+  BORDER_WIDTHS,
+  BORDER_COLORS,
+  GRADIENT_START,
+  GRADIENT_END,
+  GRADIENT_REPEATING,
+  N_COLOR_STOPS,
+  COLOR_STOP_OFFSETS,
+  COLOR_STOPS,
+  SHADOW_COLOR,
+  SHADOW_OFFSET,
+  SHADOW_SPREAD,
   N_UNIFORMS
 };
 
+/* The order matches the attribute locations, see
+ * gsk_shader_builder_create_program()
+ */
 enum {
   POSITION,
   UV,
+  COLOR,
   N_ATTRIBUTES
 };
 
@@ -111,6 +251,11 @@ enum {
 typedef struct {
   GQuark frames;
   GQuark draw_calls;
+  GQuark render_items;
+  GQuark batches;
+  GQuark uploads;
+  GQuark upload_bytes;
+  GQuark texture_memory;
 } ProfileCounters;
 
 typedef struct {
@@ -124,7 +269,7 @@ typedef enum {
   RENDER_SCISSOR
 } RenderMode;
 
-#define NUM_PROGRAMS 3
+#define NUM_PROGRAMS 7
 
 struct _GskGLRenderer
 {
@@ -137,12 +282,18 @@ struct _GskGLRenderer
   guint depth_stencil_buffer;
   guint texture_id;
 
+  guint vao_id;
+  guint buffer_id;
+
   GQuark uniforms[N_UNIFORMS];
   GQuark attributes[N_ATTRIBUTES];
 
   GdkGLContext *gl_context;
   GskGLDriver *gl_driver;
   GskGLProfiler *gl_profiler;
+  GskGlyphCache *glyph_cache;
+  GArray *glyph_textures;
+  GskOffscreenCache *offscreen_cache;
   GskShaderBuilder *shader_builder;
 
   union {
@@ -150,6 +301,10 @@ struct _GskGLRenderer
       Program blend_program;
       Program blit_program;
       Program color_program;
+      Program border_program;
+      Program linear_gradient_program;
+      Program inset_shadow_program;
+      Program outset_shadow_program;
     };
     struct {
       Program programs[NUM_PROGRAMS];
@@ -157,6 +312,10 @@ struct _GskGLRenderer
   };
 
   GArray *render_items;
+  GArray *vertices;
+  GArray *batches;
+  GArray *render_targets;
+  GArray *clips;
 
 #ifdef G_ENABLE_DEBUG
   ProfileCounters profile_counters;
@@ -182,6 +341,11 @@ gsk_gl_renderer_dispose (GObject *gobject)
 
   g_clear_object (&self->gl_context);
   g_clear_pointer (&self->render_items, g_array_unref);
+  g_clear_pointer (&self->vertices, g_array_unref);
+  g_clear_pointer (&self->batches, g_array_unref);
+  g_clear_pointer (&self->render_targets, g_array_unref);
+  g_clear_pointer (&self->clips, g_array_unref);
+  g_clear_pointer (&self->glyph_textures, g_array_unref);
 
   G_OBJECT_CLASS (gsk_gl_renderer_parent_class)->dispose (gobject);
 }
@@ -247,6 +411,12 @@ init_common_locations (GskGLRenderer *self,
     gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[ALPHA]);
   prog->blendMode_location =
     gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[BLEND_MODE]);
+  prog->clip_bounds_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[CLIP_BOUNDS]);
+  prog->clip_widths_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[CLIP_WIDTHS]);
+  prog->clip_heights_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[CLIP_HEIGHTS]);
 
   prog->position_location =
     gsk_shader_builder_get_attribute_location (self->shader_builder, prog->id, self->attributes[POSITION]);
@@ -254,13 +424,61 @@ init_common_locations (GskGLRenderer *self,
     gsk_shader_builder_get_attribute_location (self->shader_builder, prog->id, self->attributes[UV]);
 }
 
+static void
+init_node_locations (GskGLRenderer *self,
+                     Program       *prog)
+{
+  prog->outline_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[OUTLINE]);
+  prog->corner_widths_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[CORNER_WIDTHS]);
+  prog->corner_heights_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[CORNER_HEIGHTS]);
+  prog->border_widths_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[BORDER_WIDTHS]);
+  prog->border_colors_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[BORDER_COLORS]);
+  prog->gradient_start_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[GRADIENT_START]);
+  prog->gradient_end_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[GRADIENT_END]);
+  prog->gradient_repeating_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[GRADIENT_REPEATING]);
+  prog->n_color_stops_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[N_COLOR_STOPS]);
+  prog->color_stop_offsets_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[COLOR_STOP_OFFSETS]);
+  prog->color_stops_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[COLOR_STOPS]);
+  prog->shadow_color_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[SHADOW_COLOR]);
+  prog->shadow_offset_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[SHADOW_OFFSET]);
+  prog->shadow_spread_location =
+    gsk_shader_builder_get_uniform_location (self->shader_builder, prog->id, self->uniforms[SHADOW_SPREAD]);
+}
+
 static gboolean
 gsk_gl_renderer_create_programs (GskGLRenderer  *self,
                                  GError        **error)
 {
+  static const struct {
+    const char *name;
+    const char *vs;
+    const char *fs;
+  } program_info[NUM_PROGRAMS] = {
+    { "blend", "blend.vs.glsl", "blend.fs.glsl" },
+    { "blit", "blit.vs.glsl", "blit.fs.glsl" },
+    { "color", "color.vs.glsl", "color.fs.glsl" },
+    { "border", "blit.vs.glsl", "border.fs.glsl" },
+    { "linear gradient", "blit.vs.glsl", "linear_gradient.fs.glsl" },
+    { "inset shadow", "blit.vs.glsl", "inset_shadow.fs.glsl" },
+    { "outset shadow", "blit.vs.glsl", "outset_shadow.fs.glsl" },
+  };
   GskShaderBuilder *builder;
   GError *shader_error = NULL;
   gboolean res = FALSE;
+  int i;
 
   builder = gsk_shader_builder_new ();
 
@@ -271,9 +489,27 @@ gsk_gl_renderer_create_programs (GskGLRenderer  *self,
   self->uniforms[MASK] = gsk_shader_builder_add_uniform (builder, "uMask");
   self->uniforms[ALPHA] = gsk_shader_builder_add_uniform (builder, "uAlpha");
   self->uniforms[BLEND_MODE] = gsk_shader_builder_add_uniform (builder, "uBlendMode");
-  
+  self->uniforms[CLIP_BOUNDS] = gsk_shader_builder_add_uniform (builder, "uClipBounds");
+  self->uniforms[CLIP_WIDTHS] = gsk_shader_builder_add_uniform (builder, "uClipWidths");
+  self->uniforms[CLIP_HEIGHTS] = gsk_shader_builder_add_uniform (builder, "uClipHeights");
+  self->uniforms[OUTLINE] = gsk_shader_builder_add_uniform (builder, "uOutline");
+  self->uniforms[CORNER_WIDTHS] = gsk_shader_builder_add_uniform (builder, "uCornerWidths");
+  self->uniforms[CORNER_HEIGHTS] = gsk_shader_builder_add_uniform (builder, "uCornerHeights");
+  self->uniforms[BORDER_WIDTHS] = gsk_shader_builder_add_uniform (builder, "uBorderWidths");
+  self->uniforms[BORDER_COLORS] = gsk_shader_builder_add_uniform (builder, "uBorderColors");
+  self->uniforms[GRADIENT_START] = gsk_shader_builder_add_uniform (builder, "uGradientStart");
+  self->uniforms[GRADIENT_END] = gsk_shader_builder_add_uniform (builder, "uGradientEnd");
+  self->uniforms[GRADIENT_REPEATING] = gsk_shader_builder_add_uniform (builder, "uGradientRepeating");
+  self->uniforms[N_COLOR_STOPS] = gsk_shader_builder_add_uniform (builder, "uNumColorStops");
+  self->uniforms[COLOR_STOP_OFFSETS] = gsk_shader_builder_add_uniform (builder, "uColorStopOffsets");
+  self->uniforms[COLOR_STOPS] = gsk_shader_builder_add_uniform (builder, "uColorStops");
+  self->uniforms[SHADOW_COLOR] = gsk_shader_builder_add_uniform (builder, "uShadowColor");
+  self->uniforms[SHADOW_OFFSET] = gsk_shader_builder_add_uniform (builder, "uShadowOffset");
+  self->uniforms[SHADOW_SPREAD] = gsk_shader_builder_add_uniform (builder, "uShadowSpread");
+
   self->attributes[POSITION] = gsk_shader_builder_add_attribute (builder, "aPosition");
   self->attributes[UV] = gsk_shader_builder_add_attribute (builder, "aUv");
+  self->attributes[COLOR] = gsk_shader_builder_add_attribute (builder, "aColor");
 
   if (gdk_gl_context_get_use_es (self->gl_context))
     {
@@ -308,51 +544,36 @@ gsk_gl_renderer_create_programs (GskGLRenderer  *self,
   if (GSK_RENDER_MODE_CHECK (SHADERS))
     gsk_shader_builder_add_define (builder, "GSK_DEBUG", "1");
 #endif
+
+  /* Every fragment shader can apply a rounded clip */
+  gsk_shader_builder_add_fragment_include (builder, "rounded_rect.fs.glsl");
+
   /* Keep a pointer to query for the uniform and attribute locations
    * when rendering the scene
    */
   self->shader_builder = builder;
 
-  self->blend_program.id = 
-    gsk_shader_builder_create_program (builder, "blend.vs.glsl", "blend.fs.glsl", &shader_error);
-  if (shader_error != NULL)
+  for (i = 0; i < NUM_PROGRAMS; i++)
     {
-      g_propagate_prefixed_error (error,
-                                  shader_error,
-                                  "Unable to create 'blend' program: ");
-      g_object_unref (builder);
-      goto out;
-    }
-  init_common_locations (self, &self->blend_program);
+      Program *program = &self->programs[i];
 
-  self->blit_program.id =
-    gsk_shader_builder_create_program (builder, "blit.vs.glsl", "blit.fs.glsl", &shader_error);
-  if (shader_error != NULL)
-    {
-      g_propagate_prefixed_error (error,
-                                  shader_error,
-                                  "Unable to create 'blit' program: ");
-      g_object_unref (builder);
-      goto out;
-    }
-  init_common_locations (self, &self->blit_program);
+      program->id = gsk_shader_builder_create_program (builder,
+                                                       program_info[i].vs,
+                                                       program_info[i].fs,
+                                                       &shader_error);
+      if (shader_error != NULL)
+        {
+          g_propagate_prefixed_error (error,
+                                      shader_error,
+                                      "Unable to create '%s' program: ",
+                                      program_info[i].name);
+          g_clear_object (&self->shader_builder);
+          goto out;
+        }
 
-  self->color_program.id =
-    gsk_shader_builder_create_program (builder, "color.vs.glsl", "color.fs.glsl", &shader_error);
-  if (shader_error != NULL)
-    {
-      g_propagate_prefixed_error (error,
-                                  shader_error,
-                                  "Unable to create 'color' program: ");
-      g_object_unref (builder);
-      goto out;
+      init_common_locations (self, program);
+      init_node_locations (self, program);
     }
-  init_common_locations (self, &self->color_program);
-  self->color_program.color_location = gsk_shader_builder_get_uniform_location (self->shader_builder,
-                                                                                self->color_program.id,
-                                                                                g_quark_from_string("uColor"));
-  self->color_program.color_location = glGetUniformLocation(self->color_program.id, "uColor");
-  g_assert(self->color_program.color_location >= 0);
 
   res = TRUE;
 
@@ -366,6 +587,59 @@ gsk_gl_renderer_destroy_programs (GskGLRenderer *self)
   g_clear_object (&self->shader_builder);
 }
 
+static void
+gsk_gl_renderer_create_vertex_array (GskGLRenderer *self)
+{
+  glGenVertexArrays (1, &self->vao_id);
+  glBindVertexArray (self->vao_id);
+
+  glGenBuffers (1, &self->buffer_id);
+  glBindBuffer (GL_ARRAY_BUFFER, self->buffer_id);
+
+  glEnableVertexAttribArray (POSITION);
+  glVertexAttribPointer (POSITION, 2, GL_FLOAT, GL_FALSE,
+                         sizeof (GskGLVertex),
+                         (void *) G_STRUCT_OFFSET (GskGLVertex, position));
+
+  glEnableVertexAttribArray (UV);
+  glVertexAttribPointer (UV, 2, GL_FLOAT, GL_FALSE,
+                         sizeof (GskGLVertex),
+                         (void *) G_STRUCT_OFFSET (GskGLVertex, uv));
+
+  glEnableVertexAttribArray (COLOR);
+  glVertexAttribPointer (COLOR, 4, GL_FLOAT, GL_FALSE,
+                         sizeof (GskGLVertex),
+                         (void *) G_STRUCT_OFFSET (GskGLVertex, color));
+
+  glBindBuffer (GL_ARRAY_BUFFER, 0);
+  glBindVertexArray (0);
+}
+
+static void
+gsk_gl_renderer_destroy_vertex_array (GskGLRenderer *self)
+{
+  if (self->buffer_id != 0)
+    {
+      glDeleteBuffers (1, &self->buffer_id);
+      self->buffer_id = 0;
+    }
+
+  if (self->vao_id != 0)
+    {
+      glDeleteVertexArrays (1, &self->vao_id);
+      self->vao_id = 0;
+    }
+}
+
+static void
+gsk_gl_renderer_free_cached_texture (gpointer data,
+                                     gpointer user_data)
+{
+  GskGLRenderer *self = user_data;
+
+  gsk_gl_driver_destroy_texture (self->gl_driver, GPOINTER_TO_INT (data));
+}
+
 static gboolean
 gsk_gl_renderer_realize (GskRenderer  *renderer,
                          GdkWindow    *window,
@@ -391,11 +665,17 @@ gsk_gl_renderer_realize (GskRenderer  *renderer,
   g_assert (self->gl_driver == NULL);
   self->gl_driver = gsk_gl_driver_new (self->gl_context);
   self->gl_profiler = gsk_gl_profiler_new (self->gl_context);
+  self->glyph_cache = gsk_glyph_cache_get_for_display (gsk_renderer_get_display (renderer));
+  self->offscreen_cache = gsk_offscreen_cache_new (OFFSCREEN_CACHE_SIZE,
+                                                   gsk_gl_renderer_free_cached_texture,
+                                                   self);
 
   GSK_NOTE (OPENGL, g_print ("Creating buffers and programs\n"));
   if (!gsk_gl_renderer_create_programs (self, error))
     return FALSE;
 
+  gsk_gl_renderer_create_vertex_array (self);
+
   return TRUE;
 }
 
@@ -412,11 +692,18 @@ gsk_gl_renderer_unrealize (GskRenderer *renderer)
   /* We don't need to iterate to destroy the associated GL resources,
    * as they will be dropped when we finalize the GskGLDriver
    */
-  g_clear_pointer (&self->render_items, g_array_unref);
+  g_array_set_size (self->render_items, 0);
+  g_array_set_size (self->vertices, 0);
+  g_array_set_size (self->batches, 0);
+  g_array_set_size (self->render_targets, 0);
+  g_array_set_size (self->clips, 0);
+  g_array_set_size (self->glyph_textures, 0);
 
   gsk_gl_renderer_destroy_buffers (self);
   gsk_gl_renderer_destroy_programs (self);
+  gsk_gl_renderer_destroy_vertex_array (self);
 
+  g_clear_pointer (&self->offscreen_cache, gsk_offscreen_cache_free);
   g_clear_object (&self->gl_profiler);
   g_clear_object (&self->gl_driver);
 
@@ -502,146 +789,199 @@ gsk_gl_renderer_update_frustum (GskGLRenderer           *self,
             g_print ("\n"));
 }
 
-#define N_VERTICES      6
+static void
+gsk_gl_renderer_clear (GskGLRenderer *self)
+{
+  GSK_NOTE (OPENGL, g_print ("Clearing viewport\n"));
+  glClearColor (0, 0, 0, 0);
+  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
 
 static void
-render_item (GskGLRenderer *self,
-             RenderItem    *item)
+gsk_gl_renderer_setup_render_mode (GskGLRenderer *self)
 {
-  float mvp[16];
-  float opacity;
+  switch (self->render_mode)
+  {
+    case RENDER_FULL:
+      glDisable (GL_SCISSOR_TEST);
+      break;
 
-  if (item->children != NULL)
-    {
-      if (gsk_gl_driver_bind_render_target (self->gl_driver, item->render_data.render_target_id))
-        {
-          glViewport (0, 0, item->size.width, item->size.height);
+    case RENDER_SCISSOR:
+      {
+        GdkDrawingContext *context = gsk_renderer_get_drawing_context (GSK_RENDERER (self));
+        GdkWindow *window = gsk_renderer_get_window (GSK_RENDERER (self));
+        GdkRectangle extents;
+        int scale_factor = gsk_renderer_get_scale_factor (GSK_RENDERER (self));
 
-          glClearColor (0.0, 0.0, 0.0, 0.0);
-          glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        }
-    }
+        cairo_region_get_extents (gdk_drawing_context_get_clip (context), &extents);
+
+        glScissor (extents.x * scale_factor,
+                   (gdk_window_get_height (window) - extents.height - extents.y) * scale_factor,
+                   extents.width * scale_factor, extents.height * scale_factor);
+        glEnable (GL_SCISSOR_TEST);
+        break;
+      }
+
+    default:
+      g_assert_not_reached ();
+      break;
+  }
+}
+
+#define ORTHO_NEAR_PLANE        -10000
+#define ORTHO_FAR_PLANE          10000
+
+#define N_VERTICES      6
+
+static void
+set_clip_uniforms (GskGLRenderer *self,
+                   Program       *program,
+                   int            clip_index)
+{
+  float clip[12] = { 0, };
 
-  gsk_gl_driver_bind_vao (self->gl_driver, item->render_data.vao_id);
+  /* An empty clip disables the clipping in the fragment shader */
+  if (clip_index >= 0)
+    gsk_rounded_rect_to_float (&g_array_index (self->clips, GskRoundedRect, clip_index), clip);
 
-  glUseProgram (item->render_data.program->id);
+  glUniform4fv (program->clip_bounds_location, 1, &clip[0]);
+  glUniform4fv (program->clip_widths_location, 1, &clip[4]);
+  glUniform4fv (program->clip_heights_location, 1, &clip[8]);
+}
 
-  switch(item->mode)
+static void
+set_item_uniforms (Program          *program,
+                   const RenderItem *item)
+{
+  switch (item->mode)
     {
-      case MODE_COLOR:
-        {
-          glUniform4f (item->render_data.program->color_location,
-                       item->color_data.color.red,
-                       item->color_data.color.green,
-                       item->color_data.color.blue,
-                       item->color_data.color.alpha);
-        }
+    case MODE_BORDER:
+      glUniform4fv (program->outline_location, 1, &item->border.outline[0]);
+      glUniform4fv (program->corner_widths_location, 1, &item->border.outline[4]);
+      glUniform4fv (program->corner_heights_location, 1, &item->border.outline[8]);
+      glUniform4fv (program->border_widths_location, 1, item->border.widths);
+      glUniform4fv (program->border_colors_location, 4, item->border.colors);
       break;
 
-      case MODE_TEXTURE:
-        {
-          g_assert(item->render_data.texture_id != 0);
-          /* Use texture unit 0 for the source */
-          glUniform1i (item->render_data.program->source_location, 0);
-          gsk_gl_driver_bind_source_texture (self->gl_driver, item->render_data.texture_id);
+    case MODE_LINEAR_GRADIENT:
+      glUniform2fv (program->gradient_start_location, 1, item->linear_gradient.start);
+      glUniform2fv (program->gradient_end_location, 1, item->linear_gradient.end);
+      glUniform1i (program->gradient_repeating_location, item->linear_gradient.repeating);
+      glUniform1i (program->n_color_stops_location, item->linear_gradient.n_color_stops);
+      glUniform1fv (program->color_stop_offsets_location,
+                    item->linear_gradient.n_color_stops,
+                    item->linear_gradient.color_stop_offsets);
+      glUniform4fv (program->color_stops_location,
+                    item->linear_gradient.n_color_stops,
+                    item->linear_gradient.color_stops);
+      break;
 
-          if (item->parent_data != NULL)
-            {
-              glUniform1i (item->render_data.program->blendMode_location, item->blend_mode);
-
-              /* Use texture unit 1 for the mask */
-              if (item->parent_data->texture_id != 0)
-                {
-                  glUniform1i (item->render_data.program->mask_location, 1);
-                  gsk_gl_driver_bind_mask_texture (self->gl_driver, item->parent_data->texture_id);
-                }
-            }
-        }
+    case MODE_INSET_SHADOW:
+    case MODE_OUTSET_SHADOW:
+      glUniform4fv (program->outline_location, 1, &item->shadow.outline[0]);
+      glUniform4fv (program->corner_widths_location, 1, &item->shadow.outline[4]);
+      glUniform4fv (program->corner_heights_location, 1, &item->shadow.outline[8]);
+      glUniform4fv (program->shadow_color_location, 1, item->shadow.color);
+      glUniform2fv (program->shadow_offset_location, 1, item->shadow.offset);
+      glUniform1f (program->shadow_spread_location, item->shadow.spread);
       break;
 
-      default:
-        g_assert_not_reached ();
+    default:
+      break;
     }
+}
 
-  /* Pass the opacity component */
-  if (item->children != NULL)
-    opacity = 1.0;
-  else
-    opacity = item->opacity;
+static void
+bind_render_target (GskGLRenderer         *self,
+                    guint                  index,
+                    const graphene_rect_t *viewport,
+                    int                    scale_factor)
+{
+  RenderTarget *target = &g_array_index (self->render_targets, RenderTarget, index);
 
-  glUniform1f (item->render_data.program->alpha_location, opacity);
+  gsk_gl_driver_bind_render_target (self->gl_driver, target->texture_id);
 
-  /* Pass the mvp to the vertex shader */
-  GSK_NOTE (TRANSFORMS, graphene_matrix_print (&item->mvp));
-  graphene_matrix_to_float (&item->mvp, mvp);
-  glUniformMatrix4fv (item->render_data.program->mvp_location, 1, GL_FALSE, mvp);
+  if (index == 0)
+    {
+      gsk_gl_renderer_resize_viewport (self, viewport, scale_factor);
+      gsk_gl_renderer_setup_render_mode (self);
+      return;
+    }
 
-  /* Draw the quad */
-  GSK_NOTE2 (OPENGL, TRANSFORMS,
-             g_print ("Drawing item <%s>[%p] (w:%g, h:%g) with opacity: %g blend mode: %d\n",
-                      item->name,
-                      item,
-                      item->size.width, item->size.height,
-                      item->opacity,
-                      item->blend_mode));
+  GSK_NOTE (OPENGL, g_print ("Binding offscreen texture %d (%dx%d)\n",
+                             target->texture_id,
+                             target->width,
+                             target->height));
 
-  glDrawArrays (GL_TRIANGLES, 0, N_VERTICES);
+  glDisable (GL_SCISSOR_TEST);
+  glViewport (0, 0, target->width, target->height);
 
-#ifdef G_ENABLE_DEBUG
-  gsk_profiler_counter_inc (gsk_renderer_get_profiler (GSK_RENDERER (self)),
-                            self->profile_counters.draw_calls);
-#endif
+  if (!target->cleared)
+    {
+      glClearColor (0, 0, 0, 0);
+      glClear (GL_COLOR_BUFFER_BIT);
+      target->cleared = TRUE;
+    }
+}
 
-  /* Render all children items, so we can take the result
-   * render target texture during the compositing
-   */
-  if (item->children != NULL)
+static void
+render_batch (GskGLRenderer  *self,
+              RenderBatch    *batch,
+              Program       **current_program,
+              int            *current_clip)
+{
+  const RenderItem *item = &g_array_index (self->render_items, RenderItem, batch->first_item);
+  float mvp[16];
+
+  if (*current_program != batch->program)
     {
-      int i;
+      glUseProgram (batch->program->id);
 
-      for (i = 0; i < item->children->len; i++)
-        {
-          RenderItem *child = &g_array_index (item->children, RenderItem, i);
+      /* Use texture unit 0 for the source */
+      glUniform1i (batch->program->source_location, 0);
+      glUniform1f (batch->program->alpha_location, 1.0);
 
-          render_item (self, child);
-        }
+      set_clip_uniforms (self, batch->program, batch->clip_index);
 
-      /* Bind the parent render target */
-      if (item->parent_data != NULL)
-        gsk_gl_driver_bind_render_target (self->gl_driver, item->parent_data->render_target_id);
+      *current_program = batch->program;
+      *current_clip = batch->clip_index;
+    }
+  else if (*current_clip != batch->clip_index)
+    {
+      set_clip_uniforms (self, batch->program, batch->clip_index);
 
-      /* Bind the same VAO, as the render target is created with the same size
-       * and vertices as the texture target
-       */
-      gsk_gl_driver_bind_vao (self->gl_driver, item->render_data.vao_id);
+      *current_clip = batch->clip_index;
+    }
 
-      /* Since we're rendering the target texture, we only need the blit program */
-      glUseProgram (self->blit_program.id);
+  /* Only items without node specific uniforms are merged */
+  set_item_uniforms (batch->program, item);
 
-      /* Use texture unit 0 for the render target */
-      glUniform1i (item->render_data.program->source_location, 0);
-      gsk_gl_driver_bind_source_texture (self->gl_driver, item->render_data.render_target_id);
+  if (batch->texture_id != 0)
+    gsk_gl_driver_bind_source_texture (self->gl_driver, batch->texture_id);
 
-      /* Pass the opacity component; if we got here, we know that the original render
-       * target is neither fully opaque nor at full opacity
-       */
-      glUniform1f (item->render_data.program->alpha_location, item->opacity);
-
-      /* Pass the mvp to the vertex shader */
-      GSK_NOTE (TRANSFORMS, graphene_matrix_print (&item->mvp));
-      graphene_matrix_to_float (&item->mvp, mvp);
-      glUniformMatrix4fv (item->render_data.program->mvp_location, 1, GL_FALSE, mvp);
-
-      /* Draw the quad */
-      GSK_NOTE2 (OPENGL, TRANSFORMS,
-                 g_print ("Drawing offscreen item <%s>[%p] (w:%g, h:%g) with opacity: %g\n",
-                          item->name,
-                          item,
-                          item->size.width, item->size.height,
-                          item->opacity));
-
-      glDrawArrays (GL_TRIANGLES, 0, N_VERTICES);
-    }
+  /* Pass the mvp to the vertex shader */
+  if (batch->uses_frame_mvp)
+    graphene_matrix_to_float (&g_array_index (self->render_targets, RenderTarget, batch->render_target).mvp, mvp);
+  else
+    graphene_matrix_to_float (&batch->mvp, mvp);
+  glUniformMatrix4fv (batch->program->mvp_location, 1, GL_FALSE, mvp);
+
+  GSK_NOTE (OPENGL,
+            g_print ("Drawing batch of %u items (program:%d, texture:%d, target:%u, clip:%d, vertices:%u+%u)\n",
+                     batch->n_items,
+                     batch->program->id,
+                     batch->texture_id,
+                     batch->render_target,
+                     batch->clip_index,
+                     batch->first_vertex,
+                     batch->n_vertices));
+
+  glDrawArrays (GL_TRIANGLES, batch->first_vertex, batch->n_vertices);
+
+#ifdef G_ENABLE_DEBUG
+  gsk_profiler_counter_inc (gsk_renderer_get_profiler (GSK_RENDERER (self)),
+                            self->profile_counters.draw_calls);
+#endif
 }
 
 static void
@@ -680,236 +1020,979 @@ get_gl_scaling_filters (GskRenderNode *node,
     }
 }
 
-#if 0
 static gboolean
 check_in_frustum (const graphene_frustum_t *frustum,
-                  RenderItem               *item)
+                  const graphene_matrix_t  *modelview,
+                  const graphene_rect_t    *bounds)
 {
   graphene_box_t aabb;
 
-  graphene_box_init (&aabb, &item->min, &item->max);
-  graphene_matrix_transform_box (&item->mvp, &aabb, &aabb);
+  graphene_box_init (&aabb,
+                     &GRAPHENE_POINT3D_INIT (bounds->origin.x, bounds->origin.y, 0.f),
+                     &GRAPHENE_POINT3D_INIT (bounds->origin.x + bounds->size.width,
+                                             bounds->origin.y + bounds->size.height,
+                                             0.f));
+  graphene_matrix_transform_box (modelview, &aabb, &aabb);
 
   return graphene_frustum_intersects_box (frustum, &aabb);
 }
-#endif
-
-static float
-project_item (const graphene_matrix_t *projection,
-              const graphene_matrix_t *modelview)
-{
-  graphene_vec4_t vec;
-
-  graphene_matrix_get_row (modelview, 3, &vec);
-  graphene_matrix_transform_vec4 (projection, &vec, &vec);
-
-  return graphene_vec4_get_z (&vec) / graphene_vec4_get_w (&vec);
-}
 
+/* Whether @m only scales and translates, in which case rectangles
+ * stay rectangles, and can be clipped before filling the vertex buffer
+ */
 static gboolean
-render_node_needs_render_target (GskRenderNode *node)
+matrix_is_axis_aligned (const graphene_matrix_t *m)
 {
-  return FALSE;
+  return graphene_matrix_is_2d (m) &&
+         graphene_matrix_get_value (m, 0, 1) == 0.f &&
+         graphene_matrix_get_value (m, 1, 0) == 0.f &&
+         graphene_matrix_get_value (m, 0, 0) > 0.f &&
+         graphene_matrix_get_value (m, 1, 1) > 0.f;
 }
 
-static void
-gsk_gl_renderer_add_render_item (GskGLRenderer           *self,
-                                 const graphene_matrix_t *projection,
-                                 const graphene_matrix_t *modelview,
-                                 GArray                  *render_items,
-                                 GskRenderNode           *node,
-                                 RenderItem              *parent)
+static gboolean
+transform_rounded_rect (const graphene_matrix_t *m,
+                        const GskRoundedRect    *rect,
+                        GskRoundedRect          *res)
 {
-  RenderItem item;
-  RenderItem *ritem = NULL;
-  int program_id;
-  int scale_factor;
+  float scale_x, scale_y;
+  guint i;
 
-  memset (&item, 0, sizeof (RenderItem));
+  if (!matrix_is_axis_aligned (m))
+    return FALSE;
 
-  scale_factor = gsk_renderer_get_scale_factor (GSK_RENDERER (self));
-  if (scale_factor < 1)
-    scale_factor = 1;
+  scale_x = graphene_matrix_get_value (m, 0, 0);
+  scale_y = graphene_matrix_get_value (m, 1, 1);
 
-  item.node = node;
-  item.name = node->name != NULL ? node->name : "unnamed";
+  graphene_matrix_transform_bounds (m, &rect->bounds, &res->bounds);
+  for (i = 0; i < 4; i++)
+    graphene_size_init (&res->corner[i],
+                        rect->corner[i].width * scale_x,
+                        rect->corner[i].height * scale_y);
 
-  /* The texture size */
-  item.size.width = node->bounds.size.width * scale_factor;
-  item.size.height = node->bounds.size.height * scale_factor;
+  return TRUE;
+}
 
-  /* Each render item is an axis-aligned bounding box that we
-   * transform using the given transformation matrix
-   */
-  item.min.x = node->bounds.origin.x;
-  item.min.y = node->bounds.origin.y;
-  item.min.z = 0.f;
+static void
+render_state_set_clip (GskGLRenderer        *self,
+                       RenderState          *state,
+                       ClipType              clip_type,
+                       const GskRoundedRect *clip)
+{
+  state->clip_type = clip_type;
 
-  item.max.x = item.min.x + node->bounds.size.width;
-  item.max.y = item.min.y + node->bounds.size.height;
-  item.max.z = 0.f;
+  if (clip_type == CLIP_RECT || clip_type == CLIP_ROUNDED)
+    {
+      gsk_rounded_rect_init_copy (&state->clip, clip);
+      g_array_append_val (self->clips, state->clip);
+      state->clip_index = self->clips->len - 1;
+    }
+  else
+    state->clip_index = -1;
+}
 
-  /* The location of the item, in normalized world coordinates */
-  graphene_matrix_multiply (modelview, &self->mvp, &item.mvp);
-  item.z = project_item (projection, modelview);
+/* Follows the same rules as gsk_vulkan_clip_intersect_rect() */
+static gboolean
+render_state_intersect_rect (GskGLRenderer         *self,
+                             RenderState           *state,
+                             const graphene_rect_t *rect)
+{
+  GskRoundedRect clip;
 
-  item.opacity = 1.0;
+  if (state->clip_type == CLIP_ALL_CLIPPED)
+    return TRUE;
 
-  item.blend_mode = GSK_BLEND_MODE_DEFAULT;
+  if (state->clip_type == CLIP_NONE)
+    {
+      gsk_rounded_rect_init_from_rect (&clip, rect, 0);
+      render_state_set_clip (self, state, CLIP_RECT, &clip);
+      return TRUE;
+    }
 
-  /* Back-pointer to the parent node */
-  if (parent != NULL)
-    item.parent_data = &(parent->render_data);
-  else
-    item.parent_data = NULL;
+  if (graphene_rect_contains_rect (rect, &state->clip.bounds))
+    return TRUE;
 
-  /* Select the program to use */
-  if (parent != NULL)
+  if (!graphene_rect_intersection (rect, &state->clip.bounds, &clip.bounds))
     {
-      item.render_data.program = &self->blend_program;
-      program_id = self->blend_program.id;
+      render_state_set_clip (self, state, CLIP_ALL_CLIPPED, NULL);
+      return TRUE;
     }
-  else
+
+  if (state->clip_type == CLIP_RECT)
     {
-      item.render_data.program = &self->blit_program;
-      program_id = self->blit_program.id;
+      gsk_rounded_rect_init_from_rect (&clip, &clip.bounds, 0);
+      render_state_set_clip (self, state, CLIP_RECT, &clip);
+      return TRUE;
     }
 
-  if (render_node_needs_render_target (node))
+  if (gsk_rounded_rect_contains_rect (&state->clip, rect))
     {
-      item.render_data.render_target_id =
-        gsk_gl_driver_create_texture (self->gl_driver, item.size.width, item.size.height);
-      gsk_gl_driver_init_texture_empty (self->gl_driver, item.render_data.render_target_id);
-      gsk_gl_driver_create_render_target (self->gl_driver, item.render_data.render_target_id, TRUE, TRUE);
+      gsk_rounded_rect_init_from_rect (&clip, rect, 0);
+      render_state_set_clip (self, state, CLIP_RECT, &clip);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Follows the same rules as gsk_vulkan_clip_intersect_rounded_rect() */
+static gboolean
+render_state_intersect_rounded_rect (GskGLRenderer        *self,
+                                     RenderState          *state,
+                                     const GskRoundedRect *rect)
+{
+  if (state->clip_type == CLIP_ALL_CLIPPED)
+    return TRUE;
 
-      item.children = g_array_new (FALSE, FALSE, sizeof (RenderItem));
+  if (state->clip_type == CLIP_NONE)
+    {
+      render_state_set_clip (self, state, CLIP_ROUNDED, rect);
+      return TRUE;
     }
-  else
+
+  if (gsk_rounded_rect_contains_rect (rect, &state->clip.bounds))
+    return TRUE;
+
+  if (!graphene_rect_intersection (&rect->bounds, &state->clip.bounds, NULL))
     {
-      item.render_data.render_target_id = self->texture_id;
-      item.children = NULL;
+      render_state_set_clip (self, state, CLIP_ALL_CLIPPED, NULL);
+      return TRUE;
     }
 
-  switch (gsk_render_node_get_node_type (node))
+  if (state->clip_type == CLIP_RECT &&
+      graphene_rect_contains_rect (&state->clip.bounds, &rect->bounds))
     {
-    case GSK_TEXTURE_NODE:
-      {
-        GskTexture *texture = gsk_texture_node_get_texture (node);
-        int gl_min_filter = GL_NEAREST, gl_mag_filter = GL_NEAREST;
+      render_state_set_clip (self, state, CLIP_ROUNDED, rect);
+      return TRUE;
+    }
 
-        get_gl_scaling_filters (node, &gl_min_filter, &gl_mag_filter);
+  return FALSE;
+}
 
-        item.render_data.texture_id = gsk_gl_driver_get_texture_for_texture (self->gl_driver,
-                                                                             texture,
-                                                                             gl_min_filter,
-                                                                             gl_mag_filter);
-        item.mode = MODE_TEXTURE;
-      }
-      break;
+/* Whether @node ends up outside of the render target or the clip,
+ * so that it can be skipped entirely
+ */
+static gboolean
+render_state_clips_node (GskGLRenderer     *self,
+                         const RenderState *state,
+                         GskRenderNode     *node)
+{
+  const RenderTarget *target;
+  graphene_rect_t bounds;
 
-    case GSK_CAIRO_NODE:
-      {
-        cairo_surface_t *surface = gsk_cairo_node_get_surface (node);
-        int gl_min_filter = GL_NEAREST, gl_mag_filter = GL_NEAREST;
+  if (state->clip_type == CLIP_ALL_CLIPPED)
+    return TRUE;
 
-        if (surface == NULL)
-          return;
+  if (!graphene_matrix_is_2d (&state->modelview))
+    {
+      /* Only the frame has a frustum; 3D transformations in
+       * offscreens are rare enough to not bother
+       */
+      if (state->render_target == 0)
+        return !check_in_frustum (&self->frustum, &state->modelview, &node->bounds);
 
-        get_gl_scaling_filters (node, &gl_min_filter, &gl_mag_filter);
+      return FALSE;
+    }
 
-        /* Upload the Cairo surface to a GL texture */
-        item.render_data.texture_id = gsk_gl_driver_create_texture (self->gl_driver,
-                                                                    item.size.width,
-                                                                    item.size.height);
-        gsk_gl_driver_bind_source_texture (self->gl_driver, item.render_data.texture_id);
-        gsk_gl_driver_init_texture_with_surface (self->gl_driver,
-                                                 item.render_data.texture_id,
-                                                 surface,
-                                                 gl_min_filter,
-                                                 gl_mag_filter);
-        item.mode = MODE_TEXTURE;
-      }
-      break;
+  target = &g_array_index (self->render_targets, RenderTarget, state->render_target);
 
+  graphene_matrix_transform_bounds (&state->modelview, &node->bounds, &bounds);
+
+  if (!graphene_rect_intersection (&bounds, &target->bounds, &bounds))
+    return TRUE;
+
+  if (state->clip_type != CLIP_NONE &&
+      !graphene_rect_intersection (&bounds, &state->clip.bounds, NULL))
+    return TRUE;
+
+  return FALSE;
+}
+
+/* Gets the part of the render target that is visible through the
+ * clip, in the coordinate space of the node being added. Returns
+ * %FALSE if the modelview can't be inverted to a rectangle
+ */
+static gboolean
+render_state_get_visible_rect (GskGLRenderer     *self,
+                               const RenderState *state,
+                               graphene_rect_t   *visible)
+{
+  const RenderTarget *target;
+  graphene_matrix_t inverse;
+
+  if (!graphene_matrix_is_2d (&state->modelview) ||
+      !graphene_matrix_inverse (&state->modelview, &inverse))
+    return FALSE;
+
+  target = &g_array_index (self->render_targets, RenderTarget, state->render_target);
+
+  *visible = target->bounds;
+  if (state->clip_type != CLIP_NONE &&
+      !graphene_rect_intersection (visible, &state->clip.bounds, visible))
+    return FALSE;
+
+  graphene_matrix_transform_bounds (&inverse, visible, visible);
+
+  return TRUE;
+}
+
+static gboolean
+gsk_gl_renderer_add_quad (GskGLRenderer           *self,
+                          RenderItem              *item,
+                          const RenderState       *state,
+                          const graphene_rect_t   *bounds,
+                          const graphene_rect_t   *uv,
+                          const float              color[4])
+{
+  graphene_point_t corners[N_VERTICES];
+  graphene_point_t uvs[N_VERTICES];
+  guint i;
+
+  item->render_target = state->render_target;
+  item->clip_index = state->clip_index;
+
+  if (matrix_is_axis_aligned (&state->modelview))
+    {
+      graphene_rect_t rect, clipped, clipped_uv;
+
+      graphene_matrix_transform_bounds (&state->modelview, bounds, &rect);
+      clipped = rect;
+
+      if (state->clip_type != CLIP_NONE)
+        {
+          if (!graphene_rect_intersection (&rect, &state->clip.bounds, &clipped))
+            return FALSE;
+
+          /* Rectangular clips are applied to the quad itself */
+          if (state->clip_type == CLIP_RECT ||
+              gsk_rounded_rect_contains_rect (&state->clip, &clipped))
+            item->clip_index = -1;
+        }
+
+      graphene_rect_init (&clipped_uv,
+                          uv->origin.x + (clipped.origin.x - rect.origin.x) / rect.size.width * uv->size.width,
+                          uv->origin.y + (clipped.origin.y - rect.origin.y) / rect.size.height * uv->size.height,
+                          clipped.size.width / rect.size.width * uv->size.width,
+                          clipped.size.height / rect.size.height * uv->size.height);
+
+      graphene_rect_get_top_left (&clipped, &corners[0]);
+      graphene_rect_get_bottom_left (&clipped, &corners[1]);
+      graphene_rect_get_top_right (&clipped, &corners[2]);
+      graphene_rect_get_bottom_right (&clipped, &corners[3]);
+
+      graphene_rect_get_top_left (&clipped_uv, &uvs[0]);
+      graphene_rect_get_bottom_left (&clipped_uv, &uvs[1]);
+      graphene_rect_get_top_right (&clipped_uv, &uvs[2]);
+      graphene_rect_get_bottom_right (&clipped_uv, &uvs[3]);
+
+      item->uses_frame_mvp = TRUE;
+    }
+  else
+    {
+      graphene_rect_get_top_left (bounds, &corners[0]);
+      graphene_rect_get_bottom_left (bounds, &corners[1]);
+      graphene_rect_get_top_right (bounds, &corners[2]);
+      graphene_rect_get_bottom_right (bounds, &corners[3]);
+
+      graphene_rect_get_top_left (uv, &uvs[0]);
+      graphene_rect_get_bottom_left (uv, &uvs[1]);
+      graphene_rect_get_top_right (uv, &uvs[2]);
+      graphene_rect_get_bottom_right (uv, &uvs[3]);
+
+      /* The clip is applied by the fragment shader, in the
+       * coordinate space of the render target
+       */
+      if (graphene_matrix_is_2d (&state->modelview))
+        {
+          for (i = 0; i < 4; i++)
+            graphene_matrix_transform_point (&state->modelview, &corners[i], &corners[i]);
+
+          item->uses_frame_mvp = TRUE;
+        }
+      else
+        {
+          const RenderTarget *target = &g_array_index (self->render_targets, RenderTarget, state->render_target);
+
+          /* Clipped 3D transformations go through the fallback path */
+          g_assert (state->clip_type == CLIP_NONE);
+
+          graphene_matrix_multiply (&state->modelview, &target->mvp, &item->mvp);
+          item->uses_frame_mvp = FALSE;
+        }
+    }
+
+  corners[4] = corners[1];
+  corners[5] = corners[2];
+  uvs[4] = uvs[1];
+  uvs[5] = uvs[2];
+
+  item->vertex_offset = self->vertices->len;
+  item->n_vertices = N_VERTICES;
+
+  g_array_set_size (self->vertices, self->vertices->len + N_VERTICES);
+
+  for (i = 0; i < N_VERTICES; i++)
+    {
+      GskGLVertex *v = &g_array_index (self->vertices, GskGLVertex, item->vertex_offset + i);
+
+      v->position[0] = corners[i].x;
+      v->position[1] = corners[i].y;
+      v->uv[0] = uvs[i].x;
+      v->uv[1] = uvs[i].y;
+      v->color[0] = color[0] * state->opacity;
+      v->color[1] = color[1] * state->opacity;
+      v->color[2] = color[2] * state->opacity;
+      v->color[3] = color[3] * state->opacity;
+    }
+
+  return TRUE;
+}
+
+static void
+rgba_to_float_premultiplied (const GdkRGBA *rgba,
+                             float          color[4])
+{
+  color[0] = rgba->red * rgba->alpha;
+  color[1] = rgba->green * rgba->alpha;
+  color[2] = rgba->blue * rgba->alpha;
+  color[3] = rgba->alpha;
+}
+
+/* Whether @node draws at most a single quad, in which case its opacity
+ * can be applied to the vertex colors instead of going through an
+ * offscreen texture
+ */
+static gboolean
+node_is_single_quad (GskRenderNode *node)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
     case GSK_COLOR_NODE:
+    case GSK_TEXTURE_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+      return TRUE;
+
+    case GSK_TRANSFORM_NODE:
+      return node_is_single_quad (gsk_transform_node_get_child (node));
+
+    case GSK_OPACITY_NODE:
+      return node_is_single_quad (gsk_opacity_node_get_child (node));
+
+    case GSK_CLIP_NODE:
+      return node_is_single_quad (gsk_clip_node_get_child (node));
+
+    case GSK_ROUNDED_CLIP_NODE:
+      return node_is_single_quad (gsk_rounded_clip_node_get_child (node));
+
+    case GSK_CONTAINER_NODE:
+      return gsk_container_node_get_n_children (node) == 0 ||
+             (gsk_container_node_get_n_children (node) == 1 &&
+              node_is_single_quad (gsk_container_node_get_child (node, 0)));
+
+    default:
+      return FALSE;
+    }
+}
+
+/* Draws @node with Cairo and uploads the result. Fallbacks are
+ * mostly used for expensive nodes, like blurred shadows, so the
+ * textures are kept for as long as the node is drawn
+ */
+static int
+gsk_gl_renderer_upload_fallback (GskGLRenderer *self,
+                                 GskRenderNode *node,
+                                 int            scale_factor)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+  int width, height;
+  int texture_id;
+
+  texture_id = GPOINTER_TO_INT (gsk_offscreen_cache_lookup (self->offscreen_cache,
+                                                            node,
+                                                            &node->bounds,
+                                                            scale_factor));
+  if (texture_id != 0)
+    return texture_id;
+
+  width = ceilf (node->bounds.size.width * scale_factor);
+  height = ceilf (node->bounds.size.height * scale_factor);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_surface_set_device_scale (surface, scale_factor, scale_factor);
+  cr = cairo_create (surface);
+  cairo_translate (cr, -node->bounds.origin.x, -node->bounds.origin.y);
+
+  gsk_render_node_draw (node, cr);
+
+  cairo_destroy (cr);
+
+  /* Upload the Cairo surface to a GL texture */
+  texture_id = gsk_gl_driver_create_texture (self->gl_driver, width, height);
+  gsk_gl_driver_bind_source_texture (self->gl_driver, texture_id);
+  gsk_gl_driver_init_texture_with_surface (self->gl_driver,
+                                           texture_id,
+                                           surface,
+                                           GL_NEAREST, GL_NEAREST);
+
+  cairo_surface_destroy (surface);
+
+  if (gsk_offscreen_cache_insert (self->offscreen_cache,
+                                  node,
+                                  &node->bounds,
+                                  scale_factor,
+                                  GINT_TO_POINTER (texture_id),
+                                  width * height * 4))
+    gsk_gl_driver_mark_texture_permanent (self->gl_driver, texture_id);
+
+  return texture_id;
+}
+
+static void gsk_gl_renderer_add_render_item (GskGLRenderer     *self,
+                                             const RenderState *state,
+                                             GskRenderNode     *node);
+
+/* Renders @node into an offscreen texture covering its bounds in the
+ * coordinate space of the current render target, and returns the
+ * texture, or 0 if the node is not visible
+ */
+static int
+gsk_gl_renderer_add_offscreen (GskGLRenderer     *self,
+                               const RenderState *state,
+                               GskRenderNode     *node,
+                               graphene_rect_t   *bounds)
+{
+  const RenderTarget *parent;
+  RenderTarget target;
+  RenderState offscreen_state;
+  graphene_matrix_t modelview, projection;
+  graphene_rect_t rect;
+  int scale_factor;
+  float x0, y0, x1, y1;
+
+  scale_factor = gsk_renderer_get_scale_factor (GSK_RENDERER (self));
+  if (scale_factor < 1)
+    scale_factor = 1;
+
+  parent = &g_array_index (self->render_targets, RenderTarget, state->render_target);
+
+  graphene_matrix_transform_bounds (&state->modelview, &node->bounds, &rect);
+  if (!graphene_rect_intersection (&rect, &parent->bounds, &rect))
+    return 0;
+  if (state->clip_type != CLIP_NONE &&
+      !graphene_rect_intersection (&rect, &state->clip.bounds, &rect))
+    return 0;
+
+  /* Align the texture to the pixel grid */
+  x0 = floorf (rect.origin.x * scale_factor);
+  y0 = floorf (rect.origin.y * scale_factor);
+  x1 = ceilf ((rect.origin.x + rect.size.width) * scale_factor);
+  y1 = ceilf ((rect.origin.y + rect.size.height) * scale_factor);
+
+  graphene_rect_init (bounds,
+                      x0 / scale_factor, y0 / scale_factor,
+                      (x1 - x0) / scale_factor, (y1 - y0) / scale_factor);
+
+  memset (&target, 0, sizeof (RenderTarget));
+  target.width = x1 - x0;
+  target.height = y1 - y0;
+  target.bounds = *bounds;
+
+  target.texture_id = gsk_gl_driver_create_texture (self->gl_driver, target.width, target.height);
+  gsk_gl_driver_bind_source_texture (self->gl_driver, target.texture_id);
+  gsk_gl_driver_init_texture_empty (self->gl_driver, target.texture_id);
+  gsk_gl_driver_create_render_target (self->gl_driver, target.texture_id, FALSE, FALSE);
+
+  /* Same orientation as the frame, so that the texture can be drawn
+   * like any other texture
+   */
+  graphene_matrix_init_translate (&modelview,
+                                  &GRAPHENE_POINT3D_INIT (- bounds->origin.x, - bounds->origin.y, 0));
+  graphene_matrix_scale (&modelview, scale_factor, scale_factor, 1.0);
+  graphene_matrix_init_ortho (&projection,
+                              0, target.width,
+                              target.height, 0,
+                              ORTHO_NEAR_PLANE,
+                              ORTHO_FAR_PLANE);
+  graphene_matrix_multiply (&modelview, &projection, &target.mvp);
+
+  g_array_append_val (self->render_targets, target);
+
+  GSK_NOTE (OPENGL, g_print ("Adding offscreen texture %d (%dx%d) for node <%s>[%p]\n",
+                             target.texture_id,
+                             target.width,
+                             target.height,
+                             node->name != NULL ? node->name : "unnamed",
+                             node));
+
+  offscreen_state.modelview = state->modelview;
+  offscreen_state.clip_type = CLIP_NONE;
+  offscreen_state.clip_index = -1;
+  offscreen_state.render_target = self->render_targets->len - 1;
+  offscreen_state.opacity = 1.0f;
+
+  gsk_gl_renderer_add_render_item (self, &offscreen_state, node);
+
+  return target.texture_id;
+}
+
+/* Keeps a texture per glyph cache page, and only uploads the area
+ * of the glyphs added to the page since the last upload
+ */
+static int
+gsk_gl_renderer_get_glyph_texture (GskGLRenderer *self,
+                                   guint          page)
+{
+  GlyphTexture *t;
+  cairo_rectangle_int_t area;
+  cairo_surface_t *surface;
+
+  if (page >= self->glyph_textures->len)
+    g_array_set_size (self->glyph_textures, page + 1);
+
+  t = &g_array_index (self->glyph_textures, GlyphTexture, page);
+
+  surface = gsk_glyph_cache_get_page_update (self->glyph_cache, page, &t->serial, &area);
+  if (surface == NULL)
+    return t->texture_id;
+
+  if (t->texture_id == 0)
+    {
+      t->texture_id = gsk_gl_driver_create_texture (self->gl_driver,
+                                                    cairo_image_surface_get_width (surface),
+                                                    cairo_image_surface_get_height (surface));
+      gsk_gl_driver_mark_texture_permanent (self->gl_driver, t->texture_id);
+      gsk_gl_driver_bind_source_texture (self->gl_driver, t->texture_id);
+      gsk_gl_driver_init_texture_with_surface (self->gl_driver,
+                                               t->texture_id,
+                                               surface,
+                                               GL_LINEAR, GL_LINEAR);
+    }
+  else
+    {
+      gsk_gl_driver_bind_source_texture (self->gl_driver, t->texture_id);
+      gsk_gl_driver_update_texture_region (self->gl_driver, t->texture_id, surface, &area);
+    }
+
+  return t->texture_id;
+}
+
+/* Adds a textured quad per glyph, tinted with the text color. All the
+ * glyphs share a few glyph cache pages, so they end up in the same batch.
+ * Returns %FALSE if the glyphs don't fit into the glyph cache
+ */
+static gboolean
+gsk_gl_renderer_add_text (GskGLRenderer     *self,
+                          const RenderState *state,
+                          GskRenderNode     *node,
+                          int                scale_factor)
+{
+  PangoFont *font = gsk_text_node_peek_font (node);
+  PangoGlyphString *glyphs = gsk_text_node_peek_glyphs (node);
+  float x = gsk_text_node_get_x (node);
+  float y = gsk_text_node_get_y (node);
+  guint current_page = G_MAXUINT;
+  int texture_id = 0;
+  int x_position;
+  float color[4];
+  int i;
+
+  /* Rendering glyphs into the cache makes the page textures change,
+   * so all glyphs need to be looked up before using any texture
+   */
+  for (i = 0; i < glyphs->num_glyphs; i++)
+    {
+      if (gsk_glyph_cache_lookup (self->glyph_cache, font, glyphs->glyphs[i].glyph, scale_factor) == NULL)
+        return FALSE;
+    }
+
+  rgba_to_float_premultiplied (gsk_text_node_peek_color (node), color);
+
+  x_position = 0;
+  for (i = 0; i < glyphs->num_glyphs; i++)
+    {
+      const PangoGlyphInfo *gi = &glyphs->glyphs[i];
+      const GskCachedGlyph *glyph;
+      graphene_rect_t bounds;
+      RenderItem item;
+      float glyph_x, glyph_y;
+
+      glyph = gsk_glyph_cache_lookup (self->glyph_cache, font, gi->glyph, scale_factor);
+      glyph_x = x + (float) (x_position + gi->geometry.x_offset) / PANGO_SCALE;
+      glyph_y = y + (float) gi->geometry.y_offset / PANGO_SCALE;
+      x_position += gi->geometry.width;
+
+      if (glyph->page == G_MAXUINT)
+        continue;
+
+      if (glyph->page != current_page)
+        {
+          current_page = glyph->page;
+          texture_id = gsk_gl_renderer_get_glyph_texture (self, current_page);
+        }
+
+      graphene_rect_init (&bounds,
+                          glyph_x + glyph->draw.origin.x,
+                          glyph_y + glyph->draw.origin.y,
+                          glyph->draw.size.width,
+                          glyph->draw.size.height);
+
+      memset (&item, 0, sizeof (RenderItem));
+      item.node = node;
+      item.name = node->name != NULL ? node->name : "unnamed";
+      item.program = &self->blit_program;
+      item.mode = MODE_TEXTURE;
+      item.texture_id = texture_id;
+
+      if (gsk_gl_renderer_add_quad (self, &item, state, &bounds, &glyph->uv, color))
+        g_array_append_val (self->render_items, item);
+    }
+
+  return TRUE;
+}
+
+static void
+gsk_gl_renderer_add_render_item (GskGLRenderer     *self,
+                                 const RenderState *state,
+                                 GskRenderNode     *node)
+{
+  static const float white[4] = { 1.f, 1.f, 1.f, 1.f };
+  static const graphene_rect_t unit_uv = { { 0, 0 }, { 1, 1 } };
+  const graphene_rect_t *uv;
+  graphene_rect_t texture_uv;
+  RenderItem item;
+  float color[4];
+  int scale_factor;
+
+  if (render_state_clips_node (self, state, node))
+    return;
+
+  memset (&item, 0, sizeof (RenderItem));
+
+  scale_factor = gsk_renderer_get_scale_factor (GSK_RENDERER (self));
+  if (scale_factor < 1)
+    scale_factor = 1;
+
+  item.node = node;
+  item.name = node->name != NULL ? node->name : "unnamed";
+
+  /* Textures are drawn with the blit program, unless overridden below;
+   * the node specific programs get the position inside the node as UV
+   */
+  item.program = &self->blit_program;
+  item.mode = MODE_TEXTURE;
+  memcpy (color, white, sizeof (color));
+  uv = &unit_uv;
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_TEXTURE_NODE:
       {
-        const GdkRGBA *c = gsk_color_node_peek_color(node);
-        program_id = self->color_program.id;
-        item.render_data.program = &self->color_program;
-        item.mode = MODE_COLOR;
-        item.color_data.color= *c;
+        GskTexture *texture = gsk_texture_node_get_texture (node);
+        int gl_min_filter = GL_NEAREST, gl_mag_filter = GL_NEAREST;
+        GdkWindow *window = NULL;
+
+        get_gl_scaling_filters (node, &gl_min_filter, &gl_mag_filter);
+
+        /* Only frames drawn to the window can show the texture later */
+        if (gsk_renderer_get_drawing_context (GSK_RENDERER (self)))
+          window = gsk_renderer_get_window (GSK_RENDERER (self));
+
+        /* Small textures may be packed into an atlas */
+        item.texture_id = gsk_gl_driver_get_texture_for_texture (self->gl_driver,
+                                                                 texture,
+                                                                 window,
+                                                                 gl_min_filter,
+                                                                 gl_mag_filter,
+                                                                 &texture_uv);
+        /* Draw nothing until the pixels are ready */
+        if (item.texture_id == 0)
+          return;
+        uv = &texture_uv;
       }
       break;
 
-    case GSK_COLOR_MATRIX_NODE:
+    case GSK_CAIRO_NODE:
+      {
+        cairo_surface_t *surface = gsk_cairo_node_get_surface (node);
+        int gl_min_filter = GL_NEAREST, gl_mag_filter = GL_NEAREST;
+
+        if (surface == NULL)
+          return;
+
+        get_gl_scaling_filters (node, &gl_min_filter, &gl_mag_filter);
+
+        /* Upload the Cairo surface to a GL texture */
+        item.texture_id = gsk_gl_driver_get_texture_for_surface (self->gl_driver,
+                                                                 surface,
+                                                                 gsk_cairo_node_get_surface_serial (node),
+                                                                 node->bounds.size.width * scale_factor,
+                                                                 node->bounds.size.height * scale_factor,
+                                                                 gl_min_filter,
+                                                                 gl_mag_filter);
+      }
+      break;
+
+    case GSK_TEXT_NODE:
+      if (gsk_gl_renderer_add_text (self, state, node, scale_factor))
+        return;
+
+      FALLBACK ("Glyphs don't fit into the glyph cache\n");
+      item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+      break;
+
+    case GSK_COLOR_NODE:
+      item.program = &self->color_program;
+      item.mode = MODE_COLOR;
+      rgba_to_float_premultiplied (gsk_color_node_peek_color (node), color);
+      break;
+
+    case GSK_BORDER_NODE:
       {
-        GskRenderNode *child = gsk_color_matrix_node_get_child (node);
+        const GdkRGBA *colors = gsk_border_node_peek_colors (node);
+        guint i;
 
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        item.program = &self->border_program;
+        item.mode = MODE_BORDER;
+        uv = &node->bounds;
+
+        gsk_rounded_rect_to_float (gsk_border_node_peek_outline (node), item.border.outline);
+        memcpy (item.border.widths, gsk_border_node_peek_widths (node), sizeof (float) * 4);
+        for (i = 0; i < 4; i++)
+          rgba_to_float_premultiplied (&colors[i], &item.border.colors[i * 4]);
       }
-      return;
+      break;
 
-    case GSK_SHADOW_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
       {
-        GskRenderNode *child = gsk_shadow_node_get_child (node);
+        const graphene_point_t *start = gsk_linear_gradient_node_peek_start (node);
+        const graphene_point_t *end = gsk_linear_gradient_node_peek_end (node);
+        const GskColorStop *stops = gsk_linear_gradient_node_peek_color_stops (node);
+        gsize i, n_stops = gsk_linear_gradient_node_get_n_color_stops (node);
+
+        if (n_stops > MAX_COLOR_STOPS)
+          {
+            FALLBACK ("Linear gradient with %" G_GSIZE_FORMAT " color stops, only %d are supported\n",
+                      n_stops, MAX_COLOR_STOPS);
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
+        if (graphene_point_equal (start, end))
+          {
+            FALLBACK ("Linear gradient with a zero length\n");
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
 
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        item.program = &self->linear_gradient_program;
+        item.mode = MODE_LINEAR_GRADIENT;
+        uv = &node->bounds;
+
+        item.linear_gradient.start[0] = start->x;
+        item.linear_gradient.start[1] = start->y;
+        item.linear_gradient.end[0] = end->x;
+        item.linear_gradient.end[1] = end->y;
+        item.linear_gradient.repeating = gsk_render_node_get_node_type (node) == GSK_REPEATING_LINEAR_GRADIENT_NODE;
+        item.linear_gradient.n_color_stops = n_stops;
+        for (i = 0; i < n_stops; i++)
+          {
+            item.linear_gradient.color_stop_offsets[i] = stops[i].offset;
+            rgba_to_float_premultiplied (&stops[i].color, &item.linear_gradient.color_stops[i * 4]);
+          }
       }
-      return;
+      break;
 
-    case GSK_REPEAT_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
       {
-        GskRenderNode *child = gsk_repeat_node_get_child (node);
+        gboolean inset = gsk_render_node_get_node_type (node) == GSK_INSET_SHADOW_NODE;
+
+        /* Same as the Vulkan renderer, blurred shadows are drawn by Cairo */
+        if ((inset ? gsk_inset_shadow_node_get_blur_radius (node)
+                   : gsk_outset_shadow_node_get_blur_radius (node)) > 0)
+          {
+            FALLBACK ("Blur support not implemented for %s shadows\n", inset ? "inset" : "outset");
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
 
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        uv = &node->bounds;
+
+        if (inset)
+          {
+            item.program = &self->inset_shadow_program;
+            item.mode = MODE_INSET_SHADOW;
+            gsk_rounded_rect_to_float (gsk_inset_shadow_node_peek_outline (node), item.shadow.outline);
+            rgba_to_float_premultiplied (gsk_inset_shadow_node_peek_color (node), item.shadow.color);
+            item.shadow.offset[0] = gsk_inset_shadow_node_get_dx (node);
+            item.shadow.offset[1] = gsk_inset_shadow_node_get_dy (node);
+            item.shadow.spread = gsk_inset_shadow_node_get_spread (node);
+          }
+        else
+          {
+            item.program = &self->outset_shadow_program;
+            item.mode = MODE_OUTSET_SHADOW;
+            gsk_rounded_rect_to_float (gsk_outset_shadow_node_peek_outline (node), item.shadow.outline);
+            rgba_to_float_premultiplied (gsk_outset_shadow_node_peek_color (node), item.shadow.color);
+            item.shadow.offset[0] = gsk_outset_shadow_node_get_dx (node);
+            item.shadow.offset[1] = gsk_outset_shadow_node_get_dy (node);
+            item.shadow.spread = gsk_outset_shadow_node_get_spread (node);
+          }
+      }
+      break;
+
+    case GSK_OPACITY_NODE:
+      {
+        GskRenderNode *child = gsk_opacity_node_get_child (node);
+        float opacity = gsk_opacity_node_get_opacity (node);
+        graphene_rect_t bounds;
+        RenderState blit_state;
+
+        /* A single quad cannot overlap itself, so it does not need
+         * to be composited on its own
+         */
+        if (node_is_single_quad (child))
+          {
+            RenderState child_state = *state;
+
+            child_state.opacity *= opacity;
+            gsk_gl_renderer_add_render_item (self, &child_state, child);
+            return;
+          }
+
+        if (!graphene_matrix_is_2d (&state->modelview))
+          {
+            FALLBACK ("Opacity nodes with a 3D transformation are not supported\n");
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
+
+        item.texture_id = gsk_gl_renderer_add_offscreen (self, state, child, &bounds);
+        if (item.texture_id == 0)
+          return;
+
+        /* The offscreen texture is already in the coordinate space
+         * of the render target
+         */
+        blit_state = *state;
+        graphene_matrix_init_identity (&blit_state.modelview);
+        blit_state.opacity *= opacity;
+
+        if (gsk_gl_renderer_add_quad (self, &item, &blit_state, &bounds, &unit_uv, white))
+          g_array_append_val (self->render_items, item);
       }
       return;
 
-    case GSK_BLEND_NODE:
+    case GSK_CLIP_NODE:
       {
-        GskRenderNode *child = gsk_blend_node_get_bottom_child (node);
+        RenderState child_state = *state;
+        GskRoundedRect clip;
 
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        gsk_rounded_rect_init_from_rect (&clip, gsk_clip_node_peek_clip (node), 0);
 
-        child = gsk_blend_node_get_top_child (node);
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        if (!transform_rounded_rect (&state->modelview, &clip, &clip))
+          {
+            FALLBACK ("Clip nodes need an axis aligned transformation\n");
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
+        if (!render_state_intersect_rect (self, &child_state, &clip.bounds))
+          {
+            FALLBACK ("Failed to intersect clip type %u with a rectangle\n", state->clip_type);
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
+
+        gsk_gl_renderer_add_render_item (self, &child_state, gsk_clip_node_get_child (node));
       }
       return;
 
-    case GSK_CROSS_FADE_NODE:
+    case GSK_ROUNDED_CLIP_NODE:
       {
-        GskRenderNode *child = gsk_cross_fade_node_get_start_child (node);
+        RenderState child_state = *state;
+        GskRoundedRect clip;
 
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        if (!transform_rounded_rect (&state->modelview, gsk_rounded_clip_node_peek_clip (node), &clip))
+          {
+            FALLBACK ("Rounded clip nodes need an axis aligned transformation\n");
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
+        if (!render_state_intersect_rounded_rect (self, &child_state, &clip))
+          {
+            FALLBACK ("Failed to intersect clip type %u with a rounded rectangle\n", state->clip_type);
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
 
-        child = gsk_cross_fade_node_get_end_child (node);
-        gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
+        gsk_gl_renderer_add_render_item (self, &child_state, gsk_rounded_clip_node_get_child (node));
       }
       return;
 
+    case GSK_COLOR_MATRIX_NODE:
+      gsk_gl_renderer_add_render_item (self, state, gsk_color_matrix_node_get_child (node));
+      return;
+
+    case GSK_SHADOW_NODE:
+      gsk_gl_renderer_add_render_item (self, state, gsk_shadow_node_get_child (node));
+      return;
+
+    case GSK_REPEAT_NODE:
+      gsk_gl_renderer_add_render_item (self, state, gsk_repeat_node_get_child (node));
+      return;
+
+    case GSK_BLEND_NODE:
+      gsk_gl_renderer_add_render_item (self, state, gsk_blend_node_get_bottom_child (node));
+      gsk_gl_renderer_add_render_item (self, state, gsk_blend_node_get_top_child (node));
+      return;
+
+    case GSK_CROSS_FADE_NODE:
+      gsk_gl_renderer_add_render_item (self, state, gsk_cross_fade_node_get_start_child (node));
+      gsk_gl_renderer_add_render_item (self, state, gsk_cross_fade_node_get_end_child (node));
+      return;
+
     case GSK_CONTAINER_NODE:
       {
+        graphene_rect_t visible;
         guint i, p;
 
-        for (i = 0, p = gsk_container_node_get_n_children (node); i < p; i++)
-          {
-            GskRenderNode *child = gsk_container_node_get_child (node, i);
-            gsk_gl_renderer_add_render_item (self, projection, modelview, render_items, child, ritem);
-          }
+        /* Children hidden below an opaque sibling are skipped */
+        if (render_state_get_visible_rect (self, state, &visible))
+          i = gsk_container_node_get_first_visible_child (node, &visible);
+        else
+          i = 0;
+
+        for (p = gsk_container_node_get_n_children (node); i < p; i++)
+          gsk_gl_renderer_add_render_item (self, state, gsk_container_node_get_child (node, i));
       }
       return;
 
     case GSK_TRANSFORM_NODE:
       {
-        graphene_matrix_t transform, transformed_mv;
+        RenderState child_state = *state;
+        graphene_matrix_t transform;
 
         gsk_transform_node_get_transform (node, &transform);
-        graphene_matrix_multiply (&transform, modelview, &transformed_mv);
-        gsk_gl_renderer_add_render_item (self,
-                                         projection, &transformed_mv,
-                                         render_items,
-                                         gsk_transform_node_get_child (node),
-                                         ritem);
+        graphene_matrix_multiply (&transform, &state->modelview, &child_state.modelview);
+
+        /* Clips live in the coordinate space of the render target,
+         * which 3D transformations leave behind
+         */
+        if (!graphene_matrix_is_2d (&child_state.modelview) &&
+            state->clip_type != CLIP_NONE)
+          {
+            FALLBACK ("3D transformations can't deal with clip type %u\n", state->clip_type);
+            item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
+            break;
+          }
+
+        gsk_gl_renderer_add_render_item (self, &child_state, gsk_transform_node_get_child (node));
       }
       return;
 
@@ -918,75 +2001,73 @@ gsk_gl_renderer_add_render_item (GskGLRenderer           *self,
       return;
 
     default:
-      {
-        cairo_surface_t *surface;
-        cairo_t *cr;
-
-        surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                              item.size.width,
-                                              item.size.height);
-        cairo_surface_set_device_scale (surface, scale_factor, scale_factor);
-        cr = cairo_create (surface);
-        cairo_translate (cr, -node->bounds.origin.x, -node->bounds.origin.y);
-
-        gsk_render_node_draw (node, cr);
-
-        cairo_destroy (cr);
-
-        /* Upload the Cairo surface to a GL texture */
-        item.render_data.texture_id = gsk_gl_driver_create_texture (self->gl_driver,
-                                                                    item.size.width,
-                                                                    item.size.height);
-        gsk_gl_driver_bind_source_texture (self->gl_driver, item.render_data.texture_id);
-        gsk_gl_driver_init_texture_with_surface (self->gl_driver,
-                                                 item.render_data.texture_id,
-                                                 surface,
-                                                 GL_NEAREST, GL_NEAREST);
-
-        cairo_surface_destroy (surface);
-        item.mode = MODE_TEXTURE;
-      }
+      FALLBACK ("Unsupported node '%s'\n", node->node_class->type_name);
+      item.texture_id = gsk_gl_renderer_upload_fallback (self, node, scale_factor);
       break;
     }
 
-  item.render_data.program_id = program_id;
-
-  /* Create the vertex buffers holding the geometry of the quad */
-  {
-    GskQuadVertex vertex_data[N_VERTICES] = {
-      { { item.min.x, item.min.y }, { 0, 0 }, },
-      { { item.min.x, item.max.y }, { 0, 1 }, },
-      { { item.max.x, item.min.y }, { 1, 0 }, },
-
-      { { item.max.x, item.max.y }, { 1, 1 }, },
-      { { item.min.x, item.max.y }, { 0, 1 }, },
-      { { item.max.x, item.min.y }, { 1, 0 }, },
-    };
-
-    item.render_data.vao_id =
-      gsk_gl_driver_create_vao_for_quad (self->gl_driver,
-                                         item.render_data.program->position_location,
-                                         item.render_data.program->uv_location,
-                                         N_VERTICES,
-                                         vertex_data);
-  }
+  if (!gsk_gl_renderer_add_quad (self, &item, state, &node->bounds, uv, color))
+    return;
 
   GSK_NOTE (OPENGL, g_print ("Adding node <%s>[%p] to render items\n",
-                             node->name != NULL ? node->name : "unnamed",
+                             item.name,
                              node));
-  g_array_append_val (render_items, item);
-  ritem = &g_array_index (render_items, RenderItem, render_items->len - 1);
+  g_array_append_val (self->render_items, item);
+}
 
-  if (item.children != NULL)
-    render_items = item.children;
+static void
+gsk_gl_renderer_build_batches (GskGLRenderer *self)
+{
+  RenderBatch *batch = NULL;
+  guint i;
+
+  for (i = 0; i < self->render_items->len; i++)
+    {
+      const RenderItem *item = &g_array_index (self->render_items, RenderItem, i);
+
+      /* Only consecutive items can be merged, as reordering would
+       * break the painter's algorithm for overlapping items; items
+       * with node specific uniforms are drawn on their own
+       */
+      if (batch != NULL &&
+          (item->mode == MODE_COLOR || item->mode == MODE_TEXTURE) &&
+          batch->program == item->program &&
+          batch->texture_id == item->texture_id &&
+          batch->render_target == item->render_target &&
+          batch->clip_index == item->clip_index &&
+          batch->uses_frame_mvp && item->uses_frame_mvp &&
+          batch->first_vertex + batch->n_vertices == item->vertex_offset)
+        {
+          batch->n_vertices += item->n_vertices;
+          batch->n_items += 1;
+          continue;
+        }
+
+      g_array_set_size (self->batches, self->batches->len + 1);
+      batch = &g_array_index (self->batches, RenderBatch, self->batches->len - 1);
+
+      batch->program = item->program;
+      batch->texture_id = item->texture_id;
+      batch->render_target = item->render_target;
+      batch->clip_index = item->clip_index;
+      batch->first_item = i;
+      batch->uses_frame_mvp = item->uses_frame_mvp;
+      if (!item->uses_frame_mvp)
+        batch->mvp = item->mvp;
+      batch->first_vertex = item->vertex_offset;
+      batch->n_vertices = item->n_vertices;
+      batch->n_items = 1;
+    }
 }
 
 static gboolean
-gsk_gl_renderer_validate_tree (GskGLRenderer           *self,
-                               GskRenderNode           *root,
-                               const graphene_matrix_t *projection)
+gsk_gl_renderer_validate_tree (GskGLRenderer         *self,
+                               GskRenderNode         *root,
+                               const graphene_rect_t *viewport,
+                               int                    scale_factor)
 {
-  graphene_matrix_t identity;
+  RenderTarget frame;
+  RenderState state;
 
   if (self->gl_context == NULL)
     {
@@ -994,23 +2075,75 @@ gsk_gl_renderer_validate_tree (GskGLRenderer           *self,
       return FALSE;
     }
 
-  graphene_matrix_init_identity (&identity);
+  memset (&frame, 0, sizeof (RenderTarget));
+  frame.texture_id = self->texture_id;
+  graphene_rect_init (&frame.bounds,
+                      viewport->origin.x / scale_factor,
+                      viewport->origin.y / scale_factor,
+                      viewport->size.width,
+                      viewport->size.height);
+  frame.mvp = self->mvp;
+  frame.cleared = TRUE;
+
+  /* Only the damaged area is going to be drawn, so nodes outside
+   * of it can be culled
+   */
+  if (self->render_mode == RENDER_SCISSOR)
+    {
+      GdkDrawingContext *context = gsk_renderer_get_drawing_context (GSK_RENDERER (self));
+      GdkRectangle extents;
+
+      cairo_region_get_extents (gdk_drawing_context_get_clip (context), &extents);
+      if (!graphene_rect_intersection (&frame.bounds,
+                                       &GRAPHENE_RECT_INIT (extents.x, extents.y,
+                                                            extents.width, extents.height),
+                                       &frame.bounds))
+        graphene_rect_init (&frame.bounds, 0, 0, 0, 0);
+    }
+  g_array_append_val (self->render_targets, frame);
+
+  graphene_matrix_init_identity (&state.modelview);
+  state.clip_type = CLIP_NONE;
+  state.clip_index = -1;
+  state.render_target = 0;
+  state.opacity = 1.0f;
 
   gdk_gl_context_make_current (self->gl_context);
 
   gsk_gl_driver_begin_frame (self->gl_driver);
+  gsk_glyph_cache_begin_frame (self->glyph_cache);
+  gsk_offscreen_cache_begin_frame (self->offscreen_cache);
 
   GSK_NOTE (OPENGL, g_print ("RenderNode -> RenderItem\n"));
-  gsk_gl_renderer_add_render_item (self, projection, &identity, self->render_items, root, NULL);
+  gsk_gl_renderer_add_render_item (self, &state, root);
+  gsk_gl_renderer_build_batches (self);
 
-  GSK_NOTE (OPENGL, g_print ("Total render items: %d\n",
-                             self->render_items->len));
+  GSK_NOTE (OPENGL, g_print ("Total render items: %d, batches: %d, vertices: %d, offscreens: %d\n",
+                             self->render_items->len,
+                             self->batches->len,
+                             self->vertices->len,
+                             self->render_targets->len - 1));
 
   gsk_gl_driver_end_frame (self->gl_driver);
 
   return TRUE;
 }
 
+static void
+gsk_gl_renderer_upload_vertices (GskGLRenderer *self)
+{
+  gsize size = self->vertices->len * sizeof (GskGLVertex);
+
+  glBindVertexArray (self->vao_id);
+  glBindBuffer (GL_ARRAY_BUFFER, self->buffer_id);
+
+  /* Orphan the storage used by the previous frame, so that we do not
+   * have to wait for the GPU to finish with it
+   */
+  glBufferData (GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  glBufferSubData (GL_ARRAY_BUFFER, 0, size, self->vertices->data);
+}
+
 static void
 gsk_gl_renderer_clear_tree (GskGLRenderer *self)
 {
@@ -1021,7 +2154,11 @@ gsk_gl_renderer_clear_tree (GskGLRenderer *self)
 
   gdk_gl_context_make_current (self->gl_context);
 
-  g_array_remove_range (self->render_items, 0, self->render_items->len);
+  g_array_set_size (self->render_items, 0);
+  g_array_set_size (self->vertices, 0);
+  g_array_set_size (self->batches, 0);
+  g_array_set_size (self->render_targets, 0);
+  g_array_set_size (self->clips, 0);
 
   removed_textures = gsk_gl_driver_collect_textures (self->gl_driver);
   removed_vaos = gsk_gl_driver_collect_vaos (self->gl_driver);
@@ -1031,48 +2168,6 @@ gsk_gl_renderer_clear_tree (GskGLRenderer *self)
                              removed_vaos));
 }
 
-static void
-gsk_gl_renderer_clear (GskGLRenderer *self)
-{
-  GSK_NOTE (OPENGL, g_print ("Clearing viewport\n"));
-  glClearColor (0, 0, 0, 0);
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-}
-
-static void
-gsk_gl_renderer_setup_render_mode (GskGLRenderer *self)
-{
-  switch (self->render_mode)
-  {
-    case RENDER_FULL:
-      glDisable (GL_SCISSOR_TEST);
-      break;
-
-    case RENDER_SCISSOR:
-      {
-        GdkDrawingContext *context = gsk_renderer_get_drawing_context (GSK_RENDERER (self));
-        GdkWindow *window = gsk_renderer_get_window (GSK_RENDERER (self));
-        GdkRectangle extents;
-        int scale_factor = gsk_renderer_get_scale_factor (GSK_RENDERER (self));
-
-        cairo_region_get_extents (gdk_drawing_context_get_clip (context), &extents);
-
-        glScissor (extents.x * scale_factor,
-                   (gdk_window_get_height (window) - extents.height - extents.y) * scale_factor,
-                   extents.width * scale_factor, extents.height * scale_factor);
-        glEnable (GL_SCISSOR_TEST);
-        break;
-      }
-
-    default:
-      g_assert_not_reached ();
-      break;
-  }
-}
-
-#define ORTHO_NEAR_PLANE        -10000
-#define ORTHO_FAR_PLANE          10000
-
 static void
 gsk_gl_renderer_do_render (GskRenderer           *renderer,
                            GskRenderNode         *root,
@@ -1085,10 +2180,15 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
 #ifdef G_ENABLE_DEBUG
   GskProfiler *profiler;
   gint64 gpu_time, cpu_time;
+  guint64 n_uploads, upload_bytes, texture_memory;
+  guint64 old_n_uploads, old_upload_bytes;
 #endif
 
 #ifdef G_ENABLE_DEBUG
   profiler = gsk_renderer_get_profiler (renderer);
+
+  /* Textures are uploaded while validating the tree */
+  gsk_gl_driver_get_stats (self->gl_driver, &old_n_uploads, &old_upload_bytes, &texture_memory);
 #endif
 
   /* Set up the modelview and projection matrices to fit our viewport */
@@ -1103,7 +2203,7 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
 
   gsk_gl_renderer_update_frustum (self, &modelview, &projection);
 
-  if (!gsk_gl_renderer_validate_tree (self, root, &projection))
+  if (!gsk_gl_renderer_validate_tree (self, root, viewport, scale_factor))
     return;
 
   gsk_gl_driver_begin_frame (self->gl_driver);
@@ -1127,12 +2227,29 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
   glEnable (GL_BLEND);
   glBlendFunc (GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
-  GSK_NOTE (OPENGL, g_print ("Rendering %u items\n", self->render_items->len));
-  for (i = 0; i < self->render_items->len; i++)
+  GSK_NOTE (OPENGL, g_print ("Rendering %u items in %u batches\n",
+                             self->render_items->len,
+                             self->batches->len));
+  if (self->vertices->len > 0)
     {
-      RenderItem *item = &g_array_index (self->render_items, RenderItem, i);
+      Program *current_program = NULL;
+      guint current_target = 0;
+      int current_clip = -1;
 
-      render_item (self, item);
+      gsk_gl_renderer_upload_vertices (self);
+
+      for (i = 0; i < self->batches->len; i++)
+        {
+          RenderBatch *batch = &g_array_index (self->batches, RenderBatch, i);
+
+          if (batch->render_target != current_target)
+            {
+              bind_render_target (self, batch->render_target, viewport, scale_factor);
+              current_target = batch->render_target;
+            }
+
+          render_batch (self, batch, &current_program, &current_clip);
+        }
     }
 
   /* Draw the output of the GL rendering to the window */
@@ -1140,6 +2257,13 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
 
 #ifdef G_ENABLE_DEBUG
   gsk_profiler_counter_inc (profiler, self->profile_counters.frames);
+  gsk_profiler_counter_add (profiler, self->profile_counters.render_items, self->render_items->len);
+  gsk_profiler_counter_add (profiler, self->profile_counters.batches, self->batches->len);
+
+  gsk_gl_driver_get_stats (self->gl_driver, &n_uploads, &upload_bytes, &texture_memory);
+  gsk_profiler_counter_add (profiler, self->profile_counters.uploads, n_uploads - old_n_uploads);
+  gsk_profiler_counter_add (profiler, self->profile_counters.upload_bytes, upload_bytes - old_upload_bytes);
+  gsk_profiler_counter_add (profiler, self->profile_counters.texture_memory, texture_memory);
 
   cpu_time = gsk_profiler_timer_end (profiler, self->profile_timers.cpu_time);
   gsk_profiler_timer_set (profiler, self->profile_timers.cpu_time, cpu_time);
@@ -1190,6 +2314,9 @@ gsk_gl_renderer_render_texture (GskRenderer           *renderer,
   texture = gsk_texture_new_for_surface (surface);
   cairo_surface_destroy (surface);
 
+  gsk_gl_renderer_clear_tree (self);
+  gsk_gl_renderer_destroy_buffers (self);
+
   return texture;
 }
 
@@ -1239,6 +2366,11 @@ gsk_gl_renderer_init (GskGLRenderer *self)
   graphene_matrix_init_identity (&self->mvp);
 
   self->render_items = g_array_new (FALSE, FALSE, sizeof (RenderItem));
+  self->vertices = g_array_new (FALSE, FALSE, sizeof (GskGLVertex));
+  self->batches = g_array_new (FALSE, FALSE, sizeof (RenderBatch));
+  self->render_targets = g_array_new (FALSE, FALSE, sizeof (RenderTarget));
+  self->clips = g_array_new (FALSE, FALSE, sizeof (GskRoundedRect));
+  self->glyph_textures = g_array_new (FALSE, TRUE, sizeof (GlyphTexture));
 
 #ifdef G_ENABLE_DEBUG
   {
@@ -1246,6 +2378,11 @@ gsk_gl_renderer_init (GskGLRenderer *self)
 
     self->profile_counters.frames = gsk_profiler_add_counter (profiler, "frames", "Frames", FALSE);
     self->profile_counters.draw_calls = gsk_profiler_add_counter (profiler, "draws", "glDrawArrays", TRUE);
+    self->profile_counters.render_items = gsk_profiler_add_counter (profiler, "items", "Render items", TRUE);
+    self->profile_counters.batches = gsk_profiler_add_counter (profiler, "batches", "Batches", TRUE);
+    self->profile_counters.uploads = gsk_profiler_add_counter (profiler, "uploads", "Texture uploads", TRUE);
+    self->profile_counters.upload_bytes = gsk_profiler_add_counter (profiler, "upload-bytes", "Uploaded bytes", TRUE);
+    self->profile_counters.texture_memory = gsk_profiler_add_counter (profiler, "texture-memory", "Texture memory", TRUE);
 
     self->profile_timers.cpu_time = gsk_profiler_add_timer (profiler, "cpu-time", "CPU time", FALSE, TRUE);
     self->profile_timers.gpu_time = gsk_profiler_add_timer (profiler, "gpu-time", "GPU time", FALSE, TRUE);
@@ -0,0 +1,530 @@
+#include "config.h"
+
+#include "gskglyphcacheprivate.h"
+
+#include "gskdebugprivate.h"
+
+#include <pango/pangocairo.h>
+#include <math.h>
+
+/* Glyphs are rasterized once per font, glyph and scale into shared
+ * pages, so that renderers can draw text as textured quads
+ */
+#define PAGE_SIZE               1024
+#define PAGE_PADDING            1
+#define MAX_GLYPH_SIZE          256
+#define MAX_PAGES               4
+
+/* A row of a page; glyphs are added from left to right */
+typedef struct {
+  int y;
+  int height;
+  int x;
+} PageShelf;
+
+/* An area of a page that a glyph was rendered to */
+typedef struct {
+  guint64 serial;
+  cairo_rectangle_int_t area;
+} PageChange;
+
+typedef struct {
+  cairo_surface_t *surface;
+
+  /* The serial of the cache when the page was created, and the areas
+   * changed since, so renderers only need to upload new glyphs
+   */
+  guint64 created;
+  GArray *changes;
+
+  GArray *shelves;
+  int next_shelf_y;
+
+  /* The last frame using a glyph of the page */
+  gint64 last_used;
+} Page;
+
+typedef struct {
+  PangoFont *font;
+  PangoGlyph glyph;
+  int scale;
+} GlyphCacheKey;
+
+struct _GskGlyphCache
+{
+  GHashTable *hash_table;
+  GPtrArray *pages;
+
+  gint64 frame_counter;
+  guint64 serial;
+};
+
+static guint
+glyph_cache_hash (gconstpointer v)
+{
+  const GlyphCacheKey *key = v;
+
+  return GPOINTER_TO_UINT (key->font) ^ key->glyph ^ (key->scale << 16);
+}
+
+static gboolean
+glyph_cache_equal (gconstpointer v1,
+                   gconstpointer v2)
+{
+  const GlyphCacheKey *key1 = v1;
+  const GlyphCacheKey *key2 = v2;
+
+  return key1->font == key2->font &&
+         key1->glyph == key2->glyph &&
+         key1->scale == key2->scale;
+}
+
+static void
+glyph_cache_key_free (gpointer v)
+{
+  GlyphCacheKey *key = v;
+
+  g_object_unref (key->font);
+  g_slice_free (GlyphCacheKey, key);
+}
+
+static void
+glyph_cache_value_free (gpointer v)
+{
+  g_slice_free (GskCachedGlyph, v);
+}
+
+static Page *
+page_new (GskGlyphCache *cache)
+{
+  Page *page;
+
+  page = g_slice_new0 (Page);
+  page->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, PAGE_SIZE, PAGE_SIZE);
+  page->created = ++cache->serial;
+  page->changes = g_array_new (FALSE, FALSE, sizeof (PageChange));
+  page->shelves = g_array_new (FALSE, FALSE, sizeof (PageShelf));
+
+  return page;
+}
+
+static void
+page_free (gpointer data)
+{
+  Page *page = data;
+
+  cairo_surface_destroy (page->surface);
+  g_array_unref (page->changes);
+  g_array_unref (page->shelves);
+
+  g_slice_free (Page, page);
+}
+
+static gboolean
+page_allocate (Page *page,
+               int   width,
+               int   height,
+               int  *x,
+               int  *y)
+{
+  PageShelf *best = NULL;
+  guint i;
+
+  for (i = 0; i < page->shelves->len; i++)
+    {
+      PageShelf *shelf = &g_array_index (page->shelves, PageShelf, i);
+
+      if (shelf->height < height || shelf->x + width > PAGE_SIZE)
+        continue;
+
+      /* Don't waste tall shelves on short glyphs */
+      if (shelf->height > height * 3 / 2)
+        continue;
+
+      if (best == NULL || shelf->height < best->height)
+        best = shelf;
+    }
+
+  if (best == NULL)
+    {
+      PageShelf shelf;
+
+      if (page->next_shelf_y + height > PAGE_SIZE)
+        return FALSE;
+
+      shelf.y = page->next_shelf_y;
+      shelf.height = height;
+      shelf.x = 0;
+      g_array_append_val (page->shelves, shelf);
+
+      page->next_shelf_y += height;
+      best = &g_array_index (page->shelves, PageShelf, page->shelves->len - 1);
+    }
+
+  *x = best->x;
+  *y = best->y;
+  best->x += width;
+
+  return TRUE;
+}
+
+static void
+glyph_cache_free (gpointer data)
+{
+  GskGlyphCache *cache = data;
+
+  g_hash_table_unref (cache->hash_table);
+  g_ptr_array_unref (cache->pages);
+
+  g_slice_free (GskGlyphCache, cache);
+}
+
+GskGlyphCache *
+gsk_glyph_cache_get_for_display (GdkDisplay *display)
+{
+  GskGlyphCache *cache;
+
+  cache = g_object_get_data (G_OBJECT (display), "gsk-glyph-cache");
+  if (cache == NULL)
+    {
+      cache = g_slice_new0 (GskGlyphCache);
+      cache->hash_table = g_hash_table_new_full (glyph_cache_hash, glyph_cache_equal,
+                                                 glyph_cache_key_free, glyph_cache_value_free);
+      cache->pages = g_ptr_array_new_with_free_func (page_free);
+
+      g_object_set_data_full (G_OBJECT (display), "gsk-glyph-cache",
+                              cache, glyph_cache_free);
+    }
+
+  return cache;
+}
+
+void
+gsk_glyph_cache_begin_frame (GskGlyphCache *cache)
+{
+  cache->frame_counter++;
+}
+
+static gboolean
+remove_glyph_on_page (gpointer key,
+                      gpointer value,
+                      gpointer user_data)
+{
+  GskCachedGlyph *glyph = value;
+
+  return glyph->page == GPOINTER_TO_UINT (user_data);
+}
+
+/* Finds a page with room for a @width x @height area, evicting the
+ * least recently used page if all pages are full. Pages used in the
+ * current frame are never evicted, as the renderers may still refer
+ * to their texture
+ */
+static guint
+gsk_glyph_cache_find_page (GskGlyphCache *cache,
+                           int            width,
+                           int            height,
+                           int           *x,
+                           int           *y)
+{
+  Page *lru = NULL;
+  guint i, lru_index = 0;
+
+  for (i = 0; i < cache->pages->len; i++)
+    {
+      Page *page = g_ptr_array_index (cache->pages, i);
+
+      if (page_allocate (page, width, height, x, y))
+        return i;
+
+      if (lru == NULL || page->last_used < lru->last_used)
+        {
+          lru = page;
+          lru_index = i;
+        }
+    }
+
+  if (cache->pages->len < MAX_PAGES)
+    {
+      Page *page = page_new (cache);
+
+      g_ptr_array_add (cache->pages, page);
+      if (page_allocate (page, width, height, x, y))
+        return cache->pages->len - 1;
+
+      return G_MAXUINT;
+    }
+
+  if (lru == NULL || lru->last_used == cache->frame_counter)
+    return G_MAXUINT;
+
+  GSK_NOTE (RENDERER, g_print ("Evicting glyph cache page %u\n", lru_index));
+
+  g_hash_table_foreach_remove (cache->hash_table, remove_glyph_on_page, GUINT_TO_POINTER (lru_index));
+
+  g_ptr_array_index (cache->pages, lru_index) = page_new (cache);
+  page_free (lru);
+
+  if (page_allocate (g_ptr_array_index (cache->pages, lru_index), width, height, x, y))
+    return lru_index;
+
+  return G_MAXUINT;
+}
+
+static void
+render_glyph (cairo_surface_t *surface,
+              double           color,
+              PangoFont       *font,
+              PangoGlyph       glyph,
+              int              scale,
+              int              x,
+              int              y)
+{
+  PangoGlyphString glyph_string;
+  PangoGlyphInfo glyph_info;
+  cairo_t *cr;
+
+  glyph_info.glyph = glyph;
+  glyph_info.geometry.width = 0;
+  glyph_info.geometry.x_offset = 0;
+  glyph_info.geometry.y_offset = 0;
+  glyph_info.attr.is_cluster_start = TRUE;
+
+  glyph_string.num_glyphs = 1;
+  glyph_string.glyphs = &glyph_info;
+  glyph_string.log_clusters = NULL;
+
+  cr = cairo_create (surface);
+  cairo_translate (cr, x, y);
+  cairo_scale (cr, scale, scale);
+
+  cairo_set_source_rgba (cr, color, color, color, 1);
+  cairo_move_to (cr, 0, 0);
+  pango_cairo_show_glyph_string (cr, font, &glyph_string);
+
+  cairo_destroy (cr);
+
+  cairo_surface_flush (surface);
+}
+
+/* Color glyphs, like emoji, ignore the source color, so they can't be
+ * tinted by the renderers. Drawn in black, any other glyph only has
+ * alpha, even with subpixel antialiasing.
+ */
+static gboolean
+glyph_has_color (PangoFont  *font,
+                 PangoGlyph  glyph,
+                 int         scale,
+                 int         x0,
+                 int         y0,
+                 int         width,
+                 int         height)
+{
+  cairo_surface_t *surface;
+  const guchar *data;
+  gboolean result = FALSE;
+  int x, y, stride;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  render_glyph (surface, 0, font, glyph, scale, - x0, - y0);
+
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  for (y = 0; y < height && !result; y++)
+    {
+      const guint32 *row = (const guint32 *) (data + y * stride);
+
+      for (x = 0; x < width; x++)
+        {
+          if (row[x] & 0xffffff)
+            {
+              result = TRUE;
+              break;
+            }
+        }
+    }
+
+  cairo_surface_destroy (surface);
+
+  return result;
+}
+
+/*
+ * gsk_glyph_cache_lookup:
+ * @cache: a #GskGlyphCache
+ * @font: the font of the glyph
+ * @glyph: the glyph to look up
+ * @scale: the scale factor the glyph will be drawn with
+ *
+ * Looks up @glyph in the cache, rendering it into one of the pages
+ * if necessary.
+ *
+ * Returns: (nullable): the cached glyph, valid until the next frame,
+ *     or %NULL if the glyph does not fit into the cache or is a color
+ *     glyph that the renderers need to draw with Cairo
+ */
+const GskCachedGlyph *
+gsk_glyph_cache_lookup (GskGlyphCache *cache,
+                        PangoFont     *font,
+                        PangoGlyph     glyph,
+                        int            scale)
+{
+  GlyphCacheKey lookup_key = { font, glyph, scale };
+  GlyphCacheKey *key;
+  GskCachedGlyph *value;
+  PangoRectangle ink_rect;
+  int x0, y0, x1, y1;
+  int width, height;
+  int x, y;
+
+  value = g_hash_table_lookup (cache->hash_table, &lookup_key);
+  if (value != NULL)
+    {
+      if (value->color)
+        return NULL;
+
+      if (value->page != G_MAXUINT)
+        ((Page *) g_ptr_array_index (cache->pages, value->page))->last_used = cache->frame_counter;
+
+      return value;
+    }
+
+  pango_font_get_glyph_extents (font, glyph, &ink_rect, NULL);
+
+  /* The ink rectangle in device pixels */
+  x0 = floor ((double) ink_rect.x * scale / PANGO_SCALE);
+  y0 = floor ((double) ink_rect.y * scale / PANGO_SCALE);
+  x1 = ceil ((double) (ink_rect.x + ink_rect.width) * scale / PANGO_SCALE);
+  y1 = ceil ((double) (ink_rect.y + ink_rect.height) * scale / PANGO_SCALE);
+  width = x1 - x0;
+  height = y1 - y0;
+
+  if (width > MAX_GLYPH_SIZE || height > MAX_GLYPH_SIZE)
+    return NULL;
+
+  value = g_slice_new0 (GskCachedGlyph);
+
+  if (width <= 0 || height <= 0)
+    {
+      /* Spaces and other blank glyphs don't need room in a page */
+      value->page = G_MAXUINT;
+    }
+  else if (glyph_has_color (font, glyph, scale, x0, y0, width, height))
+    {
+      /* Remembered, so the check is only done once per glyph */
+      value->page = G_MAXUINT;
+      value->color = TRUE;
+    }
+  else
+    {
+      PageChange change;
+      Page *page;
+
+      value->page = gsk_glyph_cache_find_page (cache,
+                                               width + 2 * PAGE_PADDING,
+                                               height + 2 * PAGE_PADDING,
+                                               &x, &y);
+      if (value->page == G_MAXUINT)
+        {
+          GSK_NOTE (RENDERER, g_print ("No room for a %dx%d glyph in the glyph cache\n", width, height));
+          g_slice_free (GskCachedGlyph, value);
+          return NULL;
+        }
+
+      page = g_ptr_array_index (cache->pages, value->page);
+      page->last_used = cache->frame_counter;
+
+      /* Glyphs are stored as coverage and tinted by the renderers */
+      render_glyph (page->surface, 1, font, glyph, scale,
+                    x + PAGE_PADDING - x0,
+                    y + PAGE_PADDING - y0);
+
+      change.serial = ++cache->serial;
+      change.area = (cairo_rectangle_int_t) {
+                        x, y,
+                        width + 2 * PAGE_PADDING, height + 2 * PAGE_PADDING
+                    };
+      g_array_append_val (page->changes, change);
+
+      graphene_rect_init (&value->uv,
+                          (float) (x + PAGE_PADDING) / PAGE_SIZE,
+                          (float) (y + PAGE_PADDING) / PAGE_SIZE,
+                          (float) width / PAGE_SIZE,
+                          (float) height / PAGE_SIZE);
+      graphene_rect_init (&value->draw,
+                          (float) x0 / scale,
+                          (float) y0 / scale,
+                          (float) width / scale,
+                          (float) height / scale);
+    }
+
+  key = g_slice_new (GlyphCacheKey);
+  key->font = g_object_ref (font);
+  key->glyph = glyph;
+  key->scale = scale;
+
+  g_hash_table_insert (cache->hash_table, key, value);
+
+  return value;
+}
+
+/*
+ * gsk_glyph_cache_get_page_update:
+ * @cache: a #GskGlyphCache
+ * @page: the page of a #GskCachedGlyph
+ * @serial: (inout): the serial of the contents of @page the caller
+ *     uploaded last, or 0 if it never uploaded @page
+ * @area: (out): the area of @page that changed since @serial
+ *
+ * Checks whether glyphs were added to @page since the caller last
+ * uploaded it, and updates @serial to the current contents. If the
+ * page was replaced since, @area is the whole page.
+ *
+ * Returns: (transfer none) (nullable): the image surface of @page,
+ *     or %NULL if nothing changed since @serial
+ */
+cairo_surface_t *
+gsk_glyph_cache_get_page_update (GskGlyphCache         *cache,
+                                 guint                  page,
+                                 guint64               *serial,
+                                 cairo_rectangle_int_t *area)
+{
+  Page *p;
+  guint i;
+
+  g_return_val_if_fail (page < cache->pages->len, NULL);
+
+  p = g_ptr_array_index (cache->pages, page);
+
+  if (*serial < p->created)
+    {
+      *area = (cairo_rectangle_int_t) { 0, 0, PAGE_SIZE, PAGE_SIZE };
+    }
+  else
+    {
+      /* Changes are in the order of their serials */
+      for (i = p->changes->len; i > 0; i--)
+        {
+          const PageChange *change = &g_array_index (p->changes, PageChange, i - 1);
+
+          if (change->serial <= *serial)
+            break;
+
+          if (i == p->changes->len)
+            *area = change->area;
+          else
+            gdk_rectangle_union (area, &change->area, area);
+        }
+
+      if (i == p->changes->len)
+        return NULL;
+    }
+
+  if (p->changes->len > 0)
+    *serial = g_array_index (p->changes, PageChange, p->changes->len - 1).serial;
+  else
+    *serial = p->created;
+
+  return p->surface;
+}
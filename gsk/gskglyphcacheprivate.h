@@ -0,0 +1,45 @@
+#ifndef __GSK_GLYPH_CACHE_PRIVATE_H__
+#define __GSK_GLYPH_CACHE_PRIVATE_H__
+
+#include <gdk/gdk.h>
+#include <graphene.h>
+#include <pango/pango.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GskGlyphCache GskGlyphCache;
+typedef struct _GskCachedGlyph GskCachedGlyph;
+
+struct _GskCachedGlyph
+{
+  /* The page of the cache containing the glyph */
+  guint page;
+
+  /* The area of the page containing the glyph, normalized to [0, 1] */
+  graphene_rect_t uv;
+
+  /* The area to draw the glyph to, relative to its origin
+   * on the baseline, in user units; empty for blank glyphs
+   */
+  graphene_rect_t draw;
+
+  /* Color glyphs are not stored in a page */
+  guint color : 1;
+};
+
+GskGlyphCache *         gsk_glyph_cache_get_for_display         (GdkDisplay      *display);
+
+void                    gsk_glyph_cache_begin_frame             (GskGlyphCache   *cache);
+
+const GskCachedGlyph *  gsk_glyph_cache_lookup                  (GskGlyphCache   *cache,
+                                                                 PangoFont       *font,
+                                                                 PangoGlyph       glyph,
+                                                                 int              scale);
+cairo_surface_t *       gsk_glyph_cache_get_page_update         (GskGlyphCache          *cache,
+                                                                 guint                   page,
+                                                                 guint64                *serial,
+                                                                 cairo_rectangle_int_t  *area);
+
+G_END_DECLS
+
+#endif /* __GSK_GLYPH_CACHE_PRIVATE_H__ */
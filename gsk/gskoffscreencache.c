@@ -0,0 +1,274 @@
+#include "config.h"
+
+#include "gskoffscreencacheprivate.h"
+
+#include "gskdebugprivate.h"
+#include "gskrendernodeprivate.h"
+
+/* Render nodes are immutable, so the result of rendering a node into
+ * an offscreen can be reused for as long as the node is alive. The
+ * cache keeps a reference on the nodes, so a node is never mistaken
+ * for another one allocated at the same address.
+ *
+ * Entries that have not been used for MAX_AGE frames are dropped,
+ * so the cache does not keep nodes of old frames alive.
+ */
+#define MAX_AGE 30
+
+typedef struct {
+  GskRenderNode *node;
+  graphene_rect_t bounds;
+  int scale;
+
+  gpointer data;
+  gsize size;
+
+  gint64 last_used;
+} CacheEntry;
+
+struct _GskOffscreenCache
+{
+  GHashTable *entries;
+
+  gsize size;
+  gsize max_size;
+
+  GFunc free_func;
+  gpointer user_data;
+
+  gint64 frame_counter;
+};
+
+static guint
+cache_entry_hash (gconstpointer v)
+{
+  const CacheEntry *entry = v;
+
+  return GPOINTER_TO_UINT (entry->node) ^ (entry->scale << 24);
+}
+
+static gboolean
+cache_entry_equal (gconstpointer v1,
+                   gconstpointer v2)
+{
+  const CacheEntry *entry1 = v1;
+  const CacheEntry *entry2 = v2;
+
+  return entry1->node == entry2->node &&
+         entry1->scale == entry2->scale &&
+         graphene_rect_equal (&entry1->bounds, &entry2->bounds);
+}
+
+static void
+gsk_offscreen_cache_remove_entry (GskOffscreenCache *cache,
+                                  CacheEntry        *entry)
+{
+  g_hash_table_remove (cache->entries, entry);
+
+  cache->size -= entry->size;
+  cache->free_func (entry->data, cache->user_data);
+  gsk_render_node_unref (entry->node);
+
+  g_slice_free (CacheEntry, entry);
+}
+
+/*
+ * gsk_offscreen_cache_new:
+ * @max_size: the memory budget of the cache, in bytes
+ * @free_func: function to free the data of evicted entries
+ * @user_data: user data for @free_func
+ *
+ * Creates a cache for the offscreen renderings of nodes. The data
+ * is opaque to the cache, it is usually a texture of the renderer.
+ *
+ * Returns: (transfer full): a new #GskOffscreenCache
+ */
+GskOffscreenCache *
+gsk_offscreen_cache_new (gsize    max_size,
+                         GFunc    free_func,
+                         gpointer user_data)
+{
+  GskOffscreenCache *cache;
+
+  g_return_val_if_fail (free_func != NULL, NULL);
+
+  cache = g_slice_new0 (GskOffscreenCache);
+  cache->entries = g_hash_table_new (cache_entry_hash, cache_entry_equal);
+  cache->max_size = max_size;
+  cache->free_func = free_func;
+  cache->user_data = user_data;
+
+  return cache;
+}
+
+void
+gsk_offscreen_cache_free (GskOffscreenCache *cache)
+{
+  gsk_offscreen_cache_clear (cache);
+  g_hash_table_unref (cache->entries);
+
+  g_slice_free (GskOffscreenCache, cache);
+}
+
+void
+gsk_offscreen_cache_clear (GskOffscreenCache *cache)
+{
+  GHashTableIter iter;
+  CacheEntry *entry;
+
+  g_hash_table_iter_init (&iter, cache->entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+    {
+      g_hash_table_iter_remove (&iter);
+
+      cache->free_func (entry->data, cache->user_data);
+      gsk_render_node_unref (entry->node);
+      g_slice_free (CacheEntry, entry);
+    }
+
+  cache->size = 0;
+}
+
+void
+gsk_offscreen_cache_begin_frame (GskOffscreenCache *cache)
+{
+  GHashTableIter iter;
+  CacheEntry *entry;
+  guint dropped = 0;
+
+  cache->frame_counter++;
+
+  g_hash_table_iter_init (&iter, cache->entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+    {
+      if (cache->frame_counter - entry->last_used <= MAX_AGE)
+        continue;
+
+      g_hash_table_iter_remove (&iter);
+
+      cache->size -= entry->size;
+      cache->free_func (entry->data, cache->user_data);
+      gsk_render_node_unref (entry->node);
+      g_slice_free (CacheEntry, entry);
+
+      dropped++;
+    }
+
+  if (dropped > 0)
+    GSK_NOTE (RENDERER, g_print ("Dropped %u old offscreens, %u left using %" G_GSIZE_FORMAT " bytes\n",
+                                 dropped, g_hash_table_size (cache->entries), cache->size));
+}
+
+/*
+ * gsk_offscreen_cache_lookup:
+ * @cache: a #GskOffscreenCache
+ * @node: the node that was rendered
+ * @bounds: the area of @node that was rendered, in the coordinate
+ *     space of @node
+ * @scale: the scale factor the node was rendered with
+ *
+ * Looks up a previous rendering of @node.
+ *
+ * Returns: (nullable) (transfer none): the data passed to
+ *     gsk_offscreen_cache_insert(), or %NULL
+ */
+gpointer
+gsk_offscreen_cache_lookup (GskOffscreenCache     *cache,
+                            GskRenderNode         *node,
+                            const graphene_rect_t *bounds,
+                            int                    scale)
+{
+  CacheEntry lookup = { node, *bounds, scale };
+  CacheEntry *entry;
+
+  entry = g_hash_table_lookup (cache->entries, &lookup);
+  if (entry == NULL)
+    return NULL;
+
+  entry->last_used = cache->frame_counter;
+
+  return entry->data;
+}
+
+/* Evicts the least recently used entries until there is room for
+ * @size more bytes. Entries used in the current frame are kept, as
+ * the renderer is still going to draw them
+ */
+static gboolean
+gsk_offscreen_cache_make_room (GskOffscreenCache *cache,
+                               gsize              size)
+{
+  while (cache->size + size > cache->max_size)
+    {
+      GHashTableIter iter;
+      CacheEntry *entry, *lru = NULL;
+
+      g_hash_table_iter_init (&iter, cache->entries);
+      while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+        {
+          if (entry->last_used == cache->frame_counter)
+            continue;
+
+          if (lru == NULL || entry->last_used < lru->last_used)
+            lru = entry;
+        }
+
+      if (lru == NULL)
+        return FALSE;
+
+      gsk_offscreen_cache_remove_entry (cache, lru);
+    }
+
+  return TRUE;
+}
+
+/*
+ * gsk_offscreen_cache_insert:
+ * @cache: a #GskOffscreenCache
+ * @node: the node that was rendered
+ * @bounds: the area of @node that was rendered, in the coordinate
+ *     space of @node
+ * @scale: the scale factor the node was rendered with
+ * @data: the rendering of @node
+ * @size: the memory used by @data, in bytes
+ *
+ * Adds a rendering of @node to the cache, evicting old entries if
+ * the memory budget of the cache would be exceeded.
+ *
+ * Returns: %TRUE if the cache took ownership of @data, %FALSE if it
+ *     does not fit into the cache
+ */
+gboolean
+gsk_offscreen_cache_insert (GskOffscreenCache     *cache,
+                            GskRenderNode         *node,
+                            const graphene_rect_t *bounds,
+                            int                    scale,
+                            gpointer               data,
+                            gsize                  size)
+{
+  CacheEntry *entry;
+
+  g_return_val_if_fail (gsk_offscreen_cache_lookup (cache, node, bounds, scale) == NULL, FALSE);
+
+  if (size > cache->max_size / 4)
+    return FALSE;
+
+  if (!gsk_offscreen_cache_make_room (cache, size))
+    {
+      GSK_NOTE (RENDERER, g_print ("No room for a %" G_GSIZE_FORMAT " bytes offscreen\n", size));
+      return FALSE;
+    }
+
+  entry = g_slice_new (CacheEntry);
+  entry->node = gsk_render_node_ref (node);
+  entry->bounds = *bounds;
+  entry->scale = scale;
+  entry->data = data;
+  entry->size = size;
+  entry->last_used = cache->frame_counter;
+
+  g_hash_table_add (cache->entries, entry);
+  cache->size += size;
+
+  return TRUE;
+}
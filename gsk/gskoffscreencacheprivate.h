@@ -0,0 +1,34 @@
+#ifndef __GSK_OFFSCREEN_CACHE_PRIVATE_H__
+#define __GSK_OFFSCREEN_CACHE_PRIVATE_H__
+
+#include <glib.h>
+#include <graphene.h>
+
+#include <gsk/gskrendernode.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GskOffscreenCache GskOffscreenCache;
+
+GskOffscreenCache *     gsk_offscreen_cache_new                 (gsize                  max_size,
+                                                                 GFunc                  free_func,
+                                                                 gpointer               user_data);
+void                    gsk_offscreen_cache_free                (GskOffscreenCache     *cache);
+
+void                    gsk_offscreen_cache_begin_frame         (GskOffscreenCache     *cache);
+void                    gsk_offscreen_cache_clear               (GskOffscreenCache     *cache);
+
+gpointer                gsk_offscreen_cache_lookup              (GskOffscreenCache     *cache,
+                                                                 GskRenderNode         *node,
+                                                                 const graphene_rect_t *bounds,
+                                                                 int                    scale);
+gboolean                gsk_offscreen_cache_insert              (GskOffscreenCache     *cache,
+                                                                 GskRenderNode         *node,
+                                                                 const graphene_rect_t *bounds,
+                                                                 int                    scale,
+                                                                 gpointer               data,
+                                                                 gsize                  size);
+
+G_END_DECLS
+
+#endif /* __GSK_OFFSCREEN_CACHE_PRIVATE_H__ */
@@ -215,6 +215,22 @@ gsk_profiler_counter_inc (GskProfiler *profiler,
 
 }
 
+void
+gsk_profiler_counter_add (GskProfiler *profiler,
+                          GQuark       counter_id,
+                          gint64       increment)
+{
+  NamedCounter *counter;
+
+  g_return_if_fail (GSK_IS_PROFILER (profiler));
+
+  counter = gsk_profiler_get_counter (profiler, counter_id);
+  if (counter == NULL)
+    return;
+
+  counter->value += increment;
+}
+
 void
 gsk_profiler_timer_begin (GskProfiler *profiler,
                           GQuark       timer_id)
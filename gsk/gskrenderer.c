@@ -74,6 +74,14 @@ typedef struct
   GskRenderNode *root_node;
   GdkDisplay *display;
 
+  /* The last node rendered to the window, and the window
+   * size it was rendered at, for computing damage
+   */
+  GskRenderNode *prev_node;
+  int prev_width;
+  int prev_height;
+  int prev_scale_factor;
+
   GskProfiler *profiler;
 
   int scale_factor;
@@ -176,6 +184,7 @@ gsk_renderer_dispose (GObject *gobject)
 
   gsk_renderer_unrealize (self);
 
+  g_clear_pointer (&priv->prev_node, gsk_render_node_unref);
   g_clear_object (&priv->profiler);
   g_clear_object (&priv->display);
 
@@ -613,6 +622,8 @@ gsk_renderer_unrealize (GskRenderer *renderer)
 
   GSK_RENDERER_GET_CLASS (renderer)->unrealize (renderer);
 
+  g_clear_pointer (&priv->prev_node, gsk_render_node_unref);
+
   priv->is_realized = FALSE;
 }
 
@@ -738,7 +749,51 @@ gsk_renderer_render (GskRenderer       *renderer,
     }
 #endif
 
-  g_clear_pointer (&priv->root_node, gsk_render_node_unref);
+  g_clear_pointer (&priv->prev_node, gsk_render_node_unref);
+  priv->prev_node = priv->root_node;
+  priv->prev_width = gdk_window_get_width (priv->window);
+  priv->prev_height = gdk_window_get_height (priv->window);
+  priv->prev_scale_factor = gdk_window_get_scale_factor (priv->window);
+  priv->root_node = NULL;
+}
+
+/*
+ * gsk_renderer_get_damage:
+ * @renderer: a realized #GskRenderer
+ * @root: the #GskRenderNode about to be rendered
+ *
+ * Compares @root with the node rendered last by @renderer, and
+ * computes the area of the window that needs to be redrawn for
+ * @root. Both nodes need to cover the whole window for this to
+ * be meaningful.
+ *
+ * Returns: (transfer full) (nullable): the damaged region, or %NULL
+ *     if the whole window needs to be redrawn
+ */
+cairo_region_t *
+gsk_renderer_get_damage (GskRenderer   *renderer,
+                         GskRenderNode *root)
+{
+  GskRendererPrivate *priv = gsk_renderer_get_instance_private (renderer);
+  cairo_region_t *damage;
+
+  g_return_val_if_fail (GSK_IS_RENDERER (renderer), NULL);
+  g_return_val_if_fail (priv->is_realized, NULL);
+  g_return_val_if_fail (GSK_IS_RENDER_NODE (root), NULL);
+
+  if (priv->prev_node == NULL ||
+      priv->prev_width != gdk_window_get_width (priv->window) ||
+      priv->prev_height != gdk_window_get_height (priv->window) ||
+      priv->prev_scale_factor != gdk_window_get_scale_factor (priv->window) ||
+      GSK_RENDER_MODE_CHECK (FULL_REDRAW))
+    return NULL;
+
+  damage = cairo_region_create ();
+  gsk_render_node_diff (priv->prev_node, root, damage);
+
+  GSK_NOTE (RENDERER, g_print ("Damage: %d rectangles\n", cairo_region_num_rectangles (damage)));
+
+  return damage;
 }
 
 /*< private >
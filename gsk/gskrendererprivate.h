@@ -69,6 +69,9 @@ cairo_surface_t *       gsk_renderer_create_cairo_surface       (GskRenderer
 
 GskProfiler *           gsk_renderer_get_profiler               (GskRenderer    *renderer);
 
+cairo_region_t *        gsk_renderer_get_damage                 (GskRenderer    *renderer,
+                                                                 GskRenderNode  *root);
+
 G_END_DECLS
 
 #endif /* __GSK_RENDERER_PRIVATE_H__ */
@@ -45,7 +45,8 @@
 
 #include "gskdebugprivate.h"
 #include "gskrendererprivate.h"
-#include "gsktexture.h"
+#include "gskrendernodebinaryprivate.h"
+#include "gsktextureprivate.h"
 
 #include <graphene-gobject.h>
 
@@ -257,6 +258,21 @@ gsk_render_node_draw (GskRenderNode *node,
   g_return_if_fail (cr != NULL);
   g_return_if_fail (cairo_status (cr) == CAIRO_STATUS_SUCCESS);
 
+  if (!GSK_RENDER_MODE_CHECK (GEOMETRY))
+    {
+      double x1, y1, x2, y2;
+
+      /* Nodes outside of the clip don't change any pixels */
+      cairo_clip_extents (cr, &x1, &y1, &x2, &y2);
+      if (!graphene_rect_intersection (&node->bounds,
+                                       &GRAPHENE_RECT_INIT (x1, y1, x2 - x1, y2 - y1),
+                                       NULL))
+        {
+          GSK_NOTE (CAIRO, g_print ("Culling node %s[%p]\n", node->name, node));
+          return;
+        }
+    }
+
   cairo_save (cr);
 
   if (!GSK_RENDER_MODE_CHECK (GEOMETRY))
@@ -296,6 +312,150 @@ gsk_render_node_draw (GskRenderNode *node,
     }
 }
 
+static void
+rect_to_int_rect (const graphene_rect_t *rect,
+                  cairo_rectangle_int_t *int_rect)
+{
+  int_rect->x = floorf (rect->origin.x);
+  int_rect->y = floorf (rect->origin.y);
+  int_rect->width = ceilf (rect->origin.x + rect->size.width) - int_rect->x;
+  int_rect->height = ceilf (rect->origin.y + rect->size.height) - int_rect->y;
+}
+
+void
+gsk_render_node_diff_add_rect (cairo_region_t        *region,
+                               const graphene_rect_t *rect)
+{
+  cairo_rectangle_int_t int_rect;
+
+  rect_to_int_rect (rect, &int_rect);
+  cairo_region_union_rectangle (region, &int_rect);
+}
+
+void
+gsk_render_node_diff_intersect_rect (cairo_region_t        *region,
+                                     const graphene_rect_t *rect)
+{
+  cairo_rectangle_int_t int_rect;
+
+  rect_to_int_rect (rect, &int_rect);
+  cairo_region_intersect_rectangle (region, &int_rect);
+}
+
+/*
+ * gsk_render_node_diff_impossible:
+ * @node1: a #GskRenderNode
+ * @node2: the #GskRenderNode to compare with
+ * @region: a #cairo_region_t to add the differences to
+ *
+ * Adds the whole area of @node1 and @node2 to @region. This is
+ * the fallback for nodes that can't find out what changed.
+ */
+void
+gsk_render_node_diff_impossible (GskRenderNode  *node1,
+                                 GskRenderNode  *node2,
+                                 cairo_region_t *region)
+{
+  gsk_render_node_diff_add_rect (region, &node1->bounds);
+  gsk_render_node_diff_add_rect (region, &node2->bounds);
+}
+
+/*
+ * gsk_render_node_diff:
+ * @node1: a #GskRenderNode
+ * @node2: the #GskRenderNode to compare with
+ * @region: a #cairo_region_t to add the differences to
+ *
+ * Compares @node1 and @node2 and adds the areas that would be drawn
+ * differently to @region, in the coordinate space of the nodes.
+ *
+ * Identical nodes are skipped right away. Otherwise nodes of the same
+ * type are compared structurally, so that only the changed parts of
+ * two trees snapshotted from the same widgets end up in @region.
+ */
+void
+gsk_render_node_diff (GskRenderNode  *node1,
+                      GskRenderNode  *node2,
+                      cairo_region_t *region)
+{
+  if (node1 == node2)
+    return;
+
+  if (gsk_render_node_get_node_type (node1) == gsk_render_node_get_node_type (node2))
+    node1->node_class->diff (node1, node2, region);
+  else
+    gsk_render_node_diff_impossible (node1, node2, region);
+}
+
+/*
+ * gsk_render_node_get_opaque_rect:
+ * @node: a #GskRenderNode
+ * @rect: (out): return location for the opaque area
+ *
+ * Finds an area of @node that is known to be covered with fully
+ * opaque content, so that anything drawn below it is hidden.
+ *
+ * This is a cheap and conservative check: containers only look at
+ * their direct children.
+ *
+ * Returns: %TRUE if @rect was set
+ */
+gboolean
+gsk_render_node_get_opaque_rect (GskRenderNode   *node,
+                                 graphene_rect_t *rect)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_COLOR_NODE:
+      if (gsk_color_node_peek_color (node)->alpha < 1.0)
+        return FALSE;
+      *rect = node->bounds;
+      return TRUE;
+
+    case GSK_TEXTURE_NODE:
+      if (!gsk_texture_is_opaque (gsk_texture_node_get_texture (node)))
+        return FALSE;
+      *rect = node->bounds;
+      return TRUE;
+
+    case GSK_CLIP_NODE:
+      if (!gsk_render_node_get_opaque_rect (gsk_clip_node_get_child (node), rect))
+        return FALSE;
+      return graphene_rect_intersection (rect, gsk_clip_node_peek_clip (node), rect);
+
+    case GSK_CONTAINER_NODE:
+      {
+        gboolean found = FALSE;
+        graphene_rect_t child_rect;
+        guint i;
+
+        for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+          {
+            GskRenderNode *child = gsk_container_node_get_child (node, i);
+            GskRenderNodeType type = gsk_render_node_get_node_type (child);
+
+            if (type != GSK_COLOR_NODE && type != GSK_TEXTURE_NODE)
+              continue;
+
+            if (!gsk_render_node_get_opaque_rect (child, &child_rect))
+              continue;
+
+            if (!found ||
+                child_rect.size.width * child_rect.size.height > rect->size.width * rect->size.height)
+              {
+                *rect = child_rect;
+                found = TRUE;
+              }
+          }
+
+        return found;
+      }
+
+    default:
+      return FALSE;
+    }
+}
+
 #define GSK_RENDER_NODE_SERIALIZATION_VERSION 0
 #define GSK_RENDER_NODE_SERIALIZATION_ID "GskRenderNode"
 
@@ -304,11 +464,18 @@ gsk_render_node_draw (GskRenderNode *node,
  * @node: a #GskRenderNode
  *
  * Serializes the @node for later deserialization via
- * gsk_render_node_deserialize(). No guarantees are made about the format
- * used other than that the same version of GTK+ will be able to deserialize
- * the result of a call to gsk_render_node_serialize() and
- * gsk_render_node_deserialize() will correctly reject files it cannot open
- * that were created with previous versions of GTK+.
+ * gsk_render_node_deserialize().
+ *
+ * The result is in a binary format made of flat records: a header,
+ * the node records, a string table and the pixel data of images as
+ * premultiplied ARGB32. Nodes used more than once are stored once.
+ * All records are 4-byte aligned and in host byte order, so the data
+ * can be mapped into memory and read in place, but only on machines
+ * with the same byte order.
+ *
+ * The format has a version number. gsk_render_node_deserialize() rejects
+ * data in a binary format version it does not know, and still reads the
+ * GVariant based format written by earlier versions of GTK+.
  *
  * The intended use of this functions is testing, benchmarking and debugging.
  * The format is not meant as a permanent storage format.
@@ -318,21 +485,9 @@ gsk_render_node_draw (GskRenderNode *node,
 GBytes *
 gsk_render_node_serialize (GskRenderNode *node)
 {
-  GVariant *node_variant, *variant;
-  GBytes *result;
-
-  node_variant = gsk_render_node_serialize_node (node);
-
-  variant = g_variant_new ("(suuv)",
-                           GSK_RENDER_NODE_SERIALIZATION_ID,
-                           (guint32) GSK_RENDER_NODE_SERIALIZATION_VERSION,
-                           (guint32) gsk_render_node_get_node_type (node),
-                           node_variant);
-
-  result = g_variant_get_data_as_bytes (variant);
-  g_variant_unref (variant);
+  g_return_val_if_fail (GSK_IS_RENDER_NODE (node), NULL);
 
-  return result;
+  return gsk_render_node_serialize_binary (node);
 }
 
 /**
@@ -380,6 +535,16 @@ gsk_render_node_write_to_file (GskRenderNode *node,
  * Loads data previously created via gsk_render_node_serialize(). For a
  * discussion of the supported format, see that function.
  *
+ * Data in the binary format is read in place if it is 4-byte aligned,
+ * which is the case for the bytes of a mapped file, see
+ * g_mapped_file_get_bytes(), and for memory from g_malloc(). Images of
+ * the returned nodes then keep a reference to @bytes. Data that is not
+ * aligned, like a slice at an odd offset of a larger buffer, is copied
+ * first.
+ *
+ * Data in the GVariant based format written by earlier versions of
+ * GTK+ can still be loaded, and saved again in the current format.
+ *
  * Returns: (nullable) (transfer full): a new #GskRenderNode or %NULL on
  *     error.
  **/
@@ -392,6 +557,10 @@ gsk_render_node_deserialize (GBytes  *bytes,
   GVariant *variant, *node_variant;
   GskRenderNode *node = NULL;
 
+  if (gsk_render_node_is_binary (bytes))
+    return gsk_render_node_deserialize_binary (bytes, error);
+
+  /* Files written by earlier versions use a GVariant */
   variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("(suuv)"), bytes, FALSE);
 
   g_variant_get (variant, "(suuv)", &id_string, &version, &node_type, &node_variant);
@@ -0,0 +1,1429 @@
+#include "config.h"
+
+#include "gskrendernodebinaryprivate.h"
+
+#include "gskrendernodeprivate.h"
+#include "gskroundedrectprivate.h"
+#include "gsktextureprivate.h"
+
+#include <pango/pangocairo.h>
+#include <math.h>
+#include <string.h>
+
+/* The binary serialization format is a flat file of records, so that
+ * captured frames are cheap to write and can be mapped into memory
+ * and walked without decoding them:
+ *
+ * - a header, locating the other parts of the file
+ * - the node records; children are written before their parents and
+ *   referenced by offset, nodes used more than once are written once
+ * - the string table, with node names and font descriptions
+ * - the image table and the pixel data of textures and cairo nodes,
+ *   as premultiplied ARGB32 with a stride of 4 * width; cairo nodes
+ *   store the device scale of their surface
+ *
+ * Everything is 4-byte aligned and in host byte order.
+ */
+#define GSK_BINARY_NODE_MAGIC "GskNode"
+#define GSK_BINARY_NODE_VERSION 2
+#define GSK_BINARY_NODE_BYTE_ORDER 0x01020304
+
+typedef struct {
+  char magic[8];
+  guint32 byte_order;
+  guint32 version;
+  guint32 root;
+  guint32 n_nodes;
+  guint32 strings;
+  guint32 n_strings;
+  guint32 images;
+  guint32 n_images;
+} GskBinaryHeader;
+
+typedef struct {
+  guint32 offset;
+  guint32 length;
+} GskBinaryString;
+
+typedef struct {
+  guint32 width;
+  guint32 height;
+  guint32 offset;
+} GskBinaryImage;
+
+/* The number of children of nodes of @type, or -1 for containers */
+static int
+gsk_binary_node_get_n_children_for_type (GskRenderNodeType type)
+{
+  switch (type)
+    {
+    case GSK_CONTAINER_NODE:
+      return -1;
+
+    case GSK_TRANSFORM_NODE:
+    case GSK_OPACITY_NODE:
+    case GSK_COLOR_MATRIX_NODE:
+    case GSK_REPEAT_NODE:
+    case GSK_CLIP_NODE:
+    case GSK_ROUNDED_CLIP_NODE:
+    case GSK_SHADOW_NODE:
+      return 1;
+
+    case GSK_BLEND_NODE:
+    case GSK_CROSS_FADE_NODE:
+      return 2;
+
+    case GSK_NOT_A_RENDER_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_COLOR_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_TEXTURE_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+    case GSK_TEXT_NODE:
+    default:
+      return 0;
+    }
+}
+
+static GskRenderNode *
+gsk_binary_node_get_child_for_node (GskRenderNode *node,
+                                    guint          i)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_CONTAINER_NODE:
+      return gsk_container_node_get_child (node, i);
+    case GSK_TRANSFORM_NODE:
+      return gsk_transform_node_get_child (node);
+    case GSK_OPACITY_NODE:
+      return gsk_opacity_node_get_child (node);
+    case GSK_COLOR_MATRIX_NODE:
+      return gsk_color_matrix_node_get_child (node);
+    case GSK_REPEAT_NODE:
+      return gsk_repeat_node_get_child (node);
+    case GSK_CLIP_NODE:
+      return gsk_clip_node_get_child (node);
+    case GSK_ROUNDED_CLIP_NODE:
+      return gsk_rounded_clip_node_get_child (node);
+    case GSK_SHADOW_NODE:
+      return gsk_shadow_node_get_child (node);
+    case GSK_BLEND_NODE:
+      return i == 0 ? gsk_blend_node_get_bottom_child (node) : gsk_blend_node_get_top_child (node);
+    case GSK_CROSS_FADE_NODE:
+      return i == 0 ? gsk_cross_fade_node_get_start_child (node) : gsk_cross_fade_node_get_end_child (node);
+    default:
+      g_assert_not_reached ();
+      return NULL;
+    }
+}
+
+/*** WRITING ***/
+
+typedef struct {
+  GByteArray *data;
+
+  /* GskRenderNode * => offset of its record */
+  GHashTable *nodes;
+
+  /* string => index + 1 */
+  GHashTable *strings;
+  GPtrArray *string_list;
+
+  /* GskTexture * or cairo_surface_t * => index + 1 */
+  GHashTable *images;
+  /* ARGB32 image surfaces with a stride of 4 * width */
+  GPtrArray *image_list;
+} Writer;
+
+static void
+writer_put_uint32 (Writer  *writer,
+                   guint32  value)
+{
+  g_byte_array_append (writer->data, (const guint8 *) &value, sizeof (guint32));
+}
+
+static void
+writer_put_float (Writer *writer,
+                  float   value)
+{
+  g_byte_array_append (writer->data, (const guint8 *) &value, sizeof (float));
+}
+
+static void
+writer_put_rect (Writer                *writer,
+                 const graphene_rect_t *rect)
+{
+  writer_put_float (writer, rect->origin.x);
+  writer_put_float (writer, rect->origin.y);
+  writer_put_float (writer, rect->size.width);
+  writer_put_float (writer, rect->size.height);
+}
+
+static void
+writer_put_rounded_rect (Writer               *writer,
+                         const GskRoundedRect *rect)
+{
+  guint i;
+
+  writer_put_rect (writer, &rect->bounds);
+  for (i = 0; i < 4; i++)
+    {
+      writer_put_float (writer, rect->corner[i].width);
+      writer_put_float (writer, rect->corner[i].height);
+    }
+}
+
+static void
+writer_put_rgba (Writer        *writer,
+                 const GdkRGBA *rgba)
+{
+  writer_put_float (writer, rgba->red);
+  writer_put_float (writer, rgba->green);
+  writer_put_float (writer, rgba->blue);
+  writer_put_float (writer, rgba->alpha);
+}
+
+static void
+writer_align (Writer *writer)
+{
+  static const guint8 zeros[4] = { 0, };
+
+  if (writer->data->len % 4)
+    g_byte_array_append (writer->data, zeros, 4 - writer->data->len % 4);
+}
+
+static guint32
+writer_add_string (Writer     *writer,
+                   const char *string)
+{
+  gpointer index;
+
+  if (string == NULL)
+    return G_MAXUINT32;
+
+  index = g_hash_table_lookup (writer->strings, string);
+  if (index == NULL)
+    {
+      char *copy = g_strdup (string);
+
+      g_ptr_array_add (writer->string_list, copy);
+      index = GUINT_TO_POINTER (writer->string_list->len);
+      g_hash_table_insert (writer->strings, copy, index);
+    }
+
+  return GPOINTER_TO_UINT (index) - 1;
+}
+
+/* Takes ownership of @surface */
+static guint32
+writer_add_image (Writer          *writer,
+                  gpointer         key,
+                  cairo_surface_t *surface)
+{
+  gpointer index;
+
+  index = g_hash_table_lookup (writer->images, key);
+  if (index != NULL)
+    {
+      cairo_surface_destroy (surface);
+      return GPOINTER_TO_UINT (index) - 1;
+    }
+
+  if (cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32 ||
+      cairo_image_surface_get_stride (surface) != cairo_image_surface_get_width (surface) * 4)
+    {
+      cairo_surface_t *copy;
+      double scale_x, scale_y;
+      cairo_t *cr;
+
+      copy = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                         cairo_image_surface_get_width (surface),
+                                         cairo_image_surface_get_height (surface));
+      cairo_surface_get_device_scale (surface, &scale_x, &scale_y);
+      cairo_surface_set_device_scale (copy, scale_x, scale_y);
+      cr = cairo_create (copy);
+      cairo_set_source_surface (cr, surface, 0, 0);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+
+      cairo_surface_destroy (surface);
+      surface = copy;
+    }
+
+  cairo_surface_flush (surface);
+
+  g_ptr_array_add (writer->image_list, surface);
+  index = GUINT_TO_POINTER (writer->image_list->len);
+  g_hash_table_insert (writer->images, key, index);
+
+  return GPOINTER_TO_UINT (index) - 1;
+}
+
+static guint32
+writer_add_cairo_surface (Writer          *writer,
+                          GskRenderNode   *node,
+                          cairo_surface_t *surface)
+{
+  cairo_surface_t *image;
+  double scale_x, scale_y;
+  cairo_t *cr;
+
+  if (surface == NULL)
+    return G_MAXUINT32;
+
+  if (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE)
+    return writer_add_image (writer, surface, cairo_surface_reference (surface));
+
+  /* Surfaces of the renderer, like X11 surfaces, need a copy. They
+   * are created with the scale factor of the window.
+   */
+  cairo_surface_get_device_scale (surface, &scale_x, &scale_y);
+  image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                      ceil (node->bounds.size.width * scale_x),
+                                      ceil (node->bounds.size.height * scale_y));
+  cairo_surface_set_device_scale (image, scale_x, scale_y);
+  cr = cairo_create (image);
+  cairo_set_source_surface (cr, surface, 0, 0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  return writer_add_image (writer, surface, image);
+}
+
+static void
+writer_put_payload (Writer        *writer,
+                    GskRenderNode *node)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_NOT_A_RENDER_NODE:
+    default:
+      g_assert_not_reached ();
+      break;
+
+    case GSK_CONTAINER_NODE:
+      break;
+
+    case GSK_CAIRO_NODE:
+      {
+        cairo_surface_t *surface = gsk_cairo_node_get_surface (node);
+        double scale_x = 1, scale_y = 1;
+
+        if (surface)
+          cairo_surface_get_device_scale (surface, &scale_x, &scale_y);
+
+        writer_put_uint32 (writer, writer_add_cairo_surface (writer, node, surface));
+        writer_put_float (writer, scale_x);
+        writer_put_float (writer, scale_y);
+      }
+      break;
+
+    case GSK_COLOR_NODE:
+      writer_put_rgba (writer, gsk_color_node_peek_color (node));
+      break;
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      {
+        const GskColorStop *stops = gsk_linear_gradient_node_peek_color_stops (node);
+        gsize i, n_stops = gsk_linear_gradient_node_get_n_color_stops (node);
+
+        writer_put_float (writer, gsk_linear_gradient_node_peek_start (node)->x);
+        writer_put_float (writer, gsk_linear_gradient_node_peek_start (node)->y);
+        writer_put_float (writer, gsk_linear_gradient_node_peek_end (node)->x);
+        writer_put_float (writer, gsk_linear_gradient_node_peek_end (node)->y);
+        writer_put_uint32 (writer, n_stops);
+        for (i = 0; i < n_stops; i++)
+          {
+            writer_put_float (writer, stops[i].offset);
+            writer_put_rgba (writer, &stops[i].color);
+          }
+      }
+      break;
+
+    case GSK_BORDER_NODE:
+      {
+        const float *widths = gsk_border_node_peek_widths (node);
+        const GdkRGBA *colors = gsk_border_node_peek_colors (node);
+        guint i;
+
+        writer_put_rounded_rect (writer, gsk_border_node_peek_outline (node));
+        for (i = 0; i < 4; i++)
+          writer_put_float (writer, widths[i]);
+        for (i = 0; i < 4; i++)
+          writer_put_rgba (writer, &colors[i]);
+      }
+      break;
+
+    case GSK_TEXTURE_NODE:
+      {
+        GskTexture *texture = gsk_texture_node_get_texture (node);
+
+        writer_put_uint32 (writer, writer_add_image (writer, texture, gsk_texture_download_surface (texture)));
+      }
+      break;
+
+    case GSK_INSET_SHADOW_NODE:
+      writer_put_rounded_rect (writer, gsk_inset_shadow_node_peek_outline (node));
+      writer_put_rgba (writer, gsk_inset_shadow_node_peek_color (node));
+      writer_put_float (writer, gsk_inset_shadow_node_get_dx (node));
+      writer_put_float (writer, gsk_inset_shadow_node_get_dy (node));
+      writer_put_float (writer, gsk_inset_shadow_node_get_spread (node));
+      writer_put_float (writer, gsk_inset_shadow_node_get_blur_radius (node));
+      break;
+
+    case GSK_OUTSET_SHADOW_NODE:
+      writer_put_rounded_rect (writer, gsk_outset_shadow_node_peek_outline (node));
+      writer_put_rgba (writer, gsk_outset_shadow_node_peek_color (node));
+      writer_put_float (writer, gsk_outset_shadow_node_get_dx (node));
+      writer_put_float (writer, gsk_outset_shadow_node_get_dy (node));
+      writer_put_float (writer, gsk_outset_shadow_node_get_spread (node));
+      writer_put_float (writer, gsk_outset_shadow_node_get_blur_radius (node));
+      break;
+
+    case GSK_TRANSFORM_NODE:
+      {
+        graphene_matrix_t transform;
+        float values[16];
+        guint i;
+
+        gsk_transform_node_get_transform (node, &transform);
+        graphene_matrix_to_float (&transform, values);
+        for (i = 0; i < 16; i++)
+          writer_put_float (writer, values[i]);
+      }
+      break;
+
+    case GSK_OPACITY_NODE:
+      writer_put_float (writer, gsk_opacity_node_get_opacity (node));
+      break;
+
+    case GSK_COLOR_MATRIX_NODE:
+      {
+        float values[16];
+        guint i;
+
+        graphene_matrix_to_float (gsk_color_matrix_node_peek_color_matrix (node), values);
+        for (i = 0; i < 16; i++)
+          writer_put_float (writer, values[i]);
+        graphene_vec4_to_float (gsk_color_matrix_node_peek_color_offset (node), values);
+        for (i = 0; i < 4; i++)
+          writer_put_float (writer, values[i]);
+      }
+      break;
+
+    case GSK_REPEAT_NODE:
+      writer_put_rect (writer, gsk_repeat_node_peek_child_bounds (node));
+      break;
+
+    case GSK_CLIP_NODE:
+      writer_put_rect (writer, gsk_clip_node_peek_clip (node));
+      break;
+
+    case GSK_ROUNDED_CLIP_NODE:
+      writer_put_rounded_rect (writer, gsk_rounded_clip_node_peek_clip (node));
+      break;
+
+    case GSK_SHADOW_NODE:
+      {
+        gsize i, n_shadows = gsk_shadow_node_get_n_shadows (node);
+
+        writer_put_uint32 (writer, n_shadows);
+        for (i = 0; i < n_shadows; i++)
+          {
+            const GskShadow *shadow = gsk_shadow_node_peek_shadow (node, i);
+
+            writer_put_rgba (writer, &shadow->color);
+            writer_put_float (writer, shadow->dx);
+            writer_put_float (writer, shadow->dy);
+            writer_put_float (writer, shadow->radius);
+          }
+      }
+      break;
+
+    case GSK_BLEND_NODE:
+      writer_put_uint32 (writer, gsk_blend_node_get_blend_mode (node));
+      break;
+
+    case GSK_CROSS_FADE_NODE:
+      writer_put_float (writer, gsk_cross_fade_node_get_progress (node));
+      break;
+
+    case GSK_TEXT_NODE:
+      {
+        PangoGlyphString *glyphs = gsk_text_node_peek_glyphs (node);
+        PangoFontDescription *desc;
+        char *desc_string;
+        int i;
+
+        desc = pango_font_describe_with_absolute_size (gsk_text_node_peek_font (node));
+        desc_string = pango_font_description_to_string (desc);
+        writer_put_uint32 (writer, writer_add_string (writer, desc_string));
+        g_free (desc_string);
+        pango_font_description_free (desc);
+
+        writer_put_rgba (writer, gsk_text_node_peek_color (node));
+        writer_put_float (writer, gsk_text_node_get_x (node));
+        writer_put_float (writer, gsk_text_node_get_y (node));
+        writer_put_uint32 (writer, glyphs->num_glyphs);
+        for (i = 0; i < glyphs->num_glyphs; i++)
+          {
+            writer_put_uint32 (writer, glyphs->glyphs[i].glyph);
+            writer_put_uint32 (writer, glyphs->glyphs[i].geometry.width);
+            writer_put_uint32 (writer, glyphs->glyphs[i].geometry.x_offset);
+            writer_put_uint32 (writer, glyphs->glyphs[i].geometry.y_offset);
+            writer_put_uint32 (writer, glyphs->glyphs[i].attr.is_cluster_start);
+          }
+      }
+      break;
+    }
+}
+
+static guint32
+writer_add_node (Writer        *writer,
+                 GskRenderNode *node)
+{
+  GskBinaryNode record;
+  guint32 *children;
+  guint32 offset;
+  guint i;
+
+  offset = GPOINTER_TO_UINT (g_hash_table_lookup (writer->nodes, node));
+  if (offset != 0)
+    return offset;
+
+  record.type = gsk_render_node_get_node_type (node);
+  record.name = writer_add_string (writer, gsk_render_node_get_name (node));
+  if (record.type == GSK_CONTAINER_NODE)
+    record.n_children = gsk_container_node_get_n_children (node);
+  else
+    record.n_children = gsk_binary_node_get_n_children_for_type (record.type);
+  record.bounds[0] = node->bounds.origin.x;
+  record.bounds[1] = node->bounds.origin.y;
+  record.bounds[2] = node->bounds.size.width;
+  record.bounds[3] = node->bounds.size.height;
+
+  children = g_new (guint32, record.n_children);
+  for (i = 0; i < record.n_children; i++)
+    children[i] = writer_add_node (writer, gsk_binary_node_get_child_for_node (node, i));
+
+  offset = writer->data->len;
+  g_byte_array_append (writer->data, (const guint8 *) &record, sizeof (GskBinaryNode));
+  g_byte_array_append (writer->data, (const guint8 *) children, sizeof (guint32) * record.n_children);
+  writer_put_payload (writer, node);
+
+  record.size = writer->data->len - offset;
+  memcpy (writer->data->data + offset + G_STRUCT_OFFSET (GskBinaryNode, size), &record.size, sizeof (guint32));
+
+  g_hash_table_insert (writer->nodes, node, GUINT_TO_POINTER (offset));
+  g_free (children);
+
+  return offset;
+}
+
+static guint32
+writer_put_strings (Writer *writer)
+{
+  guint32 offset;
+  guint i;
+
+  offset = writer->data->len;
+  g_byte_array_set_size (writer->data, offset + sizeof (GskBinaryString) * writer->string_list->len);
+
+  for (i = 0; i < writer->string_list->len; i++)
+    {
+      const char *string = g_ptr_array_index (writer->string_list, i);
+      GskBinaryString entry;
+
+      entry.offset = writer->data->len;
+      entry.length = strlen (string);
+      g_byte_array_append (writer->data, (const guint8 *) string, entry.length + 1);
+      writer_align (writer);
+
+      memcpy (writer->data->data + offset + sizeof (GskBinaryString) * i, &entry, sizeof (GskBinaryString));
+    }
+
+  return offset;
+}
+
+static guint32
+writer_put_images (Writer *writer)
+{
+  guint32 offset;
+  guint i;
+
+  offset = writer->data->len;
+  g_byte_array_set_size (writer->data, offset + sizeof (GskBinaryImage) * writer->image_list->len);
+  writer_align (writer);
+
+  for (i = 0; i < writer->image_list->len; i++)
+    {
+      cairo_surface_t *surface = g_ptr_array_index (writer->image_list, i);
+      GskBinaryImage entry;
+
+      entry.width = cairo_image_surface_get_width (surface);
+      entry.height = cairo_image_surface_get_height (surface);
+      entry.offset = writer->data->len;
+      g_byte_array_append (writer->data,
+                           cairo_image_surface_get_data (surface),
+                           entry.width * entry.height * 4);
+
+      memcpy (writer->data->data + offset + sizeof (GskBinaryImage) * i, &entry, sizeof (GskBinaryImage));
+    }
+
+  return offset;
+}
+
+/*
+ * gsk_render_node_serialize_binary:
+ * @node: a #GskRenderNode
+ *
+ * Serializes @node into the binary format. Textures, cairo surfaces,
+ * strings and nodes that are used more than once are only stored once.
+ *
+ * Returns: (transfer full): the serialized node
+ */
+GBytes *
+gsk_render_node_serialize_binary (GskRenderNode *node)
+{
+  GskBinaryHeader header = { GSK_BINARY_NODE_MAGIC, };
+  Writer writer;
+
+  writer.data = g_byte_array_new ();
+  writer.nodes = g_hash_table_new (NULL, NULL);
+  writer.strings = g_hash_table_new (g_str_hash, g_str_equal);
+  writer.string_list = g_ptr_array_new_with_free_func (g_free);
+  writer.images = g_hash_table_new (NULL, NULL);
+  writer.image_list = g_ptr_array_new_with_free_func ((GDestroyNotify) cairo_surface_destroy);
+
+  g_byte_array_set_size (writer.data, sizeof (GskBinaryHeader));
+
+  header.byte_order = GSK_BINARY_NODE_BYTE_ORDER;
+  header.version = GSK_BINARY_NODE_VERSION;
+  header.root = writer_add_node (&writer, node);
+  header.n_nodes = g_hash_table_size (writer.nodes);
+  header.n_strings = writer.string_list->len;
+  header.strings = writer_put_strings (&writer);
+  header.n_images = writer.image_list->len;
+  header.images = writer_put_images (&writer);
+
+  memcpy (writer.data->data, &header, sizeof (GskBinaryHeader));
+
+  g_hash_table_unref (writer.nodes);
+  g_hash_table_unref (writer.strings);
+  g_ptr_array_unref (writer.string_list);
+  g_hash_table_unref (writer.images);
+  g_ptr_array_unref (writer.image_list);
+
+  return g_byte_array_free_to_bytes (writer.data);
+}
+
+/*** WALKING ***/
+
+gboolean
+gsk_render_node_is_binary (GBytes *bytes)
+{
+  gsize size;
+  const char *data = g_bytes_get_data (bytes, &size);
+
+  return size >= sizeof (GskBinaryHeader) &&
+         memcmp (data, GSK_BINARY_NODE_MAGIC, sizeof (GSK_BINARY_NODE_MAGIC)) == 0;
+}
+
+static const GskBinaryHeader *
+gsk_binary_header_check (GBytes  *bytes,
+                         GError **error)
+{
+  const GskBinaryHeader *header;
+  gsize size;
+
+  header = g_bytes_get_data (bytes, &size);
+
+  if (!gsk_render_node_is_binary (bytes))
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_UNSUPPORTED_FORMAT,
+                   "Data not in GskRenderNode binary format.");
+      return NULL;
+    }
+
+  if (GPOINTER_TO_SIZE (header) % 4 != 0)
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_UNSUPPORTED_FORMAT,
+                   "Data is not aligned.");
+      return NULL;
+    }
+
+  if (header->byte_order != GSK_BINARY_NODE_BYTE_ORDER)
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_UNSUPPORTED_FORMAT,
+                   "Data was written with a different byte order.");
+      return NULL;
+    }
+
+  if (header->version != GSK_BINARY_NODE_VERSION)
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_UNSUPPORTED_VERSION,
+                   "Format version %u not supported.", header->version);
+      return NULL;
+    }
+
+  if (header->strings > size ||
+      header->n_strings > (size - header->strings) / sizeof (GskBinaryString) ||
+      header->images > size ||
+      header->images % 4 != 0 ||
+      header->strings % 4 != 0 ||
+      header->n_images > (size - header->images) / sizeof (GskBinaryImage))
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA,
+                   "Tables out of bounds.");
+      return NULL;
+    }
+
+  return header;
+}
+
+static const GskBinaryNode *
+gsk_binary_node_check (GBytes  *bytes,
+                       guint32  offset)
+{
+  const GskBinaryNode *node;
+  const guchar *data;
+  gsize size;
+
+  data = g_bytes_get_data (bytes, &size);
+
+  if (offset % 4 != 0 ||
+      offset < sizeof (GskBinaryHeader) ||
+      offset > size ||
+      size - offset < sizeof (GskBinaryNode))
+    return NULL;
+
+  node = (const GskBinaryNode *) (data + offset);
+
+  if (node->size > size - offset ||
+      node->size < sizeof (GskBinaryNode) ||
+      node->n_children > (node->size - sizeof (GskBinaryNode)) / sizeof (guint32))
+    return NULL;
+
+  return node;
+}
+
+/*
+ * gsk_binary_node_get_root:
+ * @bytes: data in the binary format
+ * @error: return location for an error
+ *
+ * Checks the header of @bytes and gets the record of the root node,
+ * without decoding anything else. The data of @bytes must be 4-byte
+ * aligned.
+ *
+ * Returns: (nullable): the root node record, pointing into @bytes
+ */
+const GskBinaryNode *
+gsk_binary_node_get_root (GBytes  *bytes,
+                          GError **error)
+{
+  const GskBinaryHeader *header;
+  const GskBinaryNode *root;
+
+  header = gsk_binary_header_check (bytes, error);
+  if (header == NULL)
+    return NULL;
+
+  root = gsk_binary_node_check (bytes, header->root);
+  if (root == NULL)
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA,
+                   "Invalid root node.");
+      return NULL;
+    }
+
+  return root;
+}
+
+/*
+ * gsk_binary_node_get_child:
+ * @bytes: data in the binary format
+ * @node: a node record of @bytes
+ * @i: the index of the child
+ *
+ * Gets the record of a child of @node.
+ *
+ * Returns: (nullable): the child record, or %NULL if @bytes is corrupt
+ */
+const GskBinaryNode *
+gsk_binary_node_get_child (GBytes              *bytes,
+                           const GskBinaryNode *node,
+                           guint                i)
+{
+  guint32 offset;
+
+  g_return_val_if_fail (i < node->n_children, NULL);
+
+  offset = (const guchar *) node - (const guchar *) g_bytes_get_data (bytes, NULL);
+
+  /* Children are always written first, which also rules out cycles */
+  if (node->children[i] >= offset)
+    return NULL;
+
+  return gsk_binary_node_check (bytes, node->children[i]);
+}
+
+static const char *
+gsk_binary_get_string (GBytes  *bytes,
+                       guint32  index)
+{
+  const GskBinaryHeader *header;
+  const GskBinaryString *entry;
+  const char *data;
+  gsize size;
+
+  data = g_bytes_get_data (bytes, &size);
+  header = (const GskBinaryHeader *) data;
+
+  if (index >= header->n_strings)
+    return NULL;
+
+  entry = (const GskBinaryString *) (data + header->strings) + index;
+  if (entry->offset > size ||
+      entry->length >= size - entry->offset ||
+      data[entry->offset + entry->length] != '\0')
+    return NULL;
+
+  return data + entry->offset;
+}
+
+/*
+ * gsk_binary_node_get_name:
+ * @bytes: data in the binary format
+ * @node: a node record of @bytes
+ *
+ * Returns: (nullable): the name of @node
+ */
+const char *
+gsk_binary_node_get_name (GBytes              *bytes,
+                          const GskBinaryNode *node)
+{
+  return gsk_binary_get_string (bytes, node->name);
+}
+
+/*** READING ***/
+
+typedef struct {
+  GBytes *bytes;
+  const GskBinaryHeader *header;
+
+  /* offset => GskRenderNode * */
+  GHashTable *nodes;
+  /* index => cairo_surface_t * */
+  GHashTable *surfaces;
+  /* index => GskTexture * */
+  GHashTable *textures;
+  /* index => PangoFont * */
+  GHashTable *fonts;
+} Reader;
+
+typedef struct {
+  const guchar *p;
+  const guchar *end;
+} Payload;
+
+static gboolean
+payload_get_uint32 (Payload *payload,
+                    guint32 *value)
+{
+  if ((gsize) (payload->end - payload->p) < sizeof (guint32))
+    return FALSE;
+
+  memcpy (value, payload->p, sizeof (guint32));
+  payload->p += sizeof (guint32);
+
+  return TRUE;
+}
+
+static gboolean
+payload_get_floats (Payload *payload,
+                    float   *values,
+                    gsize    n_values)
+{
+  if ((gsize) (payload->end - payload->p) / sizeof (float) < n_values)
+    return FALSE;
+
+  memcpy (values, payload->p, sizeof (float) * n_values);
+  payload->p += sizeof (float) * n_values;
+
+  return TRUE;
+}
+
+static gboolean
+payload_get_rounded_rect (Payload        *payload,
+                          GskRoundedRect *rect)
+{
+  float v[12];
+
+  if (!payload_get_floats (payload, v, 12))
+    return FALSE;
+
+  gsk_rounded_rect_init (rect,
+                         &GRAPHENE_RECT_INIT (v[0], v[1], v[2], v[3]),
+                         &GRAPHENE_SIZE_INIT (v[4], v[5]),
+                         &GRAPHENE_SIZE_INIT (v[6], v[7]),
+                         &GRAPHENE_SIZE_INIT (v[8], v[9]),
+                         &GRAPHENE_SIZE_INIT (v[10], v[11]));
+
+  return TRUE;
+}
+
+static gboolean
+payload_get_rgba (Payload *payload,
+                  GdkRGBA *rgba)
+{
+  float v[4];
+
+  if (!payload_get_floats (payload, v, 4))
+    return FALSE;
+
+  *rgba = (GdkRGBA) { v[0], v[1], v[2], v[3] };
+
+  return TRUE;
+}
+
+static const cairo_user_data_key_t gsk_binary_bytes_key;
+
+/* The surface uses the pixel data in the bytes, so mapped
+ * files don't need to be copied
+ */
+static cairo_surface_t *
+reader_get_surface (Reader  *reader,
+                    guint32  index)
+{
+  cairo_surface_t *surface;
+  const GskBinaryImage *entry;
+  const guchar *data;
+  gsize size;
+
+  surface = g_hash_table_lookup (reader->surfaces, GUINT_TO_POINTER (index));
+  if (surface != NULL)
+    return surface;
+
+  if (index >= reader->header->n_images)
+    return NULL;
+
+  data = g_bytes_get_data (reader->bytes, &size);
+  entry = (const GskBinaryImage *) (data + reader->header->images) + index;
+
+  if (entry->width == 0 || entry->width > G_MAXINT16 ||
+      entry->height == 0 || entry->height > G_MAXINT16 ||
+      entry->offset % 4 != 0 ||
+      entry->offset > size ||
+      (guint64) entry->width * entry->height * 4 > size - entry->offset)
+    return NULL;
+
+  surface = cairo_image_surface_create_for_data ((guchar *) data + entry->offset,
+                                                 CAIRO_FORMAT_ARGB32,
+                                                 entry->width, entry->height,
+                                                 entry->width * 4);
+  cairo_surface_set_user_data (surface,
+                               &gsk_binary_bytes_key,
+                               g_bytes_ref (reader->bytes),
+                               (cairo_destroy_func_t) g_bytes_unref);
+
+  g_hash_table_insert (reader->surfaces, GUINT_TO_POINTER (index), surface);
+
+  return surface;
+}
+
+static GskTexture *
+reader_get_texture (Reader  *reader,
+                    guint32  index)
+{
+  cairo_surface_t *surface;
+  GskTexture *texture;
+
+  texture = g_hash_table_lookup (reader->textures, GUINT_TO_POINTER (index));
+  if (texture != NULL)
+    return texture;
+
+  surface = reader_get_surface (reader, index);
+  if (surface == NULL)
+    return NULL;
+
+  texture = gsk_texture_new_for_surface (surface);
+  g_hash_table_insert (reader->textures, GUINT_TO_POINTER (index), texture);
+
+  return texture;
+}
+
+static PangoFont *
+reader_get_font (Reader  *reader,
+                 guint32  index)
+{
+  PangoFontDescription *desc;
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  const char *desc_string;
+  PangoFont *font;
+
+  font = g_hash_table_lookup (reader->fonts, GUINT_TO_POINTER (index));
+  if (font != NULL)
+    return font;
+
+  desc_string = gsk_binary_get_string (reader->bytes, index);
+  if (desc_string == NULL)
+    return NULL;
+
+  desc = pango_font_description_from_string (desc_string);
+  fontmap = pango_cairo_font_map_get_default ();
+  context = pango_font_map_create_context (fontmap);
+  font = pango_font_map_load_font (fontmap, context, desc);
+  g_object_unref (context);
+  pango_font_description_free (desc);
+
+  if (font != NULL)
+    g_hash_table_insert (reader->fonts, GUINT_TO_POINTER (index), font);
+
+  return font;
+}
+
+static GskRenderNode *
+reader_create_node (Reader               *reader,
+                    const GskBinaryNode  *record,
+                    GskRenderNode       **children,
+                    Payload              *payload)
+{
+  const graphene_rect_t bounds = GRAPHENE_RECT_INIT (record->bounds[0], record->bounds[1],
+                                                     record->bounds[2], record->bounds[3]);
+
+  switch (record->type)
+    {
+    case GSK_CONTAINER_NODE:
+      return gsk_container_node_new (children, record->n_children);
+
+    case GSK_CAIRO_NODE:
+      {
+        cairo_surface_t *surface;
+        guint32 index;
+        float scale[2];
+
+        if (!payload_get_uint32 (payload, &index) ||
+            !payload_get_floats (payload, scale, 2))
+          return NULL;
+
+        if (index == G_MAXUINT32)
+          return gsk_cairo_node_new (&bounds);
+
+        if (!(scale[0] > 0 && scale[0] <= G_MAXINT16) ||
+            !(scale[1] > 0 && scale[1] <= G_MAXINT16))
+          return NULL;
+
+        surface = reader_get_surface (reader, index);
+        if (surface == NULL)
+          return NULL;
+
+        cairo_surface_set_device_scale (surface, scale[0], scale[1]);
+
+        return gsk_cairo_node_new_for_surface (&bounds, surface);
+      }
+
+    case GSK_COLOR_NODE:
+      {
+        GdkRGBA color;
+
+        if (!payload_get_rgba (payload, &color))
+          return NULL;
+
+        return gsk_color_node_new (&color, &bounds);
+      }
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      {
+        GskRenderNode *result;
+        GskColorStop *stops;
+        float points[4];
+        guint32 i, n_stops;
+
+        if (!payload_get_floats (payload, points, 4) ||
+            !payload_get_uint32 (payload, &n_stops) ||
+            n_stops > (gsize) (payload->end - payload->p) / (5 * sizeof (float)))
+          return NULL;
+
+        stops = g_new (GskColorStop, n_stops);
+        for (i = 0; i < n_stops; i++)
+          {
+            float offset;
+
+            payload_get_floats (payload, &offset, 1);
+            payload_get_rgba (payload, &stops[i].color);
+            stops[i].offset = offset;
+          }
+
+        if (record->type == GSK_LINEAR_GRADIENT_NODE)
+          result = gsk_linear_gradient_node_new (&bounds,
+                                                 &GRAPHENE_POINT_INIT (points[0], points[1]),
+                                                 &GRAPHENE_POINT_INIT (points[2], points[3]),
+                                                 stops, n_stops);
+        else
+          result = gsk_repeating_linear_gradient_node_new (&bounds,
+                                                           &GRAPHENE_POINT_INIT (points[0], points[1]),
+                                                           &GRAPHENE_POINT_INIT (points[2], points[3]),
+                                                           stops, n_stops);
+        g_free (stops);
+
+        return result;
+      }
+
+    case GSK_BORDER_NODE:
+      {
+        GskRoundedRect outline;
+        float widths[4];
+        GdkRGBA colors[4];
+
+        if (!payload_get_rounded_rect (payload, &outline) ||
+            !payload_get_floats (payload, widths, 4) ||
+            !payload_get_rgba (payload, &colors[0]) ||
+            !payload_get_rgba (payload, &colors[1]) ||
+            !payload_get_rgba (payload, &colors[2]) ||
+            !payload_get_rgba (payload, &colors[3]))
+          return NULL;
+
+        return gsk_border_node_new (&outline, widths, colors);
+      }
+
+    case GSK_TEXTURE_NODE:
+      {
+        GskTexture *texture;
+        guint32 index;
+
+        if (!payload_get_uint32 (payload, &index))
+          return NULL;
+
+        texture = reader_get_texture (reader, index);
+        if (texture == NULL)
+          return NULL;
+
+        return gsk_texture_node_new (texture, &bounds);
+      }
+
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+      {
+        GskRoundedRect outline;
+        GdkRGBA color;
+        float v[4];
+
+        if (!payload_get_rounded_rect (payload, &outline) ||
+            !payload_get_rgba (payload, &color) ||
+            !payload_get_floats (payload, v, 4))
+          return NULL;
+
+        if (record->type == GSK_INSET_SHADOW_NODE)
+          return gsk_inset_shadow_node_new (&outline, &color, v[0], v[1], v[2], v[3]);
+        else
+          return gsk_outset_shadow_node_new (&outline, &color, v[0], v[1], v[2], v[3]);
+      }
+
+    case GSK_TRANSFORM_NODE:
+      {
+        graphene_matrix_t transform;
+        float v[16];
+
+        if (!payload_get_floats (payload, v, 16))
+          return NULL;
+
+        graphene_matrix_init_from_float (&transform, v);
+
+        return gsk_transform_node_new (children[0], &transform);
+      }
+
+    case GSK_OPACITY_NODE:
+      {
+        float opacity;
+
+        if (!payload_get_floats (payload, &opacity, 1))
+          return NULL;
+
+        return gsk_opacity_node_new (children[0], opacity);
+      }
+
+    case GSK_COLOR_MATRIX_NODE:
+      {
+        graphene_matrix_t matrix;
+        graphene_vec4_t offset;
+        float v[20];
+
+        if (!payload_get_floats (payload, v, 20))
+          return NULL;
+
+        graphene_matrix_init_from_float (&matrix, v);
+        graphene_vec4_init_from_float (&offset, v + 16);
+
+        return gsk_color_matrix_node_new (children[0], &matrix, &offset);
+      }
+
+    case GSK_REPEAT_NODE:
+      {
+        float v[4];
+
+        if (!payload_get_floats (payload, v, 4))
+          return NULL;
+
+        return gsk_repeat_node_new (&bounds, children[0], &GRAPHENE_RECT_INIT (v[0], v[1], v[2], v[3]));
+      }
+
+    case GSK_CLIP_NODE:
+      {
+        float v[4];
+
+        if (!payload_get_floats (payload, v, 4))
+          return NULL;
+
+        return gsk_clip_node_new (children[0], &GRAPHENE_RECT_INIT (v[0], v[1], v[2], v[3]));
+      }
+
+    case GSK_ROUNDED_CLIP_NODE:
+      {
+        GskRoundedRect clip;
+
+        if (!payload_get_rounded_rect (payload, &clip))
+          return NULL;
+
+        return gsk_rounded_clip_node_new (children[0], &clip);
+      }
+
+    case GSK_SHADOW_NODE:
+      {
+        GskRenderNode *result;
+        GskShadow *shadows;
+        guint32 i, n_shadows;
+
+        if (!payload_get_uint32 (payload, &n_shadows) ||
+            n_shadows > (gsize) (payload->end - payload->p) / (7 * sizeof (float)))
+          return NULL;
+
+        shadows = g_new (GskShadow, n_shadows);
+        for (i = 0; i < n_shadows; i++)
+          {
+            float v[3];
+
+            payload_get_rgba (payload, &shadows[i].color);
+            payload_get_floats (payload, v, 3);
+            shadows[i].dx = v[0];
+            shadows[i].dy = v[1];
+            shadows[i].radius = v[2];
+          }
+
+        result = gsk_shadow_node_new (children[0], shadows, n_shadows);
+        g_free (shadows);
+
+        return result;
+      }
+
+    case GSK_BLEND_NODE:
+      {
+        guint32 mode;
+
+        if (!payload_get_uint32 (payload, &mode) ||
+            mode > GSK_BLEND_MODE_LUMINOSITY)
+          return NULL;
+
+        return gsk_blend_node_new (children[0], children[1], mode);
+      }
+
+    case GSK_CROSS_FADE_NODE:
+      {
+        float progress;
+
+        if (!payload_get_floats (payload, &progress, 1))
+          return NULL;
+
+        return gsk_cross_fade_node_new (children[0], children[1], progress);
+      }
+
+    case GSK_TEXT_NODE:
+      {
+        PangoGlyphString *glyphs;
+        GskRenderNode *result;
+        PangoFont *font;
+        GdkRGBA color;
+        guint32 index, n_glyphs;
+        float pos[2];
+        guint32 i;
+
+        if (!payload_get_uint32 (payload, &index) ||
+            !payload_get_rgba (payload, &color) ||
+            !payload_get_floats (payload, pos, 2) ||
+            !payload_get_uint32 (payload, &n_glyphs) ||
+            n_glyphs > (gsize) (payload->end - payload->p) / (5 * sizeof (guint32)))
+          return NULL;
+
+        font = reader_get_font (reader, index);
+        if (font == NULL)
+          return NULL;
+
+        glyphs = pango_glyph_string_new ();
+        pango_glyph_string_set_size (glyphs, n_glyphs);
+        for (i = 0; i < n_glyphs; i++)
+          {
+            guint32 v[5];
+
+            payload_get_uint32 (payload, &v[0]);
+            payload_get_uint32 (payload, &v[1]);
+            payload_get_uint32 (payload, &v[2]);
+            payload_get_uint32 (payload, &v[3]);
+            payload_get_uint32 (payload, &v[4]);
+
+            glyphs->glyphs[i].glyph = v[0];
+            glyphs->glyphs[i].geometry.width = (gint32) v[1];
+            glyphs->glyphs[i].geometry.x_offset = (gint32) v[2];
+            glyphs->glyphs[i].geometry.y_offset = (gint32) v[3];
+            glyphs->glyphs[i].attr.is_cluster_start = v[4];
+            glyphs->log_clusters[i] = i;
+          }
+
+        result = gsk_text_node_new (font, glyphs, &color, pos[0], pos[1]);
+        pango_glyph_string_free (glyphs);
+
+        return result;
+      }
+
+    case GSK_NOT_A_RENDER_NODE:
+    default:
+      return NULL;
+    }
+}
+
+static GskRenderNode *
+reader_get_node (Reader               *reader,
+                 const GskBinaryNode  *record,
+                 GError              **error)
+{
+  GskRenderNode **children;
+  GskRenderNode *node;
+  Payload payload;
+  guint32 offset;
+  const char *name;
+  guint i;
+
+  offset = (const guchar *) record - (const guchar *) reader->header;
+
+  node = g_hash_table_lookup (reader->nodes, GUINT_TO_POINTER (offset));
+  if (node != NULL)
+    return gsk_render_node_ref (node);
+
+  if (record->type == GSK_NOT_A_RENDER_NODE ||
+      record->type > GSK_TEXT_NODE ||
+      (record->type != GSK_CONTAINER_NODE &&
+       record->n_children != gsk_binary_node_get_n_children_for_type (record->type)))
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA,
+                   "Invalid node record at offset %u", offset);
+      return NULL;
+    }
+
+  children = g_new0 (GskRenderNode *, record->n_children);
+  node = NULL;
+
+  for (i = 0; i < record->n_children; i++)
+    {
+      const GskBinaryNode *child = gsk_binary_node_get_child (reader->bytes, record, i);
+
+      if (child == NULL)
+        {
+          g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA,
+                       "Invalid child %u of node at offset %u", i, offset);
+          goto out;
+        }
+
+      children[i] = reader_get_node (reader, child, error);
+      if (children[i] == NULL)
+        goto out;
+    }
+
+  payload.p = (const guchar *) &record->children[record->n_children];
+  payload.end = (const guchar *) record + record->size;
+
+  node = reader_create_node (reader, record, children, &payload);
+  if (node == NULL)
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA,
+                   "Invalid data for node of type %u at offset %u", record->type, offset);
+      goto out;
+    }
+
+  name = gsk_binary_node_get_name (reader->bytes, record);
+  if (name != NULL)
+    gsk_render_node_set_name (node, name);
+
+  g_hash_table_insert (reader->nodes, GUINT_TO_POINTER (offset), gsk_render_node_ref (node));
+
+out:
+  for (i = 0; i < record->n_children; i++)
+    g_clear_pointer (&children[i], gsk_render_node_unref);
+  g_free (children);
+
+  return node;
+}
+
+/*
+ * gsk_render_node_deserialize_binary:
+ * @bytes: data in the binary format
+ * @error: return location for an error
+ *
+ * Loads a node tree written by gsk_render_node_serialize_binary().
+ * Image data is not copied, so @bytes may come from a mapped file,
+ * see g_mapped_file_get_bytes().
+ *
+ * Returns: (nullable) (transfer full): the root of the node tree
+ */
+GskRenderNode *
+gsk_render_node_deserialize_binary (GBytes  *bytes,
+                                    GError **error)
+{
+  const GskBinaryNode *root;
+  GskRenderNode *node;
+  Reader reader;
+  const guchar *data;
+  gsize size;
+
+  /* Records are read in place, which needs them to be aligned. Data
+   * that isn't, like a slice of a larger buffer, is copied.
+   */
+  data = g_bytes_get_data (bytes, &size);
+  if (GPOINTER_TO_SIZE (data) % 4 != 0)
+    {
+      guchar *copy = g_malloc (size);
+
+      memcpy (copy, data, size);
+      bytes = g_bytes_new_take (copy, size);
+    }
+  else
+    bytes = g_bytes_ref (bytes);
+
+  root = gsk_binary_node_get_root (bytes, error);
+  if (root == NULL)
+    {
+      g_bytes_unref (bytes);
+      return NULL;
+    }
+
+  reader.bytes = bytes;
+  reader.header = g_bytes_get_data (bytes, NULL);
+  reader.nodes = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) gsk_render_node_unref);
+  reader.surfaces = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) cairo_surface_destroy);
+  reader.textures = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+  reader.fonts = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+
+  node = reader_get_node (&reader, root, error);
+
+  g_hash_table_unref (reader.nodes);
+  g_hash_table_unref (reader.surfaces);
+  g_hash_table_unref (reader.textures);
+  g_hash_table_unref (reader.fonts);
+  g_bytes_unref (bytes);
+
+  return node;
+}
@@ -0,0 +1,47 @@
+#ifndef __GSK_RENDER_NODE_BINARY_PRIVATE_H__
+#define __GSK_RENDER_NODE_BINARY_PRIVATE_H__
+
+#include <glib.h>
+
+#include <gsk/gskrendernode.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GskBinaryNode GskBinaryNode;
+
+/* A node record of the binary format. All values are in host byte
+ * order and all records are 4-byte aligned, so a mapped file can be
+ * walked by looking at the records directly
+ */
+struct _GskBinaryNode
+{
+  guint32 type;
+  /* The size of the record, including children and payload */
+  guint32 size;
+  /* An index into the string table, or G_MAXUINT32 */
+  guint32 name;
+  guint32 n_children;
+  float bounds[4];
+  /* The offsets of the child records, followed by the
+   * payload of the node type
+   */
+  guint32 children[];
+};
+
+gboolean                gsk_render_node_is_binary               (GBytes                 *bytes);
+
+GBytes *                gsk_render_node_serialize_binary        (GskRenderNode          *node);
+GskRenderNode *         gsk_render_node_deserialize_binary      (GBytes                 *bytes,
+                                                                 GError                **error);
+
+const GskBinaryNode *   gsk_binary_node_get_root                (GBytes                 *bytes,
+                                                                 GError                **error);
+const GskBinaryNode *   gsk_binary_node_get_child               (GBytes                 *bytes,
+                                                                 const GskBinaryNode    *node,
+                                                                 guint                   i);
+const char *            gsk_binary_node_get_name                (GBytes                 *bytes,
+                                                                 const GskBinaryNode    *node);
+
+G_END_DECLS
+
+#endif /* __GSK_RENDER_NODE_BINARY_PRIVATE_H__ */
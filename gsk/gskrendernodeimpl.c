@@ -26,6 +26,8 @@
 #include "gskroundedrectprivate.h"
 #include "gsktextureprivate.h"
 
+#include <pango/pangocairo.h>
+
 static gboolean
 check_variant_type (GVariant *variant,
                     const char *type_string,
@@ -72,20 +74,23 @@ gsk_color_node_draw (GskRenderNode *node,
   cairo_fill (cr);
 }
 
-#define GSK_COLOR_NODE_VARIANT_TYPE "(dddddddd)"
-
-static GVariant *
-gsk_color_node_serialize (GskRenderNode *node)
+static void
+gsk_color_node_diff (GskRenderNode  *node1,
+                     GskRenderNode  *node2,
+                     cairo_region_t *region)
 {
-  GskColorNode *self = (GskColorNode *) node;
+  GskColorNode *self1 = (GskColorNode *) node1;
+  GskColorNode *self2 = (GskColorNode *) node2;
 
-  return g_variant_new (GSK_COLOR_NODE_VARIANT_TYPE,
-                        self->color.red, self->color.green,
-                        self->color.blue, self->color.alpha,
-                        (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                        (double) node->bounds.size.width, (double) node->bounds.size.height);
+  if (graphene_rect_equal (&node1->bounds, &node2->bounds) &&
+      gdk_rgba_equal (&self1->color, &self2->color))
+    return;
+
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_COLOR_NODE_VARIANT_TYPE "(dddddddd)"
+
 static GskRenderNode *
 gsk_color_node_deserialize (GVariant  *variant,
                             GError   **error)
@@ -109,7 +114,7 @@ static const GskRenderNodeClass GSK_COLOR_NODE_CLASS = {
   "GskColorNode",
   gsk_color_node_finalize,
   gsk_color_node_draw,
-  gsk_color_node_serialize,
+  gsk_color_node_diff,
   gsk_color_node_deserialize,
 };
 
@@ -203,32 +208,26 @@ gsk_linear_gradient_node_draw (GskRenderNode *node,
   cairo_fill (cr);
 }
 
-#define GSK_LINEAR_GRADIENT_NODE_VARIANT_TYPE "(dddddddda(ddddd))"
-
-static GVariant *
-gsk_linear_gradient_node_serialize (GskRenderNode *node)
-{
-  GskLinearGradientNode *self = (GskLinearGradientNode *) node;
-  GVariantBuilder builder;
-  guint i;
-
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ddddd)"));
-  for (i = 0; i < self->n_stops; i++)
-    {
-      g_variant_builder_add  (&builder, "(ddddd)",
-                              (double) self->stops[i].offset,
-                              self->stops[i].color.red, self->stops[i].color.green,
-                              self->stops[i].color.blue, self->stops[i].color.alpha);
-    }
+static void
+gsk_linear_gradient_node_diff (GskRenderNode  *node1,
+                               GskRenderNode  *node2,
+                               cairo_region_t *region)
+{
+  GskLinearGradientNode *self1 = (GskLinearGradientNode *) node1;
+  GskLinearGradientNode *self2 = (GskLinearGradientNode *) node2;
+
+  if (graphene_rect_equal (&node1->bounds, &node2->bounds) &&
+      graphene_point_equal (&self1->start, &self2->start) &&
+      graphene_point_equal (&self1->end, &self2->end) &&
+      self1->n_stops == self2->n_stops &&
+      memcmp (self1->stops, self2->stops, sizeof (GskColorStop) * self1->n_stops) == 0)
+    return;
 
-  return g_variant_new (GSK_LINEAR_GRADIENT_NODE_VARIANT_TYPE,
-                        (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                        (double) node->bounds.size.width, (double) node->bounds.size.height,
-                        (double) self->start.x, (double) self->start.y,
-                        (double) self->end.x, (double) self->end.y,
-                        &builder);
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_LINEAR_GRADIENT_NODE_VARIANT_TYPE "(dddddddda(ddddd))"
+
 static GskRenderNode *
 gsk_linear_gradient_node_real_deserialize (GVariant  *variant,
                                            gboolean   repeating,
@@ -287,7 +286,7 @@ static const GskRenderNodeClass GSK_LINEAR_GRADIENT_NODE_CLASS = {
   "GskLinearGradientNode",
   gsk_linear_gradient_node_finalize,
   gsk_linear_gradient_node_draw,
-  gsk_linear_gradient_node_serialize,
+  gsk_linear_gradient_node_diff,
   gsk_linear_gradient_node_deserialize,
 };
 
@@ -297,7 +296,7 @@ static const GskRenderNodeClass GSK_REPEATING_LINEAR_GRADIENT_NODE_CLASS = {
   "GskLinearGradientNode",
   gsk_linear_gradient_node_finalize,
   gsk_linear_gradient_node_draw,
-  gsk_linear_gradient_node_serialize,
+  gsk_linear_gradient_node_diff,
   gsk_repeating_linear_gradient_node_deserialize,
 };
 
@@ -519,32 +518,24 @@ gsk_border_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_BORDER_NODE_VARIANT_TYPE "(dddddddddddddddddddddddddddddddd)"
-
-static GVariant *
-gsk_border_node_serialize (GskRenderNode *node)
+static void
+gsk_border_node_diff (GskRenderNode  *node1,
+                      GskRenderNode  *node2,
+                      cairo_region_t *region)
 {
-  GskBorderNode *self = (GskBorderNode *) node;
+  GskBorderNode *self1 = (GskBorderNode *) node1;
+  GskBorderNode *self2 = (GskBorderNode *) node2;
+
+  if (gsk_rounded_rect_equal (&self1->outline, &self2->outline) &&
+      memcmp (self1->border_width, self2->border_width, sizeof (self1->border_width)) == 0 &&
+      memcmp (self1->border_color, self2->border_color, sizeof (self1->border_color)) == 0)
+    return;
 
-  return g_variant_new (GSK_BORDER_NODE_VARIANT_TYPE,
-                        (double) self->outline.bounds.origin.x, (double) self->outline.bounds.origin.y,
-                        (double) self->outline.bounds.size.width, (double) self->outline.bounds.size.height,
-                        (double) self->outline.corner[0].width, (double) self->outline.corner[0].height,
-                        (double) self->outline.corner[1].width, (double) self->outline.corner[1].height,
-                        (double) self->outline.corner[2].width, (double) self->outline.corner[2].height,
-                        (double) self->outline.corner[3].width, (double) self->outline.corner[3].height,
-                        (double) self->border_width[0], (double) self->border_width[1],
-                        (double) self->border_width[2], (double) self->border_width[3],
-                        self->border_color[0].red, self->border_color[0].green,
-                        self->border_color[0].blue, self->border_color[0].alpha,
-                        self->border_color[1].red, self->border_color[1].green,
-                        self->border_color[1].blue, self->border_color[1].alpha,
-                        self->border_color[2].red, self->border_color[2].green,
-                        self->border_color[2].blue, self->border_color[2].alpha,
-                        self->border_color[3].red, self->border_color[3].green,
-                        self->border_color[3].blue, self->border_color[3].alpha);
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_BORDER_NODE_VARIANT_TYPE "(dddddddddddddddddddddddddddddddd)"
+
 static GskRenderNode *
 gsk_border_node_deserialize (GVariant  *variant,
                              GError   **error)
@@ -584,7 +575,7 @@ static const GskRenderNodeClass GSK_BORDER_NODE_CLASS = {
   "GskBorderNode",
   gsk_border_node_finalize,
   gsk_border_node_draw,
-  gsk_border_node_serialize,
+  gsk_border_node_diff,
   gsk_border_node_deserialize
 };
 
@@ -692,35 +683,23 @@ gsk_texture_node_draw (GskRenderNode *node,
   cairo_surface_destroy (surface);
 }
 
-#define GSK_TEXTURE_NODE_VARIANT_TYPE "(dddduuau)"
-
-static GVariant *
-gsk_texture_node_serialize (GskRenderNode *node)
+static void
+gsk_texture_node_diff (GskRenderNode  *node1,
+                       GskRenderNode  *node2,
+                       cairo_region_t *region)
 {
-  GskTextureNode *self = (GskTextureNode *) node;
-  cairo_surface_t *surface;
-  GVariant *result;
-
-  surface = gsk_texture_download_surface (self->texture);
-
-  g_assert (cairo_image_surface_get_width (surface) * 4 == cairo_image_surface_get_stride (surface));
-
-  result = g_variant_new ("(dddduu@au)",
-                          (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                          (double) node->bounds.size.width, (double) node->bounds.size.height,
-                          (guint32) gsk_texture_get_width (self->texture),
-                          (guint32) gsk_texture_get_height (self->texture),
-                          g_variant_new_fixed_array (G_VARIANT_TYPE ("u"),
-                                                     cairo_image_surface_get_data (surface),
-                                                     gsk_texture_get_width (self->texture)
-                                                     * gsk_texture_get_height (self->texture),
-                                                     sizeof (guint32)));
+  GskTextureNode *self1 = (GskTextureNode *) node1;
+  GskTextureNode *self2 = (GskTextureNode *) node2;
 
-  cairo_surface_destroy (surface);
+  if (graphene_rect_equal (&node1->bounds, &node2->bounds) &&
+      self1->texture == self2->texture)
+    return;
 
-  return result;
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_TEXTURE_NODE_VARIANT_TYPE "(dddduuau)"
+
 static GskRenderNode *
 gsk_texture_node_deserialize (GVariant  *variant,
                               GError   **error)
@@ -757,7 +736,7 @@ static const GskRenderNodeClass GSK_TEXTURE_NODE_CLASS = {
   "GskTextureNode",
   gsk_texture_node_finalize,
   gsk_texture_node_draw,
-  gsk_texture_node_serialize,
+  gsk_texture_node_diff,
   gsk_texture_node_deserialize
 };
 
@@ -895,6 +874,9 @@ corner_mask_equal (CornerMask *mask1,
     mask1->corner.height == mask2->corner.height;
 }
 
+static GHashTable *corner_mask_cache = NULL;
+G_LOCK_DEFINE_STATIC (corner_mask_cache);
+
 static void
 draw_shadow_corner (cairo_t               *cr,
                     gboolean               inset,
@@ -913,7 +895,6 @@ draw_shadow_corner (cairo_t               *cr,
   cairo_pattern_t *pattern;
   cairo_matrix_t matrix;
   float sx, sy;
-  static GHashTable *corner_mask_cache = NULL;
   float max_other;
   CornerMask key;
   gboolean overlapped;
@@ -1001,6 +982,11 @@ draw_shadow_corner (cairo_t               *cr,
    * mask, so we cache rendered masks based on the blur radius and the
    * corner radius.
    */
+  /* Nodes may be drawn from multiple threads. Masks are never removed
+   * from the cache, so they can be used after unlocking.
+   */
+  G_LOCK (corner_mask_cache);
+
   if (corner_mask_cache == NULL)
     corner_mask_cache = g_hash_table_new_full ((GHashFunc)corner_mask_hash,
                                                (GEqualFunc)corner_mask_equal,
@@ -1025,6 +1011,8 @@ draw_shadow_corner (cairo_t               *cr,
       g_hash_table_insert (corner_mask_cache, g_memdup (&key, sizeof (key)), mask);
     }
 
+  G_UNLOCK (corner_mask_cache);
+
   gdk_cairo_set_source_rgba (cr, color);
   pattern = cairo_pattern_create_for_surface (mask);
   cairo_matrix_init_identity (&matrix);
@@ -1204,26 +1192,27 @@ gsk_inset_shadow_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_INSET_SHADOW_NODE_VARIANT_TYPE "(dddddddddddddddddddd)"
-
-static GVariant *
-gsk_inset_shadow_node_serialize (GskRenderNode *node)
-{
-  GskInsetShadowNode *self = (GskInsetShadowNode *) node;
+static void
+gsk_inset_shadow_node_diff (GskRenderNode  *node1,
+                            GskRenderNode  *node2,
+                            cairo_region_t *region)
+{
+  GskInsetShadowNode *self1 = (GskInsetShadowNode *) node1;
+  GskInsetShadowNode *self2 = (GskInsetShadowNode *) node2;
+
+  if (gsk_rounded_rect_equal (&self1->outline, &self2->outline) &&
+      gdk_rgba_equal (&self1->color, &self2->color) &&
+      self1->dx == self2->dx &&
+      self1->dy == self2->dy &&
+      self1->spread == self2->spread &&
+      self1->blur_radius == self2->blur_radius)
+    return;
 
-  return g_variant_new (GSK_INSET_SHADOW_NODE_VARIANT_TYPE,
-                        (double) self->outline.bounds.origin.x, (double) self->outline.bounds.origin.y,
-                        (double) self->outline.bounds.size.width, (double) self->outline.bounds.size.height,
-                        (double) self->outline.corner[0].width, (double) self->outline.corner[0].height,
-                        (double) self->outline.corner[1].width, (double) self->outline.corner[1].height,
-                        (double) self->outline.corner[2].width, (double) self->outline.corner[2].height,
-                        (double) self->outline.corner[3].width, (double) self->outline.corner[3].height,
-                        self->color.red, self->color.green,
-                        self->color.blue, self->color.alpha,
-                        (double) self->dx, (double) self->dy,
-                        (double) self->spread, (double) self->blur_radius);
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_INSET_SHADOW_NODE_VARIANT_TYPE "(dddddddddddddddddddd)"
+
 static GskRenderNode *
 gsk_inset_shadow_node_deserialize (GVariant  *variant,
                                    GError   **error)
@@ -1259,7 +1248,7 @@ static const GskRenderNodeClass GSK_INSET_SHADOW_NODE_CLASS = {
   "GskInsetShadowNode",
   gsk_inset_shadow_node_finalize,
   gsk_inset_shadow_node_draw,
-  gsk_inset_shadow_node_serialize,
+  gsk_inset_shadow_node_diff,
   gsk_inset_shadow_node_deserialize
 };
 
@@ -1507,26 +1496,27 @@ gsk_outset_shadow_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_OUTSET_SHADOW_NODE_VARIANT_TYPE "(dddddddddddddddddddd)"
-
-static GVariant *
-gsk_outset_shadow_node_serialize (GskRenderNode *node)
-{
-  GskOutsetShadowNode *self = (GskOutsetShadowNode *) node;
+static void
+gsk_outset_shadow_node_diff (GskRenderNode  *node1,
+                             GskRenderNode  *node2,
+                             cairo_region_t *region)
+{
+  GskOutsetShadowNode *self1 = (GskOutsetShadowNode *) node1;
+  GskOutsetShadowNode *self2 = (GskOutsetShadowNode *) node2;
+
+  if (gsk_rounded_rect_equal (&self1->outline, &self2->outline) &&
+      gdk_rgba_equal (&self1->color, &self2->color) &&
+      self1->dx == self2->dx &&
+      self1->dy == self2->dy &&
+      self1->spread == self2->spread &&
+      self1->blur_radius == self2->blur_radius)
+    return;
 
-  return g_variant_new (GSK_OUTSET_SHADOW_NODE_VARIANT_TYPE,
-                        (double) self->outline.bounds.origin.x, (double) self->outline.bounds.origin.y,
-                        (double) self->outline.bounds.size.width, (double) self->outline.bounds.size.height,
-                        (double) self->outline.corner[0].width, (double) self->outline.corner[0].height,
-                        (double) self->outline.corner[1].width, (double) self->outline.corner[1].height,
-                        (double) self->outline.corner[2].width, (double) self->outline.corner[2].height,
-                        (double) self->outline.corner[3].width, (double) self->outline.corner[3].height,
-                        self->color.red, self->color.green,
-                        self->color.blue, self->color.alpha,
-                        (double) self->dx, (double) self->dy,
-                        (double) self->spread, (double) self->blur_radius);
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_OUTSET_SHADOW_NODE_VARIANT_TYPE "(dddddddddddddddddddd)"
+
 static GskRenderNode *
 gsk_outset_shadow_node_deserialize (GVariant  *variant,
                                     GError   **error)
@@ -1562,7 +1552,7 @@ static const GskRenderNodeClass GSK_OUTSET_SHADOW_NODE_CLASS = {
   "GskOutsetShadowNode",
   gsk_outset_shadow_node_finalize,
   gsk_outset_shadow_node_draw,
-  gsk_outset_shadow_node_serialize,
+  gsk_outset_shadow_node_diff,
   gsk_outset_shadow_node_deserialize
 };
 
@@ -1710,42 +1700,23 @@ gsk_cairo_node_draw (GskRenderNode *node,
   cairo_paint (cr);
 }
 
-#define GSK_CAIRO_NODE_VARIANT_TYPE "(dddduuau)"
-
-static GVariant *
-gsk_cairo_node_serialize (GskRenderNode *node)
+static void
+gsk_cairo_node_diff (GskRenderNode  *node1,
+                     GskRenderNode  *node2,
+                     cairo_region_t *region)
 {
-  GskCairoNode *self = (GskCairoNode *) node;
+  GskCairoNode *self1 = (GskCairoNode *) node1;
+  GskCairoNode *self2 = (GskCairoNode *) node2;
 
-  if (self->surface == NULL)
-    {
-      return g_variant_new ("(dddduu@au)",
-                            (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                            (double) node->bounds.size.width, (double) node->bounds.size.height,
-                            (guint32) 0, (guint32) 0,
-                            g_variant_new_array (G_VARIANT_TYPE ("u"), NULL, 0));
-    }
-  else if (cairo_image_surface_get_width (self->surface) * 4 == cairo_image_surface_get_stride (self->surface))
-    {
-      return g_variant_new ("(dddduu@au)",
-                            (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                            (double) node->bounds.size.width, (double) node->bounds.size.height,
-                            (guint32) cairo_image_surface_get_width (self->surface),
-                            (guint32) cairo_image_surface_get_height (self->surface),
-                            g_variant_new_fixed_array (G_VARIANT_TYPE ("u"),
-                                                       cairo_image_surface_get_data (self->surface),
-                                                       cairo_image_surface_get_width (self->surface)
-                                                       * cairo_image_surface_get_height (self->surface),
-                                                       sizeof (guint32)));
-    }
-  else
-    {
-      /* FIXME: implement! */
-      g_assert_not_reached ();
-      return NULL;
-    }
+  if (graphene_rect_equal (&node1->bounds, &node2->bounds) &&
+      self1->surface == self2->surface)
+    return;
+
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_CAIRO_NODE_VARIANT_TYPE "(dddduuau)"
+
 const cairo_user_data_key_t gsk_surface_variant_key;
 
 static GskRenderNode *
@@ -1795,7 +1766,7 @@ static const GskRenderNodeClass GSK_CAIRO_NODE_CLASS = {
   "GskCairoNode",
   gsk_cairo_node_finalize,
   gsk_cairo_node_draw,
-  gsk_cairo_node_serialize,
+  gsk_cairo_node_diff,
   gsk_cairo_node_deserialize
 };
 
@@ -1817,6 +1788,39 @@ gsk_cairo_node_get_surface (GskRenderNode *node)
   return self->surface;
 }
 
+static cairo_user_data_key_t surface_serial_key;
+
+static void
+gsk_cairo_node_bump_surface_serial (cairo_surface_t *surface)
+{
+  static guint serial;
+
+  cairo_surface_set_user_data (surface, &surface_serial_key, GUINT_TO_POINTER (++serial), NULL);
+}
+
+/*< private >
+ * gsk_cairo_node_get_surface_serial:
+ * @node: a #GskRenderNode
+ *
+ * Retrieves a serial that changes whenever the surface of @node is
+ * drawn to with gsk_cairo_node_get_draw_context(). Renderers keeping
+ * uploads of the surface use it to know when to upload it again.
+ *
+ * Returns: the serial of the contents of the surface
+ */
+guint
+gsk_cairo_node_get_surface_serial (GskRenderNode *node)
+{
+  GskCairoNode *self = (GskCairoNode *) node;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_CAIRO_NODE), 0);
+
+  if (self->surface == NULL)
+    return 0;
+
+  return GPOINTER_TO_UINT (cairo_surface_get_user_data (self->surface, &surface_serial_key));
+}
+
 GskRenderNode *
 gsk_cairo_node_new_for_surface (const graphene_rect_t *bounds,
                                 cairo_surface_t       *surface)
@@ -1916,6 +1920,9 @@ gsk_cairo_node_get_draw_context (GskRenderNode *node,
       res = cairo_create (self->surface);
     }
 
+  if (self->surface)
+    gsk_cairo_node_bump_surface_serial (self->surface);
+
   cairo_translate (res, -node->bounds.origin.x, -node->bounds.origin.y);
 
   cairo_rectangle (res,
@@ -1970,9 +1977,13 @@ gsk_container_node_draw (GskRenderNode *node,
                          cairo_t       *cr)
 {
   GskContainerNode *container = (GskContainerNode *) node;
+  double x1, y1, x2, y2;
   guint i;
 
-  for (i = 0; i < container->n_children; i++)
+  cairo_clip_extents (cr, &x1, &y1, &x2, &y2);
+
+  i = gsk_container_node_get_first_visible_child (node, &GRAPHENE_RECT_INIT (x1, y1, x2 - x1, y2 - y1));
+  for (; i < container->n_children; i++)
     {
       gsk_render_node_draw (container->children[i], cr);
     }
@@ -1995,27 +2006,50 @@ gsk_container_node_get_bounds (GskContainerNode *container,
     graphene_rect_union (bounds, &container->children[i]->bounds, bounds);
 }
 
-#define GSK_CONTAINER_NODE_VARIANT_TYPE "a(uv)"
-
-static GVariant *
-gsk_container_node_serialize (GskRenderNode *node)
+/* Children are only compared in order, which deals with the common
+ * case of a few children changing, and children being added or removed
+ * at the start or end
+ */
+static void
+gsk_container_node_diff (GskRenderNode  *node1,
+                         GskRenderNode  *node2,
+                         cairo_region_t *region)
 {
-  GskContainerNode *self = (GskContainerNode *) node;
-  GVariantBuilder builder;
-  guint i;
+  GskContainerNode *self1 = (GskContainerNode *) node1;
+  GskContainerNode *self2 = (GskContainerNode *) node2;
+  guint i, n_prefix, n_suffix;
 
-  g_variant_builder_init (&builder, G_VARIANT_TYPE (GSK_CONTAINER_NODE_VARIANT_TYPE));
-  
-  for (i = 0; i < self->n_children; i++)
-    {
-      g_variant_builder_add (&builder, "(uv)",
-                             (guint32) gsk_render_node_get_node_type (self->children[i]),
-                             gsk_render_node_serialize_node (self->children[i]));
-    }
+  n_prefix = 0;
+  while (n_prefix < self1->n_children &&
+         n_prefix < self2->n_children &&
+         gsk_render_node_get_node_type (self1->children[n_prefix]) ==
+         gsk_render_node_get_node_type (self2->children[n_prefix]))
+    n_prefix++;
+
+  n_suffix = 0;
+  while (n_suffix < self1->n_children - n_prefix &&
+         n_suffix < self2->n_children - n_prefix &&
+         gsk_render_node_get_node_type (self1->children[self1->n_children - n_suffix - 1]) ==
+         gsk_render_node_get_node_type (self2->children[self2->n_children - n_suffix - 1]))
+    n_suffix++;
+
+  for (i = 0; i < n_prefix; i++)
+    gsk_render_node_diff (self1->children[i], self2->children[i], region);
+
+  for (i = 0; i < n_suffix; i++)
+    gsk_render_node_diff (self1->children[self1->n_children - i - 1],
+                          self2->children[self2->n_children - i - 1],
+                          region);
+
+  for (i = n_prefix; i < self1->n_children - n_suffix; i++)
+    gsk_render_node_diff_add_rect (region, &self1->children[i]->bounds);
 
-  return g_variant_builder_end (&builder);
+  for (i = n_prefix; i < self2->n_children - n_suffix; i++)
+    gsk_render_node_diff_add_rect (region, &self2->children[i]->bounds);
 }
 
+#define GSK_CONTAINER_NODE_VARIANT_TYPE "a(uv)"
+
 static GskRenderNode *
 gsk_container_node_deserialize (GVariant  *variant,
                                 GError   **error)
@@ -2061,7 +2095,7 @@ static const GskRenderNodeClass GSK_CONTAINER_NODE_CLASS = {
   "GskContainerNode",
   gsk_container_node_finalize,
   gsk_container_node_draw,
-  gsk_container_node_serialize,
+  gsk_container_node_diff,
   gsk_container_node_deserialize
 };
 
@@ -2128,6 +2162,42 @@ gsk_container_node_get_child (GskRenderNode *node,
   return container->children[idx];
 }
 
+/*
+ * gsk_container_node_get_first_visible_child:
+ * @node: a container #GskRenderNode
+ * @visible: the area that is going to be drawn, in the coordinate
+ *     space of @node
+ *
+ * Finds the topmost child that fully covers the visible part of
+ * @node with opaque content. Children below it are hidden and
+ * don't need to be drawn.
+ *
+ * Returns: the index of the first child to draw, or the number
+ *     of children if nothing of @node is visible
+ */
+guint
+gsk_container_node_get_first_visible_child (GskRenderNode         *node,
+                                            const graphene_rect_t *visible)
+{
+  GskContainerNode *container = (GskContainerNode *) node;
+  graphene_rect_t area, opaque;
+  guint i;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_CONTAINER_NODE), 0);
+
+  if (!graphene_rect_intersection (&node->bounds, visible, &area))
+    return container->n_children;
+
+  for (i = container->n_children; i > 1; i--)
+    {
+      if (gsk_render_node_get_opaque_rect (container->children[i - 1], &opaque) &&
+          graphene_rect_contains_rect (&opaque, &area))
+        return i - 1;
+    }
+
+  return 0;
+}
+
 /*** GSK_TRANSFORM_NODE ***/
 
 typedef struct _GskTransformNode GskTransformNode;
@@ -2173,25 +2243,45 @@ gsk_transform_node_draw (GskRenderNode *node,
     }
 }
 
-#define GSK_TRANSFORM_NODE_VARIANT_TYPE "(dddddddddddddddduv)"
+static void
+gsk_transform_node_diff (GskRenderNode  *node1,
+                         GskRenderNode  *node2,
+                         cairo_region_t *region)
+{
+  GskTransformNode *self1 = (GskTransformNode *) node1;
+  GskTransformNode *self2 = (GskTransformNode *) node2;
+  float m1[16], m2[16];
+  cairo_region_t *sub;
+  int i, n;
+
+  graphene_matrix_to_float (&self1->transform, m1);
+  graphene_matrix_to_float (&self2->transform, m2);
+  if (memcmp (m1, m2, sizeof (m1)) != 0)
+    {
+      gsk_render_node_diff_impossible (node1, node2, region);
+      return;
+    }
 
-static GVariant *
-gsk_transform_node_serialize (GskRenderNode *node)
-{
-  GskTransformNode *self = (GskTransformNode *) node;
-  float mat[16];
+  sub = cairo_region_create ();
+  gsk_render_node_diff (self1->child, self2->child, sub);
 
-  graphene_matrix_to_float (&self->transform, mat);
+  n = cairo_region_num_rectangles (sub);
+  for (i = 0; i < n; i++)
+    {
+      cairo_rectangle_int_t rect;
+      graphene_rect_t bounds;
 
-  return g_variant_new (GSK_TRANSFORM_NODE_VARIANT_TYPE,
-                        (double) mat[0], (double) mat[1], (double) mat[2], (double) mat[3],
-                        (double) mat[4], (double) mat[5], (double) mat[6], (double) mat[7],
-                        (double) mat[8], (double) mat[9], (double) mat[10], (double) mat[11],
-                        (double) mat[12], (double) mat[13], (double) mat[14], (double) mat[15],
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child));
+      cairo_region_get_rectangle (sub, i, &rect);
+      graphene_rect_init (&bounds, rect.x, rect.y, rect.width, rect.height);
+      graphene_matrix_transform_bounds (&self1->transform, &bounds, &bounds);
+      gsk_render_node_diff_add_rect (region, &bounds);
+    }
+
+  cairo_region_destroy (sub);
 }
 
+#define GSK_TRANSFORM_NODE_VARIANT_TYPE "(dddddddddddddddduv)"
+
 static GskRenderNode *
 gsk_transform_node_deserialize (GVariant  *variant,
                                 GError   **error)
@@ -2239,7 +2329,7 @@ static const GskRenderNodeClass GSK_TRANSFORM_NODE_CLASS = {
   "GskTransformNode",
   gsk_transform_node_finalize,
   gsk_transform_node_draw,
-  gsk_transform_node_serialize,
+  gsk_transform_node_diff,
   gsk_transform_node_deserialize
 };
 
@@ -2347,19 +2437,22 @@ gsk_opacity_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_OPACITY_NODE_VARIANT_TYPE "(duv)"
-
-static GVariant *
-gsk_opacity_node_serialize (GskRenderNode *node)
+static void
+gsk_opacity_node_diff (GskRenderNode  *node1,
+                       GskRenderNode  *node2,
+                       cairo_region_t *region)
 {
-  GskOpacityNode *self = (GskOpacityNode *) node;
+  GskOpacityNode *self1 = (GskOpacityNode *) node1;
+  GskOpacityNode *self2 = (GskOpacityNode *) node2;
 
-  return g_variant_new (GSK_OPACITY_NODE_VARIANT_TYPE,
-                        (double) self->opacity,
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child));
+  if (self1->opacity == self2->opacity)
+    gsk_render_node_diff (self1->child, self2->child, region);
+  else
+    gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_OPACITY_NODE_VARIANT_TYPE "(duv)"
+
 static GskRenderNode *
 gsk_opacity_node_deserialize (GVariant  *variant,
                               GError   **error)
@@ -2395,7 +2488,7 @@ static const GskRenderNodeClass GSK_OPACITY_NODE_CLASS = {
   "GskOpacityNode",
   gsk_opacity_node_finalize,
   gsk_opacity_node_draw,
-  gsk_opacity_node_serialize,
+  gsk_opacity_node_diff,
   gsk_opacity_node_deserialize
 };
 
@@ -2560,27 +2653,27 @@ gsk_color_matrix_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_COLOR_MATRIX_NODE_VARIANT_TYPE "(dddddddddddddddddddduv)"
-
-static GVariant *
-gsk_color_matrix_node_serialize (GskRenderNode *node)
+static void
+gsk_color_matrix_node_diff (GskRenderNode  *node1,
+                            GskRenderNode  *node2,
+                            cairo_region_t *region)
 {
-  GskColorMatrixNode *self = (GskColorMatrixNode *) node;
-  float mat[16], vec[4];
+  GskColorMatrixNode *self1 = (GskColorMatrixNode *) node1;
+  GskColorMatrixNode *self2 = (GskColorMatrixNode *) node2;
+  float m1[16], m2[16];
 
-  graphene_matrix_to_float (&self->color_matrix, mat);
-  graphene_vec4_to_float (&self->color_offset, vec);
+  graphene_matrix_to_float (&self1->color_matrix, m1);
+  graphene_matrix_to_float (&self2->color_matrix, m2);
 
-  return g_variant_new (GSK_COLOR_MATRIX_NODE_VARIANT_TYPE,
-                        (double) mat[0], (double) mat[1], (double) mat[2], (double) mat[3],
-                        (double) mat[4], (double) mat[5], (double) mat[6], (double) mat[7],
-                        (double) mat[8], (double) mat[9], (double) mat[10], (double) mat[11],
-                        (double) mat[12], (double) mat[13], (double) mat[14], (double) mat[15],
-                        (double) vec[0], (double) vec[1], (double) vec[2], (double) vec[3],
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child));
+  if (memcmp (m1, m2, sizeof (m1)) == 0 &&
+      graphene_vec4_equal (&self1->color_offset, &self2->color_offset))
+    gsk_render_node_diff (self1->child, self2->child, region);
+  else
+    gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_COLOR_MATRIX_NODE_VARIANT_TYPE "(dddddddddddddddddddduv)"
+
 static GskRenderNode *
 gsk_color_matrix_node_deserialize (GVariant  *variant,
                                    GError   **error)
@@ -2631,7 +2724,7 @@ static const GskRenderNodeClass GSK_COLOR_MATRIX_NODE_CLASS = {
   "GskColorMatrixNode",
   gsk_color_matrix_node_finalize,
   gsk_color_matrix_node_draw,
-  gsk_color_matrix_node_serialize,
+  gsk_color_matrix_node_diff,
   gsk_color_matrix_node_deserialize
 };
 
@@ -2759,22 +2852,17 @@ gsk_repeat_node_draw (GskRenderNode *node,
   cairo_surface_destroy (surface);
 }
 
-#define GSK_REPEAT_NODE_VARIANT_TYPE "(dddddddduv)"
-
-static GVariant *
-gsk_repeat_node_serialize (GskRenderNode *node)
+static void
+gsk_repeat_node_diff (GskRenderNode  *node1,
+                      GskRenderNode  *node2,
+                      cairo_region_t *region)
 {
-  GskRepeatNode *self = (GskRepeatNode *) node;
-
-  return g_variant_new (GSK_REPEAT_NODE_VARIANT_TYPE,
-                        (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                        (double) node->bounds.size.width, (double) node->bounds.size.height,
-                        (double) self->child_bounds.origin.x, (double) self->child_bounds.origin.y,
-                        (double) self->child_bounds.size.width, (double) self->child_bounds.size.height,
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child));
+  /* Every change of the child is repeated all over the node */
+  gsk_render_node_diff_impossible (node1, node2, region);
 }
 
+#define GSK_REPEAT_NODE_VARIANT_TYPE "(dddddddduv)"
+
 static GskRenderNode *
 gsk_repeat_node_deserialize (GVariant  *variant,
                              GError   **error)
@@ -2813,7 +2901,7 @@ static const GskRenderNodeClass GSK_REPEAT_NODE_CLASS = {
   "GskRepeatNode",
   gsk_repeat_node_finalize,
   gsk_repeat_node_draw,
-  gsk_repeat_node_serialize,
+  gsk_repeat_node_diff,
   gsk_repeat_node_deserialize
 };
 
@@ -2911,20 +2999,30 @@ gsk_clip_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_CLIP_NODE_VARIANT_TYPE "(dddduv)"
-
-static GVariant *
-gsk_clip_node_serialize (GskRenderNode *node)
+static void
+gsk_clip_node_diff (GskRenderNode  *node1,
+                    GskRenderNode  *node2,
+                    cairo_region_t *region)
 {
-  GskClipNode *self = (GskClipNode *) node;
+  GskClipNode *self1 = (GskClipNode *) node1;
+  GskClipNode *self2 = (GskClipNode *) node2;
+  cairo_region_t *sub;
+
+  if (!graphene_rect_equal (&self1->clip, &self2->clip))
+    {
+      gsk_render_node_diff_impossible (node1, node2, region);
+      return;
+    }
 
-  return g_variant_new (GSK_CLIP_NODE_VARIANT_TYPE,
-                        (double) node->bounds.origin.x, (double) node->bounds.origin.y,
-                        (double) node->bounds.size.width, (double) node->bounds.size.height,
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child));
+  sub = cairo_region_create ();
+  gsk_render_node_diff (self1->child, self2->child, sub);
+  gsk_render_node_diff_intersect_rect (sub, &self1->clip);
+  cairo_region_union (region, sub);
+  cairo_region_destroy (sub);
 }
 
+#define GSK_CLIP_NODE_VARIANT_TYPE "(dddduv)"
+
 static GskRenderNode *
 gsk_clip_node_deserialize (GVariant  *variant,
                            GError   **error)
@@ -2960,7 +3058,7 @@ static const GskRenderNodeClass GSK_CLIP_NODE_CLASS = {
   "GskClipNode",
   gsk_clip_node_finalize,
   gsk_clip_node_draw,
-  gsk_clip_node_serialize,
+  gsk_clip_node_diff,
   gsk_clip_node_deserialize
 };
 
@@ -3059,24 +3157,30 @@ gsk_rounded_clip_node_draw (GskRenderNode *node,
   cairo_restore (cr);
 }
 
-#define GSK_ROUNDED_CLIP_NODE_VARIANT_TYPE "(dddddddddddduv)"
-
-static GVariant *
-gsk_rounded_clip_node_serialize (GskRenderNode *node)
+static void
+gsk_rounded_clip_node_diff (GskRenderNode  *node1,
+                            GskRenderNode  *node2,
+                            cairo_region_t *region)
 {
-  GskRoundedClipNode *self = (GskRoundedClipNode *) node;
+  GskRoundedClipNode *self1 = (GskRoundedClipNode *) node1;
+  GskRoundedClipNode *self2 = (GskRoundedClipNode *) node2;
+  cairo_region_t *sub;
+
+  if (!gsk_rounded_rect_equal (&self1->clip, &self2->clip))
+    {
+      gsk_render_node_diff_impossible (node1, node2, region);
+      return;
+    }
 
-  return g_variant_new (GSK_ROUNDED_CLIP_NODE_VARIANT_TYPE,
-                        (double) self->clip.bounds.origin.x, (double) self->clip.bounds.origin.y,
-                        (double) self->clip.bounds.size.width, (double) self->clip.bounds.size.height,
-                        (double) self->clip.corner[0].width, (double) self->clip.corner[0].height,
-                        (double) self->clip.corner[1].width, (double) self->clip.corner[1].height,
-                        (double) self->clip.corner[2].width, (double) self->clip.corner[2].height,
-                        (double) self->clip.corner[3].width, (double) self->clip.corner[3].height,
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child));
+  sub = cairo_region_create ();
+  gsk_render_node_diff (self1->child, self2->child, sub);
+  gsk_render_node_diff_intersect_rect (sub, &self1->clip.bounds);
+  cairo_region_union (region, sub);
+  cairo_region_destroy (sub);
 }
 
+#define GSK_ROUNDED_CLIP_NODE_VARIANT_TYPE "(dddddddddddduv)"
+
 static GskRenderNode *
 gsk_rounded_clip_node_deserialize (GVariant  *variant,
                                    GError   **error)
@@ -3123,7 +3227,7 @@ static const GskRenderNodeClass GSK_ROUNDED_CLIP_NODE_CLASS = {
   "GskRoundedClipNode",
   gsk_rounded_clip_node_finalize,
   gsk_rounded_clip_node_draw,
-  gsk_rounded_clip_node_serialize,
+  gsk_rounded_clip_node_diff,
   gsk_rounded_clip_node_deserialize
 };
 
@@ -3269,31 +3373,55 @@ gsk_shadow_node_get_bounds (GskShadowNode *self,
   bounds->size.height += top + bottom;
 }
 
-#define GSK_SHADOW_NODE_VARIANT_TYPE "(uva(ddddddd))"
-
-static GVariant *
-gsk_shadow_node_serialize (GskRenderNode *node)
+static void
+gsk_shadow_node_diff (GskRenderNode  *node1,
+                      GskRenderNode  *node2,
+                      cairo_region_t *region)
 {
-  GskShadowNode *self = (GskShadowNode *) node;
-  GVariantBuilder builder;
+  GskShadowNode *self1 = (GskShadowNode *) node1;
+  GskShadowNode *self2 = (GskShadowNode *) node2;
+  cairo_region_t *sub;
   gsize i;
+  int j, n;
 
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ddddddd)"));
-  for (i = 0; i < self->n_shadows; i++)
+  if (self1->n_shadows != self2->n_shadows ||
+      memcmp (self1->shadows, self2->shadows, sizeof (GskShadow) * self1->n_shadows) != 0)
     {
-      g_variant_builder_add  (&builder, "(ddddddd)",
-                              self->shadows[i].color.red, self->shadows[i].color.green,
-                              self->shadows[i].color.blue, self->shadows[i].color.alpha,
-                              self->shadows[i].dx, self->shadows[i].dy,
-                              self->shadows[i].radius);
+      gsk_render_node_diff_impossible (node1, node2, region);
+      return;
     }
 
-  return g_variant_new (GSK_SHADOW_NODE_VARIANT_TYPE,
-                        (guint32) gsk_render_node_get_node_type (self->child),
-                        gsk_render_node_serialize_node (self->child),
-                        &builder);
+  sub = cairo_region_create ();
+  gsk_render_node_diff (self1->child, self2->child, sub);
+
+  /* Every changed area of the child also changes its shadows */
+  cairo_region_union (region, sub);
+  n = cairo_region_num_rectangles (sub);
+  for (i = 0; i < self1->n_shadows; i++)
+    {
+      const GskShadow *shadow = &self1->shadows[i];
+      int clip_radius = ceil (gsk_cairo_blur_compute_pixels (shadow->radius));
+
+      for (j = 0; j < n; j++)
+        {
+          cairo_rectangle_int_t rect;
+          graphene_rect_t bounds;
+
+          cairo_region_get_rectangle (sub, j, &rect);
+          graphene_rect_init (&bounds,
+                              rect.x + shadow->dx - clip_radius,
+                              rect.y + shadow->dy - clip_radius,
+                              rect.width + 2 * clip_radius,
+                              rect.height + 2 * clip_radius);
+          gsk_render_node_diff_add_rect (region, &bounds);
+        }
+    }
+
+  cairo_region_destroy (sub);
 }
 
+#define GSK_SHADOW_NODE_VARIANT_TYPE "(uva(ddddddd))"
+
 static GskRenderNode *
 gsk_shadow_node_deserialize (GVariant  *variant,
                              GError   **error)
@@ -3348,7 +3476,7 @@ static const GskRenderNodeClass GSK_SHADOW_NODE_CLASS = {
   "GskShadowNode",
   gsk_shadow_node_finalize,
   gsk_shadow_node_draw,
-  gsk_shadow_node_serialize,
+  gsk_shadow_node_diff,
   gsk_shadow_node_deserialize
 };
 
@@ -3503,21 +3631,28 @@ gsk_blend_node_draw (GskRenderNode *node,
   cairo_paint (cr);
 }
 
-#define GSK_BLEND_NODE_VARIANT_TYPE "(uvuvu)"
-
-static GVariant *
-gsk_blend_node_serialize (GskRenderNode *node)
+static void
+gsk_blend_node_diff (GskRenderNode  *node1,
+                     GskRenderNode  *node2,
+                     cairo_region_t *region)
 {
-  GskBlendNode *self = (GskBlendNode *) node;
+  GskBlendNode *self1 = (GskBlendNode *) node1;
+  GskBlendNode *self2 = (GskBlendNode *) node2;
 
-  return g_variant_new (GSK_BLEND_NODE_VARIANT_TYPE,
-                        (guint32) gsk_render_node_get_node_type (self->bottom),
-                        gsk_render_node_serialize_node (self->bottom),
-                        (guint32) gsk_render_node_get_node_type (self->top),
-                        gsk_render_node_serialize_node (self->top),
-                        (guint32) self->blend_mode);
+  /* All blend modes operate on single pixels */
+  if (self1->blend_mode == self2->blend_mode)
+    {
+      gsk_render_node_diff (self1->bottom, self2->bottom, region);
+      gsk_render_node_diff (self1->top, self2->top, region);
+    }
+  else
+    {
+      gsk_render_node_diff_impossible (node1, node2, region);
+    }
 }
 
+#define GSK_BLEND_NODE_VARIANT_TYPE "(uvuvu)"
+
 static GskRenderNode *
 gsk_blend_node_deserialize (GVariant  *variant,
                             GError   **error)
@@ -3564,7 +3699,7 @@ static const GskRenderNodeClass GSK_BLEND_NODE_CLASS = {
   "GskBlendNode",
   gsk_blend_node_finalize,
   gsk_blend_node_draw,
-  gsk_blend_node_serialize,
+  gsk_blend_node_diff,
   gsk_blend_node_deserialize
 };
 
@@ -3674,21 +3809,27 @@ gsk_cross_fade_node_draw (GskRenderNode *node,
   cairo_paint (cr);
 }
 
-#define GSK_CROSS_FADE_NODE_VARIANT_TYPE "(uvuvd)"
-
-static GVariant *
-gsk_cross_fade_node_serialize (GskRenderNode *node)
+static void
+gsk_cross_fade_node_diff (GskRenderNode  *node1,
+                          GskRenderNode  *node2,
+                          cairo_region_t *region)
 {
-  GskCrossFadeNode *self = (GskCrossFadeNode *) node;
+  GskCrossFadeNode *self1 = (GskCrossFadeNode *) node1;
+  GskCrossFadeNode *self2 = (GskCrossFadeNode *) node2;
 
-  return g_variant_new (GSK_CROSS_FADE_NODE_VARIANT_TYPE,
-                        (guint32) gsk_render_node_get_node_type (self->start),
-                        gsk_render_node_serialize_node (self->start),
-                        (guint32) gsk_render_node_get_node_type (self->end),
-                        gsk_render_node_serialize_node (self->end),
-                        (double) self->progress);
+  if (self1->progress == self2->progress)
+    {
+      gsk_render_node_diff (self1->start, self2->start, region);
+      gsk_render_node_diff (self1->end, self2->end, region);
+    }
+  else
+    {
+      gsk_render_node_diff_impossible (node1, node2, region);
+    }
 }
 
+#define GSK_CROSS_FADE_NODE_VARIANT_TYPE "(uvuvd)"
+
 static GskRenderNode *
 gsk_cross_fade_node_deserialize (GVariant  *variant,
                                  GError   **error)
@@ -3736,7 +3877,7 @@ static const GskRenderNodeClass GSK_CROSS_FADE_NODE_CLASS = {
   "GskCrossFadeNode",
   gsk_cross_fade_node_finalize,
   gsk_cross_fade_node_draw,
-  gsk_cross_fade_node_serialize,
+  gsk_cross_fade_node_diff,
   gsk_cross_fade_node_deserialize
 };
 
@@ -3804,6 +3945,259 @@ gsk_cross_fade_node_get_progress (GskRenderNode *node)
   return self->progress;
 }
 
+/*** GSK_TEXT_NODE ***/
+
+typedef struct _GskTextNode GskTextNode;
+
+struct _GskTextNode
+{
+  GskRenderNode render_node;
+
+  PangoFont *font;
+  PangoGlyphString *glyphs;
+
+  GdkRGBA color;
+  double x;
+  double y;
+};
+
+static void
+gsk_text_node_finalize (GskRenderNode *node)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  g_object_unref (self->font);
+  pango_glyph_string_free (self->glyphs);
+}
+
+G_LOCK_DEFINE_STATIC (text_drawing);
+
+static void
+gsk_text_node_draw (GskRenderNode *node,
+                    cairo_t       *cr)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  cairo_save (cr);
+
+  gdk_cairo_set_source_rgba (cr, &self->color);
+  cairo_translate (cr, self->x, self->y);
+  cairo_move_to (cr, 0, 0);
+
+  /* Pango fonts are not thread-safe, and both the tiles of the Cairo
+   * renderer and the fallbacks of the Vulkan renderer are drawn in
+   * multiple threads
+   */
+  G_LOCK (text_drawing);
+  pango_cairo_show_glyph_string (cr, self->font, self->glyphs);
+  G_UNLOCK (text_drawing);
+
+  cairo_restore (cr);
+}
+
+static void
+gsk_text_node_diff (GskRenderNode  *node1,
+                    GskRenderNode  *node2,
+                    cairo_region_t *region)
+{
+  GskTextNode *self1 = (GskTextNode *) node1;
+  GskTextNode *self2 = (GskTextNode *) node2;
+
+  if (self1->font == self2->font &&
+      gdk_rgba_equal (&self1->color, &self2->color) &&
+      self1->x == self2->x &&
+      self1->y == self2->y &&
+      self1->glyphs->num_glyphs == self2->glyphs->num_glyphs &&
+      memcmp (self1->glyphs->glyphs, self2->glyphs->glyphs,
+              sizeof (PangoGlyphInfo) * self1->glyphs->num_glyphs) == 0)
+    return;
+
+  gsk_render_node_diff_impossible (node1, node2, region);
+}
+
+#define GSK_TEXT_NODE_VARIANT_TYPE "(sdddddda(uiiiu))"
+
+static GskRenderNode *
+gsk_text_node_deserialize (GVariant  *variant,
+                           GError   **error)
+{
+  PangoFontDescription *desc;
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFont *font;
+  PangoGlyphString *glyphs;
+  GVariantIter *iter;
+  GskRenderNode *result;
+  GdkRGBA color;
+  double x, y;
+  char *desc_string;
+  guint32 glyph, is_cluster_start;
+  gint32 width, x_offset, y_offset;
+  int i;
+
+  if (!check_variant_type (variant, GSK_TEXT_NODE_VARIANT_TYPE, error))
+    return NULL;
+
+  g_variant_get (variant, GSK_TEXT_NODE_VARIANT_TYPE,
+                 &desc_string,
+                 &color.red, &color.green, &color.blue, &color.alpha,
+                 &x, &y,
+                 &iter);
+
+  desc = pango_font_description_from_string (desc_string);
+  fontmap = pango_cairo_font_map_get_default ();
+  context = pango_font_map_create_context (fontmap);
+  font = pango_font_map_load_font (fontmap, context, desc);
+  g_object_unref (context);
+  pango_font_description_free (desc);
+
+  if (font == NULL)
+    {
+      g_set_error (error, GSK_SERIALIZATION_ERROR, GSK_SERIALIZATION_INVALID_DATA,
+                   "Could not load font '%s'", desc_string);
+      g_variant_iter_free (iter);
+      g_free (desc_string);
+      return NULL;
+    }
+
+  glyphs = pango_glyph_string_new ();
+  pango_glyph_string_set_size (glyphs, g_variant_iter_n_children (iter));
+  i = 0;
+  while (g_variant_iter_next (iter, "(uiiiu)", &glyph, &width, &x_offset, &y_offset, &is_cluster_start))
+    {
+      glyphs->glyphs[i].glyph = glyph;
+      glyphs->glyphs[i].geometry.width = width;
+      glyphs->glyphs[i].geometry.x_offset = x_offset;
+      glyphs->glyphs[i].geometry.y_offset = y_offset;
+      glyphs->glyphs[i].attr.is_cluster_start = is_cluster_start;
+      glyphs->log_clusters[i] = i;
+      i++;
+    }
+
+  result = gsk_text_node_new (font, glyphs, &color, x, y);
+
+  pango_glyph_string_free (glyphs);
+  g_object_unref (font);
+  g_variant_iter_free (iter);
+  g_free (desc_string);
+
+  return result;
+}
+
+static const GskRenderNodeClass GSK_TEXT_NODE_CLASS = {
+  GSK_TEXT_NODE,
+  sizeof (GskTextNode),
+  "GskTextNode",
+  gsk_text_node_finalize,
+  gsk_text_node_draw,
+  gsk_text_node_diff,
+  gsk_text_node_deserialize
+};
+
+/**
+ * gsk_text_node_new:
+ * @font: the #PangoFont containing the glyphs
+ * @glyphs: the #PangoGlyphString to render
+ * @color: the foreground color to render with
+ * @x: the x coordinate of the start of the baseline
+ * @y: the y coordinate of the baseline
+ *
+ * Creates a render node that renders the given glyphs.
+ * Note that @color may not be used if the font contains
+ * color glyphs.
+ *
+ * Unlike a #GskCairoNode, the glyphs are kept around, so
+ * renderers can draw them from a glyph cache instead of
+ * uploading a new surface every time the text changes.
+ *
+ * Returns: a new text node
+ *
+ * Since: 3.92
+ */
+GskRenderNode *
+gsk_text_node_new (PangoFont        *font,
+                   PangoGlyphString *glyphs,
+                   const GdkRGBA    *color,
+                   double            x,
+                   double            y)
+{
+  GskTextNode *self;
+  PangoRectangle ink_rect;
+
+  g_return_val_if_fail (PANGO_IS_FONT (font), NULL);
+  g_return_val_if_fail (glyphs != NULL, NULL);
+  g_return_val_if_fail (color != NULL, NULL);
+
+  self = (GskTextNode *) gsk_render_node_new (&GSK_TEXT_NODE_CLASS, 0);
+
+  self->font = g_object_ref (font);
+  self->glyphs = pango_glyph_string_copy (glyphs);
+  self->color = *color;
+  self->x = x;
+  self->y = y;
+
+  pango_glyph_string_extents (self->glyphs, self->font, &ink_rect, NULL);
+  pango_extents_to_pixels (&ink_rect, NULL);
+
+  graphene_rect_init (&self->render_node.bounds,
+                      x + ink_rect.x,
+                      y + ink_rect.y,
+                      ink_rect.width,
+                      ink_rect.height);
+
+  return &self->render_node;
+}
+
+PangoFont *
+gsk_text_node_peek_font (GskRenderNode *node)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_TEXT_NODE), NULL);
+
+  return self->font;
+}
+
+PangoGlyphString *
+gsk_text_node_peek_glyphs (GskRenderNode *node)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_TEXT_NODE), NULL);
+
+  return self->glyphs;
+}
+
+const GdkRGBA *
+gsk_text_node_peek_color (GskRenderNode *node)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_TEXT_NODE), NULL);
+
+  return &self->color;
+}
+
+double
+gsk_text_node_get_x (GskRenderNode *node)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_TEXT_NODE), 0.0);
+
+  return self->x;
+}
+
+double
+gsk_text_node_get_y (GskRenderNode *node)
+{
+  GskTextNode *self = (GskTextNode *) node;
+
+  g_return_val_if_fail (GSK_IS_RENDER_NODE_TYPE (node, GSK_TEXT_NODE), 0.0);
+
+  return self->y;
+}
+
 static const GskRenderNodeClass *klasses[] = {
   [GSK_CONTAINER_NODE] = &GSK_CONTAINER_NODE_CLASS,
   [GSK_CAIRO_NODE] = &GSK_CAIRO_NODE_CLASS,
@@ -3821,7 +4215,8 @@ static const GskRenderNodeClass *klasses[] = {
   [GSK_ROUNDED_CLIP_NODE] = &GSK_ROUNDED_CLIP_NODE_CLASS,
   [GSK_SHADOW_NODE] = &GSK_SHADOW_NODE_CLASS,
   [GSK_BLEND_NODE] = &GSK_BLEND_NODE_CLASS,
-  [GSK_CROSS_FADE_NODE] = &GSK_CROSS_FADE_NODE_CLASS
+  [GSK_CROSS_FADE_NODE] = &GSK_CROSS_FADE_NODE_CLASS,
+  [GSK_TEXT_NODE] = &GSK_TEXT_NODE_CLASS
 };
 
 GskRenderNode *
@@ -3848,10 +4243,3 @@ gsk_render_node_deserialize_node (GskRenderNodeType   type,
 
   return result;
 }
-
-GVariant *
-gsk_render_node_serialize_node (GskRenderNode *node)
-{
-  return node->node_class->serialize (node);
-}
-
@@ -34,16 +34,27 @@ struct _GskRenderNodeClass
   void (* finalize) (GskRenderNode *node);
   void (* draw) (GskRenderNode *node,
                  cairo_t       *cr);
-  GVariant * (* serialize) (GskRenderNode *node);
+  void (* diff) (GskRenderNode  *node1,
+                 GskRenderNode  *node2,
+                 cairo_region_t *region);
   GskRenderNode * (* deserialize) (GVariant  *variant,
                                    GError   **error);
 };
 
 GskRenderNode *gsk_render_node_new (const GskRenderNodeClass *node_class, gsize extra_size);
 
-GVariant * gsk_render_node_serialize_node (GskRenderNode *node);
+GDK_AVAILABLE_IN_ALL
+void gsk_render_node_diff (GskRenderNode *node1, GskRenderNode *node2, cairo_region_t *region);
+void gsk_render_node_diff_impossible (GskRenderNode *node1, GskRenderNode *node2, cairo_region_t *region);
+void gsk_render_node_diff_add_rect (cairo_region_t *region, const graphene_rect_t *rect);
+void gsk_render_node_diff_intersect_rect (cairo_region_t *region, const graphene_rect_t *rect);
+
+gboolean gsk_render_node_get_opaque_rect (GskRenderNode *node, graphene_rect_t *rect);
+
 GskRenderNode * gsk_render_node_deserialize_node (GskRenderNodeType type, GVariant *variant, GError **error);
 
+guint gsk_container_node_get_first_visible_child (GskRenderNode *node, const graphene_rect_t *visible);
+
 double gsk_opacity_node_get_opacity (GskRenderNode *node);
 
 GskRenderNode * gsk_color_matrix_node_get_child (GskRenderNode *node);
@@ -78,6 +89,7 @@ float gsk_outset_shadow_node_get_blur_radius (GskRenderNode *node);
 
 GskRenderNode *gsk_cairo_node_new_for_surface (const graphene_rect_t *bounds, cairo_surface_t *surface);
 cairo_surface_t *gsk_cairo_node_get_surface (GskRenderNode *node);
+guint gsk_cairo_node_get_surface_serial (GskRenderNode *node);
 
 GskTexture *gsk_texture_node_get_texture (GskRenderNode *node);
 
@@ -101,6 +113,12 @@ GskRenderNode * gsk_cross_fade_node_get_start_child (GskRenderNode *node);
 GskRenderNode * gsk_cross_fade_node_get_end_child (GskRenderNode *node);
 double gsk_cross_fade_node_get_progress (GskRenderNode *node);
 
+PangoFont * gsk_text_node_peek_font (GskRenderNode *node);
+PangoGlyphString * gsk_text_node_peek_glyphs (GskRenderNode *node);
+const GdkRGBA * gsk_text_node_peek_color (GskRenderNode *node);
+double gsk_text_node_get_x (GskRenderNode *node);
+double gsk_text_node_get_y (GskRenderNode *node);
+
 G_END_DECLS
 
 #endif /* __GSK_RENDER_NODE_PRIVATE_H__ */
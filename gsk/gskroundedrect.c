@@ -500,6 +500,24 @@ gsk_rounded_rect_path (const GskRoundedRect *self,
   cairo_close_path (cr);
 }
 
+gboolean
+gsk_rounded_rect_equal (const GskRoundedRect *rect1,
+                        const GskRoundedRect *rect2)
+{
+  guint i;
+
+  if (!graphene_rect_equal (&rect1->bounds, &rect2->bounds))
+    return FALSE;
+
+  for (i = 0; i < 4; i++)
+    {
+      if (!graphene_size_equal (&rect1->corner[i], &rect2->corner[i]))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 /*
  * Converts to the format we use in our shaders:
  * vec4 rect;
@@ -22,6 +22,9 @@ struct _GskShaderBuilder
   char *vertex_preamble;
   char *fragment_preamble;
 
+  /* Shared code appended to the preamble of every fragment shader */
+  GPtrArray *fragment_includes;
+
   int version;
 
   GPtrArray *defines;
@@ -68,6 +71,7 @@ gsk_shader_builder_finalize (GObject *gobject)
   g_free (self->vertex_preamble);
   g_free (self->fragment_preamble);
 
+  g_clear_pointer (&self->fragment_includes, g_ptr_array_unref);
   g_clear_pointer (&self->defines, g_ptr_array_unref);
   g_clear_pointer (&self->uniforms, g_ptr_array_unref);
   g_clear_pointer (&self->attributes, g_ptr_array_unref);
@@ -86,6 +90,7 @@ gsk_shader_builder_class_init (GskShaderBuilderClass *klass)
 static void
 gsk_shader_builder_init (GskShaderBuilder *self)
 {
+  self->fragment_includes = g_ptr_array_new_with_free_func (g_free);
   self->defines = g_ptr_array_new_with_free_func (g_free);
   self->uniforms = g_ptr_array_new_with_free_func (g_free);
   self->attributes = g_ptr_array_new_with_free_func (g_free);
@@ -131,6 +136,16 @@ gsk_shader_builder_set_fragment_preamble (GskShaderBuilder *builder,
   builder->fragment_preamble = g_strdup (fragment_preamble);
 }
 
+void
+gsk_shader_builder_add_fragment_include (GskShaderBuilder *builder,
+                                         const char       *shader_include)
+{
+  g_return_if_fail (GSK_IS_SHADER_BUILDER (builder));
+  g_return_if_fail (shader_include != NULL);
+
+  g_ptr_array_add (builder->fragment_includes, g_strdup (shader_include));
+}
+
 void
 gsk_shader_builder_set_version (GskShaderBuilder *builder,
                                 int               version)
@@ -249,6 +264,22 @@ gsk_shader_builder_compile_shader (GskShaderBuilder *builder,
 
   g_string_append_c (code, '\n');
 
+  if (shader_type == GL_FRAGMENT_SHADER)
+    {
+      for (i = 0; i < builder->fragment_includes->len; i++)
+        {
+          const char *include = g_ptr_array_index (builder->fragment_includes, i);
+
+          if (!lookup_shader_code (code, builder->resource_base_path, include, error))
+            {
+              g_string_free (code, TRUE);
+              return -1;
+            }
+
+          g_string_append_c (code, '\n');
+        }
+    }
+
   if (!lookup_shader_code (code, builder->resource_base_path, shader_source, error))
     {
       g_string_free (code, TRUE);
@@ -343,6 +374,7 @@ gsk_shader_builder_create_program (GskShaderBuilder *builder,
   int vertex_id, fragment_id;
   int program_id;
   int status;
+  int i;
 
   g_return_val_if_fail (GSK_IS_SHADER_BUILDER (builder), -1);
   g_return_val_if_fail (vertex_shader != NULL, -1);
@@ -368,6 +400,13 @@ gsk_shader_builder_create_program (GskShaderBuilder *builder,
   program_id = glCreateProgram ();
   glAttachShader (program_id, vertex_id);
   glAttachShader (program_id, fragment_id);
+
+  /* Give every attribute the same location in all programs, so that
+   * the same vertex array can be used with any of them
+   */
+  for (i = 0; i < builder->attributes->len; i++)
+    glBindAttribLocation (program_id, i, g_ptr_array_index (builder->attributes, i));
+
   glLinkProgram (program_id);
 
   glGetProgramiv (program_id, GL_LINK_STATUS, &status);
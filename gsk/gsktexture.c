@@ -140,6 +140,8 @@ gsk_texture_dispose (GObject *object)
 
   gsk_texture_clear_render_data (self);
 
+  g_clear_pointer (&self->async_surface, cairo_surface_destroy);
+
   G_OBJECT_CLASS (gsk_texture_parent_class)->dispose (object);
 }
 
@@ -408,6 +410,21 @@ gsk_texture_new_for_pixbuf (GdkPixbuf *pixbuf)
   return GSK_TEXTURE (self);
 }
 
+/* Whether all pixels of @texture are known to be opaque, without
+ * looking at the pixel data
+ */
+gboolean
+gsk_texture_is_opaque (GskTexture *texture)
+{
+  if (GSK_IS_CAIRO_TEXTURE (texture))
+    return cairo_image_surface_get_format (GSK_CAIRO_TEXTURE (texture)->surface) == CAIRO_FORMAT_RGB24;
+
+  if (GSK_IS_PIXBUF_TEXTURE (texture))
+    return !gdk_pixbuf_get_has_alpha (GSK_PIXBUF_TEXTURE (texture)->pixbuf);
+
+  return FALSE;
+}
+
 /**
  * gsk_texture_get_width:
  * @texture: a #GskTexture
@@ -450,6 +467,87 @@ gsk_texture_download_surface (GskTexture *texture)
   return GSK_TEXTURE_GET_CLASS (texture)->download_surface (texture);
 }
 
+/* Converting the pixels of big textures takes long enough to drop
+ * frames, so it happens in a thread
+ */
+#define ASYNC_DOWNLOAD_MIN_PIXELS (256 * 256)
+
+static void
+gsk_texture_download_surface_thread (GTask        *task,
+                                     gpointer      source_object,
+                                     gpointer      task_data,
+                                     GCancellable *cancellable)
+{
+  g_task_return_pointer (task,
+                         gsk_texture_download_surface (source_object),
+                         (GDestroyNotify) cairo_surface_destroy);
+}
+
+static void
+gsk_texture_download_surface_done (GObject      *source_object,
+                                   GAsyncResult *result,
+                                   gpointer      data)
+{
+  GskTexture *self = GSK_TEXTURE (source_object);
+  GSList *l;
+
+  self->async_pending = FALSE;
+  g_clear_pointer (&self->async_surface, cairo_surface_destroy);
+  self->async_surface = g_task_propagate_pointer (G_TASK (result), NULL);
+
+  /* A renderer uploaded the texture synchronously in the meantime */
+  if (self->render_key != NULL)
+    g_clear_pointer (&self->async_surface, cairo_surface_destroy);
+
+  for (l = self->async_windows; l; l = l->next)
+    gdk_window_invalidate_rect (l->data, NULL, FALSE);
+
+  g_slist_free_full (self->async_windows, g_object_unref);
+  self->async_windows = NULL;
+}
+
+/* Like gsk_texture_download_surface(), but if getting the surface
+ * means converting a lot of pixels, it is done in a thread and %NULL
+ * is returned in the meantime. Once the surface is ready, @window is
+ * invalidated so that the next frame can use it.
+ *
+ * The converted surface stays with the texture until a renderer stores
+ * its upload with gsk_texture_set_render_data(). If a renderer already
+ * did, a new upload can't be kept either, so the surface is downloaded
+ * right away.
+ *
+ * With a %NULL @window, the surface is always returned.
+ */
+cairo_surface_t *
+gsk_texture_download_surface_async (GskTexture *texture,
+                                    GdkWindow  *window)
+{
+  GTask *task;
+
+  if (texture->async_surface)
+    return cairo_surface_reference (texture->async_surface);
+
+  if (window == NULL ||
+      texture->render_key != NULL ||
+      !GSK_IS_PIXBUF_TEXTURE (texture) ||
+      texture->width * texture->height < ASYNC_DOWNLOAD_MIN_PIXELS)
+    return gsk_texture_download_surface (texture);
+
+  if (!g_slist_find (texture->async_windows, window))
+    texture->async_windows = g_slist_prepend (texture->async_windows, g_object_ref (window));
+
+  if (!texture->async_pending)
+    {
+      texture->async_pending = TRUE;
+
+      task = g_task_new (texture, NULL, gsk_texture_download_surface_done, NULL);
+      g_task_run_in_thread (task, gsk_texture_download_surface_thread);
+      g_object_unref (task);
+    }
+
+  return NULL;
+}
+
 /**
  * gsk_texture_download:
  * @texture: a #GskTexture
@@ -503,6 +601,9 @@ gsk_texture_set_render_data (GskTexture     *self,
   self->render_data = data;
   self->render_notify = notify;
 
+  /* The upload is kept now, so the converted pixels aren't needed */
+  g_clear_pointer (&self->async_surface, cairo_surface_destroy);
+
   return TRUE;
 }
 
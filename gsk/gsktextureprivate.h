@@ -19,6 +19,11 @@ struct _GskTexture
   gpointer render_key;
   gpointer render_data;
   GDestroyNotify render_notify;
+
+  /* State of gsk_texture_download_surface_async() */
+  cairo_surface_t *async_surface;
+  GSList *async_windows;
+  gboolean async_pending;
 };
 
 struct _GskTextureClass {
@@ -35,6 +40,10 @@ gpointer                gsk_texture_new                 (const GskTextureClass
                                                          int                     height);
 GskTexture *            gsk_texture_new_for_surface     (cairo_surface_t        *surface);
 cairo_surface_t *       gsk_texture_download_surface    (GskTexture             *texture);
+cairo_surface_t *       gsk_texture_download_surface_async
+                                                        (GskTexture             *texture,
+                                                         GdkWindow              *window);
+gboolean                gsk_texture_is_opaque           (GskTexture             *texture);
 
 gboolean                gsk_texture_set_render_data     (GskTexture             *self,
                                                          gpointer                key,
@@ -46,12 +46,13 @@ gsk_vulkan_buffer_new_internal (GdkVulkanContext  *context,
   self->memory = gsk_vulkan_memory_new (context,
                                         requirements.memoryTypeBits,
                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        size);
+                                        requirements.size,
+                                        requirements.alignment);
 
   GSK_VK_CHECK (vkBindBufferMemory, gdk_vulkan_context_get_device (context),
                                     self->vk_buffer,
                                     gsk_vulkan_memory_get_device_memory (self->memory),
-                                    0);
+                                    gsk_vulkan_memory_get_offset (self->memory));
   return self;
 }
 
@@ -97,6 +98,12 @@ gsk_vulkan_buffer_get_buffer (GskVulkanBuffer *self)
   return self->vk_buffer;
 }
 
+gsize
+gsk_vulkan_buffer_get_size (GskVulkanBuffer *self)
+{
+  return self->size;
+}
+
 guchar *
 gsk_vulkan_buffer_map (GskVulkanBuffer *self)
 {
@@ -133,25 +133,59 @@ gsk_vulkan_clip_transform (GskVulkanClip           *dest,
                            const graphene_matrix_t *transform,
                            const graphene_rect_t   *viewport)
 {
-  switch (dest->type)
-    {
-    default:
-      g_assert_not_reached();
-      return FALSE;
+  double xx, yx, xy, yy, dx, dy;
+  guint i;
 
-    case GSK_VULKAN_CLIP_ALL_CLIPPED:
+  if (src->type == GSK_VULKAN_CLIP_ALL_CLIPPED)
+    {
       gsk_vulkan_clip_init_copy (dest, src);
       return TRUE;
+    }
 
-    case GSK_VULKAN_CLIP_NONE:
+  /* The clip is applied in the coordinates of the child, so it needs to be
+   * mapped back through the transform. That keeps it a (rounded) rectangle
+   * only for translations and scales.
+   */
+  if (!graphene_matrix_to_2d (transform, &xx, &yx, &xy, &yy, &dx, &dy) ||
+      yx != 0.0 || xy != 0.0 || xx <= 0.0 || yy <= 0.0)
+    {
+      if (src->type != GSK_VULKAN_CLIP_NONE)
+        {
+          /* FIXME: Handle rotations and projections */
+          return FALSE;
+        }
+
+      /* Nothing is clipped, so the child's bounds are a safe visible area */
       gsk_vulkan_clip_init_empty (dest, viewport);
       return TRUE;
+    }
+
+  gsk_vulkan_clip_init_copy (dest, src);
+  graphene_rect_init (&dest->rect.bounds,
+                      (src->rect.bounds.origin.x - dx) / xx,
+                      (src->rect.bounds.origin.y - dy) / yy,
+                      src->rect.bounds.size.width / xx,
+                      src->rect.bounds.size.height / yy);
 
+  switch (src->type)
+    {
+    default:
+      g_assert_not_reached();
+      return FALSE;
+
+    case GSK_VULKAN_CLIP_NONE:
     case GSK_VULKAN_CLIP_RECT:
+      return TRUE;
+
     case GSK_VULKAN_CLIP_ROUNDED_CIRCULAR:
     case GSK_VULKAN_CLIP_ROUNDED:
-      /* FIXME: Handle 2D operations, in particular transform and scale */
-      return FALSE;
+      for (i = 0; i < 4; i++)
+        {
+          dest->rect.corner[i].width /= xx;
+          dest->rect.corner[i].height /= yy;
+        }
+      dest->type = gsk_rounded_rect_is_circular (&dest->rect) ? GSK_VULKAN_CLIP_ROUNDED_CIRCULAR : GSK_VULKAN_CLIP_ROUNDED;
+      return TRUE;
     }
 }
 
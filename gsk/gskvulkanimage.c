@@ -20,6 +20,10 @@ struct _GskVulkanUploader
 
   GSList *staging_image_free_list;
   GSList *staging_buffer_free_list;
+
+  /* Totals over the lifetime of the uploader */
+  guint64 n_uploads;
+  guint64 upload_bytes;
 };
 
 struct _GskVulkanImage
@@ -32,6 +36,8 @@ struct _GskVulkanImage
   gsize height;
   VkImage vk_image;
   VkImageView vk_image_view;
+  /* Only tracked for images created with gsk_vulkan_image_new_for_atlas() */
+  VkImageLayout vk_image_layout;
 
   GskVulkanMemory *memory;
 };
@@ -92,8 +98,9 @@ gsk_vulkan_uploader_get_copy_buffer (GskVulkanUploader *self)
   return self->copy_buffer;
 }
 
-void
-gsk_vulkan_uploader_upload (GskVulkanUploader *self)
+static void
+gsk_vulkan_uploader_submit (GskVulkanUploader *self,
+                            VkFence            fence)
 {
   if (self->before_barriers->len > 0)
     {
@@ -107,7 +114,7 @@ gsk_vulkan_uploader_upload (GskVulkanUploader *self)
                             0, NULL,
                             0, NULL,
                             self->before_barriers->len, (VkImageMemoryBarrier *) self->before_barriers->data);
-      gsk_vulkan_command_pool_submit_buffer (self->command_pool, command_buffer, VK_NULL_HANDLE);
+      gsk_vulkan_command_pool_submit_buffer (self->command_pool, command_buffer, 0, NULL, 0, NULL, VK_NULL_HANDLE);
       g_array_set_size (self->before_barriers, 0);
     }
 
@@ -127,11 +134,17 @@ gsk_vulkan_uploader_upload (GskVulkanUploader *self)
 
   if (self->copy_buffer != VK_NULL_HANDLE)
     {
-      gsk_vulkan_command_pool_submit_buffer (self->command_pool, self->copy_buffer, VK_NULL_HANDLE);
+      gsk_vulkan_command_pool_submit_buffer (self->command_pool, self->copy_buffer, 0, NULL, 0, NULL, fence);
       self->copy_buffer = VK_NULL_HANDLE;
     }
 }
 
+void
+gsk_vulkan_uploader_upload (GskVulkanUploader *self)
+{
+  gsk_vulkan_uploader_submit (self, VK_NULL_HANDLE);
+}
+
 void
 gsk_vulkan_uploader_reset (GskVulkanUploader *self)
 {
@@ -145,6 +158,15 @@ gsk_vulkan_uploader_reset (GskVulkanUploader *self)
   self->staging_buffer_free_list = NULL;
 }
 
+void
+gsk_vulkan_uploader_get_stats (GskVulkanUploader *self,
+                               guint64           *n_uploads,
+                               guint64           *upload_bytes)
+{
+  *n_uploads = self->n_uploads;
+  *upload_bytes = self->upload_bytes;
+}
+
 static GskVulkanImage *
 gsk_vulkan_image_new (GdkVulkanContext      *context,
                       gsize                  width,
@@ -187,12 +209,13 @@ gsk_vulkan_image_new (GdkVulkanContext      *context,
   self->memory = gsk_vulkan_memory_new (context,
                                         requirements.memoryTypeBits,
                                         memory,
-                                        requirements.size);
+                                        requirements.size,
+                                        requirements.alignment);
 
   GSK_VK_CHECK (vkBindImageMemory, gdk_vulkan_context_get_device (context),
                                    self->vk_image,
                                    gsk_vulkan_memory_get_device_memory (self->memory),
-                                   0);
+                                   gsk_vulkan_memory_get_offset (self->memory));
   return self;
 }
 
@@ -533,6 +556,9 @@ gsk_vulkan_image_new_from_data (GskVulkanUploader *uploader,
                                 gsize              height,
                                 gsize              stride)
 {
+  uploader->n_uploads += 1;
+  uploader->upload_bytes += width * height * 4;
+
   if (GSK_RENDER_MODE_CHECK (STAGING_BUFFER))
     return gsk_vulkan_image_new_from_data_via_staging_buffer (uploader, data, width, height, stride);
   if (GSK_RENDER_MODE_CHECK (STAGING_IMAGE))
@@ -582,14 +608,147 @@ gsk_vulkan_image_new_for_framebuffer (GdkVulkanContext *context,
   return self;
 }
 
+GskVulkanImage *
+gsk_vulkan_image_new_for_atlas (GdkVulkanContext *context,
+                                gsize             width,
+                                gsize             height)
+{
+  GskVulkanImage *self;
+
+  self = gsk_vulkan_image_new (context,
+                               width,
+                               height,
+                               VK_IMAGE_TILING_OPTIMAL,
+                               VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  self->vk_image_layout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+
+  gsk_vulkan_image_ensure_view (self, VK_FORMAT_B8G8R8A8_UNORM);
+
+  return self;
+}
+
+/* Uploads @data to the area of an atlas image at @x, @y. Frames that
+ * are still in flight may sample other areas of the image, so the
+ * barriers wait for their fragment shaders.
+ */
+void
+gsk_vulkan_image_upload_region (GskVulkanImage    *self,
+                                GskVulkanUploader *uploader,
+                                guchar            *data,
+                                gsize              width,
+                                gsize              height,
+                                gsize              stride,
+                                gsize              x,
+                                gsize              y)
+{
+  VkCommandBuffer command_buffer;
+  GskVulkanBuffer *staging;
+  guchar *mem;
+
+  uploader->n_uploads += 1;
+  uploader->upload_bytes += width * height * 4;
+
+  staging = gsk_vulkan_buffer_new_staging (uploader->vulkan, width * height * 4);
+  mem = gsk_vulkan_buffer_map (staging);
+
+  for (gsize i = 0; i < height; i++)
+    {
+      memcpy (mem + i * width * 4, data + i * stride, width * 4);
+    }
+
+  gsk_vulkan_buffer_unmap (staging);
+
+  command_buffer = gsk_vulkan_uploader_get_copy_buffer (uploader);
+
+  vkCmdPipelineBarrier (command_buffer,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        0,
+                        0, NULL,
+                        0, NULL,
+                        1, &(VkImageMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .oldLayout = self->vk_image_layout,
+                            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                            .image = self->vk_image,
+                            .subresourceRange = {
+                                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                .baseMipLevel = 0,
+                                .levelCount = 1,
+                                .baseArrayLayer = 0,
+                                .layerCount = 1
+                            }
+                        });
+
+  vkCmdCopyBufferToImage (command_buffer,
+                          gsk_vulkan_buffer_get_buffer (staging),
+                          self->vk_image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          1,
+                          (VkBufferImageCopy[1]) {
+                               {
+                                   .bufferOffset = 0,
+                                   .imageSubresource = {
+                                       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                       .mipLevel = 0,
+                                       .baseArrayLayer = 0,
+                                       .layerCount = 1
+                                   },
+                                   .imageOffset = { x, y, 0 },
+                                   .imageExtent = {
+                                       .width = width,
+                                       .height = height,
+                                       .depth = 1
+                                   }
+                               }
+                          });
+
+  vkCmdPipelineBarrier (command_buffer,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        0,
+                        0, NULL,
+                        0, NULL,
+                        1, &(VkImageMemoryBarrier) {
+                            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                            .image = self->vk_image,
+                            .subresourceRange = {
+                                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                .baseMipLevel = 0,
+                                .levelCount = 1,
+                                .baseArrayLayer = 0,
+                                .layerCount = 1
+                            }
+                        });
+
+  self->vk_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  uploader->staging_buffer_free_list = g_slist_prepend (uploader->staging_buffer_free_list, staging);
+}
+
 GskTexture *
 gsk_vulkan_image_download (GskVulkanImage    *self,
                            GskVulkanUploader *uploader)
 {
   GskVulkanBuffer *buffer;
   GskTexture *texture;
+  VkDevice device;
+  VkFence fence;
   guchar *mem;
 
+  device = gdk_vulkan_context_get_device (self->vulkan);
+
   gsk_vulkan_uploader_add_image_barrier (uploader,
                                          FALSE,
                                          &(VkImageMemoryBarrier) {
@@ -635,9 +794,25 @@ gsk_vulkan_image_download (GskVulkanImage    *self,
                                }
                           });
 
-  gsk_vulkan_uploader_upload (uploader);
-
-  GSK_VK_CHECK (vkQueueWaitIdle, gdk_vulkan_context_get_queue (self->vulkan));
+  /* Only wait for the copy, not for the whole queue, as other frames
+   * may still be in flight
+   */
+  GSK_VK_CHECK (vkCreateFence, device,
+                               &(VkFenceCreateInfo) {
+                                   .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+                                   .flags = 0
+                               },
+                               NULL,
+                               &fence);
+
+  gsk_vulkan_uploader_submit (uploader, fence);
+
+  GSK_VK_CHECK (vkWaitForFences, device,
+                                 1,
+                                 &fence,
+                                 VK_TRUE,
+                                 INT64_MAX);
+  vkDestroyFence (device, fence, NULL);
 
   mem = gsk_vulkan_buffer_map (buffer);
   texture = gsk_texture_new_for_data (mem, self->width, self->height, self->width * 4);
@@ -20,6 +20,9 @@ void                    gsk_vulkan_uploader_free                        (GskVulk
 
 void                    gsk_vulkan_uploader_reset                       (GskVulkanUploader      *self);
 void                    gsk_vulkan_uploader_upload                      (GskVulkanUploader      *self);
+void                    gsk_vulkan_uploader_get_stats                   (GskVulkanUploader      *self,
+                                                                         guint64                *n_uploads,
+                                                                         guint64                *upload_bytes);
 
 GskVulkanImage *        gsk_vulkan_image_new_for_swapchain              (GdkVulkanContext       *context,
                                                                          VkImage                 image,
@@ -34,6 +37,17 @@ GskVulkanImage *        gsk_vulkan_image_new_from_data                  (GskVulk
 GskVulkanImage *        gsk_vulkan_image_new_for_framebuffer            (GdkVulkanContext       *context,
                                                                          gsize                   width,
                                                                          gsize                   height);
+GskVulkanImage *        gsk_vulkan_image_new_for_atlas                  (GdkVulkanContext       *context,
+                                                                         gsize                   width,
+                                                                         gsize                   height);
+void                    gsk_vulkan_image_upload_region                  (GskVulkanImage         *self,
+                                                                         GskVulkanUploader      *uploader,
+                                                                         guchar                 *data,
+                                                                         gsize                   width,
+                                                                         gsize                   height,
+                                                                         gsize                   stride,
+                                                                         gsize                   x,
+                                                                         gsize                   y);
 
 GskTexture *            gsk_vulkan_image_download                       (GskVulkanImage         *self,
                                                                          GskVulkanUploader      *uploader);
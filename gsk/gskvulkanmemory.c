@@ -3,52 +3,324 @@
 #include "gskvulkanpipelineprivate.h"
 #include "gskvulkanmemoryprivate.h"
 
+#include "gskdebugprivate.h"
+
+/* Drivers limit the number of allocations and allocating device memory
+ * is slow, so memory is allocated in large blocks per memory type and
+ * handed out in pieces. Host visible blocks stay mapped for their whole
+ * lifetime, as a VkDeviceMemory can only be mapped once.
+ *
+ * Allocations bigger than a block get a block of their own.
+ */
+#define BLOCK_SIZE (16 * 1024 * 1024)
+
+typedef struct _GskVulkanAllocator GskVulkanAllocator;
+typedef struct _GskVulkanMemoryBlock GskVulkanMemoryBlock;
+
+typedef struct {
+  gsize offset;
+  gsize size;
+} FreeRange;
+
+struct _GskVulkanMemoryBlock
+{
+  GskVulkanAllocator *allocator;
+  uint32_t memory_type;
+
+  VkDeviceMemory vk_memory;
+  gsize size;
+  gsize used;
+
+  guchar *map;
+
+  /* Sorted by offset, adjacent ranges are merged */
+  GArray *free_ranges;
+};
+
+struct _GskVulkanAllocator
+{
+  /* Not a reference, the allocator lives as long as the context */
+  GdkVulkanContext *vulkan;
+
+  VkPhysicalDeviceMemoryProperties properties;
+  gsize granularity;
+
+  GPtrArray *blocks[VK_MAX_MEMORY_TYPES];
+  guint n_memories;
+};
+
 struct _GskVulkanMemory
 {
   GdkVulkanContext *vulkan;
 
+  GskVulkanMemoryBlock *block;
+  gsize offset;
   gsize size;
-
-  VkDeviceMemory vk_memory;
 };
 
+static gsize
+align (gsize value,
+       gsize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static GskVulkanMemoryBlock *
+gsk_vulkan_memory_block_new (GskVulkanAllocator *allocator,
+                             uint32_t            memory_type,
+                             gsize               size)
+{
+  GskVulkanMemoryBlock *block;
+  VkDevice device = gdk_vulkan_context_get_device (allocator->vulkan);
+  FreeRange range = { 0, size };
+
+  block = g_slice_new0 (GskVulkanMemoryBlock);
+  block->allocator = allocator;
+  block->memory_type = memory_type;
+  block->size = size;
+  block->free_ranges = g_array_new (FALSE, FALSE, sizeof (FreeRange));
+  g_array_append_val (block->free_ranges, range);
+
+  GSK_VK_CHECK (vkAllocateMemory, device,
+                                  &(VkMemoryAllocateInfo) {
+                                      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                                      .allocationSize = size,
+                                      .memoryTypeIndex = memory_type
+                                  },
+                                  NULL,
+                                  &block->vk_memory);
+
+  if (allocator->properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+      void *data;
+
+      GSK_VK_CHECK (vkMapMemory, device,
+                                 block->vk_memory,
+                                 0,
+                                 VK_WHOLE_SIZE,
+                                 0,
+                                 &data);
+      block->map = data;
+    }
+
+  GSK_NOTE (VULKAN, g_print ("Allocated %" G_GSIZE_FORMAT " bytes of device memory of type %u\n",
+                             size, memory_type));
+
+  g_ptr_array_add (allocator->blocks[memory_type], block);
+
+  return block;
+}
+
+static void
+gsk_vulkan_memory_block_free (GskVulkanMemoryBlock *block)
+{
+  VkDevice device = gdk_vulkan_context_get_device (block->allocator->vulkan);
+
+  if (block->map)
+    vkUnmapMemory (device, block->vk_memory);
+
+  vkFreeMemory (device, block->vk_memory, NULL);
+
+  g_array_unref (block->free_ranges);
+
+  g_slice_free (GskVulkanMemoryBlock, block);
+}
+
+/* Finds the first free range that fits, and returns the aligned offset */
+static gboolean
+gsk_vulkan_memory_block_alloc (GskVulkanMemoryBlock *block,
+                               gsize                 size,
+                               gsize                 alignment,
+                               gsize                *offset)
+{
+  guint i;
+
+  if (block->size - block->used < size)
+    return FALSE;
+
+  for (i = 0; i < block->free_ranges->len; i++)
+    {
+      FreeRange *range = &g_array_index (block->free_ranges, FreeRange, i);
+      gsize start = align (range->offset, alignment);
+      gsize end = range->offset + range->size;
+
+      if (start + size > end)
+        continue;
+
+      *offset = start;
+      block->used += size;
+
+      /* Keep the space in front of the allocation and behind it */
+      if (start + size < end)
+        {
+          FreeRange rest = { start + size, end - start - size };
+
+          if (start > range->offset)
+            {
+              range->size = start - range->offset;
+              g_array_insert_val (block->free_ranges, i + 1, rest);
+            }
+          else
+            {
+              *range = rest;
+            }
+        }
+      else if (start > range->offset)
+        {
+          range->size = start - range->offset;
+        }
+      else
+        {
+          g_array_remove_index (block->free_ranges, i);
+        }
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+gsk_vulkan_memory_block_release (GskVulkanMemoryBlock *block,
+                                 gsize                 offset,
+                                 gsize                 size)
+{
+  FreeRange *prev = NULL, *next = NULL;
+  FreeRange range = { offset, size };
+  guint i;
+
+  block->used -= size;
+
+  for (i = 0; i < block->free_ranges->len; i++)
+    {
+      if (g_array_index (block->free_ranges, FreeRange, i).offset > offset)
+        break;
+    }
+
+  if (i > 0)
+    prev = &g_array_index (block->free_ranges, FreeRange, i - 1);
+  if (i < block->free_ranges->len)
+    next = &g_array_index (block->free_ranges, FreeRange, i);
+
+  if (prev && prev->offset + prev->size == offset)
+    {
+      prev->size += size;
+      if (next && offset + size == next->offset)
+        {
+          prev->size += next->size;
+          g_array_remove_index (block->free_ranges, i);
+        }
+    }
+  else if (next && offset + size == next->offset)
+    {
+      next->offset = offset;
+      next->size += size;
+    }
+  else
+    {
+      g_array_insert_val (block->free_ranges, i, range);
+    }
+}
+
+static void
+gsk_vulkan_allocator_free (gpointer data)
+{
+  GskVulkanAllocator *allocator = data;
+  uint32_t i;
+
+  for (i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+    g_ptr_array_unref (allocator->blocks[i]);
+
+  g_slice_free (GskVulkanAllocator, allocator);
+}
+
+static GskVulkanAllocator *
+gsk_vulkan_allocator_get (GdkVulkanContext *context)
+{
+  GskVulkanAllocator *allocator;
+  VkPhysicalDeviceProperties properties;
+  uint32_t i;
+
+  allocator = g_object_get_data (G_OBJECT (context), "gsk-vulkan-allocator");
+  if (allocator)
+    return allocator;
+
+  allocator = g_slice_new0 (GskVulkanAllocator);
+  allocator->vulkan = context;
+
+  vkGetPhysicalDeviceMemoryProperties (gdk_vulkan_context_get_physical_device (context),
+                                       &allocator->properties);
+
+  /* Linear and optimal resources must not share a page of this size,
+   * so we align all allocations to it
+   */
+  vkGetPhysicalDeviceProperties (gdk_vulkan_context_get_physical_device (context),
+                                 &properties);
+  allocator->granularity = MAX (properties.limits.bufferImageGranularity, 1);
+
+  for (i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+    allocator->blocks[i] = g_ptr_array_new_with_free_func ((GDestroyNotify) gsk_vulkan_memory_block_free);
+
+  g_object_set_data_full (G_OBJECT (context), "gsk-vulkan-allocator",
+                          allocator, gsk_vulkan_allocator_free);
+
+  return allocator;
+}
+
 GskVulkanMemory *
 gsk_vulkan_memory_new (GdkVulkanContext      *context,
                        uint32_t               allowed_types,
                        VkMemoryPropertyFlags  flags,
-                       gsize                  size)
+                       gsize                  size,
+                       gsize                  alignment)
 {
-  VkPhysicalDeviceMemoryProperties properties;
+  GskVulkanAllocator *allocator;
+  GskVulkanMemoryBlock *block;
   GskVulkanMemory *self;
+  GPtrArray *blocks;
+  gsize offset;
   uint32_t i;
+  guint j;
 
-  self = g_slice_new0 (GskVulkanMemory);
-
-  self->vulkan = g_object_ref (context);
-  self->size = size;
-
-  vkGetPhysicalDeviceMemoryProperties (gdk_vulkan_context_get_physical_device (context),
-                                       &properties);
+  allocator = gsk_vulkan_allocator_get (context);
 
-  for (i = 0; i < properties.memoryTypeCount; i++)
+  for (i = 0; i < allocator->properties.memoryTypeCount; i++)
     {
       if (!(allowed_types & (1 << i)))
         continue;
 
-      if ((properties.memoryTypes[i].propertyFlags & flags) == flags)
+      if ((allocator->properties.memoryTypes[i].propertyFlags & flags) == flags)
         break;
   }
 
-  g_assert (i < properties.memoryTypeCount);
+  g_assert (i < allocator->properties.memoryTypeCount);
 
-  GSK_VK_CHECK (vkAllocateMemory, gdk_vulkan_context_get_device (context),
-                                  &(VkMemoryAllocateInfo) {
-                                      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-                                      .allocationSize = size,
-                                      .memoryTypeIndex = i
-                                  },
-                                  NULL,
-                                  &self->vk_memory);
+  self = g_slice_new0 (GskVulkanMemory);
+
+  self->vulkan = g_object_ref (context);
+  self->size = align (size, allocator->granularity);
+  alignment = MAX (alignment, allocator->granularity);
+
+  blocks = allocator->blocks[i];
+  for (j = 0; j < blocks->len; j++)
+    {
+      block = g_ptr_array_index (blocks, j);
+
+      if (gsk_vulkan_memory_block_alloc (block, self->size, alignment, &offset))
+        break;
+    }
+
+  if (j == blocks->len)
+    {
+      block = gsk_vulkan_memory_block_new (allocator, i, MAX (BLOCK_SIZE, self->size));
+      if (!gsk_vulkan_memory_block_alloc (block, self->size, alignment, &offset))
+        g_assert_not_reached ();
+    }
+
+  self->block = block;
+  self->offset = offset;
+
+  allocator->n_memories++;
 
   return self;
 }
@@ -56,9 +328,31 @@ gsk_vulkan_memory_new (GdkVulkanContext      *context,
 void
 gsk_vulkan_memory_free (GskVulkanMemory *self)
 {
-  vkFreeMemory (gdk_vulkan_context_get_device (self->vulkan),
-                self->vk_memory,
-                NULL);
+  GskVulkanMemoryBlock *block = self->block;
+  GskVulkanAllocator *allocator = block->allocator;
+  GPtrArray *blocks = allocator->blocks[block->memory_type];
+  uint32_t i;
+
+  gsk_vulkan_memory_block_release (block, self->offset, self->size);
+
+  allocator->n_memories--;
+
+  /* The device goes away in the dispose of the context, before the
+   * allocator is freed, so all blocks must be gone once the last
+   * memory is. Otherwise keep one empty block of the default size
+   * around, so memory that is freed and allocated every frame stays
+   * in the block
+   */
+  if (allocator->n_memories == 0)
+    {
+      for (i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+        g_ptr_array_set_size (allocator->blocks[i], 0);
+    }
+  else if (block->used == 0 &&
+           (block->size > BLOCK_SIZE || blocks->len > 1))
+    {
+      g_ptr_array_remove_fast (blocks, block);
+    }
 
   g_object_unref (self->vulkan);
 
@@ -68,28 +362,25 @@ gsk_vulkan_memory_free (GskVulkanMemory *self)
 VkDeviceMemory
 gsk_vulkan_memory_get_device_memory (GskVulkanMemory *self)
 {
-  return self->vk_memory;
+  return self->block->vk_memory;
+}
+
+gsize
+gsk_vulkan_memory_get_offset (GskVulkanMemory *self)
+{
+  return self->offset;
 }
 
 guchar *
 gsk_vulkan_memory_map (GskVulkanMemory *self)
 {
-  void *data;
-
-  GSK_VK_CHECK (vkMapMemory, gdk_vulkan_context_get_device (self->vulkan),
-                             self->vk_memory,
-                             0,
-                             self->size,
-                             0,
-                             &data);
+  g_return_val_if_fail (self->block->map != NULL, NULL);
 
-  return data;
+  return self->block->map + self->offset;
 }
 
 void
 gsk_vulkan_memory_unmap (GskVulkanMemory *self)
 {
-  vkUnmapMemory (gdk_vulkan_context_get_device (self->vulkan),
-                 self->vk_memory);
+  /* The block stays mapped */
 }
-
@@ -17,11 +17,12 @@
 #include "gskvulkaneffectpipelineprivate.h"
 #include "gskvulkanlineargradientpipelineprivate.h"
 
+#include "gdk/gdkvulkancontextprivate.h"
+
 #define ORTHO_NEAR_PLANE        -10000
 #define ORTHO_FAR_PLANE          10000
 
 #define DESCRIPTOR_POOL_MAXSETS 128
-#define DESCRIPTOR_POOL_MAXSETS_INCREASE 128
 
 struct _GskVulkanRender
 {
@@ -36,16 +37,25 @@ struct _GskVulkanRender
   GHashTable *framebuffers;
   GskVulkanCommandPool *command_pool;
   VkFence fence;
+  /* Only set when drawing to the window, see gsk_vulkan_render_draw() */
+  VkSemaphore draw_semaphore;
+  VkSemaphore render_semaphore;
   VkRenderPass render_pass;
   GskVulkanPipelineLayout *layout;
   GskVulkanUploader *uploader;
   GskVulkanBuffer *vertex_buffer;
 
+  /* Descriptor sets are kept per image across frames, so they only
+   * need to be written when an image is used for the first time
+   */
+  GHashTable *descriptor_set_cache;
+  VkSampler descriptor_set_sampler;
+  GArray *descriptor_pools;
+  guint n_pool_sets;
+  GArray *free_descriptor_sets;
+
   GHashTable *descriptor_set_indexes;
-  VkDescriptorPool descriptor_pool;
-  uint32_t descriptor_pool_maxsets;
-  VkDescriptorSet *descriptor_sets;  
-  gsize n_descriptor_sets;
+  GArray *descriptor_sets;
   GskVulkanPipeline *pipelines[GSK_VULKAN_N_PIPELINES];
 
   GskVulkanImage *target;
@@ -72,6 +82,8 @@ gsk_vulkan_render_setup (GskVulkanRender       *self,
                                                       0, 0,
                                                       gsk_vulkan_image_get_width (target), gsk_vulkan_image_get_height (target)
                                                   });
+      self->draw_semaphore = VK_NULL_HANDLE;
+      self->render_semaphore = VK_NULL_HANDLE;
     }
   else
     {
@@ -80,6 +92,8 @@ gsk_vulkan_render_setup (GskVulkanRender       *self,
       self->viewport.extent.width = gdk_window_get_width (window) * self->scale_factor;
       self->viewport.extent.height = gdk_window_get_height (window) * self->scale_factor;
       self->clip = gdk_drawing_context_get_clip (gsk_renderer_get_drawing_context (self->renderer));
+      self->draw_semaphore = gdk_vulkan_context_get_draw_semaphore (self->vulkan);
+      self->render_semaphore = gdk_vulkan_context_get_render_semaphore (self->vulkan);
     }
 
   graphene_matrix_init_scale (&modelview, self->scale_factor, self->scale_factor, 1.0);
@@ -104,7 +118,11 @@ gsk_vulkan_render_new (GskRenderer      *renderer,
   self->vulkan = context;
   self->renderer = renderer;
   self->framebuffers = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->descriptor_set_cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->descriptor_pools = g_array_new (FALSE, FALSE, sizeof (VkDescriptorPool));
+  self->free_descriptor_sets = g_array_new (FALSE, FALSE, sizeof (VkDescriptorSet));
   self->descriptor_set_indexes = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->descriptor_sets = g_array_new (FALSE, FALSE, sizeof (VkDescriptorSet));
 
   device = gdk_vulkan_context_get_device (self->vulkan);
 
@@ -117,22 +135,6 @@ gsk_vulkan_render_new (GskRenderer      *renderer,
                                NULL,
                                &self->fence);
 
-  self->descriptor_pool_maxsets = DESCRIPTOR_POOL_MAXSETS;
-  GSK_VK_CHECK (vkCreateDescriptorPool, device,
-                                        &(VkDescriptorPoolCreateInfo) {
-                                            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-                                            .maxSets = self->descriptor_pool_maxsets,
-                                            .poolSizeCount = 1,
-                                            .pPoolSizes = (VkDescriptorPoolSize[1]) {
-                                                {
-                                                    .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                                    .descriptorCount = self->descriptor_pool_maxsets
-                                                }
-                                            }
-                                        },
-                                        NULL,
-                                        &self->descriptor_pool);
-
   GSK_VK_CHECK (vkCreateRenderPass, gdk_vulkan_context_get_device (self->vulkan),
                                     &(VkRenderPassCreateInfo) {
                                         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
@@ -246,15 +248,22 @@ gsk_vulkan_render_add_node (GskVulkanRender *self,
                             GskRenderNode   *node)
 {
   GskVulkanRenderPass *pass = gsk_vulkan_render_pass_new (self->vulkan);
+  cairo_rectangle_int_t extents;
 
   self->render_passes = g_slist_prepend (self->render_passes, pass);
 
+  /* Only the clip region gets drawn, so its extents are what is
+   * visible of the node tree, in the coordinate space of the root node
+   */
+  cairo_region_get_extents (self->clip, &extents);
+
   gsk_vulkan_render_pass_add (pass,
                               self,
                               &self->mvp,
                               &GRAPHENE_RECT_INIT (
-                                  self->viewport.offset.x, self->viewport.offset.y,
-                                  self->viewport.extent.width, self->viewport.extent.height
+                                  (float) self->viewport.offset.x / self->scale_factor + extents.x,
+                                  (float) self->viewport.offset.y / self->scale_factor + extents.y,
+                                  extents.width, extents.height
                               ),
                               node);
 }
@@ -297,7 +306,17 @@ gsk_vulkan_render_collect_vertex_data (GskVulkanRender *self)
   
   offset = 0;
   n_bytes = gsk_vulkan_renderer_count_vertex_data (self);
-  buffer = gsk_vulkan_buffer_new (self->vulkan, n_bytes);
+
+  /* The buffer is kept between frames and only replaced when
+   * it is too small, so frames usually don't allocate one
+   */
+  buffer = self->vertex_buffer;
+  self->vertex_buffer = NULL;
+  if (buffer == NULL || gsk_vulkan_buffer_get_size (buffer) < n_bytes)
+    {
+      g_clear_pointer (&buffer, gsk_vulkan_buffer_free);
+      buffer = gsk_vulkan_buffer_new (self->vulkan, MAX (n_bytes, 64 * 1024));
+    }
   data = gsk_vulkan_buffer_map (buffer);
 
   for (l = self->render_passes; l; l = l->next)
@@ -358,9 +377,9 @@ VkDescriptorSet
 gsk_vulkan_render_get_descriptor_set (GskVulkanRender *self,
                                       gsize            id)
 {
-  g_assert (id < self->n_descriptor_sets);
+  g_assert (id < self->descriptor_sets->len);
 
-  return self->descriptor_sets[id];
+  return g_array_index (self->descriptor_sets, VkDescriptorSet, id);
 }
 
 gsize
@@ -379,101 +398,181 @@ gsk_vulkan_render_reserve_descriptor_set (GskVulkanRender *self,
   return GPOINTER_TO_SIZE (id_plus_one) - 1;
 }
 
+typedef struct {
+  VkDescriptorSet descriptor_set;
+} HashDescriptorSetEntry;
+
 static void
-gsk_vulkan_render_prepare_descriptor_sets (GskVulkanRender *self,
-                                           VkSampler        sampler)
+gsk_vulkan_render_remove_descriptor_set_from_image (gpointer  data,
+                                                    GObject  *image)
+{
+  GskVulkanRender *self = data;
+  HashDescriptorSetEntry *entry;
+
+  entry = g_hash_table_lookup (self->descriptor_set_cache, image);
+  g_hash_table_remove (self->descriptor_set_cache, image);
+
+  /* The set is only written again in a later frame, after the fence
+   * of this render has been waited on
+   */
+  g_array_append_val (self->free_descriptor_sets, entry->descriptor_set);
+
+  g_slice_free (HashDescriptorSetEntry, entry);
+}
+
+static void
+gsk_vulkan_render_clear_descriptor_sets (GskVulkanRender *self)
 {
   GHashTableIter iter;
   gpointer key, value;
   VkDevice device;
-  GSList *l;
-  guint i, needed_sets;
+  guint i;
 
   device = gdk_vulkan_context_get_device (self->vulkan);
 
-  for (l = self->render_passes; l; l = l->next)
+  g_hash_table_iter_init (&iter, self->descriptor_set_cache);
+  while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      gsk_vulkan_render_pass_reserve_descriptor_sets (l->data, self);
+      g_slice_free (HashDescriptorSetEntry, value);
+      g_object_weak_unref (G_OBJECT (key), gsk_vulkan_render_remove_descriptor_set_from_image, self);
+      g_hash_table_iter_remove (&iter);
     }
-  
-  needed_sets = g_hash_table_size (self->descriptor_set_indexes);
-  if (needed_sets > self->n_descriptor_sets)
+
+  for (i = 0; i < self->descriptor_pools->len; i++)
     {
-      if (needed_sets > self->descriptor_pool_maxsets)
-        {
-          guint added_sets = needed_sets - self->descriptor_pool_maxsets;
-          added_sets = added_sets + DESCRIPTOR_POOL_MAXSETS_INCREASE - 1;
-          added_sets -= added_sets % DESCRIPTOR_POOL_MAXSETS_INCREASE;
-
-          vkDestroyDescriptorPool (device,
-                                   self->descriptor_pool,
-                                   NULL);
-          self->descriptor_pool_maxsets += added_sets;
-          GSK_VK_CHECK (vkCreateDescriptorPool, device,
-                                                &(VkDescriptorPoolCreateInfo) {
-                                                    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-                                                    .maxSets = self->descriptor_pool_maxsets,
-                                                    .poolSizeCount = 1,
-                                                    .pPoolSizes = (VkDescriptorPoolSize[1]) {
-                                                        {
-                                                            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                                            .descriptorCount = self->descriptor_pool_maxsets
-                                                        }
-                                                    }
-                                                },
-                                                NULL,
-                                                &self->descriptor_pool);
-        }
-      else
-        {
-          GSK_VK_CHECK (vkResetDescriptorPool, device,
-                                               self->descriptor_pool,
-                                               0);
-        }
+      vkDestroyDescriptorPool (device,
+                               g_array_index (self->descriptor_pools, VkDescriptorPool, i),
+                               NULL);
+    }
+  g_array_set_size (self->descriptor_pools, 0);
+  g_array_set_size (self->free_descriptor_sets, 0);
+  self->n_pool_sets = 0;
+}
 
-      self->n_descriptor_sets = needed_sets;
-      self->descriptor_sets = g_renew (VkDescriptorSet, self->descriptor_sets, needed_sets);
+static VkDescriptorSet
+gsk_vulkan_render_allocate_descriptor_set (GskVulkanRender *self)
+{
+  VkDescriptorSetLayout layout;
+  VkDescriptorPool pool;
+  VkDescriptorSet descriptor_set;
+  VkDevice device;
+
+  if (self->free_descriptor_sets->len > 0)
+    {
+      descriptor_set = g_array_index (self->free_descriptor_sets, VkDescriptorSet, self->free_descriptor_sets->len - 1);
+      g_array_set_size (self->free_descriptor_sets, self->free_descriptor_sets->len - 1);
+      return descriptor_set;
     }
 
-  VkDescriptorSetLayout *layouts = g_newa (VkDescriptorSetLayout, needed_sets);
-  for (i = 0; i < needed_sets; i++)
+  device = gdk_vulkan_context_get_device (self->vulkan);
+
+  /* Sets are never returned to their pool, so once a pool is used up,
+   * we add another one instead of recreating it
+   */
+  if (self->descriptor_pools->len == 0 || self->n_pool_sets == DESCRIPTOR_POOL_MAXSETS)
     {
-      layouts[i] = gsk_vulkan_pipeline_layout_get_descriptor_set_layout (self->layout);
+      GSK_VK_CHECK (vkCreateDescriptorPool, device,
+                                            &(VkDescriptorPoolCreateInfo) {
+                                                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                                                .maxSets = DESCRIPTOR_POOL_MAXSETS,
+                                                .poolSizeCount = 1,
+                                                .pPoolSizes = (VkDescriptorPoolSize[1]) {
+                                                    {
+                                                        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                                        .descriptorCount = DESCRIPTOR_POOL_MAXSETS
+                                                    }
+                                                }
+                                            },
+                                            NULL,
+                                            &pool);
+      g_array_append_val (self->descriptor_pools, pool);
+      self->n_pool_sets = 0;
     }
 
+  pool = g_array_index (self->descriptor_pools, VkDescriptorPool, self->descriptor_pools->len - 1);
+  layout = gsk_vulkan_pipeline_layout_get_descriptor_set_layout (self->layout);
+
   GSK_VK_CHECK (vkAllocateDescriptorSets, device,
                                           &(VkDescriptorSetAllocateInfo) {
                                               .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-                                              .descriptorPool = self->descriptor_pool,
-                                              .descriptorSetCount = needed_sets,
-                                              .pSetLayouts = layouts
+                                              .descriptorPool = pool,
+                                              .descriptorSetCount = 1,
+                                              .pSetLayouts = &layout
                                           },
-                                          self->descriptor_sets);
+                                          &descriptor_set);
+  self->n_pool_sets++;
+
+  return descriptor_set;
+}
+
+static VkDescriptorSet
+gsk_vulkan_render_get_descriptor_set_for_image (GskVulkanRender *self,
+                                                GskVulkanImage  *image,
+                                                VkSampler        sampler)
+{
+  HashDescriptorSetEntry *entry;
+
+  entry = g_hash_table_lookup (self->descriptor_set_cache, image);
+  if (entry)
+    return entry->descriptor_set;
+
+  entry = g_slice_new0 (HashDescriptorSetEntry);
+  entry->descriptor_set = gsk_vulkan_render_allocate_descriptor_set (self);
+
+  vkUpdateDescriptorSets (gdk_vulkan_context_get_device (self->vulkan),
+                          1,
+                          (VkWriteDescriptorSet[1]) {
+                              {
+                                  .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                                  .dstSet = entry->descriptor_set,
+                                  .dstBinding = 0,
+                                  .dstArrayElement = 0,
+                                  .descriptorCount = 1,
+                                  .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                  .pImageInfo = &(VkDescriptorImageInfo) {
+                                      .sampler = sampler,
+                                      .imageView = gsk_vulkan_image_get_image_view (image),
+                                      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                  }
+                              }
+                          },
+                          0, NULL);
+
+  g_hash_table_insert (self->descriptor_set_cache, image, entry);
+  g_object_weak_ref (G_OBJECT (image), gsk_vulkan_render_remove_descriptor_set_from_image, self);
+
+  return entry->descriptor_set;
+}
+
+static void
+gsk_vulkan_render_prepare_descriptor_sets (GskVulkanRender *self,
+                                           VkSampler        sampler)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GSList *l;
+
+  /* The cached sets are only valid for the sampler they were written with */
+  if (sampler != self->descriptor_set_sampler)
+    {
+      gsk_vulkan_render_clear_descriptor_sets (self);
+      self->descriptor_set_sampler = sampler;
+    }
+
+  for (l = self->render_passes; l; l = l->next)
+    {
+      gsk_vulkan_render_pass_reserve_descriptor_sets (l->data, self);
+    }
+
+  g_array_set_size (self->descriptor_sets, g_hash_table_size (self->descriptor_set_indexes));
 
   g_hash_table_iter_init (&iter, self->descriptor_set_indexes);
   while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      GskVulkanImage *image = key;
       gsize id = GPOINTER_TO_SIZE (value) - 1;
 
-      vkUpdateDescriptorSets (device,
-                              1,
-                              (VkWriteDescriptorSet[1]) {
-                                  {
-                                      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                                      .dstSet = self->descriptor_sets[id],
-                                      .dstBinding = 0,
-                                      .dstArrayElement = 0,
-                                      .descriptorCount = 1,
-                                      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                      .pImageInfo = &(VkDescriptorImageInfo) {
-                                          .sampler = sampler,
-                                          .imageView = gsk_vulkan_image_get_image_view (image),
-                                          .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-                                      }
-                                  }
-                              },
-                              0, NULL);
+      g_array_index (self->descriptor_sets, VkDescriptorSet, id) =
+          gsk_vulkan_render_get_descriptor_set_for_image (self, key, sampler);
     }
 }
 
@@ -541,7 +640,22 @@ gsk_vulkan_render_draw (GskVulkanRender   *self,
       vkCmdEndRenderPass (command_buffer);
     }
 
-  gsk_vulkan_command_pool_submit_buffer (self->command_pool, command_buffer, self->fence);
+  /* The swapchain image may still be in use by the present engine when
+   * it was acquired, and it must not be presented before drawing to it
+   * is done.
+   */
+  if (self->draw_semaphore != VK_NULL_HANDLE)
+    gsk_vulkan_command_pool_submit_buffer (self->command_pool,
+                                           command_buffer,
+                                           1, &self->draw_semaphore,
+                                           1, &self->render_semaphore,
+                                           self->fence);
+  else
+    gsk_vulkan_command_pool_submit_buffer (self->command_pool,
+                                           command_buffer,
+                                           0, NULL,
+                                           0, NULL,
+                                           self->fence);
 
   if (GSK_RENDER_MODE_CHECK (SYNC))
     {
@@ -581,12 +695,8 @@ gsk_vulkan_render_cleanup (GskVulkanRender *self)
 
   gsk_vulkan_command_pool_reset (self->command_pool);
 
-  g_clear_pointer (&self->vertex_buffer, gsk_vulkan_buffer_free);
-
   g_hash_table_remove_all (self->descriptor_set_indexes);
-  GSK_VK_CHECK (vkResetDescriptorPool, device,
-                                       self->descriptor_pool,
-                                       0);
+  g_array_set_size (self->descriptor_sets, 0);
 
   g_slist_free_full (self->render_passes, (GDestroyNotify) gsk_vulkan_render_pass_free);
   self->render_passes = NULL;
@@ -628,16 +738,19 @@ gsk_vulkan_render_free (GskVulkanRender *self)
 
   g_clear_pointer (&self->uploader, gsk_vulkan_uploader_free);
 
+  g_clear_pointer (&self->vertex_buffer, gsk_vulkan_buffer_free);
+
   g_clear_pointer (&self->layout, gsk_vulkan_pipeline_layout_unref);
 
   vkDestroyRenderPass (device,
                        self->render_pass,
                        NULL);
 
-  vkDestroyDescriptorPool (device,
-                           self->descriptor_pool,
-                           NULL);
-  g_free (self->descriptor_sets);
+  gsk_vulkan_render_clear_descriptor_sets (self);
+  g_hash_table_unref (self->descriptor_set_cache);
+  g_array_unref (self->descriptor_pools);
+  g_array_unref (self->free_descriptor_sets);
+  g_array_unref (self->descriptor_sets);
   g_hash_table_unref (self->descriptor_set_indexes);
 
   vkDestroyFence (device,
@@ -670,3 +783,11 @@ gsk_vulkan_render_get_renderer (GskVulkanRender *self)
 {
   return self->renderer;
 }
+
+void
+gsk_vulkan_render_get_upload_stats (GskVulkanRender *self,
+                                    guint64         *n_uploads,
+                                    guint64         *upload_bytes)
+{
+  gsk_vulkan_uploader_get_stats (self->uploader, n_uploads, upload_bytes);
+}
@@ -14,15 +14,59 @@
 
 #include <graphene.h>
 
+/* Memory budget for the fallback images kept across frames */
+#define OFFSCREEN_CACHE_SIZE (32 * 1024 * 1024)
+
+/* Every frame uses the next render of a ring, and only waits for the
+ * GPU to finish the frame that last used that render. With 2 renders,
+ * a frame is recorded while the GPU still executes the previous one.
+ * Can be changed with GSK_VULKAN_FRAMES_IN_FLIGHT.
+ */
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 4
+
+typedef struct _GskVulkanTextureCache GskVulkanTextureCache;
 typedef struct _GskVulkanTextureData GskVulkanTextureData;
 
+/* All Vulkan contexts of a display share the device, so textures are
+ * uploaded once per display and used by the renderers of all windows.
+ * An image keeps the context and the memory blocks it was created with
+ * alive, so the images of a renderer are evicted when it unrealizes.
+ */
+struct _GskVulkanTextureCache {
+  GSList *textures;
+};
+
 struct _GskVulkanTextureData {
   GskTexture *texture;
   GskVulkanImage *image;
+  GskVulkanTextureCache *cache;
+  /* The context the image was created with */
+  GdkVulkanContext *vulkan;
+};
+
+typedef struct _GskVulkanSurfaceData GskVulkanSurfaceData;
+
+struct _GskVulkanSurfaceData {
+  cairo_surface_t *surface;
+  guint serial;
+  GskVulkanImage *image;
   GskVulkanRenderer *renderer;
 };
 
+/* The image of a glyph cache page, and the serial of its contents */
+typedef struct {
+  GskVulkanImage *image;
+  guint64 serial;
+} GskVulkanGlyphImage;
+
 #ifdef G_ENABLE_DEBUG
+typedef struct {
+  GQuark uploads;
+  GQuark upload_bytes;
+  GQuark texture_memory;
+} ProfileCounters;
+
 typedef struct {
   GQuark cpu_time;
   GQuark gpu_time;
@@ -40,11 +84,22 @@ struct _GskVulkanRenderer
 
   VkSampler sampler;
 
-  GskVulkanRender *render;
+  GskVulkanRender *renders[MAX_FRAMES_IN_FLIGHT];
+  guint n_renders;
+  guint current_render;
 
-  GSList *textures;
+  GskVulkanTextureCache *texture_cache;
+
+  /* Uploads of the surfaces of cairo nodes */
+  GSList *surfaces;
+  cairo_user_data_key_t surface_key;
+
+  GskGlyphCache *glyph_cache;
+  GArray *glyph_images;
+  GskOffscreenCache *offscreen_cache;
 
 #ifdef G_ENABLE_DEBUG
+  ProfileCounters profile_counters;
   ProfileTimers profile_timers;
 #endif
 };
@@ -98,6 +153,94 @@ gsk_vulkan_renderer_update_images_cb (GdkVulkanContext  *context,
     }
 }
 
+static void
+gsk_vulkan_renderer_free_cached_image (gpointer data,
+                                       gpointer user_data)
+{
+  g_object_unref (data);
+}
+
+static void
+gsk_vulkan_renderer_clear_texture (gpointer p)
+{
+  GskVulkanTextureData *data = p;
+
+  data->cache->textures = g_slist_remove (data->cache->textures, data);
+
+  g_object_unref (data->image);
+
+  g_slice_free (GskVulkanTextureData, data);
+}
+
+static void
+gsk_vulkan_texture_cache_free (gpointer p)
+{
+  GskVulkanTextureCache *cache = p;
+
+  /* Clearing the render data removes the texture from the list */
+  while (cache->textures)
+    {
+      GskVulkanTextureData *data = cache->textures->data;
+
+      gsk_texture_clear_render_data (data->texture);
+    }
+
+  g_slice_free (GskVulkanTextureCache, cache);
+}
+
+static void
+gsk_vulkan_texture_cache_evict (GskVulkanTextureCache *cache,
+                                GdkVulkanContext      *vulkan)
+{
+  GSList *l, *next;
+
+  for (l = cache->textures; l; l = next)
+    {
+      GskVulkanTextureData *data = l->data;
+
+      /* Clearing the render data frees the current link */
+      next = l->next;
+
+      if (data->vulkan == vulkan)
+        gsk_texture_clear_render_data (data->texture);
+    }
+}
+
+static GskVulkanTextureCache *
+gsk_vulkan_texture_cache_get_for_display (GdkDisplay *display)
+{
+  GskVulkanTextureCache *cache;
+
+  cache = g_object_get_data (G_OBJECT (display), "gsk-vulkan-texture-cache");
+  if (cache == NULL)
+    {
+      cache = g_slice_new0 (GskVulkanTextureCache);
+
+      g_object_set_data_full (G_OBJECT (display), "gsk-vulkan-texture-cache",
+                              cache, gsk_vulkan_texture_cache_free);
+    }
+
+  return cache;
+}
+
+static guint
+get_frames_in_flight (void)
+{
+  const char *env;
+  guint64 n;
+
+  if (GSK_RENDER_MODE_CHECK (SYNC))
+    return 1;
+
+  env = g_getenv ("GSK_VULKAN_FRAMES_IN_FLIGHT");
+  if (env == NULL)
+    return DEFAULT_FRAMES_IN_FLIGHT;
+
+  n = g_ascii_strtoull (env, NULL, 10);
+
+  return CLAMP (n, 1, MAX_FRAMES_IN_FLIGHT);
+}
+
 static gboolean
 gsk_vulkan_renderer_realize (GskRenderer  *renderer,
                              GdkWindow    *window,
@@ -105,6 +248,7 @@ gsk_vulkan_renderer_realize (GskRenderer  *renderer,
 {
   GskVulkanRenderer *self = GSK_VULKAN_RENDERER (renderer);
   VkDevice device;
+  guint i;
 
   self->vulkan = gdk_window_create_vulkan_context (window, error);
   if (self->vulkan == NULL)
@@ -112,6 +256,13 @@ gsk_vulkan_renderer_realize (GskRenderer  *renderer,
 
   device = gdk_vulkan_context_get_device (self->vulkan);
 
+  self->glyph_cache = gsk_glyph_cache_get_for_display (gsk_renderer_get_display (renderer));
+  self->glyph_images = g_array_new (FALSE, TRUE, sizeof (GskVulkanGlyphImage));
+  self->texture_cache = gsk_vulkan_texture_cache_get_for_display (gsk_renderer_get_display (renderer));
+  self->offscreen_cache = gsk_offscreen_cache_new (OFFSCREEN_CACHE_SIZE,
+                                                   gsk_vulkan_renderer_free_cached_image,
+                                                   self);
+
   GSK_VK_CHECK (vkCreateSampler, device,
                                  &(VkSamplerCreateInfo) {
                                      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
@@ -132,7 +283,10 @@ gsk_vulkan_renderer_realize (GskRenderer  *renderer,
                     self);
   gsk_vulkan_renderer_update_images_cb (self->vulkan, self);
 
-  self->render = gsk_vulkan_render_new (renderer, self->vulkan);
+  self->n_renders = get_frames_in_flight ();
+  for (i = 0; i < self->n_renders; i++)
+    self->renders[i] = gsk_vulkan_render_new (renderer, self->vulkan);
+  self->current_render = 0;
 
   return TRUE;
 }
@@ -142,18 +296,29 @@ gsk_vulkan_renderer_unrealize (GskRenderer *renderer)
 {
   GskVulkanRenderer *self = GSK_VULKAN_RENDERER (renderer);
   VkDevice device;
-  GSList *l;
+  guint i;
+
+  /* The texture cache belongs to the display, but the images of
+   * this renderer would keep its context alive */
+  gsk_vulkan_texture_cache_evict (self->texture_cache, self->vulkan);
+  self->texture_cache = NULL;
 
-  for (l = self->textures; l; l = l->next)
+  /* Removing the user data frees the data and removes it from the list */
+  while (self->surfaces)
     {
-      GskVulkanTextureData *data = l->data;
+      GskVulkanSurfaceData *data = self->surfaces->data;
 
-      data->renderer = NULL;
-      gsk_texture_clear_render_data (data->texture);
+      cairo_surface_set_user_data (data->surface, &self->surface_key, NULL, NULL);
     }
-  g_clear_pointer (&self->textures, (GDestroyNotify) g_slist_free);
 
-  g_clear_pointer (&self->render, gsk_vulkan_render_free);
+  for (i = 0; i < self->n_renders; i++)
+    g_clear_pointer (&self->renders[i], gsk_vulkan_render_free);
+  self->n_renders = 0;
+  g_clear_pointer (&self->offscreen_cache, gsk_offscreen_cache_free);
+
+  for (i = 0; i < self->glyph_images->len; i++)
+    g_clear_object (&g_array_index (self->glyph_images, GskVulkanGlyphImage, i).image);
+  g_clear_pointer (&self->glyph_images, g_array_unref);
 
   device = gdk_vulkan_context_get_device (self->vulkan);
 
@@ -170,6 +335,33 @@ gsk_vulkan_renderer_unrealize (GskRenderer *renderer)
   g_clear_object (&self->vulkan);
 }
 
+#ifdef G_ENABLE_DEBUG
+static void
+gsk_vulkan_renderer_count_uploads (GskVulkanRenderer *self,
+                                   GskVulkanRender   *render,
+                                   guint64            old_n_uploads,
+                                   guint64            old_upload_bytes)
+{
+  GskProfiler *profiler = gsk_renderer_get_profiler (GSK_RENDERER (self));
+  guint64 n_uploads, upload_bytes, texture_memory;
+  GSList *l;
+
+  gsk_vulkan_render_get_upload_stats (render, &n_uploads, &upload_bytes);
+
+  texture_memory = 0;
+  for (l = self->texture_cache->textures; l; l = l->next)
+    {
+      GskVulkanTextureData *data = l->data;
+
+      texture_memory += gsk_vulkan_image_get_width (data->image) * gsk_vulkan_image_get_height (data->image) * 4;
+    }
+
+  gsk_profiler_counter_add (profiler, self->profile_counters.uploads, n_uploads - old_n_uploads);
+  gsk_profiler_counter_add (profiler, self->profile_counters.upload_bytes, upload_bytes - old_upload_bytes);
+  gsk_profiler_counter_add (profiler, self->profile_counters.texture_memory, texture_memory);
+}
+#endif
+
 static GskTexture *
 gsk_vulkan_renderer_render_texture (GskRenderer           *renderer,
                                     GskRenderNode         *root,
@@ -196,6 +388,8 @@ gsk_vulkan_renderer_render_texture (GskRenderer           *renderer,
                                                 ceil (viewport->size.height));
 
   gsk_vulkan_render_reset (render, image, viewport);
+  gsk_glyph_cache_begin_frame (self->glyph_cache);
+  gsk_offscreen_cache_begin_frame (self->offscreen_cache);
 
   gsk_vulkan_render_add_node (render, root);
 
@@ -203,6 +397,10 @@ gsk_vulkan_renderer_render_texture (GskRenderer           *renderer,
 
   gsk_vulkan_render_draw (render, self->sampler);
 
+#ifdef G_ENABLE_DEBUG
+  gsk_vulkan_renderer_count_uploads (self, render, 0, 0);
+#endif
+
   texture = gsk_vulkan_render_download_target (render);
 
   g_object_unref (image);
@@ -227,6 +425,7 @@ gsk_vulkan_renderer_render (GskRenderer   *renderer,
 #ifdef G_ENABLE_DEBUG
   GskProfiler *profiler;
   gint64 cpu_time;
+  guint64 old_n_uploads, old_upload_bytes;
 #endif
 
 #ifdef G_ENABLE_DEBUG
@@ -234,9 +433,16 @@ gsk_vulkan_renderer_render (GskRenderer   *renderer,
   gsk_profiler_timer_begin (profiler, self->profile_timers.cpu_time);
 #endif
 
-  render = self->render;
+  render = self->renders[self->current_render];
+  self->current_render = (self->current_render + 1) % self->n_renders;
+
+#ifdef G_ENABLE_DEBUG
+  gsk_vulkan_render_get_upload_stats (render, &old_n_uploads, &old_upload_bytes);
+#endif
 
   gsk_vulkan_render_reset (render, self->targets[gdk_vulkan_context_get_draw_index (self->vulkan)], NULL);
+  gsk_glyph_cache_begin_frame (self->glyph_cache);
+  gsk_offscreen_cache_begin_frame (self->offscreen_cache);
 
   gsk_vulkan_render_add_node (render, root);
 
@@ -245,6 +451,8 @@ gsk_vulkan_renderer_render (GskRenderer   *renderer,
   gsk_vulkan_render_draw (render, self->sampler);
 
 #ifdef G_ENABLE_DEBUG
+  gsk_vulkan_renderer_count_uploads (self, render, old_n_uploads, old_upload_bytes);
+
   cpu_time = gsk_profiler_timer_end (profiler, self->profile_timers.cpu_time);
   gsk_profiler_timer_set (profiler, self->profile_timers.cpu_time, cpu_time);
 
@@ -288,23 +496,14 @@ gsk_vulkan_renderer_init (GskVulkanRenderer *self)
   gsk_ensure_resources ();
 
 #ifdef G_ENABLE_DEBUG
+  self->profile_counters.uploads = gsk_profiler_add_counter (profiler, "uploads", "Texture uploads", TRUE);
+  self->profile_counters.upload_bytes = gsk_profiler_add_counter (profiler, "upload-bytes", "Uploaded bytes", TRUE);
+  self->profile_counters.texture_memory = gsk_profiler_add_counter (profiler, "texture-memory", "Texture memory", TRUE);
+
   self->profile_timers.cpu_time = gsk_profiler_add_timer (profiler, "cpu-time", "CPU time", FALSE, TRUE);
 #endif
 }
 
-static void
-gsk_vulkan_renderer_clear_texture (gpointer p)
-{
-  GskVulkanTextureData *data = p;
-
-  if (data->renderer != NULL)
-    data->renderer->textures = g_slist_remove (data->renderer->textures, data);
-
-  g_object_unref (data->image);
-
-  g_slice_free (GskVulkanTextureData, data);
-}
-
 GskVulkanImage *
 gsk_vulkan_renderer_ref_texture_image (GskVulkanRenderer *self,
                                        GskTexture        *texture,
@@ -313,12 +512,27 @@ gsk_vulkan_renderer_ref_texture_image (GskVulkanRenderer *self,
   GskVulkanTextureData *data;
   cairo_surface_t *surface;
   GskVulkanImage *image;
+  GdkWindow *window;
 
-  data = gsk_texture_get_render_data (texture, self);
+  data = gsk_texture_get_render_data (texture, self->texture_cache);
   if (data)
     return g_object_ref (data->image);
 
-  surface = gsk_texture_download_surface (texture);
+  /* Only frames drawn to the window can show the texture later */
+  if (gsk_renderer_get_drawing_context (GSK_RENDERER (self)))
+    window = gsk_renderer_get_window (GSK_RENDERER (self));
+  else
+    window = NULL;
+
+  surface = gsk_texture_download_surface_async (texture, window);
+  if (surface == NULL)
+    {
+      /* Draw nothing until the pixels are ready */
+      return gsk_vulkan_image_new_from_data (uploader,
+                                             (guchar[4]) { 0, 0, 0, 0 },
+                                             1, 1, 4);
+    }
+
   image = gsk_vulkan_image_new_from_data (uploader,
                                           cairo_image_surface_get_data (surface),
                                           cairo_image_surface_get_width (surface),
@@ -329,12 +543,13 @@ gsk_vulkan_renderer_ref_texture_image (GskVulkanRenderer *self,
   data = g_slice_new0 (GskVulkanTextureData);
   data->image = image;
   data->texture = texture;
-  data->renderer = self;
+  data->cache = self->texture_cache;
+  data->vulkan = self->vulkan;
 
-  if (gsk_texture_set_render_data (texture, self, data, gsk_vulkan_renderer_clear_texture))
+  if (gsk_texture_set_render_data (texture, self->texture_cache, data, gsk_vulkan_renderer_clear_texture))
     {
       g_object_ref (data->image);
-      self->textures = g_slist_prepend (self->textures, data);
+      self->texture_cache->textures = g_slist_prepend (self->texture_cache->textures, data);
     }
   else
     {
@@ -343,3 +558,109 @@ gsk_vulkan_renderer_ref_texture_image (GskVulkanRenderer *self,
 
   return image;
 }
+
+static void
+gsk_vulkan_renderer_clear_surface (gpointer p)
+{
+  GskVulkanSurfaceData *data = p;
+
+  data->renderer->surfaces = g_slist_remove (data->renderer->surfaces, data);
+
+  g_object_unref (data->image);
+
+  g_slice_free (GskVulkanSurfaceData, data);
+}
+
+/* Cairo nodes are often kept across frames, so the upload of their
+ * surface is kept until the surface goes away or is drawn to again
+ */
+GskVulkanImage *
+gsk_vulkan_renderer_ref_surface_image (GskVulkanRenderer *self,
+                                       cairo_surface_t   *surface,
+                                       guint              serial,
+                                       GskVulkanUploader *uploader)
+{
+  GskVulkanSurfaceData *data;
+  GskVulkanImage *image;
+
+  data = cairo_surface_get_user_data (surface, &self->surface_key);
+  if (data && data->serial == serial)
+    return g_object_ref (data->image);
+
+  image = gsk_vulkan_image_new_from_data (uploader,
+                                          cairo_image_surface_get_data (surface),
+                                          cairo_image_surface_get_width (surface),
+                                          cairo_image_surface_get_height (surface),
+                                          cairo_image_surface_get_stride (surface));
+
+  data = g_slice_new0 (GskVulkanSurfaceData);
+  data->surface = surface;
+  data->serial = serial;
+  data->image = g_object_ref (image);
+  data->renderer = self;
+  self->surfaces = g_slist_prepend (self->surfaces, data);
+
+  /* Replacing the user data frees the outdated upload */
+  if (cairo_surface_set_user_data (surface, &self->surface_key,
+                                   data, gsk_vulkan_renderer_clear_surface) != CAIRO_STATUS_SUCCESS)
+    gsk_vulkan_renderer_clear_surface (data);
+
+  return image;
+}
+
+/* Keeps an image per glyph cache page, and only uploads the area
+ * of the glyphs added to the page since the last upload
+ */
+GskVulkanImage *
+gsk_vulkan_renderer_ref_glyph_image (GskVulkanRenderer *self,
+                                     guint              page,
+                                     GskVulkanUploader *uploader)
+{
+  GskVulkanGlyphImage *glyph_image;
+  cairo_rectangle_int_t area;
+  cairo_surface_t *surface;
+  int width, height, stride;
+
+  if (page >= self->glyph_images->len)
+    g_array_set_size (self->glyph_images, page + 1);
+
+  glyph_image = &g_array_index (self->glyph_images, GskVulkanGlyphImage, page);
+
+  surface = gsk_glyph_cache_get_page_update (self->glyph_cache, page, &glyph_image->serial, &area);
+  if (surface != NULL)
+    {
+      width = cairo_image_surface_get_width (surface);
+      height = cairo_image_surface_get_height (surface);
+      stride = cairo_image_surface_get_stride (surface);
+
+      /* A page that was replaced goes to a new image, as frames
+       * in flight may still use the glyphs of the old one
+       */
+      if (glyph_image->image == NULL || (area.width == width && area.height == height))
+        {
+          g_clear_object (&glyph_image->image);
+          glyph_image->image = gsk_vulkan_image_new_for_atlas (self->vulkan, width, height);
+        }
+
+      gsk_vulkan_image_upload_region (glyph_image->image,
+                                      uploader,
+                                      cairo_image_surface_get_data (surface) + area.y * stride + area.x * 4,
+                                      area.width, area.height,
+                                      stride,
+                                      area.x, area.y);
+    }
+
+  return g_object_ref (glyph_image->image);
+}
+
+GskGlyphCache *
+gsk_vulkan_renderer_get_glyph_cache (GskVulkanRenderer *self)
+{
+  return self->glyph_cache;
+}
+
+GskOffscreenCache *
+gsk_vulkan_renderer_get_offscreen_cache (GskVulkanRenderer *self)
+{
+  return self->offscreen_cache;
+}
@@ -4,6 +4,8 @@
 #include <vulkan/vulkan.h>
 #include <gsk/gskrenderer.h>
 
+#include "gsk/gskglyphcacheprivate.h"
+#include "gsk/gskoffscreencacheprivate.h"
 #include "gsk/gskvulkanimageprivate.h"
 
 G_BEGIN_DECLS
@@ -24,6 +26,16 @@ GType gsk_vulkan_renderer_get_type (void) G_GNUC_CONST;
 GskVulkanImage *        gsk_vulkan_renderer_ref_texture_image           (GskVulkanRenderer      *self,
                                                                          GskTexture             *texture,
                                                                          GskVulkanUploader      *uploader);
+GskVulkanImage *        gsk_vulkan_renderer_ref_surface_image           (GskVulkanRenderer      *self,
+                                                                         cairo_surface_t        *surface,
+                                                                         guint                   serial,
+                                                                         GskVulkanUploader      *uploader);
+GskVulkanImage *        gsk_vulkan_renderer_ref_glyph_image             (GskVulkanRenderer      *self,
+                                                                         guint                   page,
+                                                                         GskVulkanUploader      *uploader);
+
+GskGlyphCache *         gsk_vulkan_renderer_get_glyph_cache             (GskVulkanRenderer      *self);
+GskOffscreenCache *     gsk_vulkan_renderer_get_offscreen_cache         (GskVulkanRenderer      *self);
 
 G_END_DECLS
 
@@ -3,6 +3,7 @@
 #include "gskvulkanrenderpassprivate.h"
 
 #include "gskdebugprivate.h"
+#include "gskglyphcacheprivate.h"
 #include "gskrendernodeprivate.h"
 #include "gskrenderer.h"
 #include "gskroundedrectprivate.h"
@@ -19,6 +20,7 @@
 
 typedef union _GskVulkanOp GskVulkanOp;
 typedef struct _GskVulkanOpRender GskVulkanOpRender;
+typedef struct _GskVulkanOpText GskVulkanOpText;
 typedef struct _GskVulkanOpPushConstants GskVulkanOpPushConstants;
 
 typedef enum {
@@ -32,9 +34,12 @@ typedef enum {
   GSK_VULKAN_OP_LINEAR_GRADIENT,
   GSK_VULKAN_OP_OPACITY,
   GSK_VULKAN_OP_COLOR_MATRIX,
+  GSK_VULKAN_OP_TEXTURE_EFFECT,
   GSK_VULKAN_OP_BORDER,
   GSK_VULKAN_OP_INSET_SHADOW,
   GSK_VULKAN_OP_OUTSET_SHADOW,
+  /* GskVulkanOpText */
+  GSK_VULKAN_OP_TEXT,
   /* GskVulkanOpPushConstants */
   GSK_VULKAN_OP_PUSH_VERTEX_CONSTANTS
 } GskVulkanOpType;
@@ -46,11 +51,28 @@ struct _GskVulkanOpRender
   GskVulkanPipeline   *pipeline; /* pipeline to use */
   GskRoundedRect       clip; /* clip rect (or random memory if not relevant) */
   GskVulkanImage      *source; /* source image to render */
+  GskRenderNode       *effect; /* opacity or color matrix node applied to node, or NULL */
   gsize                vertex_offset; /* offset into vertex buffer */
   gsize                vertex_count; /* number of vertices */
   gsize                descriptor_set_index; /* index into descriptor sets array for the right descriptor set to bind */
 };
 
+struct _GskVulkanOpText
+{
+  GskVulkanOpType      type;
+  GskRenderNode       *node; /* node that's the source of this op */
+  GskVulkanPipeline   *pipeline; /* pipeline to use */
+  GskRoundedRect       clip; /* clip rect (or random memory if not relevant) */
+  GskVulkanImage      *source; /* source image to render */
+  gsize                vertex_offset; /* offset into vertex buffer */
+  gsize                vertex_count; /* number of vertices */
+  gsize                descriptor_set_index; /* index into descriptor sets array for the right descriptor set to bind */
+  guint                page; /* glyph cache page containing the glyphs */
+  guint                start_glyph; /* first glyph of the node's glyph string drawn by this op */
+  guint                num_glyphs; /* number of glyphs drawn by this op */
+  int                  scale; /* scale the glyphs were rendered with */
+};
+
 struct _GskVulkanOpPushConstants
 {
   GskVulkanOpType         type;
@@ -62,6 +84,7 @@ union _GskVulkanOp
 {
   GskVulkanOpType          type;
   GskVulkanOpRender        render;
+  GskVulkanOpText          text;
   GskVulkanOpPushConstants constants;
 };
 
@@ -98,6 +121,190 @@ gsk_vulkan_render_pass_free (GskVulkanRenderPass *self)
   goto fallback; \
 }G_STMT_END
 
+/* Containers with more children aren't checked for overlaps */
+#define MAX_EFFECT_CHILDREN 16
+
+static void
+gsk_vulkan_render_pass_get_effect (GskRenderNode     *effect,
+                                   graphene_matrix_t *color_matrix,
+                                   graphene_vec4_t   *color_offset)
+{
+  if (gsk_render_node_get_node_type (effect) == GSK_OPACITY_NODE)
+    {
+      graphene_matrix_init_from_float (color_matrix,
+                                       (float[16]) {
+                                           1.0, 0.0, 0.0, 0.0,
+                                           0.0, 1.0, 0.0, 0.0,
+                                           0.0, 0.0, 1.0, 0.0,
+                                           0.0, 0.0, 0.0, gsk_opacity_node_get_opacity (effect)
+                                       });
+      graphene_vec4_init (color_offset, 0.0, 0.0, 0.0, 0.0);
+    }
+  else
+    {
+      graphene_matrix_init_from_matrix (color_matrix, gsk_color_matrix_node_peek_color_matrix (effect));
+      graphene_vec4_init_from_vec4 (color_offset, gsk_color_matrix_node_peek_color_offset (effect));
+    }
+}
+
+/* Does the same as the color matrix shader */
+static void
+gsk_vulkan_render_pass_apply_effect (GskRenderNode *effect,
+                                     const GdkRGBA *color,
+                                     GdkRGBA       *result)
+{
+  graphene_matrix_t color_matrix;
+  graphene_vec4_t color_offset, pixel;
+
+  gsk_vulkan_render_pass_get_effect (effect, &color_matrix, &color_offset);
+
+  graphene_vec4_init (&pixel, color->red, color->green, color->blue, color->alpha);
+  graphene_matrix_transform_vec4 (&color_matrix, &pixel, &pixel);
+  graphene_vec4_add (&pixel, &color_offset, &pixel);
+
+  result->red = CLAMP (graphene_vec4_get_x (&pixel), 0, 1);
+  result->green = CLAMP (graphene_vec4_get_y (&pixel), 0, 1);
+  result->blue = CLAMP (graphene_vec4_get_z (&pixel), 0, 1);
+  result->alpha = CLAMP (graphene_vec4_get_w (&pixel), 0, 1);
+}
+
+/* Checks if @effect can be applied to every node of @node separately
+ * instead of to an offscreen rendering of @node. That is the case if
+ * no two nodes overlap and if every node can be drawn with the effect
+ * applied.
+ */
+static gboolean
+gsk_vulkan_render_pass_can_push_effect (GskRenderNode *effect,
+                                        GskRenderNode *node)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_COLOR_NODE:
+    case GSK_TEXTURE_NODE:
+      return TRUE;
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      /* The colors are interpolated and clamped after applying the
+       * stops, so only scaling the alpha gives the same result
+       */
+      return gsk_render_node_get_node_type (effect) == GSK_OPACITY_NODE &&
+             gsk_linear_gradient_node_get_n_color_stops (node) <= GSK_VULKAN_LINEAR_GRADIENT_PIPELINE_MAX_COLOR_STOPS;
+
+    case GSK_CONTAINER_NODE:
+      {
+        guint i, j, n;
+
+        /* The offscreen is transparent between the children, and a
+         * color offset could make that visible
+         */
+        if (gsk_render_node_get_node_type (effect) == GSK_COLOR_MATRIX_NODE &&
+            graphene_vec4_get_w (gsk_color_matrix_node_peek_color_offset (effect)) > 0)
+          return FALSE;
+
+        n = gsk_container_node_get_n_children (node);
+        if (n > MAX_EFFECT_CHILDREN)
+          return FALSE;
+
+        for (i = 0; i < n; i++)
+          {
+            GskRenderNode *child = gsk_container_node_get_child (node, i);
+
+            if (!gsk_vulkan_render_pass_can_push_effect (effect, child))
+              return FALSE;
+
+            for (j = 0; j < i; j++)
+              {
+                if (graphene_rect_intersection (&child->bounds,
+                                                &gsk_container_node_get_child (node, j)->bounds,
+                                                NULL))
+                  return FALSE;
+              }
+          }
+      }
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+/* Adds the nodes of a subtree accepted by
+ * gsk_vulkan_render_pass_can_push_effect() with @effect applied
+ */
+static void
+gsk_vulkan_render_pass_add_effect_node (GskVulkanRenderPass          *self,
+                                        GskVulkanRender              *render,
+                                        const GskVulkanPushConstants *constants,
+                                        GskRenderNode                *effect,
+                                        GskRenderNode                *node)
+{
+  GskVulkanOp op = {
+    .render.node = node,
+    .render.effect = effect
+  };
+  GskVulkanPipelineType pipeline_type;
+  gboolean unclipped;
+
+  if (!graphene_rect_intersection (&node->bounds, &constants->clip.rect.bounds, NULL))
+    return;
+
+  unclipped = gsk_vulkan_clip_contains_rect (&constants->clip, &node->bounds);
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_COLOR_NODE:
+      if (unclipped)
+        pipeline_type = GSK_VULKAN_PIPELINE_COLOR;
+      else if (constants->clip.type == GSK_VULKAN_CLIP_RECT)
+        pipeline_type = GSK_VULKAN_PIPELINE_COLOR_CLIP;
+      else
+        pipeline_type = GSK_VULKAN_PIPELINE_COLOR_CLIP_ROUNDED;
+      op.type = GSK_VULKAN_OP_COLOR;
+      break;
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      if (unclipped)
+        pipeline_type = GSK_VULKAN_PIPELINE_LINEAR_GRADIENT;
+      else if (constants->clip.type == GSK_VULKAN_CLIP_RECT)
+        pipeline_type = GSK_VULKAN_PIPELINE_LINEAR_GRADIENT_CLIP;
+      else
+        pipeline_type = GSK_VULKAN_PIPELINE_LINEAR_GRADIENT_CLIP_ROUNDED;
+      op.type = GSK_VULKAN_OP_LINEAR_GRADIENT;
+      break;
+
+    case GSK_TEXTURE_NODE:
+      if (unclipped)
+        pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX;
+      else if (constants->clip.type == GSK_VULKAN_CLIP_RECT)
+        pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX_CLIP;
+      else
+        pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX_CLIP_ROUNDED;
+      op.type = GSK_VULKAN_OP_TEXTURE_EFFECT;
+      break;
+
+    case GSK_CONTAINER_NODE:
+      {
+        guint i;
+
+        for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+          {
+            gsk_vulkan_render_pass_add_effect_node (self, render, constants, effect,
+                                                    gsk_container_node_get_child (node, i));
+          }
+      }
+      return;
+
+    default:
+      g_assert_not_reached ();
+      return;
+    }
+
+  op.render.pipeline = gsk_vulkan_render_get_pipeline (render, pipeline_type);
+  g_array_append_val (self->render_ops, op);
+}
+
 static void
 gsk_vulkan_render_pass_add_node (GskVulkanRenderPass           *self,
                                  GskVulkanRender               *render,
@@ -110,6 +317,13 @@ gsk_vulkan_render_pass_add_node (GskVulkanRenderPass           *self,
   };
   GskVulkanPipelineType pipeline_type;
 
+  /* The clip rect is the visible area in the node's coordinates even
+   * without a clip, so nodes outside of it can't change any pixels
+   */
+  if (constants->clip.type == GSK_VULKAN_CLIP_ALL_CLIPPED ||
+      !graphene_rect_intersection (&node->bounds, &constants->clip.rect.bounds, NULL))
+    return;
+
   switch (gsk_render_node_get_node_type (node))
     {
     case GSK_NOT_A_RENDER_NODE:
@@ -184,6 +398,71 @@ gsk_vulkan_render_pass_add_node (GskVulkanRenderPass           *self,
       g_array_append_val (self->render_ops, op);
       return;
 
+    case GSK_TEXT_NODE:
+      {
+        GskGlyphCache *cache = gsk_vulkan_renderer_get_glyph_cache (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)));
+        PangoFont *font = gsk_text_node_peek_font (node);
+        PangoGlyphString *glyphs = gsk_text_node_peek_glyphs (node);
+        int scale = gsk_renderer_get_scale_factor (gsk_vulkan_render_get_renderer (render));
+        int i;
+
+        if (gsk_vulkan_clip_contains_rect (&constants->clip, &node->bounds))
+          pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX;
+        else if (constants->clip.type == GSK_VULKAN_CLIP_RECT)
+          pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX_CLIP;
+        else if (constants->clip.type == GSK_VULKAN_CLIP_ROUNDED_CIRCULAR)
+          pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX_CLIP_ROUNDED;
+        else
+          FALLBACK ("Text nodes can't deal with clip type %u\n", constants->clip.type);
+
+        if (scale < 1)
+          scale = 1;
+
+        /* Rendering glyphs into the cache changes the page textures,
+         * so they're only fetched when uploading
+         */
+        for (i = 0; i < glyphs->num_glyphs; i++)
+          {
+            if (gsk_glyph_cache_lookup (cache, font, glyphs->glyphs[i].glyph, scale) == NULL)
+              FALLBACK ("Glyphs don't fit into the glyph cache\n");
+          }
+
+        /* One op per run of glyphs on the same page; blank glyphs
+         * are drawn as empty rectangles
+         */
+        op.type = GSK_VULKAN_OP_TEXT;
+        op.text.pipeline = gsk_vulkan_render_get_pipeline (render, pipeline_type);
+        op.text.scale = scale;
+        op.text.num_glyphs = 0;
+        for (i = 0; i < glyphs->num_glyphs; i++)
+          {
+            const GskCachedGlyph *glyph = gsk_glyph_cache_lookup (cache, font, glyphs->glyphs[i].glyph, scale);
+
+            if (glyph->page == G_MAXUINT)
+              {
+                if (op.text.num_glyphs > 0)
+                  op.text.num_glyphs++;
+                continue;
+              }
+
+            if (op.text.num_glyphs > 0 && glyph->page != op.text.page)
+              {
+                g_array_append_val (self->render_ops, op);
+                op.text.num_glyphs = 0;
+              }
+
+            if (op.text.num_glyphs == 0)
+              {
+                op.text.page = glyph->page;
+                op.text.start_glyph = i;
+              }
+            op.text.num_glyphs++;
+          }
+        if (op.text.num_glyphs > 0)
+          g_array_append_val (self->render_ops, op);
+      }
+      return;
+
     case GSK_COLOR_NODE:
       if (gsk_vulkan_clip_contains_rect (&constants->clip, &node->bounds))
         pipeline_type = GSK_VULKAN_PIPELINE_COLOR;
@@ -226,6 +505,11 @@ gsk_vulkan_render_pass_add_node (GskVulkanRenderPass           *self,
         pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX_CLIP_ROUNDED;
       else
         FALLBACK ("Opacity nodes can't deal with clip type %u\n", constants->clip.type);
+      if (gsk_vulkan_render_pass_can_push_effect (node, gsk_opacity_node_get_child (node)))
+        {
+          gsk_vulkan_render_pass_add_effect_node (self, render, constants, node, gsk_opacity_node_get_child (node));
+          return;
+        }
       op.type = GSK_VULKAN_OP_OPACITY;
       op.render.pipeline = gsk_vulkan_render_get_pipeline (render, pipeline_type);
       g_array_append_val (self->render_ops, op);
@@ -240,6 +524,11 @@ gsk_vulkan_render_pass_add_node (GskVulkanRenderPass           *self,
         pipeline_type = GSK_VULKAN_PIPELINE_COLOR_MATRIX_CLIP_ROUNDED;
       else
         FALLBACK ("Color matrix nodes can't deal with clip type %u\n", constants->clip.type);
+      if (gsk_vulkan_render_pass_can_push_effect (node, gsk_color_matrix_node_get_child (node)))
+        {
+          gsk_vulkan_render_pass_add_effect_node (self, render, constants, node, gsk_color_matrix_node_get_child (node));
+          return;
+        }
       op.type = GSK_VULKAN_OP_COLOR_MATRIX;
       op.render.pipeline = gsk_vulkan_render_get_pipeline (render, pipeline_type);
       g_array_append_val (self->render_ops, op);
@@ -263,7 +552,9 @@ gsk_vulkan_render_pass_add_node (GskVulkanRenderPass           *self,
       {
         guint i;
 
-        for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+        /* Children hidden below an opaque sibling are skipped */
+        i = gsk_container_node_get_first_visible_child (node, &constants->clip.rect.bounds);
+        for (; i < gsk_container_node_get_n_children (node); i++)
           {
             gsk_vulkan_render_pass_add_node (self, render, constants, gsk_container_node_get_child (node, i));
           }
@@ -374,18 +665,284 @@ gsk_vulkan_render_pass_add (GskVulkanRenderPass     *self,
   gsk_vulkan_render_pass_add_node (self, render, &op.constants.constants, node);
 }
 
+/* Fallbacks are drawn with Cairo before any of them is uploaded, so the
+ * drawing can be spread over a pool of threads. The main thread draws
+ * one of them, too, and copies the results into images once all of
+ * them are done. Pango fonts are not thread-safe, so text nodes draw
+ * their glyphs under a lock, see gsk_text_node_draw().
+ */
+typedef struct {
+  GMutex lock;
+  GCond cond;
+  guint n_pending;
+} FallbackQueue;
+
+typedef struct {
+  FallbackQueue *queue;
+
+  GskRenderNode *node;
+  graphene_rect_t bounds;
+  GskVulkanOpType clip_type;
+  GskRoundedRect clip;
+
+  cairo_surface_t *surface;
+} FallbackJob;
+
+static void
+fallback_job_draw (FallbackJob *job)
+{
+  cairo_t *cr;
+
+  /* XXX: We could intersect bounds with clip bounds here */
+  job->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                             ceil (job->bounds.size.width),
+                                             ceil (job->bounds.size.height));
+  cr = cairo_create (job->surface);
+  cairo_translate (cr, -job->bounds.origin.x, -job->bounds.origin.y);
+
+  if (job->clip_type == GSK_VULKAN_OP_FALLBACK_CLIP)
+    {
+      cairo_rectangle (cr,
+                       job->clip.bounds.origin.x, job->clip.bounds.origin.y,
+                       job->clip.bounds.size.width, job->clip.bounds.size.height);
+      cairo_clip (cr);
+    }
+  else if (job->clip_type == GSK_VULKAN_OP_FALLBACK_ROUNDED_CLIP)
+    {
+      gsk_rounded_rect_path (&job->clip, cr);
+      cairo_clip (cr);
+    }
+  else
+    {
+      g_assert (job->clip_type == GSK_VULKAN_OP_FALLBACK);
+    }
+
+  gsk_render_node_draw (job->node, cr);
+
+  cairo_destroy (cr);
+}
+
+static void
+fallback_job_run (gpointer data,
+                  gpointer user_data)
+{
+  FallbackJob *job = data;
+  FallbackQueue *queue = job->queue;
+
+  fallback_job_draw (job);
+
+  g_mutex_lock (&queue->lock);
+  queue->n_pending--;
+  if (queue->n_pending == 0)
+    g_cond_signal (&queue->cond);
+  g_mutex_unlock (&queue->lock);
+}
+
+static GThreadPool *
+get_fallback_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (pool == NULL)
+    pool = g_thread_pool_new (fallback_job_run, NULL,
+                              g_get_num_processors (), FALSE,
+                              NULL);
+
+  return pool;
+}
+
+static FallbackJob *
+fallback_job_new (GskRenderNode         *node,
+                  const graphene_rect_t *bounds,
+                  GskVulkanOpType        clip_type,
+                  const GskRoundedRect  *clip)
+{
+  FallbackJob *job;
+
+  job = g_slice_new0 (FallbackJob);
+  job->node = node;
+  job->bounds = *bounds;
+  job->clip_type = clip_type;
+  if (clip_type != GSK_VULKAN_OP_FALLBACK)
+    job->clip = *clip;
+
+  return job;
+}
+
+static void
+fallback_job_free (gpointer data)
+{
+  FallbackJob *job = data;
+
+  g_clear_pointer (&job->surface, cairo_surface_destroy);
+
+  g_slice_free (FallbackJob, job);
+}
+
+/* Checks if gsk_vulkan_render_pass_get_node_as_texture() has to draw
+ * @node with Cairo, or if it can use an image
+ */
+static gboolean
+gsk_vulkan_render_pass_needs_fallback (GskVulkanRender       *render,
+                                       GskRenderNode         *node,
+                                       const graphene_rect_t *bounds)
+{
+  GskOffscreenCache *cache;
+
+  if (graphene_rect_equal (bounds, &node->bounds))
+    {
+      switch (gsk_render_node_get_node_type (node))
+        {
+        case GSK_TEXTURE_NODE:
+        case GSK_CAIRO_NODE:
+          return FALSE;
+
+        default:
+          break;
+        }
+    }
+
+  cache = gsk_vulkan_renderer_get_offscreen_cache (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)));
+
+  return gsk_offscreen_cache_lookup (cache, node, bounds, 1) == NULL;
+}
+
+/* Collects the fallbacks of all ops into @jobs, at the index of the op,
+ * and draws them
+ */
+static void
+gsk_vulkan_render_pass_draw_fallbacks (GskVulkanRenderPass *self,
+                                       GskVulkanRender     *render,
+                                       GPtrArray           *jobs)
+{
+  GskOffscreenCache *cache;
+  FallbackQueue queue;
+  GskVulkanOp *op;
+  GskRenderNode *child;
+  FallbackJob *job, *main_job;
+  guint i, n_jobs;
+
+  cache = gsk_vulkan_renderer_get_offscreen_cache (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)));
+
+  g_ptr_array_set_size (jobs, self->render_ops->len);
+  n_jobs = 0;
+
+  for (i = 0; i < self->render_ops->len; i++)
+    {
+      op = &g_array_index (self->render_ops, GskVulkanOp, i);
+      job = NULL;
+
+      switch (op->type)
+        {
+        case GSK_VULKAN_OP_FALLBACK:
+          /* Clipped fallbacks depend on the clip, so only unclipped ones
+           * are kept across frames
+           */
+          if (gsk_offscreen_cache_lookup (cache, op->render.node, &op->render.node->bounds, 1))
+            break;
+          /* fall through */
+        case GSK_VULKAN_OP_FALLBACK_CLIP:
+        case GSK_VULKAN_OP_FALLBACK_ROUNDED_CLIP:
+          job = fallback_job_new (op->render.node, &op->render.node->bounds, op->type, &op->render.clip);
+          break;
+
+        case GSK_VULKAN_OP_OPACITY:
+        case GSK_VULKAN_OP_COLOR_MATRIX:
+          if (op->type == GSK_VULKAN_OP_OPACITY)
+            child = gsk_opacity_node_get_child (op->render.node);
+          else
+            child = gsk_color_matrix_node_get_child (op->render.node);
+
+          if (gsk_vulkan_render_pass_needs_fallback (render, child, &child->bounds))
+            job = fallback_job_new (child, &child->bounds, GSK_VULKAN_OP_FALLBACK, NULL);
+          break;
+
+        default:
+          break;
+        }
+
+      if (job)
+        {
+          g_ptr_array_index (jobs, i) = job;
+          n_jobs++;
+        }
+    }
+
+  if (n_jobs == 0)
+    return;
+
+  if (n_jobs == 1)
+    {
+      for (i = 0; i < jobs->len; i++)
+        {
+          if (g_ptr_array_index (jobs, i))
+            fallback_job_draw (g_ptr_array_index (jobs, i));
+        }
+      return;
+    }
+
+  GSK_NOTE (FALLBACK, g_print ("Drawing %u fallbacks in threads\n", n_jobs));
+
+  g_mutex_init (&queue.lock);
+  g_cond_init (&queue.cond);
+  queue.n_pending = 0;
+
+  main_job = NULL;
+
+  g_mutex_lock (&queue.lock);
+  for (i = 0; i < jobs->len; i++)
+    {
+      job = g_ptr_array_index (jobs, i);
+      if (job == NULL)
+        continue;
+
+      if (main_job == NULL)
+        {
+          main_job = job;
+          continue;
+        }
+
+      job->queue = &queue;
+      queue.n_pending++;
+      g_thread_pool_push (get_fallback_pool (), job, NULL);
+    }
+  g_mutex_unlock (&queue.lock);
+
+  fallback_job_draw (main_job);
+
+  g_mutex_lock (&queue.lock);
+  while (queue.n_pending > 0)
+    g_cond_wait (&queue.cond, &queue.lock);
+  g_mutex_unlock (&queue.lock);
+
+  g_cond_clear (&queue.cond);
+  g_mutex_clear (&queue.lock);
+}
+
+static GskVulkanImage *
+gsk_vulkan_render_pass_upload_surface (GskVulkanUploader *uploader,
+                                       cairo_surface_t   *surface)
+{
+  return gsk_vulkan_image_new_from_data (uploader,
+                                         cairo_image_surface_get_data (surface),
+                                         cairo_image_surface_get_width (surface),
+                                         cairo_image_surface_get_height (surface),
+                                         cairo_image_surface_get_stride (surface));
+}
+
 static GskVulkanImage *
 gsk_vulkan_render_pass_get_node_as_texture (GskVulkanRenderPass   *self,
                                             GskVulkanRender       *render,
                                             GskVulkanUploader     *uploader,
                                             GskRenderNode         *node,
-                                            const graphene_rect_t *bounds)
+                                            const graphene_rect_t *bounds,
+                                            FallbackJob           *job)
 {
+  GskOffscreenCache *cache;
   GskVulkanImage *result;
   cairo_surface_t *surface;
-  cairo_t *cr;
 
-  if (graphene_rect_equal (bounds, &node->bounds))
+  if (job == NULL && graphene_rect_equal (bounds, &node->bounds))
     {
       switch (gsk_render_node_get_node_type (node))
         {
@@ -394,37 +951,41 @@ gsk_vulkan_render_pass_get_node_as_texture (GskVulkanRenderPass   *self,
                                                         gsk_texture_node_get_texture (node),
                                                         uploader);
         case GSK_CAIRO_NODE:
-          surface = cairo_surface_reference (gsk_cairo_node_get_surface (node));
-          goto got_surface;
+          result = gsk_vulkan_renderer_ref_surface_image (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)),
+                                                          gsk_cairo_node_get_surface (node),
+                                                          gsk_cairo_node_get_surface_serial (node),
+                                                          uploader);
+          gsk_vulkan_render_add_cleanup_image (render, result);
+          return result;
 
         default:
           break;
         }
     }
 
+  /* Rendering with Cairo is expensive, so keep the result around */
+  cache = gsk_vulkan_renderer_get_offscreen_cache (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)));
+  if (job == NULL)
+    {
+      result = gsk_offscreen_cache_lookup (cache, node, bounds, 1);
+      g_assert (result != NULL);
+
+      g_object_ref (result);
+      gsk_vulkan_render_add_cleanup_image (render, result);
+      return result;
+    }
+
   GSK_NOTE (FALLBACK, g_print ("Node as texture not implemented. Using %gx%g fallback surface\n",
                                ceil (bounds->size.width),
                                ceil (bounds->size.height)));
 
-  /* XXX: We could intersect bounds with clip bounds here */
-  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                        ceil (bounds->size.width),
-                                        ceil (bounds->size.height));
-  cr = cairo_create (surface);
-  cairo_translate (cr, -bounds->origin.x, -bounds->origin.y);
-
-  gsk_render_node_draw (node, cr);
-
-  cairo_destroy (cr);
-
-got_surface:
-  result = gsk_vulkan_image_new_from_data (uploader,
-                                           cairo_image_surface_get_data (surface),
-                                           cairo_image_surface_get_width (surface),
-                                           cairo_image_surface_get_height (surface),
-                                           cairo_image_surface_get_stride (surface));
+  surface = job->surface;
+  result = gsk_vulkan_render_pass_upload_surface (uploader, surface);
 
-  cairo_surface_destroy (surface);
+  if (gsk_offscreen_cache_insert (cache, node, bounds, 1,
+                                  result,
+                                  cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface)))
+    g_object_ref (result);
 
   gsk_vulkan_render_add_cleanup_image (render, result);
 
@@ -435,49 +996,34 @@ static void
 gsk_vulkan_render_pass_upload_fallback (GskVulkanRenderPass  *self,
                                         GskVulkanOpRender    *op,
                                         GskVulkanRender      *render,
-                                        GskVulkanUploader    *uploader)
+                                        GskVulkanUploader    *uploader,
+                                        FallbackJob          *job)
 {
+  GskOffscreenCache *cache;
   GskRenderNode *node;
   cairo_surface_t *surface;
-  cairo_t *cr;
 
   node = op->node;
 
-  /* XXX: We could intersect bounds with clip bounds here */
-  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                        ceil (node->bounds.size.width),
-                                        ceil (node->bounds.size.height));
-  cr = cairo_create (surface);
-  cairo_translate (cr, -node->bounds.origin.x, -node->bounds.origin.y);
-
-  if (op->type == GSK_VULKAN_OP_FALLBACK_CLIP)
-    {
-      cairo_rectangle (cr,
-                       op->clip.bounds.origin.x, op->clip.bounds.origin.y,
-                       op->clip.bounds.size.width, op->clip.bounds.size.height);
-      cairo_clip (cr);
-    }
-  else if (op->type == GSK_VULKAN_OP_FALLBACK_ROUNDED_CLIP)
-    {
-      gsk_rounded_rect_path (&op->clip, cr);
-      cairo_clip (cr);
-    }
-  else
+  cache = gsk_vulkan_renderer_get_offscreen_cache (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)));
+  if (job == NULL)
     {
-      g_assert (op->type == GSK_VULKAN_OP_FALLBACK);
-    }
-
-  gsk_render_node_draw (node, cr);
+      op->source = gsk_offscreen_cache_lookup (cache, node, &node->bounds, 1);
+      g_assert (op->source != NULL);
 
-  cairo_destroy (cr);
+      g_object_ref (op->source);
+      gsk_vulkan_render_add_cleanup_image (render, op->source);
+      return;
+    }
 
-  op->source = gsk_vulkan_image_new_from_data (uploader,
-                                               cairo_image_surface_get_data (surface),
-                                               cairo_image_surface_get_width (surface),
-                                               cairo_image_surface_get_height (surface),
-                                               cairo_image_surface_get_stride (surface));
+  surface = job->surface;
+  op->source = gsk_vulkan_render_pass_upload_surface (uploader, surface);
 
-  cairo_surface_destroy (surface);
+  if (op->type == GSK_VULKAN_OP_FALLBACK &&
+      gsk_offscreen_cache_insert (cache, node, &node->bounds, 1,
+                                  op->source,
+                                  cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface)))
+    g_object_ref (op->source);
 
   gsk_vulkan_render_add_cleanup_image (render, op->source);
 }
@@ -487,9 +1033,13 @@ gsk_vulkan_render_pass_upload (GskVulkanRenderPass  *self,
                                GskVulkanRender      *render,
                                GskVulkanUploader    *uploader)
 {
+  GPtrArray *jobs;
   GskVulkanOp *op;
   guint i;
 
+  jobs = g_ptr_array_new_with_free_func (fallback_job_free);
+  gsk_vulkan_render_pass_draw_fallbacks (self, render, jobs);
+
   for (i = 0; i < self->render_ops->len; i++)
     {
       op = &g_array_index (self->render_ops, GskVulkanOp, i);
@@ -499,22 +1049,22 @@ gsk_vulkan_render_pass_upload (GskVulkanRenderPass  *self,
         case GSK_VULKAN_OP_FALLBACK:
         case GSK_VULKAN_OP_FALLBACK_CLIP:
         case GSK_VULKAN_OP_FALLBACK_ROUNDED_CLIP:
-          gsk_vulkan_render_pass_upload_fallback (self, &op->render, render, uploader);
+          gsk_vulkan_render_pass_upload_fallback (self, &op->render, render, uploader,
+                                                  g_ptr_array_index (jobs, i));
           break;
 
         case GSK_VULKAN_OP_SURFACE:
           {
-            cairo_surface_t *surface = gsk_cairo_node_get_surface (op->render.node);
-            op->render.source = gsk_vulkan_image_new_from_data (uploader,
-                                                                cairo_image_surface_get_data (surface),
-                                                                cairo_image_surface_get_width (surface),
-                                                                cairo_image_surface_get_height (surface),
-                                                                cairo_image_surface_get_stride (surface));
+            op->render.source = gsk_vulkan_renderer_ref_surface_image (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)),
+                                                                       gsk_cairo_node_get_surface (op->render.node),
+                                                                       gsk_cairo_node_get_surface_serial (op->render.node),
+                                                                       uploader);
             gsk_vulkan_render_add_cleanup_image (render, op->render.source);
           }
           break;
 
         case GSK_VULKAN_OP_TEXTURE:
+        case GSK_VULKAN_OP_TEXTURE_EFFECT:
           {
             op->render.source = gsk_vulkan_renderer_ref_texture_image (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)),
                                                                        gsk_texture_node_get_texture (op->render.node),
@@ -523,6 +1073,17 @@ gsk_vulkan_render_pass_upload (GskVulkanRenderPass  *self,
           }
           break;
 
+        case GSK_VULKAN_OP_TEXT:
+          {
+            GskVulkanRenderer *renderer = GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render));
+
+            op->text.source = gsk_vulkan_renderer_ref_glyph_image (renderer,
+                                                                   op->text.page,
+                                                                   uploader);
+            gsk_vulkan_render_add_cleanup_image (render, op->text.source);
+          }
+          break;
+
         case GSK_VULKAN_OP_OPACITY:
           {
             GskRenderNode *child = gsk_opacity_node_get_child (op->render.node);
@@ -531,7 +1092,8 @@ gsk_vulkan_render_pass_upload (GskVulkanRenderPass  *self,
                                                                             render,
                                                                             uploader,
                                                                             child,
-                                                                            &child->bounds);
+                                                                            &child->bounds,
+                                                                            g_ptr_array_index (jobs, i));
           }
           break;
 
@@ -543,7 +1105,8 @@ gsk_vulkan_render_pass_upload (GskVulkanRenderPass  *self,
                                                                             render,
                                                                             uploader,
                                                                             child,
-                                                                            &child->bounds);
+                                                                            &child->bounds,
+                                                                            g_ptr_array_index (jobs, i));
           }
           break;
 
@@ -558,6 +1121,68 @@ gsk_vulkan_render_pass_upload (GskVulkanRenderPass  *self,
           break;
         }
     }
+
+  g_ptr_array_unref (jobs);
+}
+
+/* Glyphs are stored as white coverage in the glyph cache, so scaling
+ * the unpremultiplied channels by the text color tints them
+ */
+static void
+gsk_vulkan_render_pass_collect_text (GskVulkanRenderPass *self,
+                                     GskVulkanRender     *render,
+                                     GskVulkanOpText     *op,
+                                     guchar              *data)
+{
+  GskGlyphCache *cache = gsk_vulkan_renderer_get_glyph_cache (GSK_VULKAN_RENDERER (gsk_vulkan_render_get_renderer (render)));
+  PangoFont *font = gsk_text_node_peek_font (op->node);
+  PangoGlyphString *glyphs = gsk_text_node_peek_glyphs (op->node);
+  const GdkRGBA *color = gsk_text_node_peek_color (op->node);
+  gsize instance_size = gsk_vulkan_effect_pipeline_count_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->pipeline));
+  graphene_matrix_t color_matrix;
+  graphene_vec4_t color_offset;
+  int x_position;
+  guint i;
+
+  graphene_matrix_init_from_float (&color_matrix,
+                                   (float[16]) {
+                                       color->red, 0.0, 0.0, 0.0,
+                                       0.0, color->green, 0.0, 0.0,
+                                       0.0, 0.0, color->blue, 0.0,
+                                       0.0, 0.0, 0.0, color->alpha
+                                   });
+  graphene_vec4_init (&color_offset, 0.0, 0.0, 0.0, 0.0);
+
+  x_position = 0;
+  for (i = 0; i < op->start_glyph; i++)
+    x_position += glyphs->glyphs[i].geometry.width;
+
+  for (i = 0; i < op->num_glyphs; i++)
+    {
+      const PangoGlyphInfo *gi = &glyphs->glyphs[op->start_glyph + i];
+      const GskCachedGlyph *glyph;
+      graphene_rect_t rect;
+
+      glyph = gsk_glyph_cache_lookup (cache, font, gi->glyph, op->scale);
+
+      if (glyph->page == op->page)
+        graphene_rect_init (&rect,
+                            gsk_text_node_get_x (op->node) + (float) (x_position + gi->geometry.x_offset) / PANGO_SCALE + glyph->draw.origin.x,
+                            gsk_text_node_get_y (op->node) + (float) gi->geometry.y_offset / PANGO_SCALE + glyph->draw.origin.y,
+                            glyph->draw.size.width,
+                            glyph->draw.size.height);
+      else
+        graphene_rect_init (&rect, 0, 0, 0, 0);
+
+      gsk_vulkan_effect_pipeline_collect_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->pipeline),
+                                                      data + i * instance_size,
+                                                      &rect,
+                                                      &glyph->uv,
+                                                      &color_matrix,
+                                                      &color_offset);
+
+      x_position += gi->geometry.width;
+    }
 }
 
 gsize
@@ -595,10 +1220,16 @@ gsk_vulkan_render_pass_count_vertex_data (GskVulkanRenderPass *self)
 
         case GSK_VULKAN_OP_OPACITY:
         case GSK_VULKAN_OP_COLOR_MATRIX:
+        case GSK_VULKAN_OP_TEXTURE_EFFECT:
           op->render.vertex_count = gsk_vulkan_effect_pipeline_count_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->render.pipeline));
           n_bytes += op->render.vertex_count;
           break;
 
+        case GSK_VULKAN_OP_TEXT:
+          op->text.vertex_count = op->text.num_glyphs * gsk_vulkan_effect_pipeline_count_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->text.pipeline));
+          n_bytes += op->text.vertex_count;
+          break;
+
         case GSK_VULKAN_OP_BORDER:
           op->render.vertex_count = gsk_vulkan_border_pipeline_count_vertex_data (GSK_VULKAN_BORDER_PIPELINE (op->render.pipeline));
           n_bytes += op->render.vertex_count;
@@ -653,17 +1284,38 @@ gsk_vulkan_render_pass_collect_vertex_data (GskVulkanRenderPass *self,
 
         case GSK_VULKAN_OP_COLOR:
           {
+            GdkRGBA color = *gsk_color_node_peek_color (op->render.node);
+
+            if (op->render.effect)
+              gsk_vulkan_render_pass_apply_effect (op->render.effect, &color, &color);
+
             op->render.vertex_offset = offset + n_bytes;
             gsk_vulkan_color_pipeline_collect_vertex_data (GSK_VULKAN_COLOR_PIPELINE (op->render.pipeline),
                                                            data + n_bytes + offset,
                                                            &op->render.node->bounds,
-                                                           gsk_color_node_peek_color (op->render.node));
+                                                           &color);
             n_bytes += op->render.vertex_count;
           }
           break;
 
         case GSK_VULKAN_OP_LINEAR_GRADIENT:
           {
+            GskColorStop stops[GSK_VULKAN_LINEAR_GRADIENT_PIPELINE_MAX_COLOR_STOPS];
+            const GskColorStop *color_stops;
+            gsize j, n_stops;
+
+            n_stops = gsk_linear_gradient_node_get_n_color_stops (op->render.node);
+            color_stops = gsk_linear_gradient_node_peek_color_stops (op->render.node);
+            if (op->render.effect)
+              {
+                for (j = 0; j < n_stops; j++)
+                  {
+                    stops[j].offset = color_stops[j].offset;
+                    gsk_vulkan_render_pass_apply_effect (op->render.effect, &color_stops[j].color, &stops[j].color);
+                  }
+                color_stops = stops;
+              }
+
             op->render.vertex_offset = offset + n_bytes;
             gsk_vulkan_linear_gradient_pipeline_collect_vertex_data (GSK_VULKAN_LINEAR_GRADIENT_PIPELINE (op->render.pipeline),
                                                                      data + n_bytes + offset,
@@ -671,8 +1323,8 @@ gsk_vulkan_render_pass_collect_vertex_data (GskVulkanRenderPass *self,
                                                                      gsk_linear_gradient_node_peek_start (op->render.node),
                                                                      gsk_linear_gradient_node_peek_end (op->render.node),
                                                                      gsk_render_node_get_node_type (op->render.node) == GSK_REPEATING_LINEAR_GRADIENT_NODE,
-                                                                     gsk_linear_gradient_node_get_n_color_stops (op->render.node),
-                                                                     gsk_linear_gradient_node_peek_color_stops (op->render.node));
+                                                                     n_stops,
+                                                                     color_stops);
             n_bytes += op->render.vertex_count;
           }
           break;
@@ -681,18 +1333,13 @@ gsk_vulkan_render_pass_collect_vertex_data (GskVulkanRenderPass *self,
           {
             graphene_matrix_t color_matrix;
             graphene_vec4_t color_offset;
-            graphene_matrix_init_from_float (&color_matrix,
-                                             (float[16]) {
-                                                 1.0, 0.0, 0.0, 0.0,         
-                                                 0.0, 1.0, 0.0, 0.0,         
-                                                 0.0, 0.0, 1.0, 0.0,         
-                                                 0.0, 0.0, 0.0, gsk_opacity_node_get_opacity (op->render.node)
-                                             });
-            graphene_vec4_init (&color_offset, 0.0, 0.0, 0.0, 0.0);
+
+            gsk_vulkan_render_pass_get_effect (op->render.node, &color_matrix, &color_offset);
             op->render.vertex_offset = offset + n_bytes;
             gsk_vulkan_effect_pipeline_collect_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->render.pipeline),
                                                             data + n_bytes + offset,
                                                             &op->render.node->bounds,
+                                                            &GRAPHENE_RECT_INIT (0, 0, 1, 1),
                                                             &color_matrix,
                                                             &color_offset);
             n_bytes += op->render.vertex_count;
@@ -705,12 +1352,41 @@ gsk_vulkan_render_pass_collect_vertex_data (GskVulkanRenderPass *self,
             gsk_vulkan_effect_pipeline_collect_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->render.pipeline),
                                                             data + n_bytes + offset,
                                                             &op->render.node->bounds,
+                                                            &GRAPHENE_RECT_INIT (0, 0, 1, 1),
                                                             gsk_color_matrix_node_peek_color_matrix (op->render.node),
                                                             gsk_color_matrix_node_peek_color_offset (op->render.node));
             n_bytes += op->render.vertex_count;
           }
           break;
 
+        case GSK_VULKAN_OP_TEXTURE_EFFECT:
+          {
+            graphene_matrix_t color_matrix;
+            graphene_vec4_t color_offset;
+
+            gsk_vulkan_render_pass_get_effect (op->render.effect, &color_matrix, &color_offset);
+            op->render.vertex_offset = offset + n_bytes;
+            gsk_vulkan_effect_pipeline_collect_vertex_data (GSK_VULKAN_EFFECT_PIPELINE (op->render.pipeline),
+                                                            data + n_bytes + offset,
+                                                            &op->render.node->bounds,
+                                                            &GRAPHENE_RECT_INIT (0, 0, 1, 1),
+                                                            &color_matrix,
+                                                            &color_offset);
+            n_bytes += op->render.vertex_count;
+          }
+          break;
+
+        case GSK_VULKAN_OP_TEXT:
+          {
+            op->text.vertex_offset = offset + n_bytes;
+            gsk_vulkan_render_pass_collect_text (self,
+                                                 render,
+                                                 &op->text,
+                                                 data + n_bytes + offset);
+            n_bytes += op->text.vertex_count;
+          }
+          break;
+
         case GSK_VULKAN_OP_BORDER:
           {
             op->render.vertex_offset = offset + n_bytes;
@@ -785,9 +1461,14 @@ gsk_vulkan_render_pass_reserve_descriptor_sets (GskVulkanRenderPass *self,
         case GSK_VULKAN_OP_TEXTURE:
         case GSK_VULKAN_OP_OPACITY:
         case GSK_VULKAN_OP_COLOR_MATRIX:
+        case GSK_VULKAN_OP_TEXTURE_EFFECT:
           op->render.descriptor_set_index = gsk_vulkan_render_reserve_descriptor_set (render, op->render.source);
           break;
 
+        case GSK_VULKAN_OP_TEXT:
+          op->text.descriptor_set_index = gsk_vulkan_render_reserve_descriptor_set (render, op->text.source);
+          break;
+
         default:
           g_assert_not_reached ();
         case GSK_VULKAN_OP_COLOR:
@@ -859,6 +1540,7 @@ gsk_vulkan_render_pass_draw (GskVulkanRenderPass     *self,
 
         case GSK_VULKAN_OP_OPACITY:
         case GSK_VULKAN_OP_COLOR_MATRIX:
+        case GSK_VULKAN_OP_TEXTURE_EFFECT:
           if (current_pipeline != op->render.pipeline)
             {
               current_pipeline = op->render.pipeline;
@@ -891,6 +1573,39 @@ gsk_vulkan_render_pass_draw (GskVulkanRenderPass     *self,
                                                                  current_draw_index, 1);
           break;
 
+        case GSK_VULKAN_OP_TEXT:
+          if (current_pipeline != op->text.pipeline)
+            {
+              current_pipeline = op->text.pipeline;
+              vkCmdBindPipeline (command_buffer,
+                                 VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                 gsk_vulkan_pipeline_get_pipeline (current_pipeline));
+              vkCmdBindVertexBuffers (command_buffer,
+                                      0,
+                                      1,
+                                      (VkBuffer[1]) {
+                                          gsk_vulkan_buffer_get_buffer (vertex_buffer)
+                                      },
+                                      (VkDeviceSize[1]) { op->text.vertex_offset });
+              current_draw_index = 0;
+            }
+
+          vkCmdBindDescriptorSets (command_buffer,
+                                   VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                   gsk_vulkan_pipeline_layout_get_pipeline_layout (layout),
+                                   0,
+                                   1,
+                                   (VkDescriptorSet[1]) {
+                                       gsk_vulkan_render_get_descriptor_set (render, op->text.descriptor_set_index)
+                                   },
+                                   0,
+                                   NULL);
+
+          current_draw_index += gsk_vulkan_effect_pipeline_draw (GSK_VULKAN_EFFECT_PIPELINE (current_pipeline),
+                                                                 command_buffer,
+                                                                 current_draw_index, op->text.num_glyphs);
+          break;
+
         case GSK_VULKAN_OP_COLOR:
           if (current_pipeline != op->render.pipeline)
             {
@@ -47,6 +47,9 @@ void                    gsk_vulkan_render_reset                         (GskVulk
                                                                          const graphene_rect_t  *rect);
 
 GskRenderer *           gsk_vulkan_render_get_renderer                  (GskVulkanRender        *self);
+void                    gsk_vulkan_render_get_upload_stats              (GskVulkanRender        *self,
+                                                                         guint64                *n_uploads,
+                                                                         guint64                *upload_bytes);
 
 void                    gsk_vulkan_render_add_cleanup_image             (GskVulkanRender        *self,
                                                                          GskVulkanImage         *image);
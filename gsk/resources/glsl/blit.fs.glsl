@@ -1,5 +1,5 @@
 void main() {
   vec4 diffuse = Texture(uSource, vUv);
 
-  setOutputColor(vec4(diffuse.xyz, diffuse.a * uAlpha));
+  setOutputColor(clip(diffuse * vColor * uAlpha));
 }
@@ -3,4 +3,10 @@ void main() {
 
   // Flip the sampling
   vUv = vec2(aUv.x, aUv.y);
+
+  // Per-vertex color, premultiplied
+  vColor = aColor;
+
+  // Position in world coordinates, used for clipping
+  vPosition = aPosition;
 }
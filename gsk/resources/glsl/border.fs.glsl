@@ -0,0 +1,38 @@
+uniform vec4 uOutline;
+uniform vec4 uCornerWidths;
+uniform vec4 uCornerHeights;
+uniform vec4 uBorderWidths;
+uniform vec4 uBorderColors[4];
+
+void main() {
+  RoundedRect outside = RoundedRect(vec4(uOutline.xy, uOutline.xy + uOutline.zw), uCornerWidths, uCornerHeights);
+  RoundedRect inside = rounded_rect_shrink(outside, uBorderWidths);
+
+  float alpha = clamp(rounded_rect_coverage(outside, vUv) -
+                      rounded_rect_coverage(inside, vUv),
+                      0.0, 1.0);
+
+  // Split the corners between the two adjacent sides, using the
+  // distance to each edge relative to the width of that side
+  vec4 d = vec4(vUv.y - outside.bounds.y,
+                outside.bounds.z - vUv.x,
+                outside.bounds.w - vUv.y,
+                vUv.x - outside.bounds.x) / max(uBorderWidths, vec4(0.0001));
+
+  vec4 color = uBorderColors[0];
+  float m = d.x;
+
+  if (d.y < m) {
+    m = d.y;
+    color = uBorderColors[1];
+  }
+  if (d.z < m) {
+    m = d.z;
+    color = uBorderColors[2];
+  }
+  if (d.w < m) {
+    color = uBorderColors[3];
+  }
+
+  setOutputColor(clip(color * alpha * vColor));
+}
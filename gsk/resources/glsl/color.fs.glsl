@@ -1,5 +1,3 @@
-uniform vec4 uColor;
-
 void main() {
-  setOutputColor(uColor);
+  setOutputColor(clip(vColor * uAlpha));
 }
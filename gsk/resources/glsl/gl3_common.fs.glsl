@@ -7,6 +7,8 @@ uniform float uAlpha;
 uniform int uBlendMode;
 
 in vec2 vUv;
+in vec4 vColor;
+in vec2 vPosition;
 
 out vec4 outputColor;
 
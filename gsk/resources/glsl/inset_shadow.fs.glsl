@@ -0,0 +1,17 @@
+uniform vec4 uOutline;
+uniform vec4 uCornerWidths;
+uniform vec4 uCornerHeights;
+uniform vec4 uShadowColor;
+uniform vec2 uShadowOffset;
+uniform float uShadowSpread;
+
+void main() {
+  RoundedRect outline = RoundedRect(vec4(uOutline.xy, uOutline.xy + uOutline.zw), uCornerWidths, uCornerHeights);
+  RoundedRect inside = rounded_rect_shrink(outline, vec4(uShadowSpread));
+
+  float alpha = clamp(rounded_rect_coverage(outline, vUv) -
+                      rounded_rect_coverage(inside, vUv - uShadowOffset),
+                      0.0, 1.0);
+
+  setOutputColor(clip(uShadowColor * alpha * vColor));
+}
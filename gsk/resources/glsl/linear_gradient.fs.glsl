@@ -0,0 +1,30 @@
+uniform vec2 uGradientStart;
+uniform vec2 uGradientEnd;
+uniform int uGradientRepeating;
+uniform int uNumColorStops;
+uniform float uColorStopOffsets[8];
+uniform vec4 uColorStops[8];
+
+void main() {
+  vec2 grad = uGradientEnd - uGradientStart;
+  float pos = dot(vUv - uGradientStart, grad) / dot(grad, grad);
+
+  if (uGradientRepeating != 0)
+    pos = fract(pos);
+  else
+    pos = clamp(pos, 0.0, 1.0);
+
+  vec4 color = uColorStops[0];
+  for (int i = 1; i < 8; i++) {
+    if (i >= uNumColorStops)
+      break;
+
+    if (uColorStopOffsets[i] > uColorStopOffsets[i - 1])
+      color = mix(color, uColorStops[i],
+                  clamp((pos - uColorStopOffsets[i - 1]) / (uColorStopOffsets[i] - uColorStopOffsets[i - 1]), 0.0, 1.0));
+    else if (pos >= uColorStopOffsets[i])
+      color = uColorStops[i];
+  }
+
+  setOutputColor(clip(color * vColor));
+}
@@ -0,0 +1,82 @@
+// The current clip, in world coordinates, in the same layout as
+// gsk_rounded_rect_to_float(); an empty clip means no clipping
+uniform vec4 uClipBounds;
+uniform vec4 uClipWidths;
+uniform vec4 uClipHeights;
+
+struct RoundedRect
+{
+  vec4 bounds;
+  vec4 corner_widths;
+  vec4 corner_heights;
+};
+
+float
+ellipsis_dist (vec2 p, vec2 radius)
+{
+  vec2 p0 = p / radius;
+  vec2 p1 = 2.0 * p0 / radius;
+
+  return (dot (p0, p0) - 1.0) / length (p1);
+}
+
+float
+ellipsis_coverage (vec2 point, vec2 center, vec2 radius)
+{
+  float d = ellipsis_dist (point - center, radius);
+
+  return clamp (0.5 - d, 0.0, 1.0);
+}
+
+float
+rounded_rect_coverage (RoundedRect r, vec2 p)
+{
+  if (p.x < r.bounds.x || p.y < r.bounds.y ||
+      p.x >= r.bounds.z || p.y >= r.bounds.w)
+    return 0.0;
+
+  vec2 rad_tl = vec2 (r.corner_widths.x, r.corner_heights.x);
+  vec2 rad_tr = vec2 (r.corner_widths.y, r.corner_heights.y);
+  vec2 rad_br = vec2 (r.corner_widths.z, r.corner_heights.z);
+  vec2 rad_bl = vec2 (r.corner_widths.w, r.corner_heights.w);
+
+  vec2 ref_tl = r.bounds.xy + vec2 ( rad_tl.x,  rad_tl.y);
+  vec2 ref_tr = r.bounds.zy + vec2 (-rad_tr.x,  rad_tr.y);
+  vec2 ref_br = r.bounds.zw + vec2 (-rad_br.x, -rad_br.y);
+  vec2 ref_bl = r.bounds.xw + vec2 ( rad_bl.x, -rad_bl.y);
+
+  // Only look at the ellipses when we are inside a corner, to
+  // avoid dividing by a zero radius
+  if (p.x < ref_tl.x && p.y < ref_tl.y)
+    return ellipsis_coverage (p, ref_tl, rad_tl);
+  if (p.x > ref_tr.x && p.y < ref_tr.y)
+    return ellipsis_coverage (p, ref_tr, rad_tr);
+  if (p.x > ref_br.x && p.y > ref_br.y)
+    return ellipsis_coverage (p, ref_br, rad_br);
+  if (p.x < ref_bl.x && p.y > ref_bl.y)
+    return ellipsis_coverage (p, ref_bl, rad_bl);
+
+  return 1.0;
+}
+
+RoundedRect
+rounded_rect_shrink (RoundedRect r, vec4 amount)
+{
+  vec4 new_bounds = r.bounds + vec4 (1.0, 1.0, -1.0, -1.0) * amount.wxyz;
+  vec4 new_widths = max (r.corner_widths - amount.wyyw, 0.0);
+  vec4 new_heights = max (r.corner_heights - amount.xxzz, 0.0);
+
+  return RoundedRect (new_bounds, new_widths, new_heights);
+}
+
+vec4
+clip (vec4 color)
+{
+  if (uClipBounds.z <= 0.0)
+    return color;
+
+  RoundedRect r = RoundedRect (vec4 (uClipBounds.xy, uClipBounds.xy + uClipBounds.zw),
+                               uClipWidths, uClipHeights);
+
+  return color * rounded_rect_coverage (r, vPosition);
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2017 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gtkcssancestorfilterprivate.h"
+
+#include "gtkcssnodedeclarationprivate.h"
+#include "gtkcssnodeprivate.h"
+
+/* A counting Bloom filter of the names, classes and ids of the nodes
+ * on the path from the root to the node whose children are styled.
+ * If it says a feature is missing, no ancestor has it, so selectors
+ * that need such an ancestor can't match.
+ *
+ * Every feature sets 2 counters, taken from the low and high bits of
+ * its hash. Counters that overflow stay set, which is safe.
+ */
+#define FILTER_BITS 12
+#define FILTER_SIZE (1 << FILTER_BITS)
+#define FILTER_MASK (FILTER_SIZE - 1)
+
+struct _GtkCssAncestorFilter
+{
+  guint8 counters[FILTER_SIZE];
+
+  /* The hashes added for each pushed node, so popping removes
+   * exactly those, even if the node changed in between
+   */
+  GArray *hashes;
+  GArray *n_hashes;
+
+  /* A pushed node changed its name, id or classes, so the filter
+   * may miss features and has to match everything
+   */
+  guint invalid : 1;
+};
+
+enum {
+  FEATURE_NAME = 1,
+  FEATURE_CLASS,
+  FEATURE_ID
+};
+
+static guint
+feature_hash (guint  feature,
+              guint  value)
+{
+  guint hash = value * 0x9e3779b1 + feature;
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+GtkCssAncestorFilter *
+gtk_css_ancestor_filter_new (void)
+{
+  GtkCssAncestorFilter *filter;
+
+  filter = g_slice_new0 (GtkCssAncestorFilter);
+  filter->hashes = g_array_new (FALSE, FALSE, sizeof (guint));
+  filter->n_hashes = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  return filter;
+}
+
+void
+gtk_css_ancestor_filter_free (GtkCssAncestorFilter *filter)
+{
+  g_array_unref (filter->hashes);
+  g_array_unref (filter->n_hashes);
+
+  g_slice_free (GtkCssAncestorFilter, filter);
+}
+
+static void
+gtk_css_ancestor_filter_add (GtkCssAncestorFilter *filter,
+                             guint                 hash)
+{
+  guint8 *counter;
+
+  counter = &filter->counters[hash & FILTER_MASK];
+  if (*counter < G_MAXUINT8)
+    (*counter)++;
+
+  counter = &filter->counters[(hash >> FILTER_BITS) & FILTER_MASK];
+  if (*counter < G_MAXUINT8)
+    (*counter)++;
+
+  g_array_append_val (filter->hashes, hash);
+}
+
+static void
+gtk_css_ancestor_filter_remove (GtkCssAncestorFilter *filter,
+                                guint                 hash)
+{
+  guint8 *counter;
+
+  counter = &filter->counters[hash & FILTER_MASK];
+  if (*counter < G_MAXUINT8)
+    (*counter)--;
+
+  counter = &filter->counters[(hash >> FILTER_BITS) & FILTER_MASK];
+  if (*counter < G_MAXUINT8)
+    (*counter)--;
+}
+
+static gboolean
+gtk_css_ancestor_filter_may_have (const GtkCssAncestorFilter *filter,
+                                  guint                       hash)
+{
+  return filter->invalid ||
+         (filter->counters[hash & FILTER_MASK] != 0 &&
+          filter->counters[(hash >> FILTER_BITS) & FILTER_MASK] != 0);
+}
+
+void
+gtk_css_ancestor_filter_push (GtkCssAncestorFilter *filter,
+                              GtkCssNode           *node)
+{
+  const GtkCssNodeDeclaration *decl;
+  const GQuark *classes;
+  const char *name, *id;
+  guint i, n_classes, n_hashes;
+
+  decl = gtk_css_node_get_declaration (node);
+  n_hashes = filter->hashes->len;
+
+  name = gtk_css_node_declaration_get_name (decl);
+  if (name)
+    gtk_css_ancestor_filter_add (filter, feature_hash (FEATURE_NAME, GPOINTER_TO_UINT (name)));
+
+  id = gtk_css_node_declaration_get_id (decl);
+  if (id)
+    gtk_css_ancestor_filter_add (filter, feature_hash (FEATURE_ID, GPOINTER_TO_UINT (id)));
+
+  classes = gtk_css_node_declaration_get_classes (decl, &n_classes);
+  for (i = 0; i < n_classes; i++)
+    gtk_css_ancestor_filter_add (filter, feature_hash (FEATURE_CLASS, classes[i]));
+
+  n_hashes = filter->hashes->len - n_hashes;
+  g_array_append_val (filter->n_hashes, n_hashes);
+}
+
+void
+gtk_css_ancestor_filter_pop (GtkCssAncestorFilter *filter)
+{
+  guint i, n_hashes;
+
+  g_return_if_fail (filter->n_hashes->len > 0);
+
+  n_hashes = g_array_index (filter->n_hashes, guint, filter->n_hashes->len - 1);
+  g_array_set_size (filter->n_hashes, filter->n_hashes->len - 1);
+
+  for (i = filter->hashes->len - n_hashes; i < filter->hashes->len; i++)
+    gtk_css_ancestor_filter_remove (filter, g_array_index (filter->hashes, guint, i));
+
+  g_array_set_size (filter->hashes, filter->hashes->len - n_hashes);
+}
+
+/* Called when a pushed node changes. Rather than trying to fix up
+ * the counters, the filter stops rejecting anything until it is freed.
+ */
+void
+gtk_css_ancestor_filter_invalidate (GtkCssAncestorFilter *filter)
+{
+  filter->invalid = TRUE;
+}
+
+gboolean
+gtk_css_ancestor_filter_may_have_name (const GtkCssAncestorFilter *filter,
+                                       const char                 *name)
+{
+  return gtk_css_ancestor_filter_may_have (filter, feature_hash (FEATURE_NAME, GPOINTER_TO_UINT (name)));
+}
+
+gboolean
+gtk_css_ancestor_filter_may_have_class (const GtkCssAncestorFilter *filter,
+                                        GQuark                      class_name)
+{
+  return gtk_css_ancestor_filter_may_have (filter, feature_hash (FEATURE_CLASS, class_name));
+}
+
+gboolean
+gtk_css_ancestor_filter_may_have_id (const GtkCssAncestorFilter *filter,
+                                     const char                 *id)
+{
+  return gtk_css_ancestor_filter_may_have (filter, feature_hash (FEATURE_ID, GPOINTER_TO_UINT (id)));
+}
@@ -36,13 +36,9 @@ gtk_css_image_recolor_print (GtkCssImage *image,
 {
   GtkCssImageUrl *url = GTK_CSS_IMAGE_URL (image);
   GtkCssImageRecolor *recolor = GTK_CSS_IMAGE_RECOLOR (image);
-  char *uri;
 
-  g_string_append (string, "-gtk-recolor(url(");
-  uri = g_file_get_uri (url->file);
-  g_string_append (string, uri);
-  g_free (uri);
-  g_string_append (string, ")");
+  g_string_append (string, "-gtk-recolor(");
+  _gtk_css_image_url_print_source (url, string);
   if (recolor->palette)
     {
       g_string_append (string, ",");
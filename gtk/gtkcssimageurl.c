@@ -23,10 +23,14 @@
 
 #include "gtkcssimageurlprivate.h"
 #include "gtkcssimagesurfaceprivate.h"
+#include "gtkcssparserprivate.h"
 #include "gtkstyleproviderprivate.h"
 
 G_DEFINE_TYPE (GtkCssImageUrl, _gtk_css_image_url, GTK_TYPE_CSS_IMAGE)
 
+/* The files of printed images while writing a CSS cache */
+static GPtrArray *print_sources = NULL;
+
 static GtkCssImage *
 gtk_css_image_url_load_image (GtkCssImageUrl  *url,
                               GError         **error)
@@ -165,7 +169,10 @@ gtk_css_image_url_print (GtkCssImage *image,
 {
   GtkCssImageUrl *url = GTK_CSS_IMAGE_URL (image);
 
-  _gtk_css_image_print (gtk_css_image_url_load_image (url, NULL), string);
+  if (print_sources)
+    _gtk_css_image_url_print_source (url, string);
+  else
+    _gtk_css_image_print (gtk_css_image_url_load_image (url, NULL), string);
 }
 
 static void
@@ -201,3 +208,33 @@ _gtk_css_image_url_init (GtkCssImageUrl *image_url)
 {
 }
 
+/**
+ * _gtk_css_image_url_set_print_sources:
+ * @files: (allow-none): array to add the files of printed images to
+ *
+ * Makes url images print their location instead of the loaded image
+ * until this is called with %NULL, so that the output can be parsed
+ * again. This is used to write CSS caches, which need to know the
+ * files they depend on.
+ **/
+void
+_gtk_css_image_url_set_print_sources (GPtrArray *files)
+{
+  print_sources = files;
+}
+
+void
+_gtk_css_image_url_print_source (GtkCssImageUrl *url,
+                                 GString        *string)
+{
+  char *uri;
+
+  if (print_sources)
+    g_ptr_array_add (print_sources, g_object_ref (url->file));
+
+  uri = g_file_get_uri (url->file);
+  g_string_append (string, "url(");
+  _gtk_css_print_string (string, uri);
+  g_string_append (string, ")");
+  g_free (uri);
+}
@@ -49,6 +49,10 @@ struct _GtkCssImageUrlClass
 
 GType          _gtk_css_image_url_get_type             (void) G_GNUC_CONST;
 
+void           _gtk_css_image_url_set_print_sources    (GPtrArray      *files);
+void           _gtk_css_image_url_print_source         (GtkCssImageUrl *url,
+                                                        GString        *string);
+
 G_END_DECLS
 
 #endif /* __GTK_CSS_IMAGE_URL_PRIVATE_H__ */
@@ -198,7 +198,13 @@ gtk_css_matcher_node_get_parent (GtkCssMatcher       *matcher,
   if (node == NULL)
     return FALSE;
 
-  return gtk_css_node_init_matcher (node, matcher);
+  if (!gtk_css_node_init_matcher (node, matcher))
+    return FALSE;
+
+  /* The ancestors of the child include all of ours */
+  _gtk_css_matcher_set_ancestor_filter (matcher, child->node.filter);
+
+  return TRUE;
 }
 
 static GtkCssNode *
@@ -231,7 +237,12 @@ gtk_css_matcher_node_get_previous (GtkCssMatcher       *matcher,
   if (node == NULL)
     return FALSE;
 
-  return gtk_css_node_init_matcher (node, matcher);
+  if (!gtk_css_node_init_matcher (node, matcher))
+    return FALSE;
+
+  _gtk_css_matcher_set_ancestor_filter (matcher, next->node.filter);
+
+  return TRUE;
 }
 
 static GtkStateFlags
@@ -325,6 +336,42 @@ _gtk_css_matcher_node_init (GtkCssMatcher *matcher,
 {
   matcher->node.klass = &GTK_CSS_MATCHER_NODE;
   matcher->node.node = node;
+  matcher->node.filter = NULL;
+}
+
+/* The filter must contain the names, classes and ids of all ancestors
+ * of the node, it is used to skip selectors that need an ancestor that
+ * doesn't exist. Other matchers ignore it.
+ */
+void
+_gtk_css_matcher_set_ancestor_filter (GtkCssMatcher              *matcher,
+                                      const GtkCssAncestorFilter *filter)
+{
+  if (matcher->klass != &GTK_CSS_MATCHER_NODE)
+    return;
+
+  matcher->node.filter = filter;
+}
+
+const GtkCssAncestorFilter *
+_gtk_css_matcher_get_ancestor_filter (const GtkCssMatcher *matcher)
+{
+  if (matcher->klass != &GTK_CSS_MATCHER_NODE)
+    return NULL;
+
+  return matcher->node.filter;
+}
+
+/* The name, classes and id of the node, which are all a node matcher
+ * looks at for them. Returns %NULL for other matchers.
+ */
+const GtkCssNodeDeclaration *
+_gtk_css_matcher_get_declaration (const GtkCssMatcher *matcher)
+{
+  if (matcher->klass != &GTK_CSS_MATCHER_NODE)
+    return NULL;
+
+  return gtk_css_node_get_declaration (matcher->node.node);
 }
 
 /* GTK_CSS_MATCHER_WIDGET_ANY */
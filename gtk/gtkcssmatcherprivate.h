@@ -21,6 +21,7 @@
 #include <gtk/gtkenums.h>
 #include <gtk/gtktypes.h>
 #include "gtk/gtkcsstypesprivate.h"
+#include "gtk/gtkcssancestorfilterprivate.h"
 
 G_BEGIN_DECLS
 
@@ -60,6 +61,8 @@ struct _GtkCssMatcherWidgetPath {
 struct _GtkCssMatcherNode {
   const GtkCssMatcherClass *klass;
   GtkCssNode               *node;
+  /* The names, classes and ids of the ancestors of node, or NULL */
+  const GtkCssAncestorFilter *filter;
 };
 
 struct _GtkCssMatcherSuperset {
@@ -81,6 +84,15 @@ gboolean          _gtk_css_matcher_init           (GtkCssMatcher          *match
 void              _gtk_css_matcher_node_init      (GtkCssMatcher          *matcher,
                                                    GtkCssNode             *node);
 void              _gtk_css_matcher_any_init       (GtkCssMatcher          *matcher);
+void              _gtk_css_matcher_set_ancestor_filter
+                                                  (GtkCssMatcher          *matcher,
+                                                   const GtkCssAncestorFilter *filter);
+const GtkCssAncestorFilter *
+                  _gtk_css_matcher_get_ancestor_filter
+                                                  (const GtkCssMatcher    *matcher);
+const GtkCssNodeDeclaration *
+                  _gtk_css_matcher_get_declaration
+                                                  (const GtkCssMatcher    *matcher);
 void              _gtk_css_matcher_superset_init  (GtkCssMatcher          *matcher,
                                                    const GtkCssMatcher    *subset,
                                                    GtkCssChange            relevant);
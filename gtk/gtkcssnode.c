@@ -20,8 +20,12 @@
 #include "gtkcssnodeprivate.h"
 
 #include "gtkcssanimatedstyleprivate.h"
+#include "gtkcssancestorfilterprivate.h"
+#include "gtkcsslookupprivate.h"
+#include "gtkcsspathnodeprivate.h"
 #include "gtkcsssectionprivate.h"
 #include "gtkcssstylepropertyprivate.h"
+#include "gtkdebug.h"
 #include "gtkintl.h"
 #include "gtkmarshalers.h"
 #include "gtksettingsprivate.h"
@@ -87,6 +91,22 @@
  * if we need to change things. */
 #define GTK_CSS_RADICAL_CHANGE (GTK_CSS_CHANGE_ID | GTK_CSS_CHANGE_NAME | GTK_CSS_CHANGE_CLASS | GTK_CSS_CHANGE_SOURCE | GTK_CSS_CHANGE_PARENT_STYLE)
 
+/* Big validations look up the styles of the nodes in threads before
+ * the tree is walked. Lookups only read the nodes and the providers,
+ * computing the values and emitting signals stays on the main thread.
+ */
+#define MIN_THREADED_MATCHES 64
+#define MATCH_CHUNK_SIZE 32
+
+struct _GtkCssNodeMatch {
+  GtkCssNode *node;
+  GtkStyleProviderPrivate *provider;
+  /* The matching serial when the lookup was started */
+  guint serial;
+  GtkCssLookup *lookup;
+  GtkCssChange change;
+};
+
 G_DEFINE_TYPE (GtkCssNode, gtk_css_node, G_TYPE_OBJECT)
 
 enum {
@@ -115,6 +135,10 @@ struct _GtkCssNodeStyleChange {
 static guint cssnode_signals[LAST_SIGNAL] = { 0 };
 static GParamSpec *cssnode_properties[NUM_PROPERTIES];
 
+/* Changed whenever something that selectors or providers look at
+ * changes, so lookups done in threads can be discarded */
+static guint match_serial = 0;
+
 static GtkStyleProviderPrivate *
 gtk_css_node_get_style_provider_or_null (GtkCssNode *cssnode)
 {
@@ -352,10 +376,28 @@ store_in_global_parent_cache (GtkCssNode                  *node,
                                                  style);
 }
 
+static GtkCssNodeMatch *
+gtk_css_node_steal_match (GtkCssNode *cssnode)
+{
+  GtkCssNodeMatch *match = cssnode->match;
+
+  if (match == NULL)
+    return NULL;
+
+  cssnode->match = NULL;
+
+  if (match->lookup == NULL ||
+      match->serial != match_serial)
+    return NULL;
+
+  return match;
+}
+
 static GtkCssStyle *
 gtk_css_node_create_style (GtkCssNode *cssnode)
 {
   const GtkCssNodeDeclaration *decl;
+  GtkCssNodeMatch *match;
   GtkCssMatcher matcher;
   GtkCssStyle *parent;
   GtkCssStyle *style;
@@ -368,9 +410,26 @@ gtk_css_node_create_style (GtkCssNode *cssnode)
     return g_object_ref (style);
 
   if (gtk_css_node_init_matcher (cssnode, &matcher))
-    style = gtk_css_static_style_new_compute (gtk_css_node_get_style_provider (cssnode),
-                                              &matcher,
-                                              parent);
+    {
+      match = gtk_css_node_steal_match (cssnode);
+      if (match)
+        {
+          style = gtk_css_static_style_new_from_lookup (match->provider,
+                                                        match->lookup,
+                                                        match->change,
+                                                        parent);
+          g_clear_pointer (&match->lookup, _gtk_css_lookup_free);
+        }
+      else
+        {
+          if (cssnode->parent && cssnode->parent->ancestor_filter)
+            _gtk_css_matcher_set_ancestor_filter (&matcher, cssnode->parent->ancestor_filter);
+
+          style = gtk_css_static_style_new_compute (gtk_css_node_get_style_provider (cssnode),
+                                                    &matcher,
+                                                    parent);
+        }
+    }
   else
     style = gtk_css_static_style_new_compute (gtk_css_node_get_style_provider (cssnode),
                                               NULL,
@@ -742,6 +801,8 @@ gtk_css_node_reposition (GtkCssNode *node,
   /* Take a reference here so the whole function has a reference */
   g_object_ref (node);
 
+  match_serial++;
+
   if (node->visible)
     {
       if (node->next_sibling)
@@ -1042,6 +1103,7 @@ gtk_css_node_set_visible (GtkCssNode *cssnode,
     return;
 
   cssnode->visible = visible;
+  match_serial++;
   g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_VISIBLE]);
 
   if (cssnode->invalid)
@@ -1099,12 +1161,23 @@ gtk_css_node_get_visible (GtkCssNode *cssnode)
   return cssnode->visible;
 }
 
+/* Validation pushed the old name, id and classes of this node
+ * to the ancestor filter of its descendants */
+static void
+gtk_css_node_invalidate_ancestor_filter (GtkCssNode *cssnode)
+{
+  if (cssnode->ancestor_filter)
+    gtk_css_ancestor_filter_invalidate (cssnode->ancestor_filter);
+}
+
 void
 gtk_css_node_set_name (GtkCssNode              *cssnode,
                        /*interned*/ const char *name)
 {
   if (gtk_css_node_declaration_set_name (&cssnode->decl, name))
     {
+      match_serial++;
+      gtk_css_node_invalidate_ancestor_filter (cssnode);
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_NAME);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_NAME]);
     }
@@ -1122,6 +1195,7 @@ gtk_css_node_set_widget_type (GtkCssNode *cssnode,
 {
   if (gtk_css_node_declaration_set_type (&cssnode->decl, widget_type))
     {
+      match_serial++;
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_NAME);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_WIDGET_TYPE]);
     }
@@ -1139,6 +1213,8 @@ gtk_css_node_set_id (GtkCssNode                *cssnode,
 {
   if (gtk_css_node_declaration_set_id (&cssnode->decl, id))
     {
+      match_serial++;
+      gtk_css_node_invalidate_ancestor_filter (cssnode);
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_ID);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_ID]);
     }
@@ -1156,6 +1232,7 @@ gtk_css_node_set_state (GtkCssNode    *cssnode,
 {
   if (gtk_css_node_declaration_set_state (&cssnode->decl, state_flags))
     {
+      match_serial++;
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_STATE);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_STATE]);
     }
@@ -1172,6 +1249,8 @@ gtk_css_node_clear_classes (GtkCssNode *cssnode)
 {
   if (gtk_css_node_declaration_clear_classes (&cssnode->decl))
     {
+      match_serial++;
+      gtk_css_node_invalidate_ancestor_filter (cssnode);
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_CLASS);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_CLASSES]);
     }
@@ -1223,6 +1302,8 @@ gtk_css_node_add_class (GtkCssNode *cssnode,
 {
   if (gtk_css_node_declaration_add_class (&cssnode->decl, style_class))
     {
+      match_serial++;
+      gtk_css_node_invalidate_ancestor_filter (cssnode);
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_CLASS);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_CLASSES]);
     }
@@ -1234,6 +1315,8 @@ gtk_css_node_remove_class (GtkCssNode *cssnode,
 {
   if (gtk_css_node_declaration_remove_class (&cssnode->decl, style_class))
     {
+      match_serial++;
+      gtk_css_node_invalidate_ancestor_filter (cssnode);
       gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_CLASS);
       g_object_notify_by_pspec (G_OBJECT (cssnode), cssnode_properties[PROP_CLASSES]);
     }
@@ -1264,6 +1347,7 @@ gtk_css_node_invalidate_style_provider (GtkCssNode *cssnode)
 {
   GtkCssNode *child;
 
+  match_serial++;
   gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_SOURCE);
 
   for (child = cssnode->first_child;
@@ -1326,8 +1410,9 @@ gtk_css_node_invalidate (GtkCssNode   *cssnode,
 }
 
 static void
-gtk_css_node_validate_internal (GtkCssNode *cssnode,
-                                gint64      timestamp)
+gtk_css_node_validate_internal (GtkCssNode           *cssnode,
+                                gint64                timestamp,
+                                GtkCssAncestorFilter *filter)
 {
   GtkCssNode *child;
 
@@ -1343,23 +1428,321 @@ gtk_css_node_validate_internal (GtkCssNode *cssnode,
 
   GTK_CSS_NODE_GET_CLASS (cssnode)->validate (cssnode);
 
+  /* Matching continues in the widget path of path nodes,
+   * which the filter knows nothing about */
+  if (GTK_IS_CSS_PATH_NODE (cssnode))
+    filter = NULL;
+
+  if (filter)
+    {
+      gtk_css_ancestor_filter_push (filter, cssnode);
+      cssnode->ancestor_filter = filter;
+    }
+
   for (child = gtk_css_node_get_first_child (cssnode);
        child;
        child = gtk_css_node_get_next_sibling (child))
     {
       if (child->visible)
-        gtk_css_node_validate_internal (child, timestamp);
+        gtk_css_node_validate_internal (child, timestamp, filter);
+    }
+
+  if (filter)
+    {
+      cssnode->ancestor_filter = NULL;
+      gtk_css_ancestor_filter_pop (filter);
     }
 }
 
+static gboolean
+gtk_css_node_push_ancestors (GtkCssNode           *cssnode,
+                             GtkCssAncestorFilter *filter)
+{
+  if (cssnode == NULL)
+    return TRUE;
+
+  if (GTK_IS_CSS_PATH_NODE (cssnode) ||
+      !gtk_css_node_push_ancestors (cssnode->parent, filter))
+    return FALSE;
+
+  gtk_css_ancestor_filter_push (filter, cssnode);
+  if (cssnode->ancestor_filter == NULL)
+    cssnode->ancestor_filter = filter;
+
+  return TRUE;
+}
+
+static void
+gtk_css_node_unset_ancestor_filter (GtkCssNode           *cssnode,
+                                    GtkCssAncestorFilter *filter)
+{
+  for (; cssnode; cssnode = cssnode->parent)
+    {
+      if (cssnode->ancestor_filter == filter)
+        cssnode->ancestor_filter = NULL;
+    }
+}
+
+typedef struct {
+  GArray *matches;
+  volatile gint next_chunk;
+
+  GMutex lock;
+  GCond cond;
+  guint n_workers;
+} MatchBatch;
+
+static void
+gtk_css_node_collect_matches (GtkCssNode *cssnode,
+                              GArray     *matches)
+{
+  GtkCssNode *child;
+
+  /* Skip what gtk_css_node_validate_internal() skips, and widget
+   * paths, which are matched differently */
+  if (!cssnode->invalid || GTK_IS_CSS_PATH_NODE (cssnode))
+    return;
+
+  if (cssnode->style_is_invalid &&
+      cssnode->match == NULL &&
+      gtk_css_style_needs_recreation (cssnode->style, cssnode->pending_changes))
+    {
+      GtkCssNodeMatch match = { g_object_ref (cssnode),
+                                gtk_css_node_get_style_provider (cssnode),
+                                match_serial,
+                                NULL,
+                                0 };
+
+      g_array_append_val (matches, match);
+    }
+
+  for (child = gtk_css_node_get_first_child (cssnode);
+       child;
+       child = gtk_css_node_get_next_sibling (child))
+    {
+      if (child->visible)
+        gtk_css_node_collect_matches (child, matches);
+    }
+}
+
+/* Makes @filter contain the ancestors of @cssnode. @pushed are the
+ * nodes in the filter, the previous match is usually a close relative
+ * so only a few nodes need to change.
+ */
+static void
+match_batch_update_filter (GtkCssAncestorFilter *filter,
+                           GPtrArray            *pushed,
+                           GPtrArray            *ancestors,
+                           GtkCssNode           *cssnode)
+{
+  GtkCssNode *iter;
+  guint i;
+
+  g_ptr_array_set_size (ancestors, 0);
+  for (iter = cssnode->parent; iter; iter = iter->parent)
+    g_ptr_array_add (ancestors, iter);
+
+  for (i = 0; i < pushed->len && i < ancestors->len; i++)
+    {
+      if (g_ptr_array_index (pushed, i) != g_ptr_array_index (ancestors, ancestors->len - 1 - i))
+        break;
+    }
+
+  while (pushed->len > i)
+    {
+      gtk_css_ancestor_filter_pop (filter);
+      g_ptr_array_remove_index (pushed, pushed->len - 1);
+    }
+
+  for (; i < ancestors->len; i++)
+    {
+      iter = g_ptr_array_index (ancestors, ancestors->len - 1 - i);
+      gtk_css_ancestor_filter_push (filter, iter);
+      g_ptr_array_add (pushed, iter);
+    }
+}
+
+static void
+match_batch_run (MatchBatch *batch)
+{
+  GtkCssAncestorFilter *filter;
+  GPtrArray *pushed, *ancestors;
+  GtkCssMatcher matcher;
+  guint i, end;
+
+  filter = gtk_css_ancestor_filter_new ();
+  pushed = g_ptr_array_new ();
+  ancestors = g_ptr_array_new ();
+
+  while (TRUE)
+    {
+      i = g_atomic_int_add (&batch->next_chunk, 1) * MATCH_CHUNK_SIZE;
+      if (i >= batch->matches->len)
+        break;
+
+      end = MIN (i + MATCH_CHUNK_SIZE, batch->matches->len);
+      for (; i < end; i++)
+        {
+          GtkCssNodeMatch *match = &g_array_index (batch->matches, GtkCssNodeMatch, i);
+
+          if (!gtk_css_node_init_matcher (match->node, &matcher))
+            continue;
+
+          match_batch_update_filter (filter, pushed, ancestors, match->node);
+          _gtk_css_matcher_set_ancestor_filter (&matcher, filter);
+
+          match->lookup = gtk_css_static_style_lookup (match->provider,
+                                                       &matcher,
+                                                       &match->change);
+        }
+    }
+
+  g_ptr_array_free (ancestors, TRUE);
+  g_ptr_array_free (pushed, TRUE);
+  gtk_css_ancestor_filter_free (filter);
+}
+
+static void
+match_batch_worker_run (gpointer data,
+                        gpointer user_data)
+{
+  MatchBatch *batch = data;
+
+  match_batch_run (batch);
+
+  g_mutex_lock (&batch->lock);
+  batch->n_workers--;
+  if (batch->n_workers == 0)
+    g_cond_signal (&batch->cond);
+  g_mutex_unlock (&batch->lock);
+}
+
+static GThreadPool *
+get_match_pool (void)
+{
+  static GThreadPool *pool = NULL;
+
+  if (pool == NULL)
+    pool = g_thread_pool_new (match_batch_worker_run, NULL,
+                              g_get_num_processors (), FALSE,
+                              NULL);
+
+  return pool;
+}
+
+static void
+gtk_css_node_free_matches (GArray *matches)
+{
+  guint i;
+
+  for (i = 0; i < matches->len; i++)
+    {
+      GtkCssNodeMatch *match = &g_array_index (matches, GtkCssNodeMatch, i);
+
+      if (match->node->match == match)
+        match->node->match = NULL;
+      g_clear_pointer (&match->lookup, _gtk_css_lookup_free);
+      g_object_unref (match->node);
+    }
+
+  g_array_free (matches, TRUE);
+}
+
+/* Looks up the styles of the nodes below @cssnode that are going to
+ * be recomputed, using all processors. The ancestors of @cssnode must
+ * not contain path nodes. Returns %NULL if it's not worth it.
+ */
+static GArray *
+gtk_css_node_match_in_threads (GtkCssNode *cssnode)
+{
+  MatchBatch batch;
+  guint i, n_chunks, n_workers;
+
+  /*
+   * To check that threads don't change any styles, use
+   *   GTK_DEBUG=no-css-threads
+   */
+  if (g_get_num_processors () < 2 ||
+      GTK_DEBUG_CHECK (NO_CSS_THREADS))
+    return NULL;
+
+  batch.matches = g_array_new (FALSE, FALSE, sizeof (GtkCssNodeMatch));
+  gtk_css_node_collect_matches (cssnode, batch.matches);
+
+  if (batch.matches->len < MIN_THREADED_MATCHES)
+    {
+      gtk_css_node_free_matches (batch.matches);
+      return NULL;
+    }
+
+  /* The main thread matches, too */
+  n_chunks = (batch.matches->len + MATCH_CHUNK_SIZE - 1) / MATCH_CHUNK_SIZE;
+  n_workers = MIN (n_chunks, g_get_num_processors ()) - 1;
+
+  batch.next_chunk = 0;
+  g_mutex_init (&batch.lock);
+  g_cond_init (&batch.cond);
+  batch.n_workers = n_workers;
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_pool_push (get_match_pool (), &batch, NULL);
+
+  match_batch_run (&batch);
+
+  g_mutex_lock (&batch.lock);
+  while (batch.n_workers > 0)
+    g_cond_wait (&batch.cond, &batch.lock);
+  g_mutex_unlock (&batch.lock);
+
+  g_cond_clear (&batch.cond);
+  g_mutex_clear (&batch.lock);
+
+  /* The array doesn't change anymore, so the nodes can point into it */
+  for (i = 0; i < batch.matches->len; i++)
+    {
+      GtkCssNodeMatch *match = &g_array_index (batch.matches, GtkCssNodeMatch, i);
+
+      match->node->match = match;
+    }
+
+  return batch.matches;
+}
+
 void
 gtk_css_node_validate (GtkCssNode *cssnode)
 {
+  GtkCssAncestorFilter *filter;
+  GArray *matches;
   gint64 timestamp;
 
+  if (!cssnode->invalid)
+    return;
+
   timestamp = gtk_css_node_get_timestamp (cssnode);
 
-  gtk_css_node_validate_internal (cssnode, timestamp);
+  /* The names, classes and ids of the ancestors of the nodes being
+   * validated, so style lookups can skip rules for missing ancestors
+   */
+  filter = gtk_css_ancestor_filter_new ();
+  if (!gtk_css_node_push_ancestors (cssnode->parent, filter))
+    {
+      gtk_css_node_unset_ancestor_filter (cssnode->parent, filter);
+      g_clear_pointer (&filter, gtk_css_ancestor_filter_free);
+    }
+
+  /* Lookups in threads need the ancestors to be CSS nodes, too */
+  matches = filter ? gtk_css_node_match_in_threads (cssnode) : NULL;
+
+  gtk_css_node_validate_internal (cssnode, timestamp, filter);
+
+  if (matches)
+    gtk_css_node_free_matches (matches);
+
+  if (filter)
+    {
+      gtk_css_node_unset_ancestor_filter (cssnode->parent, filter);
+      gtk_css_ancestor_filter_free (filter);
+    }
 }
 
 gboolean
@@ -18,6 +18,7 @@
 #ifndef __GTK_CSS_NODE_PRIVATE_H__
 #define __GTK_CSS_NODE_PRIVATE_H__
 
+#include "gtkcssancestorfilterprivate.h"
 #include "gtkcssnodedeclarationprivate.h"
 #include "gtkcssnodestylecacheprivate.h"
 #include "gtkcssstylechangeprivate.h"
@@ -34,6 +35,7 @@ G_BEGIN_DECLS
 #define GTK_CSS_NODE_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GTK_TYPE_CSS_NODE, GtkCssNodeClass))
 
 typedef struct _GtkCssNodeClass         GtkCssNodeClass;
+typedef struct _GtkCssNodeMatch         GtkCssNodeMatch;
 
 struct _GtkCssNode
 {
@@ -48,6 +50,8 @@ struct _GtkCssNode
   GtkCssNodeDeclaration *decl;
   GtkCssStyle           *style;
   GtkCssNodeStyleCache  *cache;                 /* cache for children to look up styles */
+  GtkCssAncestorFilter  *ancestor_filter;       /* this node and its ancestors while validating the children */
+  GtkCssNodeMatch       *match;                 /* style lookup done by a thread while validating */
 
   GtkCssChange           pending_changes;       /* changes that accumulated since the style was last computed */
 
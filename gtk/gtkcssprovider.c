@@ -19,6 +19,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <cairo-gobject.h>
@@ -28,12 +29,14 @@
 #include "gtkbitmaskprivate.h"
 #include "gtkcssarrayvalueprivate.h"
 #include "gtkcsscolorvalueprivate.h"
+#include "gtkcssimageurlprivate.h"
 #include "gtkcsskeyframesprivate.h"
 #include "gtkcssparserprivate.h"
 #include "gtkcsssectionprivate.h"
 #include "gtkcssselectorprivate.h"
 #include "gtkcssshorthandpropertyprivate.h"
 #include "gtkcssstylefuncsprivate.h"
+#include "gtkcssstylepropertyprivate.h"
 #include "gtksettingsprivate.h"
 #include "gtkstyleprovider.h"
 #include "gtkstylecontextprivate.h"
@@ -41,6 +44,7 @@
 #include "gtkstyleproviderprivate.h"
 #include "gtkwidgetpath.h"
 #include "gtkbindings.h"
+#include "gtkdebug.h"
 #include "gtkmarshalers.h"
 #include "gtkprivate.h"
 #include "gtkintl.h"
@@ -118,8 +122,14 @@ struct _GtkCssProviderPrivate
 
   GArray *rulesets;
   GtkCssSelectorTree *tree;
+  GtkCssSelectorIndex *index;
   GResource *resource;
   gchar *path;
+
+  /* The files imported during a load, while writing a cache */
+  GPtrArray *dependencies;
+  gboolean had_errors;
+  gboolean loading_cache;
 };
 
 enum {
@@ -137,6 +147,8 @@ static void gtk_css_style_provider_private_iface_init (GtkStyleProviderPrivateIn
 static void gtk_css_style_provider_emit_error (GtkStyleProviderPrivate *provider,
                                                GtkCssSection           *section,
                                                const GError            *error);
+static gboolean gtk_css_provider_load_with_cache (GtkCssProvider *css_provider,
+                                                  GFile          *file);
 
 static void
 gtk_css_provider_load_internal (GtkCssProvider *css_provider,
@@ -340,6 +352,12 @@ gtk_css_provider_emit_error (GtkCssProvider *provider,
                              GtkCssScanner  *scanner,
                              const GError   *error)
 {
+  provider->priv->had_errors = TRUE;
+
+  /* A broken cache is dropped silently */
+  if (provider->priv->loading_cache)
+    return;
+
   gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER_PRIVATE (provider),
                                      scanner ? scanner->section : NULL,
                                      error);
@@ -577,7 +595,7 @@ gtk_css_style_provider_lookup (GtkStyleProviderPrivate *provider,
   css_provider = GTK_CSS_PROVIDER (provider);
   priv = css_provider->priv;
 
-  tree_rules = _gtk_css_selector_tree_match_all (priv->tree, matcher);
+  tree_rules = priv->index ? _gtk_css_selector_index_match_all (priv->index, matcher) : NULL;
   if (tree_rules)
     {
       verify_tree_match_results (css_provider, matcher, tree_rules);
@@ -634,6 +652,26 @@ gtk_css_style_provider_private_iface_init (GtkStyleProviderPrivateInterface *ifa
   iface->emit_error = gtk_css_style_provider_emit_error;
 }
 
+static void
+gtk_css_provider_clear_index (GtkCssProvider *css_provider)
+{
+  GtkCssProviderPrivate *priv = css_provider->priv;
+
+  if (priv->index == NULL)
+    return;
+
+  if (GTK_DEBUG_CHECK (MISC))
+    {
+      gsize n_considered, n_matched;
+
+      _gtk_css_selector_index_get_stats (priv->index, &n_considered, &n_matched);
+      g_message ("CSS provider %p: style lookups considered %" G_GSIZE_FORMAT " rules and matched %" G_GSIZE_FORMAT,
+                 css_provider, n_considered, n_matched);
+    }
+
+  g_clear_pointer (&priv->index, _gtk_css_selector_index_free);
+}
+
 static void
 gtk_css_provider_finalize (GObject *object)
 {
@@ -648,6 +686,7 @@ gtk_css_provider_finalize (GObject *object)
     gtk_css_ruleset_clear (&g_array_index (priv->rulesets, GtkCssRuleset, i));
 
   g_array_free (priv->rulesets, TRUE);
+  gtk_css_provider_clear_index (css_provider);
   _gtk_css_selector_tree_free (priv->tree);
 
   g_hash_table_destroy (priv->symbolic_colors);
@@ -788,6 +827,7 @@ gtk_css_provider_reset (GtkCssProvider *css_provider)
   for (i = 0; i < priv->rulesets->len; i++)
     gtk_css_ruleset_clear (&g_array_index (priv->rulesets, GtkCssRuleset, i));
   g_array_set_size (priv->rulesets, 0);
+  gtk_css_provider_clear_index (css_provider);
   _gtk_css_selector_tree_free (priv->tree);
   priv->tree = NULL;
 
@@ -1393,6 +1433,7 @@ gtk_css_provider_postprocess (GtkCssProvider *css_provider)
 
   priv->tree = _gtk_css_selector_tree_builder_build (builder);
   _gtk_css_selector_tree_builder_free (builder);
+  priv->index = _gtk_css_selector_index_new (priv->tree);
 
 #ifndef VERIFY_TREE
   for (i = 0; i < priv->rulesets->len; i++)
@@ -1407,6 +1448,55 @@ gtk_css_provider_postprocess (GtkCssProvider *css_provider)
 #endif
 }
 
+static void
+gtk_css_provider_query_file (GFile   *file,
+                             guint64 *mtime,
+                             guint64 *size)
+{
+  GFileInfo *info;
+
+  *mtime = 0;
+  *size = 0;
+
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC ","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE,
+                            NULL,
+                            NULL);
+  if (info == NULL)
+    return;
+
+  /* Resources have no modification time, 0 makes us compare contents */
+  if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+    *mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC
+             + g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  *size = g_file_info_get_size (info);
+
+  g_object_unref (info);
+}
+
+static void
+gtk_css_provider_add_dependency (GtkCssProvider *css_provider,
+                                 GFile          *file,
+                                 const char     *data,
+                                 gsize           length)
+{
+  char *uri, *checksum;
+  guint64 mtime, size;
+
+  uri = g_file_get_uri (file);
+  checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) data, length);
+  gtk_css_provider_query_file (file, &mtime, &size);
+
+  g_ptr_array_add (css_provider->priv->dependencies,
+                   g_variant_ref_sink (g_variant_new ("(stts)", uri, mtime, size, checksum)));
+
+  g_free (checksum);
+  g_free (uri);
+}
+
 static void
 gtk_css_provider_load_internal (GtkCssProvider *css_provider,
                                 GtkCssScanner  *parent,
@@ -1415,16 +1505,20 @@ gtk_css_provider_load_internal (GtkCssProvider *css_provider,
 {
   GtkCssScanner *scanner;
   char *free_data = NULL;
+  gsize length;
 
   if (text == NULL)
     {
       GError *load_error = NULL;
 
       if (g_file_load_contents (file, NULL,
-                                &free_data, NULL,
+                                &free_data, &length,
                                 NULL, &load_error))
         {
           text = free_data;
+
+          if (css_provider->priv->dependencies)
+            gtk_css_provider_add_dependency (css_provider, file, text, length);
         }
       else
         {
@@ -1534,7 +1628,8 @@ gtk_css_provider_load_from_file (GtkCssProvider  *css_provider,
 
   gtk_css_provider_reset (css_provider);
 
-  gtk_css_provider_load_internal (css_provider, NULL, file, NULL);
+  if (!gtk_css_provider_load_with_cache (css_provider, file))
+    gtk_css_provider_load_internal (css_provider, NULL, file, NULL);
 
   _gtk_style_provider_private_changed (GTK_STYLE_PROVIDER_PRIVATE (css_provider));
 }
@@ -2000,3 +2095,410 @@ gtk_css_provider_to_string (GtkCssProvider *provider)
   return g_string_free (str, FALSE);
 }
 
+
+/* CACHE */
+
+/* Parsing the theme takes a noticeable part of the startup time, so
+ * the result of loading a file is kept in the user's cache directory,
+ * in one file per URI that is overwritten when the file changed. The
+ * cache contains the selector tree as it was built and every distinct
+ * value as text, so each one is parsed once and shared by all rulesets
+ * using it. Named colors and keyframes are stored as CSS. Images are
+ * stored by their location, as printing them otherwise loses it.
+ *
+ * The loaded file, all imported files and all images are checked again
+ * when the cache is loaded. If their modification time and size are
+ * unchanged, they are not read at all. Otherwise their contents are
+ * compared.
+ */
+#define GTK_CSS_CACHE_VERSION "GtkCssCache 3 " \
+                              G_STRINGIFY (GTK_MAJOR_VERSION) "." \
+                              G_STRINGIFY (GTK_MINOR_VERSION) "." \
+                              G_STRINGIFY (GTK_MICRO_VERSION)
+#define GTK_CSS_CACHE_FORMAT "(sua(stts)sa(us)aau(asa(uuiiiiii)au))"
+
+static char *
+gtk_css_provider_get_cache_path (GFile *file)
+{
+  char *uri, *checksum, *basename, *path;
+
+  /* The version is checked when loading, so an outdated cache is
+   * overwritten instead of being left behind.
+   */
+  uri = g_file_get_uri (file);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, -1);
+
+  basename = g_strconcat (checksum, ".cache", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "css", basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+  g_free (uri);
+
+  return path;
+}
+
+static void
+gtk_css_provider_save_cache (GtkCssProvider *css_provider,
+                             const char     *path)
+{
+  GtkCssProviderPrivate *priv = css_provider->priv;
+  GVariantBuilder values, rulesets;
+  GHashTable *value_indexes, *images;
+  GPtrArray *image_files;
+  GString *prelude, *str;
+  gpointer *matches;
+  GVariant *cache;
+  GError *error = NULL;
+  char *dir;
+  guint i, j;
+
+  image_files = g_ptr_array_new_with_free_func (g_object_unref);
+  _gtk_css_image_url_set_print_sources (image_files);
+
+  prelude = g_string_new (NULL);
+  gtk_css_provider_print_colors (priv->symbolic_colors, prelude);
+  gtk_css_provider_print_keyframes (priv->keyframes, prelude);
+
+  value_indexes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_variant_builder_init (&values, G_VARIANT_TYPE ("a(us)"));
+  g_variant_builder_init (&rulesets, G_VARIANT_TYPE ("aau"));
+  matches = g_new (gpointer, priv->rulesets->len);
+  str = g_string_new (NULL);
+
+  for (i = 0; i < priv->rulesets->len; i++)
+    {
+      GtkCssRuleset *ruleset = &g_array_index (priv->rulesets, GtkCssRuleset, i);
+
+      matches[i] = ruleset;
+
+      g_variant_builder_open (&rulesets, G_VARIANT_TYPE ("au"));
+      for (j = 0; j < ruleset->n_styles; j++)
+        {
+          guint id = _gtk_css_style_property_get_id (ruleset->styles[j].property);
+          gpointer index;
+
+          g_string_printf (str, "%u ", id);
+          _gtk_css_value_print (ruleset->styles[j].value, str);
+
+          if (!g_hash_table_lookup_extended (value_indexes, str->str, NULL, &index))
+            {
+              index = GUINT_TO_POINTER (g_hash_table_size (value_indexes));
+              g_hash_table_insert (value_indexes, g_strdup (str->str), index);
+              g_variant_builder_add (&values, "(us)", id, strchr (str->str, ' ') + 1);
+            }
+
+          g_variant_builder_add (&rulesets, "u", GPOINTER_TO_UINT (index));
+        }
+      g_variant_builder_close (&rulesets);
+    }
+
+  _gtk_css_image_url_set_print_sources (NULL);
+
+  /* Images that can't be read would make every load of the cache
+   * fail, so the file is parsed again instead
+   */
+  images = g_hash_table_new (g_file_hash, (GEqualFunc) g_file_equal);
+  for (i = 0; i < image_files->len; i++)
+    {
+      GFile *file = g_ptr_array_index (image_files, i);
+      char *data;
+      gsize length;
+
+      if (!g_hash_table_add (images, file))
+        continue;
+
+      if (!g_file_load_contents (file, NULL, &data, &length, NULL, NULL))
+        {
+          GTK_NOTE (MISC, g_message ("Not writing CSS cache %s: Failed to read an image", path));
+          g_variant_builder_clear (&values);
+          g_variant_builder_clear (&rulesets);
+          goto out;
+        }
+
+      gtk_css_provider_add_dependency (css_provider, file, data, length);
+      g_free (data);
+    }
+
+  cache = g_variant_new ("(su@a(stts)s@a(us)@aau@(asa(uuiiiiii)au))",
+                         GTK_CSS_CACHE_VERSION,
+                         _gtk_css_style_property_get_n_properties (),
+                         g_variant_new_array (G_VARIANT_TYPE ("(stts)"),
+                                              (GVariant **) priv->dependencies->pdata,
+                                              priv->dependencies->len),
+                         prelude->str,
+                         g_variant_builder_end (&values),
+                         g_variant_builder_end (&rulesets),
+                         _gtk_css_selector_tree_serialize (priv->tree, matches, priv->rulesets->len));
+  g_variant_ref_sink (cache);
+
+  dir = g_path_get_dirname (path);
+  if (g_mkdir_with_parents (dir, 0755) != 0 ||
+      !g_file_set_contents (path, g_variant_get_data (cache), g_variant_get_size (cache), &error))
+    {
+      GTK_NOTE (MISC, g_message ("Failed to write CSS cache %s: %s",
+                                 path, error ? error->message : g_strerror (errno)));
+      g_clear_error (&error);
+    }
+
+  g_free (dir);
+  g_variant_unref (cache);
+
+out:
+  g_hash_table_unref (images);
+  g_ptr_array_unref (image_files);
+  g_string_free (str, TRUE);
+  g_free (matches);
+  g_hash_table_unref (value_indexes);
+  g_string_free (prelude, TRUE);
+}
+
+static gboolean
+gtk_css_provider_check_dependencies (GVariant *dependencies)
+{
+  GVariantIter iter;
+  const char *uri, *checksum;
+  guint64 mtime, size;
+
+  g_variant_iter_init (&iter, dependencies);
+  while (g_variant_iter_next (&iter, "(&stt&s)", &uri, &mtime, &size, &checksum))
+    {
+      GFile *file;
+      char *data, *current;
+      guint64 current_mtime, current_size;
+      gsize length;
+      gboolean unchanged;
+
+      file = g_file_new_for_uri (uri);
+
+      gtk_css_provider_query_file (file, &current_mtime, &current_size);
+      if (mtime != 0 && mtime == current_mtime && size == current_size)
+        {
+          g_object_unref (file);
+          continue;
+        }
+
+      if (!g_file_load_contents (file, NULL, &data, &length, NULL, NULL))
+        {
+          g_object_unref (file);
+          return FALSE;
+        }
+
+      current = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) data, length);
+      unchanged = g_str_equal (current, checksum);
+
+      g_free (current);
+      g_free (data);
+      g_object_unref (file);
+
+      if (!unchanged)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+gtk_css_provider_cache_parser_error (GtkCssParser *parser,
+                                     const GError *error,
+                                     gpointer      user_data)
+{
+  GtkCssProvider *css_provider = user_data;
+
+  css_provider->priv->had_errors = TRUE;
+}
+
+static gboolean
+gtk_css_provider_load_cache (GtkCssProvider *css_provider,
+                             const char     *path)
+{
+  GtkCssProviderPrivate *priv = css_provider->priv;
+  GVariant *cache, *dependencies, *values, *rulesets, *tree;
+  const GtkCssSelectorTree **selector_matches;
+  const char *version, *prelude;
+  PropertyValue *parsed;
+  GMappedFile *mapped;
+  gpointer *matches;
+  GBytes *bytes;
+  guint32 n_properties;
+  gsize i, j, n_values, n_rulesets;
+  gboolean success;
+
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  if (mapped == NULL)
+    return FALSE;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+  cache = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (GTK_CSS_CACHE_FORMAT), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get (cache, "(&su@a(stts)&s@a(us)@aau@(asa(uuiiiiii)au))",
+                 &version, &n_properties, &dependencies, &prelude, &values, &rulesets, &tree);
+
+  n_values = g_variant_n_children (values);
+  n_rulesets = g_variant_n_children (rulesets);
+  parsed = g_new0 (PropertyValue, n_values);
+  matches = g_new (gpointer, n_rulesets);
+  selector_matches = g_new0 (const GtkCssSelectorTree *, n_rulesets);
+  success = FALSE;
+
+  priv->loading_cache = TRUE;
+  priv->had_errors = FALSE;
+
+  if (!g_str_equal (version, GTK_CSS_CACHE_VERSION) ||
+      n_properties != _gtk_css_style_property_get_n_properties () ||
+      !gtk_css_provider_check_dependencies (dependencies))
+    goto out;
+
+  if (prelude[0])
+    {
+      GtkCssScanner *scanner;
+
+      scanner = gtk_css_scanner_new (css_provider, NULL, NULL, NULL, prelude);
+      parse_stylesheet (scanner);
+      gtk_css_scanner_destroy (scanner);
+
+      if (priv->had_errors)
+        goto out;
+    }
+
+  for (i = 0; i < n_values; i++)
+    {
+      GtkCssParser *parser;
+      const char *text;
+      guint32 id;
+
+      g_variant_get_child (values, i, "(u&s)", &id, &text);
+      if (id >= n_properties)
+        goto out;
+
+      parsed[i].property = _gtk_css_style_property_lookup_by_id (id);
+
+      parser = _gtk_css_parser_new (text, NULL, gtk_css_provider_cache_parser_error, css_provider);
+      parsed[i].value = _gtk_style_property_parse_value (GTK_STYLE_PROPERTY (parsed[i].property), parser);
+      if (!_gtk_css_parser_is_eof (parser))
+        priv->had_errors = TRUE;
+      _gtk_css_parser_free (parser);
+
+      if (parsed[i].value == NULL || priv->had_errors)
+        goto out;
+    }
+
+  for (i = 0; i < n_rulesets; i++)
+    {
+      GtkCssRuleset ruleset = { 0, };
+      const guint32 *indexes;
+      GVariant *styles;
+      gsize n_styles;
+
+      styles = g_variant_get_child_value (rulesets, i);
+      indexes = g_variant_get_fixed_array (styles, &n_styles, sizeof (guint32));
+
+      for (j = 0; j < n_styles && indexes[j] < n_values; j++)
+        gtk_css_ruleset_add (&ruleset,
+                             parsed[indexes[j]].property,
+                             _gtk_css_value_ref (parsed[indexes[j]].value),
+                             NULL);
+
+      g_variant_unref (styles);
+      g_array_append_val (priv->rulesets, ruleset);
+
+      if (j < n_styles)
+        goto out;
+    }
+
+  if (n_rulesets > 0)
+    {
+      for (i = 0; i < n_rulesets; i++)
+        matches[i] = &g_array_index (priv->rulesets, GtkCssRuleset, i);
+
+      priv->tree = _gtk_css_selector_tree_deserialize (tree, matches, selector_matches, n_rulesets);
+      if (priv->tree == NULL)
+        goto out;
+
+      for (i = 0; i < n_rulesets; i++)
+        {
+          GtkCssRuleset *ruleset = matches[i];
+
+          if (selector_matches[i] == NULL)
+            goto out;
+
+          ruleset->selector_match = (GtkCssSelectorTree *) selector_matches[i];
+        }
+    }
+
+  priv->index = _gtk_css_selector_index_new (priv->tree);
+  success = TRUE;
+
+out:
+  priv->loading_cache = FALSE;
+
+  if (!success)
+    gtk_css_provider_reset (css_provider);
+
+  for (i = 0; i < n_values; i++)
+    {
+      if (parsed[i].value)
+        _gtk_css_value_unref (parsed[i].value);
+    }
+  g_free (parsed);
+  g_free (matches);
+  g_free (selector_matches);
+  g_variant_unref (dependencies);
+  g_variant_unref (values);
+  g_variant_unref (rulesets);
+  g_variant_unref (tree);
+  g_variant_unref (cache);
+
+  return success;
+}
+
+static gboolean
+gtk_css_provider_load_with_cache (GtkCssProvider *css_provider,
+                                  GFile          *file)
+{
+  GtkCssProviderPrivate *priv = css_provider->priv;
+  char *text, *path;
+  gsize length;
+
+#ifdef VERIFY_TREE
+  /* Cached rulesets don't keep their selector */
+  return FALSE;
+#endif
+
+  if (gtk_keep_css_sections || GTK_DEBUG_CHECK (NO_CSS_CACHE))
+    return FALSE;
+
+  path = gtk_css_provider_get_cache_path (file);
+
+  if (gtk_css_provider_load_cache (css_provider, path))
+    {
+      g_free (path);
+      return TRUE;
+    }
+
+  /* Let the regular load report the error */
+  if (!g_file_load_contents (file, NULL, &text, &length, NULL, NULL))
+    {
+      g_free (path);
+      return FALSE;
+    }
+
+  priv->dependencies = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  priv->had_errors = FALSE;
+
+  gtk_css_provider_add_dependency (css_provider, file, text, length);
+  gtk_css_provider_load_internal (css_provider, NULL, file, text);
+
+  /* Errors have to be reported on every load */
+  if (!priv->had_errors)
+    gtk_css_provider_save_cache (css_provider, path);
+
+  g_clear_pointer (&priv->dependencies, g_ptr_array_unref);
+
+  g_free (path);
+  g_free (text);
+
+  return TRUE;
+}
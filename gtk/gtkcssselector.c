@@ -22,7 +22,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "gtkcssnodedeclarationprivate.h"
 #include "gtkcssprovider.h"
+#include "gtkdebug.h"
 #include "gtkstylecontextprivate.h"
 
 #if defined(_MSC_VER) && _MSC_VER >= 1500
@@ -1489,6 +1491,52 @@ gtk_css_selectors_skip_initial_selector (GtkCssSelector *selector, const GtkCssS
   return (GtkCssSelector *)gtk_css_selector_previous (selector);
 }
 
+/* Checks if a descendant or child combinator can be skipped, because
+ * every selector following it needs a name, class or id that none of
+ * the ancestors have. The filter never misses an ancestor's feature,
+ * so this never skips a match.
+ */
+static gboolean
+gtk_css_selector_tree_rejects_ancestors (const GtkCssSelectorTree   *tree,
+                                         const GtkCssAncestorFilter *filter)
+{
+  const GtkCssSelectorTree *prev;
+
+  if (tree->selector.class != &GTK_CSS_SELECTOR_DESCENDANT &&
+      tree->selector.class != &GTK_CSS_SELECTOR_CHILD)
+    return FALSE;
+
+  if (gtk_css_selector_tree_get_matches (tree))
+    return FALSE;
+
+  for (prev = gtk_css_selector_tree_get_previous (tree);
+       prev != NULL;
+       prev = gtk_css_selector_tree_get_sibling (prev))
+    {
+      const GtkCssSelector *selector = &prev->selector;
+
+      if (selector->class == &GTK_CSS_SELECTOR_NAME)
+        {
+          if (gtk_css_ancestor_filter_may_have_name (filter, selector->name.name))
+            return FALSE;
+        }
+      else if (selector->class == &GTK_CSS_SELECTOR_CLASS)
+        {
+          if (gtk_css_ancestor_filter_may_have_class (filter, selector->style_class.style_class))
+            return FALSE;
+        }
+      else if (selector->class == &GTK_CSS_SELECTOR_ID)
+        {
+          if (gtk_css_ancestor_filter_may_have_id (filter, selector->id.name))
+            return FALSE;
+        }
+      else
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 gtk_css_selector_tree_match_foreach (const GtkCssSelector *selector,
                                      const GtkCssMatcher  *matcher,
@@ -1496,16 +1544,24 @@ gtk_css_selector_tree_match_foreach (const GtkCssSelector *selector,
 {
   const GtkCssSelectorTree *tree = (const GtkCssSelectorTree *) selector;
   const GtkCssSelectorTree *prev;
+  const GtkCssAncestorFilter *filter;
 
   if (!gtk_css_selector_match (selector, matcher))
     return FALSE;
 
   gtk_css_selector_tree_found_match (tree, res);
 
+  filter = _gtk_css_matcher_get_ancestor_filter (matcher);
+
   for (prev = gtk_css_selector_tree_get_previous (tree);
        prev != NULL;
        prev = gtk_css_selector_tree_get_sibling (prev))
-    gtk_css_selector_foreach (&prev->selector, matcher, gtk_css_selector_tree_match_foreach, res);
+    {
+      if (filter && gtk_css_selector_tree_rejects_ancestors (prev, filter))
+        continue;
+
+      gtk_css_selector_foreach (&prev->selector, matcher, gtk_css_selector_tree_match_foreach, res);
+    }
 
   return FALSE;
 }
@@ -1916,3 +1972,544 @@ _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder)
 
   return tree;
 }
+
+/* SERIALIZATION */
+
+/* The index of a class in this array is what is stored,
+ * so only append to it */
+static const GtkCssSelectorClass *serialized_classes[] = {
+  &GTK_CSS_SELECTOR_DESCENDANT,
+  &GTK_CSS_SELECTOR_CHILD,
+  &GTK_CSS_SELECTOR_SIBLING,
+  &GTK_CSS_SELECTOR_ADJACENT,
+  &GTK_CSS_SELECTOR_ANY,
+  &GTK_CSS_SELECTOR_NOT_ANY,
+  &GTK_CSS_SELECTOR_NAME,
+  &GTK_CSS_SELECTOR_NOT_NAME,
+  &GTK_CSS_SELECTOR_CLASS,
+  &GTK_CSS_SELECTOR_NOT_CLASS,
+  &GTK_CSS_SELECTOR_ID,
+  &GTK_CSS_SELECTOR_NOT_ID,
+  &GTK_CSS_SELECTOR_PSEUDOCLASS_STATE,
+  &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_STATE,
+  &GTK_CSS_SELECTOR_PSEUDOCLASS_POSITION,
+  &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_POSITION
+};
+
+static guint
+serialized_class_index (const GtkCssSelectorClass *class)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (serialized_classes); i++)
+    {
+      if (serialized_classes[i] == class)
+        return i;
+    }
+
+  g_assert_not_reached ();
+  return 0;
+}
+
+static void
+collect_nodes (const GtkCssSelectorTree *tree,
+               GPtrArray                *nodes,
+               GHashTable               *indexes)
+{
+  for (; tree != NULL; tree = gtk_css_selector_tree_get_sibling (tree))
+    {
+      g_hash_table_insert (indexes, (gpointer) tree, GUINT_TO_POINTER (nodes->len));
+      g_ptr_array_add (nodes, (gpointer) tree);
+
+      collect_nodes (gtk_css_selector_tree_get_previous (tree), nodes, indexes);
+    }
+}
+
+static gint32
+lookup_node_index (GHashTable               *indexes,
+                   const GtkCssSelectorTree *tree)
+{
+  if (tree == NULL)
+    return -1;
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (indexes, tree));
+}
+
+static guint
+serialize_string (GPtrArray  *strings,
+                  GHashTable *string_indexes,
+                  const char *string)
+{
+  gpointer index;
+
+  if (g_hash_table_lookup_extended (string_indexes, string, NULL, &index))
+    return GPOINTER_TO_UINT (index);
+
+  g_hash_table_insert (string_indexes, (gpointer) string, GUINT_TO_POINTER (strings->len));
+  g_ptr_array_add (strings, (gpointer) string);
+
+  return strings->len - 1;
+}
+
+/*
+ * _gtk_css_selector_tree_serialize:
+ * @tree: (nullable): the tree to serialize
+ * @matches: the matches that were added to the tree
+ * @n_matches: number of elements in @matches
+ *
+ * Turns @tree into a #GVariant of type "(asa(uuiiiiii)au)" that
+ * _gtk_css_selector_tree_deserialize() can restore in another process.
+ * Matches are stored as their index in @matches.
+ *
+ * Returns: (transfer floating): the serialized tree
+ */
+GVariant *
+_gtk_css_selector_tree_serialize (const GtkCssSelectorTree *tree,
+                                  gpointer                 *matches,
+                                  guint                     n_matches)
+{
+  GVariantBuilder node_builder, match_builder;
+  GHashTable *node_indexes, *match_indexes, *string_indexes;
+  GPtrArray *nodes, *strings;
+  guint i, n_match_data;
+  GVariant *result;
+
+  nodes = g_ptr_array_new ();
+  node_indexes = g_hash_table_new (NULL, NULL);
+  collect_nodes (tree, nodes, node_indexes);
+
+  match_indexes = g_hash_table_new (NULL, NULL);
+  for (i = 0; i < n_matches; i++)
+    g_hash_table_insert (match_indexes, matches[i], GUINT_TO_POINTER (i));
+
+  strings = g_ptr_array_new ();
+  string_indexes = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_variant_builder_init (&node_builder, G_VARIANT_TYPE ("a(uuiiiiii)"));
+  g_variant_builder_init (&match_builder, G_VARIANT_TYPE ("au"));
+  n_match_data = 0;
+
+  for (i = 0; i < nodes->len; i++)
+    {
+      const GtkCssSelectorTree *node = g_ptr_array_index (nodes, i);
+      const GtkCssSelector *selector = &node->selector;
+      gpointer *node_matches;
+      gint32 matches_start;
+      guint value = 0;
+      gint32 a = 0, b = 0;
+
+      if (selector->class == &GTK_CSS_SELECTOR_NAME ||
+          selector->class == &GTK_CSS_SELECTOR_NOT_NAME)
+        value = serialize_string (strings, string_indexes, selector->name.name);
+      else if (selector->class == &GTK_CSS_SELECTOR_ID ||
+               selector->class == &GTK_CSS_SELECTOR_NOT_ID)
+        value = serialize_string (strings, string_indexes, selector->id.name);
+      else if (selector->class == &GTK_CSS_SELECTOR_CLASS ||
+               selector->class == &GTK_CSS_SELECTOR_NOT_CLASS)
+        value = serialize_string (strings, string_indexes, g_quark_to_string (selector->style_class.style_class));
+      else if (selector->class == &GTK_CSS_SELECTOR_PSEUDOCLASS_STATE ||
+               selector->class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_STATE)
+        value = selector->state.state;
+      else if (selector->class == &GTK_CSS_SELECTOR_PSEUDOCLASS_POSITION ||
+               selector->class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_POSITION)
+        {
+          value = selector->position.type;
+          a = selector->position.a;
+          b = selector->position.b;
+        }
+
+      node_matches = gtk_css_selector_tree_get_matches (node);
+      if (node_matches)
+        {
+          matches_start = n_match_data;
+          for (; *node_matches; node_matches++)
+            {
+              g_assert (g_hash_table_contains (match_indexes, *node_matches));
+              g_variant_builder_add (&match_builder, "u",
+                                     GPOINTER_TO_UINT (g_hash_table_lookup (match_indexes, *node_matches)));
+              n_match_data++;
+            }
+          g_variant_builder_add (&match_builder, "u", G_MAXUINT32);
+          n_match_data++;
+        }
+      else
+        matches_start = -1;
+
+      g_variant_builder_add (&node_builder, "(uuiiiiii)",
+                             serialized_class_index (selector->class),
+                             value, a, b,
+                             lookup_node_index (node_indexes, gtk_css_selector_tree_get_parent (node)),
+                             lookup_node_index (node_indexes, gtk_css_selector_tree_get_previous (node)),
+                             lookup_node_index (node_indexes, gtk_css_selector_tree_get_sibling (node)),
+                             matches_start);
+    }
+
+  g_ptr_array_add (strings, NULL);
+  result = g_variant_new ("(^as@a(uuiiiiii)@au)",
+                          (const char * const *) strings->pdata,
+                          g_variant_builder_end (&node_builder),
+                          g_variant_builder_end (&match_builder));
+
+  g_ptr_array_free (strings, TRUE);
+  g_hash_table_unref (string_indexes);
+  g_hash_table_unref (match_indexes);
+  g_hash_table_unref (node_indexes);
+  g_ptr_array_free (nodes, TRUE);
+
+  return result;
+}
+
+static gint32
+node_offset (GtkCssSelectorTree *nodes,
+             guint               from,
+             gint32              to)
+{
+  if (to < 0)
+    return GTK_CSS_SELECTOR_TREE_EMPTY_OFFSET;
+
+  return (guint8 *) &nodes[to] - (guint8 *) &nodes[from];
+}
+
+/*
+ * _gtk_css_selector_tree_deserialize:
+ * @variant: a #GVariant created by _gtk_css_selector_tree_serialize()
+ * @matches: the matches to use, in the order they were serialized
+ * @selector_matches: (out caller-allocates): the node each of
+ *     @matches was added for
+ * @n_matches: the number of elements in @matches
+ *
+ * Recreates a tree from its serialized form. The data is checked,
+ * so this is safe to call on data read from disk.
+ *
+ * Returns: the new tree or %NULL if @variant is invalid or empty
+ */
+GtkCssSelectorTree *
+_gtk_css_selector_tree_deserialize (GVariant                  *variant,
+                                    gpointer                  *matches,
+                                    const GtkCssSelectorTree **selector_matches,
+                                    guint                      n_matches)
+{
+  GVariant *string_variant, *node_variant, *match_variant;
+  const char **strings;
+  const guint32 *match_data;
+  GtkCssSelectorTree *nodes;
+  gpointer *node_matches;
+  gsize i, j, n_strings, n_nodes, n_match_data;
+
+  if (!g_variant_is_of_type (variant, G_VARIANT_TYPE ("(asa(uuiiiiii)au)")))
+    return NULL;
+
+  g_variant_get (variant, "(@as@a(uuiiiiii)@au)", &string_variant, &node_variant, &match_variant);
+
+  strings = g_variant_get_strv (string_variant, &n_strings);
+  n_nodes = g_variant_n_children (node_variant);
+  match_data = g_variant_get_fixed_array (match_variant, &n_match_data, sizeof (guint32));
+
+  nodes = NULL;
+
+  /* All match lists must be terminated */
+  if (n_nodes == 0 ||
+      (n_match_data > 0 && match_data[n_match_data - 1] != G_MAXUINT32))
+    goto out;
+
+  nodes = g_malloc0 (n_nodes * sizeof (GtkCssSelectorTree) + n_match_data * sizeof (gpointer));
+  node_matches = (gpointer *) &nodes[n_nodes];
+
+  for (i = 0; i < n_nodes; i++)
+    {
+      GtkCssSelectorTree *node = &nodes[i];
+      const GtkCssSelectorClass *class;
+      guint32 class_index, value;
+      gint32 a, b, parent, previous, sibling, matches_start;
+
+      g_variant_get_child (node_variant, i, "(uuiiiiii)",
+                           &class_index, &value, &a, &b,
+                           &parent, &previous, &sibling, &matches_start);
+
+      /* Parents come first and children and siblings later, so
+       * there can't be any loops */
+      if (class_index >= G_N_ELEMENTS (serialized_classes) ||
+          (parent >= 0 && (gsize) parent >= i) ||
+          (previous >= 0 && ((gsize) previous <= i || (gsize) previous >= n_nodes)) ||
+          (sibling >= 0 && ((gsize) sibling <= i || (gsize) sibling >= n_nodes)) ||
+          (matches_start >= 0 && (gsize) matches_start >= n_match_data))
+        goto fail;
+
+      class = serialized_classes[class_index];
+      node->selector.class = class;
+
+      if (class == &GTK_CSS_SELECTOR_NAME ||
+          class == &GTK_CSS_SELECTOR_NOT_NAME)
+        {
+          if (value >= n_strings)
+            goto fail;
+          node->selector.name.name = g_intern_string (strings[value]);
+        }
+      else if (class == &GTK_CSS_SELECTOR_ID ||
+               class == &GTK_CSS_SELECTOR_NOT_ID)
+        {
+          if (value >= n_strings)
+            goto fail;
+          node->selector.id.name = g_intern_string (strings[value]);
+        }
+      else if (class == &GTK_CSS_SELECTOR_CLASS ||
+               class == &GTK_CSS_SELECTOR_NOT_CLASS)
+        {
+          if (value >= n_strings)
+            goto fail;
+          node->selector.style_class.style_class = g_quark_from_string (strings[value]);
+        }
+      else if (class == &GTK_CSS_SELECTOR_PSEUDOCLASS_STATE ||
+               class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_STATE)
+        {
+          node->selector.state.state = value;
+        }
+      else if (class == &GTK_CSS_SELECTOR_PSEUDOCLASS_POSITION ||
+               class == &GTK_CSS_SELECTOR_NOT_PSEUDOCLASS_POSITION)
+        {
+          if (value > POSITION_ONLY)
+            goto fail;
+          node->selector.position.type = value;
+          node->selector.position.a = a;
+          node->selector.position.b = b;
+        }
+
+      node->parent_offset = node_offset (nodes, i, parent);
+      node->previous_offset = node_offset (nodes, i, previous);
+      node->sibling_offset = node_offset (nodes, i, sibling);
+
+      if (matches_start >= 0)
+        {
+          node->matches_offset = (guint8 *) &node_matches[matches_start] - (guint8 *) node;
+
+          for (j = matches_start; match_data[j] != G_MAXUINT32; j++)
+            {
+              if (match_data[j] >= n_matches)
+                goto fail;
+
+              node_matches[j] = matches[match_data[j]];
+              selector_matches[match_data[j]] = node;
+            }
+        }
+      else
+        node->matches_offset = GTK_CSS_SELECTOR_TREE_EMPTY_OFFSET;
+    }
+
+  goto out;
+
+fail:
+  g_clear_pointer (&nodes, g_free);
+
+out:
+  g_free (strings);
+  g_variant_unref (string_variant);
+  g_variant_unref (node_variant);
+  g_variant_unref (match_variant);
+
+  return nodes;
+}
+
+/* INDEX */
+
+/* Every rule below a root of the tree needs the root's selector to
+ * match, so roots that need a name, class or id are put in buckets
+ * for them. A node only looks at the buckets of its own name, classes
+ * and id and at the roots that can match any node.
+ */
+typedef struct {
+  const GtkCssSelectorTree *tree;
+  /* The rules below tree */
+  guint n_rules;
+} GtkCssSelectorBucket;
+
+struct _GtkCssSelectorIndex {
+  const GtkCssSelectorTree *tree;
+  guint n_rules;
+  guint match_tree : 1;         /* ignore the buckets */
+
+  GHashTable *names;            /* interned name => GtkCssSelectorBucket */
+  GHashTable *classes;          /* GQuark => GtkCssSelectorBucket */
+  GHashTable *ids;              /* interned id => GtkCssSelectorBucket */
+  GArray *others;               /* GtkCssSelectorBucket */
+
+  /* Lookups can run in threads, so these are updated atomically */
+  volatile gsize n_considered;
+  volatile gsize n_matched;
+};
+
+static guint
+gtk_css_selector_tree_count_rules (const GtkCssSelectorTree *tree)
+{
+  const GtkCssSelectorTree *prev;
+  gpointer *matches;
+  guint i, n_rules = 0;
+
+  matches = gtk_css_selector_tree_get_matches (tree);
+  if (matches)
+    {
+      for (i = 0; matches[i] != NULL; i++)
+        n_rules++;
+    }
+
+  for (prev = gtk_css_selector_tree_get_previous (tree);
+       prev != NULL;
+       prev = gtk_css_selector_tree_get_sibling (prev))
+    n_rules += gtk_css_selector_tree_count_rules (prev);
+
+  return n_rules;
+}
+
+static void
+gtk_css_selector_index_add (GtkCssSelectorIndex      *index,
+                            const GtkCssSelectorTree *tree)
+{
+  const GtkCssSelector *selector = &tree->selector;
+  GtkCssSelectorBucket *bucket;
+  GHashTable *table;
+  gpointer key;
+
+  if (selector->class == &GTK_CSS_SELECTOR_NAME)
+    {
+      table = index->names;
+      key = (gpointer) selector->name.name;
+    }
+  else if (selector->class == &GTK_CSS_SELECTOR_CLASS)
+    {
+      table = index->classes;
+      key = GUINT_TO_POINTER (selector->style_class.style_class);
+    }
+  else if (selector->class == &GTK_CSS_SELECTOR_ID)
+    {
+      table = index->ids;
+      key = (gpointer) selector->id.name;
+    }
+  else
+    table = NULL;
+
+  if (table == NULL || g_hash_table_contains (table, key))
+    {
+      g_array_set_size (index->others, index->others->len + 1);
+      bucket = &g_array_index (index->others, GtkCssSelectorBucket, index->others->len - 1);
+    }
+  else
+    {
+      bucket = g_new (GtkCssSelectorBucket, 1);
+      g_hash_table_insert (table, key, bucket);
+    }
+
+  bucket->tree = tree;
+  bucket->n_rules = gtk_css_selector_tree_count_rules (tree);
+  index->n_rules += bucket->n_rules;
+}
+
+GtkCssSelectorIndex *
+_gtk_css_selector_index_new (const GtkCssSelectorTree *tree)
+{
+  GtkCssSelectorIndex *index;
+
+  index = g_new0 (GtkCssSelectorIndex, 1);
+  index->tree = tree;
+  index->names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  index->classes = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  index->ids = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  index->others = g_array_new (FALSE, FALSE, sizeof (GtkCssSelectorBucket));
+
+  /*
+   * To check that the index doesn't change any styles, use
+   *   GTK_DEBUG=no-css-index
+   */
+  index->match_tree = GTK_DEBUG_CHECK (NO_CSS_INDEX);
+
+  for (; tree != NULL;
+       tree = gtk_css_selector_tree_get_sibling (tree))
+    gtk_css_selector_index_add (index, tree);
+
+  return index;
+}
+
+void
+_gtk_css_selector_index_free (GtkCssSelectorIndex *index)
+{
+  if (index == NULL)
+    return;
+
+  g_hash_table_unref (index->names);
+  g_hash_table_unref (index->classes);
+  g_hash_table_unref (index->ids);
+  g_array_free (index->others, TRUE);
+
+  g_free (index);
+}
+
+static void
+gtk_css_selector_bucket_match (const GtkCssSelectorBucket  *bucket,
+                               const GtkCssMatcher         *matcher,
+                               GPtrArray                  **array,
+                               gsize                       *n_considered)
+{
+  if (bucket == NULL)
+    return;
+
+  gtk_css_selector_foreach (&bucket->tree->selector, matcher, gtk_css_selector_tree_match_foreach, array);
+  *n_considered += bucket->n_rules;
+}
+
+/* Like _gtk_css_selector_tree_match_all(), but only looks at the
+ * parts of the tree that can match the node of @matcher. Matchers
+ * that aren't for a node look at the whole tree.
+ */
+GPtrArray *
+_gtk_css_selector_index_match_all (GtkCssSelectorIndex *index,
+                                   const GtkCssMatcher *matcher)
+{
+  const GtkCssNodeDeclaration *decl;
+  GPtrArray *array = NULL;
+  gsize n_considered;
+  const GQuark *classes;
+  guint i, n_classes;
+
+  decl = _gtk_css_matcher_get_declaration (matcher);
+  if (decl == NULL || index->match_tree)
+    {
+      array = _gtk_css_selector_tree_match_all (index->tree, matcher);
+      n_considered = index->n_rules;
+    }
+  else
+    {
+      n_considered = 0;
+
+      for (i = 0; i < index->others->len; i++)
+        gtk_css_selector_bucket_match (&g_array_index (index->others, GtkCssSelectorBucket, i),
+                                       matcher, &array, &n_considered);
+
+      if (gtk_css_node_declaration_get_name (decl))
+        gtk_css_selector_bucket_match (g_hash_table_lookup (index->names, gtk_css_node_declaration_get_name (decl)),
+                                       matcher, &array, &n_considered);
+
+      if (gtk_css_node_declaration_get_id (decl))
+        gtk_css_selector_bucket_match (g_hash_table_lookup (index->ids, gtk_css_node_declaration_get_id (decl)),
+                                       matcher, &array, &n_considered);
+
+      classes = gtk_css_node_declaration_get_classes (decl, &n_classes);
+      for (i = 0; i < n_classes; i++)
+        gtk_css_selector_bucket_match (g_hash_table_lookup (index->classes, GUINT_TO_POINTER (classes[i])),
+                                       matcher, &array, &n_considered);
+    }
+
+  g_atomic_pointer_add (&index->n_considered, n_considered);
+  if (array)
+    g_atomic_pointer_add (&index->n_matched, array->len);
+
+  return array;
+}
+
+/* The number of rules that lookups had to check, and the number
+ * of those that matched, since the index was created */
+void
+_gtk_css_selector_index_get_stats (GtkCssSelectorIndex *index,
+                                   gsize               *n_considered,
+                                   gsize               *n_matched)
+{
+  *n_considered = (gsize) g_atomic_pointer_get (&index->n_considered);
+  *n_matched = (gsize) g_atomic_pointer_get (&index->n_matched);
+}
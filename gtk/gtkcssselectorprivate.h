@@ -26,6 +26,7 @@ G_BEGIN_DECLS
 typedef union _GtkCssSelector GtkCssSelector;
 typedef struct _GtkCssSelectorTree GtkCssSelectorTree;
 typedef struct _GtkCssSelectorTreeBuilder GtkCssSelectorTreeBuilder;
+typedef struct _GtkCssSelectorIndex GtkCssSelectorIndex;
 
 GtkCssSelector *  _gtk_css_selector_parse           (GtkCssParser           *parser);
 void              _gtk_css_selector_free            (GtkCssSelector         *selector);
@@ -47,6 +48,14 @@ GtkCssChange _gtk_css_selector_tree_get_change_all   (const GtkCssSelectorTree *
 						      const GtkCssMatcher *matcher);
 void         _gtk_css_selector_tree_match_print      (const GtkCssSelectorTree *tree,
 						      GString                  *str);
+GVariant *   _gtk_css_selector_tree_serialize        (const GtkCssSelectorTree *tree,
+                                                      gpointer                 *matches,
+                                                      guint                     n_matches);
+GtkCssSelectorTree *
+             _gtk_css_selector_tree_deserialize      (GVariant                 *variant,
+                                                      gpointer                 *matches,
+                                                      const GtkCssSelectorTree **selector_matches,
+                                                      guint                     n_matches);
 
 
 GtkCssSelectorTreeBuilder *_gtk_css_selector_tree_builder_new   (void);
@@ -57,6 +66,14 @@ void                       _gtk_css_selector_tree_builder_add   (GtkCssSelectorT
 GtkCssSelectorTree *       _gtk_css_selector_tree_builder_build (GtkCssSelectorTreeBuilder *builder);
 void                       _gtk_css_selector_tree_builder_free  (GtkCssSelectorTreeBuilder *builder);
 
+GtkCssSelectorIndex *      _gtk_css_selector_index_new          (const GtkCssSelectorTree  *tree);
+void                       _gtk_css_selector_index_free         (GtkCssSelectorIndex       *index);
+GPtrArray *                _gtk_css_selector_index_match_all    (GtkCssSelectorIndex       *index,
+                                                                 const GtkCssMatcher       *matcher);
+void                       _gtk_css_selector_index_get_stats    (GtkCssSelectorIndex       *index,
+                                                                 gsize                     *n_considered,
+                                                                 gsize                     *n_matched);
+
 const char *gtk_css_pseudoclass_name (GtkStateFlags flags);
 
 G_END_DECLS
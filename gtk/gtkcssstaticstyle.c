@@ -26,20 +26,271 @@
 #include "gtkcssenumvalueprivate.h"
 #include "gtkcssinheritvalueprivate.h"
 #include "gtkcssinitialvalueprivate.h"
+#include "gtkcsslookupprivate.h"
 #include "gtkcssnumbervalueprivate.h"
 #include "gtkcsssectionprivate.h"
 #include "gtkcssshorthandpropertyprivate.h"
 #include "gtkcssstringvalueprivate.h"
 #include "gtkcssstylepropertyprivate.h"
 #include "gtkcsstransitionprivate.h"
+#include "gtkdebug.h"
 #include "gtkprivate.h"
 #include "gtksettings.h"
 #include "gtkstyleanimationprivate.h"
 #include "gtkstylepropertyprivate.h"
 #include "gtkstyleproviderprivate.h"
 
+#include <string.h>
+
 G_DEFINE_TYPE (GtkCssStaticStyle, gtk_css_static_style, GTK_TYPE_CSS_STYLE)
 
+/* Computed values are stored in groups of related properties. Groups
+ * are ref-counted and hash-consed by the identity of their values, so
+ * styles that differ in a few properties share the groups of all the
+ * others. A group is not modified anymore once it is in the table.
+ */
+struct _GtkCssValues
+{
+  int ref_count;
+  guint group : 8;
+  guint in_table : 1;
+  guint hash;
+  GtkCssValue *values[];
+};
+
+static const guint core_properties[] = {
+  GTK_CSS_PROPERTY_COLOR,
+  GTK_CSS_PROPERTY_DPI,
+  GTK_CSS_PROPERTY_FONT_SIZE,
+  GTK_CSS_PROPERTY_ICON_THEME,
+  GTK_CSS_PROPERTY_ICON_PALETTE
+};
+
+static const guint font_properties[] = {
+  GTK_CSS_PROPERTY_FONT_FAMILY,
+  GTK_CSS_PROPERTY_FONT_STYLE,
+  GTK_CSS_PROPERTY_FONT_VARIANT,
+  GTK_CSS_PROPERTY_FONT_WEIGHT,
+  GTK_CSS_PROPERTY_FONT_STRETCH,
+  GTK_CSS_PROPERTY_LETTER_SPACING,
+  GTK_CSS_PROPERTY_TEXT_SHADOW,
+  GTK_CSS_PROPERTY_CARET_COLOR,
+  GTK_CSS_PROPERTY_SECONDARY_CARET_COLOR
+};
+
+static const guint text_decoration_properties[] = {
+  GTK_CSS_PROPERTY_TEXT_DECORATION_LINE,
+  GTK_CSS_PROPERTY_TEXT_DECORATION_COLOR,
+  GTK_CSS_PROPERTY_TEXT_DECORATION_STYLE
+};
+
+static const guint icon_properties[] = {
+  GTK_CSS_PROPERTY_ICON_SHADOW,
+  GTK_CSS_PROPERTY_ICON_STYLE
+};
+
+static const guint background_properties[] = {
+  GTK_CSS_PROPERTY_BACKGROUND_COLOR,
+  GTK_CSS_PROPERTY_BOX_SHADOW,
+  GTK_CSS_PROPERTY_BACKGROUND_CLIP,
+  GTK_CSS_PROPERTY_BACKGROUND_ORIGIN,
+  GTK_CSS_PROPERTY_BACKGROUND_SIZE,
+  GTK_CSS_PROPERTY_BACKGROUND_POSITION,
+  GTK_CSS_PROPERTY_BACKGROUND_REPEAT,
+  GTK_CSS_PROPERTY_BACKGROUND_IMAGE,
+  GTK_CSS_PROPERTY_BACKGROUND_BLEND_MODE
+};
+
+static const guint border_properties[] = {
+  GTK_CSS_PROPERTY_BORDER_TOP_STYLE,
+  GTK_CSS_PROPERTY_BORDER_TOP_WIDTH,
+  GTK_CSS_PROPERTY_BORDER_LEFT_STYLE,
+  GTK_CSS_PROPERTY_BORDER_LEFT_WIDTH,
+  GTK_CSS_PROPERTY_BORDER_BOTTOM_STYLE,
+  GTK_CSS_PROPERTY_BORDER_BOTTOM_WIDTH,
+  GTK_CSS_PROPERTY_BORDER_RIGHT_STYLE,
+  GTK_CSS_PROPERTY_BORDER_RIGHT_WIDTH,
+  GTK_CSS_PROPERTY_BORDER_TOP_LEFT_RADIUS,
+  GTK_CSS_PROPERTY_BORDER_TOP_RIGHT_RADIUS,
+  GTK_CSS_PROPERTY_BORDER_BOTTOM_RIGHT_RADIUS,
+  GTK_CSS_PROPERTY_BORDER_BOTTOM_LEFT_RADIUS,
+  GTK_CSS_PROPERTY_BORDER_TOP_COLOR,
+  GTK_CSS_PROPERTY_BORDER_RIGHT_COLOR,
+  GTK_CSS_PROPERTY_BORDER_BOTTOM_COLOR,
+  GTK_CSS_PROPERTY_BORDER_LEFT_COLOR,
+  GTK_CSS_PROPERTY_BORDER_IMAGE_SOURCE,
+  GTK_CSS_PROPERTY_BORDER_IMAGE_REPEAT,
+  GTK_CSS_PROPERTY_BORDER_IMAGE_SLICE,
+  GTK_CSS_PROPERTY_BORDER_IMAGE_WIDTH
+};
+
+static const guint outline_properties[] = {
+  GTK_CSS_PROPERTY_OUTLINE_STYLE,
+  GTK_CSS_PROPERTY_OUTLINE_WIDTH,
+  GTK_CSS_PROPERTY_OUTLINE_OFFSET,
+  GTK_CSS_PROPERTY_OUTLINE_TOP_LEFT_RADIUS,
+  GTK_CSS_PROPERTY_OUTLINE_TOP_RIGHT_RADIUS,
+  GTK_CSS_PROPERTY_OUTLINE_BOTTOM_RIGHT_RADIUS,
+  GTK_CSS_PROPERTY_OUTLINE_BOTTOM_LEFT_RADIUS,
+  GTK_CSS_PROPERTY_OUTLINE_COLOR
+};
+
+static const guint size_properties[] = {
+  GTK_CSS_PROPERTY_MARGIN_TOP,
+  GTK_CSS_PROPERTY_MARGIN_LEFT,
+  GTK_CSS_PROPERTY_MARGIN_BOTTOM,
+  GTK_CSS_PROPERTY_MARGIN_RIGHT,
+  GTK_CSS_PROPERTY_PADDING_TOP,
+  GTK_CSS_PROPERTY_PADDING_LEFT,
+  GTK_CSS_PROPERTY_PADDING_BOTTOM,
+  GTK_CSS_PROPERTY_PADDING_RIGHT,
+  GTK_CSS_PROPERTY_BORDER_SPACING,
+  GTK_CSS_PROPERTY_MIN_WIDTH,
+  GTK_CSS_PROPERTY_MIN_HEIGHT
+};
+
+static const guint transition_properties[] = {
+  GTK_CSS_PROPERTY_TRANSITION_PROPERTY,
+  GTK_CSS_PROPERTY_TRANSITION_DURATION,
+  GTK_CSS_PROPERTY_TRANSITION_TIMING_FUNCTION,
+  GTK_CSS_PROPERTY_TRANSITION_DELAY
+};
+
+static const guint animation_properties[] = {
+  GTK_CSS_PROPERTY_ANIMATION_NAME,
+  GTK_CSS_PROPERTY_ANIMATION_DURATION,
+  GTK_CSS_PROPERTY_ANIMATION_TIMING_FUNCTION,
+  GTK_CSS_PROPERTY_ANIMATION_ITERATION_COUNT,
+  GTK_CSS_PROPERTY_ANIMATION_DIRECTION,
+  GTK_CSS_PROPERTY_ANIMATION_PLAY_STATE,
+  GTK_CSS_PROPERTY_ANIMATION_DELAY,
+  GTK_CSS_PROPERTY_ANIMATION_FILL_MODE
+};
+
+static const guint other_properties[] = {
+  GTK_CSS_PROPERTY_ICON_SOURCE,
+  GTK_CSS_PROPERTY_ICON_TRANSFORM,
+  GTK_CSS_PROPERTY_ICON_FILTER,
+  GTK_CSS_PROPERTY_OPACITY,
+  GTK_CSS_PROPERTY_FILTER,
+  GTK_CSS_PROPERTY_GTK_KEY_BINDINGS
+};
+
+static const struct {
+  const guint *properties;
+  guint n_properties;
+} values_groups[GTK_CSS_N_VALUES] = {
+  [GTK_CSS_CORE_VALUES] = { core_properties, G_N_ELEMENTS (core_properties) },
+  [GTK_CSS_FONT_VALUES] = { font_properties, G_N_ELEMENTS (font_properties) },
+  [GTK_CSS_TEXT_DECORATION_VALUES] = { text_decoration_properties, G_N_ELEMENTS (text_decoration_properties) },
+  [GTK_CSS_ICON_VALUES] = { icon_properties, G_N_ELEMENTS (icon_properties) },
+  [GTK_CSS_BACKGROUND_VALUES] = { background_properties, G_N_ELEMENTS (background_properties) },
+  [GTK_CSS_BORDER_VALUES] = { border_properties, G_N_ELEMENTS (border_properties) },
+  [GTK_CSS_OUTLINE_VALUES] = { outline_properties, G_N_ELEMENTS (outline_properties) },
+  [GTK_CSS_SIZE_VALUES] = { size_properties, G_N_ELEMENTS (size_properties) },
+  [GTK_CSS_TRANSITION_VALUES] = { transition_properties, G_N_ELEMENTS (transition_properties) },
+  [GTK_CSS_ANIMATION_VALUES] = { animation_properties, G_N_ELEMENTS (animation_properties) },
+  [GTK_CSS_OTHER_VALUES] = { other_properties, G_N_ELEMENTS (other_properties) }
+};
+
+/* Filled in class_init() */
+static guint8 property_group[GTK_CSS_PROPERTY_N_PROPERTIES];
+static guint8 property_index[GTK_CSS_PROPERTY_N_PROPERTIES];
+static gboolean group_is_inherited[GTK_CSS_N_VALUES];
+static GHashTable *values_table;
+
+static GtkCssValues *
+gtk_css_values_new (GtkCssValuesGroup group)
+{
+  GtkCssValues *values;
+
+  values = g_malloc0 (sizeof (GtkCssValues) + values_groups[group].n_properties * sizeof (GtkCssValue *));
+  values->ref_count = 1;
+  values->group = group;
+
+  return values;
+}
+
+static GtkCssValues *
+gtk_css_values_ref (GtkCssValues *values)
+{
+  values->ref_count++;
+
+  return values;
+}
+
+static void
+gtk_css_values_unref (GtkCssValues *values)
+{
+  guint i;
+
+  values->ref_count--;
+  if (values->ref_count > 0)
+    return;
+
+  if (values->in_table)
+    g_hash_table_remove (values_table, values);
+
+  for (i = 0; i < values_groups[values->group].n_properties; i++)
+    {
+      if (values->values[i])
+        _gtk_css_value_unref (values->values[i]);
+    }
+
+  g_free (values);
+}
+
+static guint
+gtk_css_values_hash (gconstpointer data)
+{
+  const GtkCssValues *values = data;
+
+  return values->hash;
+}
+
+static gboolean
+gtk_css_values_equal (gconstpointer data1,
+                      gconstpointer data2)
+{
+  const GtkCssValues *values1 = data1;
+  const GtkCssValues *values2 = data2;
+
+  if (values1->hash != values2->hash ||
+      values1->group != values2->group)
+    return FALSE;
+
+  return memcmp (values1->values,
+                 values2->values,
+                 values_groups[values1->group].n_properties * sizeof (GtkCssValue *)) == 0;
+}
+
+/* Returns the group in the table with the same values as @values, or
+ * adds @values to it. Takes ownership of @values.
+ */
+static GtkCssValues *
+gtk_css_values_intern (GtkCssValues *values)
+{
+  GtkCssValues *interned;
+  guint i, hash;
+
+  hash = values->group;
+  for (i = 0; i < values_groups[values->group].n_properties; i++)
+    hash = (hash << 5) - hash + g_direct_hash (values->values[i]);
+  values->hash = hash;
+
+  interned = g_hash_table_lookup (values_table, values);
+  if (interned)
+    {
+      gtk_css_values_unref (values);
+      return gtk_css_values_ref (interned);
+    }
+
+  values->in_table = TRUE;
+  g_hash_table_add (values_table, values);
+
+  return values;
+}
+
 static GtkCssValue *
 gtk_css_static_style_get_value (GtkCssStyle *style,
                                 guint        id)
@@ -47,7 +298,7 @@ gtk_css_static_style_get_value (GtkCssStyle *style,
   /* This is called a lot, so we avoid a dynamic type check here */
   GtkCssStaticStyle *sstyle = (GtkCssStaticStyle *) style;
 
-  return sstyle->values[id];
+  return sstyle->groups[property_group[id]]->values[property_index[id]];
 }
 
 static GtkCssSection *
@@ -69,11 +320,8 @@ gtk_css_static_style_dispose (GObject *object)
   GtkCssStaticStyle *style = GTK_CSS_STATIC_STYLE (object);
   guint i;
 
-  for (i = 0; i < GTK_CSS_PROPERTY_N_PROPERTIES; i++)
-    {
-      if (style->values[i])
-        _gtk_css_value_unref (style->values[i]);
-    }
+  for (i = 0; i < GTK_CSS_N_VALUES; i++)
+    g_clear_pointer (&style->groups[i], gtk_css_values_unref);
   if (style->sections)
     {
       g_ptr_array_unref (style->sections);
@@ -88,11 +336,33 @@ gtk_css_static_style_class_init (GtkCssStaticStyleClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
   GtkCssStyleClass *style_class = GTK_CSS_STYLE_CLASS (klass);
+  guint i, j, id, n_properties;
 
   object_class->dispose = gtk_css_static_style_dispose;
 
   style_class->get_value = gtk_css_static_style_get_value;
   style_class->get_section = gtk_css_static_style_get_section;
+
+  n_properties = 0;
+  for (i = 0; i < GTK_CSS_N_VALUES; i++)
+    {
+      group_is_inherited[i] = TRUE;
+
+      for (j = 0; j < values_groups[i].n_properties; j++)
+        {
+          id = values_groups[i].properties[j];
+          property_group[id] = i;
+          property_index[id] = j;
+
+          if (!_gtk_css_style_property_is_inherit (_gtk_css_style_property_lookup_by_id (id)))
+            group_is_inherited[i] = FALSE;
+        }
+
+      n_properties += values_groups[i].n_properties;
+    }
+  g_assert (n_properties == GTK_CSS_PROPERTY_N_PROPERTIES);
+
+  values_table = g_hash_table_new (gtk_css_values_hash, gtk_css_values_equal);
 }
 
 static void
@@ -113,9 +383,14 @@ gtk_css_static_style_set_value (GtkCssStaticStyle *style,
                                 GtkCssValue       *value,
                                 GtkCssSection     *section)
 {
-  if (style->values[id])
-    _gtk_css_value_unref (style->values[id]);
-  style->values[id] = _gtk_css_value_ref (value);
+  GtkCssValues *values = style->groups[property_group[id]];
+  guint i = property_index[id];
+
+  g_assert (!values->in_table);
+
+  if (values->values[i])
+    _gtk_css_value_unref (values->values[i]);
+  values->values[i] = _gtk_css_value_ref (value);
 
   if (style->sections && style->sections->len > id && g_ptr_array_index (style->sections, id))
     {
@@ -165,33 +440,113 @@ gtk_css_static_style_get_default (void)
   return default_style;
 }
 
-GtkCssStyle *
-gtk_css_static_style_new_compute (GtkStyleProviderPrivate *provider,
-                                  const GtkCssMatcher     *matcher,
-                                  GtkCssStyle             *parent)
+/* A group of inherited properties that are all left unset computes to
+ * the same values as in the parent, so the parent's group can be used
+ * without computing anything
+ */
+static gboolean
+gtk_css_static_style_can_inherit_group (const GtkCssLookup *lookup,
+                                        GtkCssStyle        *parent,
+                                        GtkCssValuesGroup   group)
+{
+  guint i;
+
+  if (!group_is_inherited[group] ||
+      !GTK_IS_CSS_STATIC_STYLE (parent))
+    return FALSE;
+
+  /* Only groups in the table are known to be complete and unchanging */
+  if (!GTK_CSS_STATIC_STYLE (parent)->groups[group]->in_table)
+    return FALSE;
+
+  for (i = 0; i < values_groups[group].n_properties; i++)
+    {
+      if (lookup->values[values_groups[group].properties[i]].value)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Finds the declarations that apply to @matcher. This only reads
+ * the provider and the nodes, so it can run in a thread while the
+ * main thread waits for it.
+ */
+GtkCssLookup *
+gtk_css_static_style_lookup (GtkStyleProviderPrivate *provider,
+                             const GtkCssMatcher     *matcher,
+                             GtkCssChange            *change)
 {
-  GtkCssStaticStyle *result;
   GtkCssLookup *lookup;
-  GtkCssChange change = GTK_CSS_CHANGE_ANY_SELF | GTK_CSS_CHANGE_ANY_SIBLING | GTK_CSS_CHANGE_ANY_PARENT;
 
   lookup = _gtk_css_lookup_new (NULL);
+  *change = GTK_CSS_CHANGE_ANY_SELF | GTK_CSS_CHANGE_ANY_SIBLING | GTK_CSS_CHANGE_ANY_PARENT;
 
   if (matcher)
     _gtk_style_provider_private_lookup (provider,
                                         matcher,
                                         lookup,
-                                        &change);
+                                        change);
+
+  return lookup;
+}
+
+GtkCssStyle *
+gtk_css_static_style_new_compute (GtkStyleProviderPrivate *provider,
+                                  const GtkCssMatcher     *matcher,
+                                  GtkCssStyle             *parent)
+{
+  GtkCssStyle *result;
+  GtkCssLookup *lookup;
+  GtkCssChange change;
+
+  lookup = gtk_css_static_style_lookup (provider, matcher, &change);
+
+  result = gtk_css_static_style_new_from_lookup (provider, lookup, change, parent);
+
+  _gtk_css_lookup_free (lookup);
+
+  return result;
+}
+
+GtkCssStyle *
+gtk_css_static_style_new_from_lookup (GtkStyleProviderPrivate *provider,
+                                      GtkCssLookup            *lookup,
+                                      GtkCssChange             change,
+                                      GtkCssStyle             *parent)
+{
+  GtkCssStaticStyle *result;
+  gboolean share;
+  guint i;
 
   result = g_object_new (GTK_TYPE_CSS_STATIC_STYLE, NULL);
 
   result->change = change;
 
+  /*
+   * To check that sharing doesn't change any computed values, use
+   *   GTK_DEBUG=no-css-sharing
+   */
+  share = !GTK_DEBUG_CHECK (NO_CSS_SHARING);
+
+  for (i = 0; i < GTK_CSS_N_VALUES; i++)
+    {
+      if (share && gtk_css_static_style_can_inherit_group (lookup, parent, i))
+        result->groups[i] = gtk_css_values_ref (GTK_CSS_STATIC_STYLE (parent)->groups[i]);
+      else
+        result->groups[i] = gtk_css_values_new (i);
+    }
+
   _gtk_css_lookup_resolve (lookup,
                            provider,
                            result,
                            parent);
 
-  _gtk_css_lookup_free (lookup);
+  for (i = 0; i < GTK_CSS_N_VALUES; i++)
+    {
+      if (share && !result->groups[i]->in_table)
+        result->groups[i] = gtk_css_values_intern (result->groups[i]);
+    }
 
   return GTK_CSS_STYLE (result);
 }
@@ -211,6 +566,10 @@ gtk_css_static_style_compute_value (GtkCssStaticStyle       *style,
   gtk_internal_return_if_fail (parent_style == NULL || GTK_IS_CSS_STYLE (parent_style));
   gtk_internal_return_if_fail (id < GTK_CSS_PROPERTY_N_PROPERTIES);
 
+  /* The group was taken from the parent style */
+  if (style->groups[property_group[id]]->in_table)
+    return;
+
   /* http://www.w3.org/TR/css3-cascade/#cascade
    * Then, for every element, the value for each property can be found
    * by following this pseudo-algorithm:
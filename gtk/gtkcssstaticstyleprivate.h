@@ -34,12 +34,30 @@ G_BEGIN_DECLS
 
 typedef struct _GtkCssStaticStyle           GtkCssStaticStyle;
 typedef struct _GtkCssStaticStyleClass      GtkCssStaticStyleClass;
+typedef struct _GtkCssValues                GtkCssValues;
+
+/* The groups of related properties the computed values are stored in */
+typedef enum {
+  GTK_CSS_CORE_VALUES,
+  GTK_CSS_FONT_VALUES,
+  GTK_CSS_TEXT_DECORATION_VALUES,
+  GTK_CSS_ICON_VALUES,
+  GTK_CSS_BACKGROUND_VALUES,
+  GTK_CSS_BORDER_VALUES,
+  GTK_CSS_OUTLINE_VALUES,
+  GTK_CSS_SIZE_VALUES,
+  GTK_CSS_TRANSITION_VALUES,
+  GTK_CSS_ANIMATION_VALUES,
+  GTK_CSS_OTHER_VALUES,
+  /* add more */
+  GTK_CSS_N_VALUES
+} GtkCssValuesGroup;
 
 struct _GtkCssStaticStyle
 {
   GtkCssStyle parent;
 
-  GtkCssValue           *values[GTK_CSS_PROPERTY_N_PROPERTIES]; /* the values */
+  GtkCssValues          *groups[GTK_CSS_N_VALUES]; /* the values, shared between styles */
   GPtrArray             *sections;             /* sections the values are defined in */
 
   GtkCssChange           change;               /* change as returned by value lookup */
@@ -56,6 +74,13 @@ GtkCssStyle *           gtk_css_static_style_get_default        (void);
 GtkCssStyle *           gtk_css_static_style_new_compute        (GtkStyleProviderPrivate *provider,
                                                                  const GtkCssMatcher    *matcher,
                                                                  GtkCssStyle            *parent);
+GtkCssLookup *          gtk_css_static_style_lookup             (GtkStyleProviderPrivate *provider,
+                                                                 const GtkCssMatcher    *matcher,
+                                                                 GtkCssChange           *change);
+GtkCssStyle *           gtk_css_static_style_new_from_lookup    (GtkStyleProviderPrivate *provider,
+                                                                 GtkCssLookup           *lookup,
+                                                                 GtkCssChange            change,
+                                                                 GtkCssStyle            *parent);
 
 void                    gtk_css_static_style_compute_value      (GtkCssStaticStyle      *style,
                                                                  GtkStyleProviderPrivate*provider,
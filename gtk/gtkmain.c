@@ -173,7 +173,10 @@ static const GDebugKey gtk_debug_keys[] = {
   { "actions", GTK_DEBUG_ACTIONS },
   { "resize", GTK_DEBUG_RESIZE },
   { "layout", GTK_DEBUG_LAYOUT },
-  { "snapshot", GTK_DEBUG_SNAPSHOT }
+  { "snapshot", GTK_DEBUG_SNAPSHOT },
+  { "no-css-sharing", GTK_DEBUG_NO_CSS_SHARING },
+  { "no-css-threads", GTK_DEBUG_NO_CSS_THREADS },
+  { "no-css-index", GTK_DEBUG_NO_CSS_INDEX }
 };
 #endif /* G_ENABLE_DEBUG */
 
@@ -918,6 +918,15 @@ gtk_snapshot_finish (GtkSnapshot *snapshot)
   return result;
 }
 
+/* Like gtk_snapshot_pop(), but hands the collected node to the
+ * caller instead of appending it to the parent node
+ */
+GskRenderNode *
+gtk_snapshot_pop_collect (GtkSnapshot *snapshot)
+{
+  return gtk_snapshot_pop_internal (snapshot);
+}
+
 /**
  * gtk_snapshot_pop:
  * @snapshot: a #GtkSnapshot
@@ -1308,6 +1317,105 @@ gtk_snapshot_render_focus (GtkSnapshot     *snapshot,
   gtk_snapshot_offset (snapshot, -x, -y);
 }
 
+/* Text nodes only know about glyphs and a color, so layouts using
+ * attributes that are applied when drawing, like underlines or
+ * backgrounds, need to be drawn by Cairo
+ */
+static gboolean
+layout_can_use_text_nodes (PangoLayout *layout)
+{
+  PangoLayoutIter *iter;
+  gboolean result = TRUE;
+
+  iter = pango_layout_get_iter (layout);
+  do
+    {
+      PangoLayoutRun *run = pango_layout_iter_get_run_readonly (iter);
+      GSList *l;
+
+      if (run == NULL)
+        continue;
+
+      for (l = run->item->analysis.extra_attrs; l; l = l->next)
+        {
+          PangoAttribute *attr = l->data;
+
+          if (attr->klass->type != PANGO_ATTR_FOREGROUND &&
+              attr->klass->type != PANGO_ATTR_LETTER_SPACING)
+            {
+              result = FALSE;
+              break;
+            }
+        }
+    }
+  while (result && pango_layout_iter_next_run (iter));
+
+  pango_layout_iter_free (iter);
+
+  return result;
+}
+
+static void
+gtk_snapshot_append_layout (GtkSnapshot   *snapshot,
+                            PangoLayout   *layout,
+                            const GdkRGBA *fg_color)
+{
+  PangoLayoutIter *iter;
+
+  iter = pango_layout_get_iter (layout);
+  do
+    {
+      PangoLayoutRun *run = pango_layout_iter_get_run_readonly (iter);
+      PangoRectangle logical_rect;
+      GskRenderNode *node;
+      GdkRGBA color;
+      GSList *l;
+      int baseline;
+
+      if (run == NULL || run->glyphs->num_glyphs == 0)
+        continue;
+
+      color = *fg_color;
+      for (l = run->item->analysis.extra_attrs; l; l = l->next)
+        {
+          PangoAttribute *attr = l->data;
+
+          if (attr->klass->type == PANGO_ATTR_FOREGROUND)
+            {
+              PangoColor *pango_color = &((PangoAttrColor *) attr)->color;
+
+              color.red = pango_color->red / 65535.;
+              color.green = pango_color->green / 65535.;
+              color.blue = pango_color->blue / 65535.;
+            }
+        }
+
+      pango_layout_iter_get_run_extents (iter, NULL, &logical_rect);
+      baseline = pango_layout_iter_get_baseline (iter);
+
+      node = gsk_text_node_new (run->item->analysis.font,
+                                run->glyphs,
+                                &color,
+                                snapshot->state->translate_x + (double) logical_rect.x / PANGO_SCALE,
+                                snapshot->state->translate_y + (double) baseline / PANGO_SCALE);
+
+      if (snapshot->record_names)
+        {
+          char *str;
+
+          str = g_strdup_printf ("Text<%dglyphs>", run->glyphs->num_glyphs);
+          gsk_render_node_set_name (node, str);
+          g_free (str);
+        }
+
+      gtk_snapshot_append_node (snapshot, node);
+      gsk_render_node_unref (node);
+    }
+  while (pango_layout_iter_next_run (iter));
+
+  pango_layout_iter_free (iter);
+}
+
 /**
  * gtk_snapshot_render_layout:
  * @snapshot: a #GtkSnapshot
@@ -1352,6 +1460,14 @@ gtk_snapshot_render_layout (GtkSnapshot     *snapshot,
 
   gtk_snapshot_offset (snapshot, x, y);
 
+  if (_gtk_css_shadows_value_is_none (shadow) &&
+      layout_can_use_text_nodes (layout))
+    {
+      gtk_snapshot_append_layout (snapshot, layout, fg_color);
+      gtk_snapshot_offset (snapshot, -x, -y);
+      return;
+    }
+
   cr = gtk_snapshot_append_cairo (snapshot, &bounds, "Text<%dchars>", pango_layout_get_character_count (layout));
 
   _gtk_css_shadows_value_paint_layout (shadow, cr, layout);
@@ -91,6 +91,7 @@ void            gtk_snapshot_init               (GtkSnapshot             *state,
                                                  const char              *name,
                                                  ...) G_GNUC_PRINTF (5, 6);
 GskRenderNode * gtk_snapshot_finish             (GtkSnapshot             *state);
+GskRenderNode * gtk_snapshot_pop_collect        (GtkSnapshot             *snapshot);
 
 GskRenderer *   gtk_snapshot_get_renderer       (const GtkSnapshot       *snapshot);
 
@@ -76,6 +76,8 @@
 
 #include "inspector/window.h"
 
+#include "gsk/gskrendererprivate.h"
+
 /* for the use of round() */
 #include "fallback-c89.c"
 
@@ -755,6 +757,7 @@ static void gtk_widget_update_input_shape (GtkWidget *widget);
 
 static gboolean gtk_widget_class_get_visible_by_default (GtkWidgetClass *widget_class);
 static void gtk_widget_set_clip (GtkWidget *widget, const GtkAllocation *clip);
+static void gtk_widget_invalidate_render_node (GtkWidget *widget);
 
 
 /* --- variables --- */
@@ -779,6 +782,7 @@ static GQuark           quark_widget_path = 0;
 static GQuark           quark_action_muxer = 0;
 static GQuark           quark_font_options = 0;
 static GQuark           quark_font_map = 0;
+static GQuark           quark_queued_draw_region = 0;
 
 GParamSpecPool         *_gtk_widget_child_property_pool = NULL;
 GObjectNotifyContext   *_gtk_widget_child_property_notify_context = NULL;
@@ -996,6 +1000,7 @@ gtk_widget_class_init (GtkWidgetClass *klass)
   quark_action_muxer = g_quark_from_static_string ("gtk-widget-action-muxer");
   quark_font_options = g_quark_from_static_string ("gtk-widget-font-options");
   quark_font_map = g_quark_from_static_string ("gtk-widget-font-map");
+  quark_queued_draw_region = g_quark_from_static_string ("gtk-widget-queued-draw-region");
 
   _gtk_widget_child_property_pool = g_param_spec_pool_new (TRUE);
   cpn_context.quark_notify_queue = g_quark_from_static_string ("GtkWidget-child-property-notify-queue");
@@ -4061,6 +4066,9 @@ gtk_widget_unparent (GtkWidget *widget)
   priv->prev_sibling = NULL;
   priv->next_sibling = NULL;
 
+  if (old_parent)
+    gtk_widget_invalidate_render_node (old_parent);
+
   /* parent may no longer expand if the removed
    * child was expand=TRUE and could therefore
    * be forcing it to.
@@ -4406,6 +4414,7 @@ gtk_widget_map (GtkWidget *widget)
 
       update_cursor_on_state_change (widget);
 
+      gtk_widget_invalidate_render_node (widget);
       if (!_gtk_widget_get_has_window (widget))
         gtk_widget_queue_draw (widget);
 
@@ -4430,6 +4439,7 @@ gtk_widget_unmap (GtkWidget *widget)
       g_object_ref (widget);
       gtk_widget_push_verify_invariants (widget);
 
+      gtk_widget_invalidate_render_node (widget);
       if (!_gtk_widget_get_has_window (widget))
 	gtk_widget_queue_draw (widget);
       _gtk_tooltip_hide (widget);
@@ -4905,6 +4915,9 @@ gtk_widget_unrealize (GtkWidget *widget)
       g_signal_emit (widget, widget_signals[UNREALIZE], 0);
       g_assert (!widget->priv->mapped);
       gtk_widget_set_realized (widget, FALSE);
+
+      /* The cached nodes may refer to data of the old renderer */
+      gtk_widget_invalidate_render_node (widget);
     }
 
   gtk_widget_pop_verify_invariants (widget);
@@ -4985,6 +4998,22 @@ gtk_widget_queue_draw_area (GtkWidget *widget,
   cairo_region_destroy (region);
 }
 
+/* Drops the cached render node of @widget. As the cached nodes of
+ * all ancestors contain it, they are dropped, too.
+ */
+static void
+gtk_widget_invalidate_render_node (GtkWidget *widget)
+{
+  for (; widget != NULL; widget = widget->priv->parent)
+    {
+      GtkWidgetPrivate *priv = widget->priv;
+
+      priv->render_node_valid = FALSE;
+      priv->render_node_renderer = NULL;
+      g_clear_pointer (&priv->render_node, gsk_render_node_unref);
+    }
+}
+
 /**
  * gtk_widget_queue_draw:
  * @widget: a #GtkWidget
@@ -5283,6 +5312,7 @@ gtk_widget_queue_draw_region (GtkWidget            *widget,
                               const cairo_region_t *region)
 {
   GtkWidget *parent;
+  GdkWindow *window;
   cairo_region_t *region2;
   int x, y;
   GtkCssStyle *parent_style;
@@ -5293,6 +5323,8 @@ gtk_widget_queue_draw_region (GtkWidget            *widget,
   if (cairo_region_is_empty (region))
     return;
 
+  gtk_widget_invalidate_render_node (widget);
+
   /* Just return if the widget isn't mapped */
   if (!_gtk_widget_get_mapped (widget))
     return;
@@ -5340,7 +5372,24 @@ gtk_widget_queue_draw_region (GtkWidget            *widget,
 
 invalidate:
   gtk_debug_updates_add (widget, region);
-  gdk_window_invalidate_region (_gtk_widget_get_window (widget), region2, TRUE);
+  window = _gtk_widget_get_window (widget);
+  gdk_window_invalidate_region (window, region2, TRUE);
+
+  /* Remember which part of the update area was queued by widgets, so
+   * gtk_widget_render() can replace it with the changes between the
+   * render nodes of the last and the next frame
+   */
+  if (gdk_window_has_native (window))
+    {
+      cairo_region_t *queued = g_object_get_qdata (G_OBJECT (window), quark_queued_draw_region);
+
+      if (queued)
+        cairo_region_union (queued, region2);
+      else
+        g_object_set_qdata_full (G_OBJECT (window), quark_queued_draw_region,
+                                 cairo_region_copy (region2),
+                                 (GDestroyNotify) cairo_region_destroy);
+    }
 
   cairo_region_destroy (region2);
 }
@@ -5605,6 +5654,11 @@ check_clip:
   position_changed |= (old_clip.x != priv->clip.x ||
                       old_clip.y != priv->clip.y);
 
+  /* The parent's render nodes contain the old position, and a new
+   * allocation of this widget may have moved its children around */
+  if (alloc_needed || size_changed || position_changed || baseline_changed)
+    gtk_widget_invalidate_render_node (widget);
+
   if (_gtk_widget_get_mapped (widget) && priv->redraw_on_alloc)
     {
       if (!_gtk_widget_get_has_window (widget) && position_changed)
@@ -8433,6 +8487,8 @@ gtk_widget_reposition_after (GtkWidget *widget,
         parent->priv->last_child = widget;
     }
 
+  gtk_widget_invalidate_render_node (parent);
+
   parent_flags = _gtk_widget_get_state_flags (parent);
 
   /* Merge both old state and current parent state,
@@ -10345,6 +10401,8 @@ gtk_widget_finalize (GObject *object)
 
   g_clear_object (&priv->accessible);
 
+  g_clear_pointer (&priv->render_node, gsk_render_node_unref);
+
   gtk_widget_clear_path (widget);
 
   gtk_css_widget_node_widget_destroyed (GTK_CSS_WIDGET_NODE (priv->cssnode));
@@ -14137,6 +14195,8 @@ gtk_widget_class_get_css_name (GtkWidgetClass *widget_class)
 void
 _gtk_widget_style_context_invalidated (GtkWidget *widget)
 {
+  gtk_widget_invalidate_render_node (widget);
+
   g_signal_emit (widget, widget_signals[STYLE_UPDATED], 0);
 }
 
@@ -15219,58 +15279,36 @@ gtk_widget_maybe_add_debug_render_nodes (GtkWidget             *widget,
     }
 }
 
-void
-gtk_widget_snapshot (GtkWidget   *widget,
-                     GtkSnapshot *snapshot)
+/* Records the contents of @widget into @snapshot, in widget coordinates */
+static void
+gtk_widget_snapshot_contents (GtkWidget   *widget,
+                              GtkSnapshot *snapshot)
 {
   GtkWidgetClass *klass = GTK_WIDGET_GET_CLASS (widget);
-  GtkWidgetPrivate *priv;
+  GtkWidgetPrivate *priv = widget->priv;
   graphene_rect_t bounds;
   GtkCssValue *filter_value;
   RenderMode mode;
   double opacity;
-  cairo_rectangle_int_t offset_clip;
   GtkCssStyle *style;
   GtkAllocation allocation;
   GtkBorder margin, border, padding;
 
-  if (!_gtk_widget_is_drawable (widget))
-    return;
-
-  if (_gtk_widget_get_alloc_needed (widget))
-    {
-      g_warning ("Trying to snapshot %s %p without a current allocation", G_OBJECT_TYPE_NAME (widget), widget);
-      return;
-    }
-
-  priv = widget->priv;
-  offset_clip = priv->clip;
-  offset_clip.x -= priv->allocation.x;
-  offset_clip.y -= priv->allocation.y;
-
-  if (gtk_snapshot_clips_rect (snapshot, &offset_clip))
-    return;
-
-  opacity = widget->priv->alpha / 255.0;
-  if (opacity <= 0.0)
-    return;
+  opacity = priv->alpha / 255.0;
 
   /* Compatibility mode: if the widget does not have a render node, we draw
    * using gtk_widget_draw() on a temporary node
    */
   mode = get_render_mode (klass);
 
-  if (GTK_DEBUG_CHECK (SNAPSHOT))
-    gtk_snapshot_push (snapshot, TRUE, "%s<%p>", gtk_widget_get_name (widget), widget);
-
   filter_value = _gtk_style_context_peek_property (_gtk_widget_get_style_context (widget), GTK_CSS_PROPERTY_FILTER);
   gtk_css_filter_value_push_snapshot (filter_value, snapshot);
 
   graphene_rect_init (&bounds,
-                      offset_clip.x,
-                      offset_clip.y,
-                      offset_clip.width,
-                      offset_clip.height);
+                      priv->clip.x - priv->allocation.x,
+                      priv->clip.y - priv->allocation.y,
+                      priv->clip.width,
+                      priv->clip.height);
 
   style = gtk_css_node_get_style (priv->cssnode);
   get_box_margin (style, &margin);
@@ -15342,14 +15380,84 @@ gtk_widget_snapshot (GtkWidget   *widget,
         gtk_snapshot_pop (snapshot);
     }
 
-
   gtk_css_filter_value_pop_snapshot (filter_value, snapshot);
+}
+
+void
+gtk_widget_snapshot (GtkWidget   *widget,
+                     GtkSnapshot *snapshot)
+{
+  GtkWidgetPrivate *priv;
+  GskRenderer *renderer;
+  cairo_rectangle_int_t offset_clip;
+  int x, y;
+
+  if (!_gtk_widget_is_drawable (widget))
+    return;
+
+  if (_gtk_widget_get_alloc_needed (widget))
+    {
+      g_warning ("Trying to snapshot %s %p without a current allocation", G_OBJECT_TYPE_NAME (widget), widget);
+      return;
+    }
+
+  priv = widget->priv;
+  offset_clip = priv->clip;
+  offset_clip.x -= priv->allocation.x;
+  offset_clip.y -= priv->allocation.y;
+
+  if (gtk_snapshot_clips_rect (snapshot, &offset_clip))
+    return;
+
+  if (priv->alpha == 0)
+    return;
+
+  if (GTK_DEBUG_CHECK (SNAPSHOT))
+    gtk_snapshot_push (snapshot, TRUE, "%s<%p>", gtk_widget_get_name (widget), widget);
+
+  /* The nodes of the last snapshot are kept until something queues
+   * a redraw, changes the style or the allocation of the widget, so
+   * only the parts of the widget tree that changed get recorded again.
+   * They are recorded without clip, so that they are complete, and
+   * cairo nodes depend on the renderer they were created for.
+   */
+  renderer = gtk_snapshot_get_renderer (snapshot);
+  if (!priv->render_node_valid || priv->render_node_renderer != renderer)
+    {
+      g_clear_pointer (&priv->render_node, gsk_render_node_unref);
+
+      gtk_snapshot_push (snapshot, FALSE, "Cached<%s>", G_OBJECT_TYPE_NAME (widget));
+      gtk_widget_snapshot_contents (widget, snapshot);
+      priv->render_node = gtk_snapshot_pop_collect (snapshot);
+      priv->render_node_renderer = renderer;
+      priv->render_node_valid = TRUE;
+    }
+
+  if (priv->render_node)
+    {
+      gtk_snapshot_get_offset (snapshot, &x, &y);
+
+      if (x == 0 && y == 0)
+        {
+          gtk_snapshot_append_node (snapshot, priv->render_node);
+        }
+      else
+        {
+          graphene_matrix_t transform;
+          GskRenderNode *node;
+
+          /* Renderers keep the clips of the parent for translations */
+          graphene_matrix_init_translate (&transform, &GRAPHENE_POINT3D_INIT (x, y, 0));
+          node = gsk_transform_node_new (priv->render_node, &transform);
+          gtk_snapshot_append_node (snapshot, node);
+          gsk_render_node_unref (node);
+        }
+    }
 
 #ifdef G_ENABLE_DEBUG
   gtk_widget_maybe_add_debug_render_nodes (widget, snapshot);
 #endif
 
-
   if (GTK_DEBUG_CHECK (SNAPSHOT))
     gtk_snapshot_pop (snapshot);
 }
@@ -15363,7 +15471,7 @@ gtk_widget_render (GtkWidget            *widget,
   GtkSnapshot snapshot;
   GskRenderer *renderer;
   GskRenderNode *root;
-  cairo_region_t *clip;
+  cairo_region_t *clip, *queued, *damage;
 
   /* We only render double buffered on native windows */
   if (!gdk_window_has_native (window))
@@ -15373,9 +15481,16 @@ gtk_widget_render (GtkWidget            *widget,
   if (renderer == NULL)
     return;
 
-  context = gsk_renderer_begin_draw_frame (renderer, region);
-  clip = gdk_drawing_context_get_clip (context);
+  queued = g_object_steal_qdata (G_OBJECT (window), quark_queued_draw_region);
 
+  /* The whole window is snapshotted, so that the render nodes can be
+   * compared with the ones of the last frame
+   */
+  clip = cairo_region_create_rectangle (&(GdkRectangle) {
+                                            0, 0,
+                                            gdk_window_get_width (window),
+                                            gdk_window_get_height (window)
+                                        });
   gtk_snapshot_init (&snapshot,
                      renderer,
                      gtk_inspector_is_recording (widget),
@@ -15384,12 +15499,40 @@ gtk_widget_render (GtkWidget            *widget,
   cairo_region_destroy (clip);
   gtk_widget_snapshot (widget, &snapshot);
   root = gtk_snapshot_finish (&snapshot);
+
+  /* Queued draws are replaced with what actually changed since the
+   * last frame; the rest of @region was exposed and needs a redraw
+   */
+  damage = cairo_region_copy (region);
+  if (root != NULL)
+    {
+      cairo_region_t *changes = gsk_renderer_get_damage (renderer, root);
+
+      if (changes != NULL)
+        {
+          if (queued != NULL)
+            cairo_region_subtract (damage, queued);
+          cairo_region_union (damage, changes);
+          cairo_region_destroy (changes);
+        }
+    }
+  g_clear_pointer (&queued, cairo_region_destroy);
+
+  if (cairo_region_is_empty (damage))
+    {
+      g_clear_pointer (&root, gsk_render_node_unref);
+      cairo_region_destroy (damage);
+      return;
+    }
+
+  context = gsk_renderer_begin_draw_frame (renderer, damage);
+
   if (root != NULL)
     {
       gtk_inspector_record_render (widget,
                                    renderer,
                                    window,
-                                   region,
+                                   damage,
                                    context,
                                    root);
 
@@ -15397,8 +15540,8 @@ gtk_widget_render (GtkWidget            *widget,
       gsk_render_node_unref (root);
     }
 
-
   gsk_renderer_end_draw_frame (renderer, context);
+  cairo_region_destroy (damage);
 }
 
 /**
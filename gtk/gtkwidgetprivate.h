@@ -71,6 +71,7 @@ struct _GtkWidgetPrivate
   guint multidevice           : 1;
   guint has_shape_mask        : 1;
   guint pass_through          : 1;
+  guint render_node_valid     : 1;
 
   /* Queue-resize related flags */
   guint resize_needed         : 1; /* queue_resize() has been called but no get_preferred_size() yet */
@@ -165,6 +166,13 @@ struct _GtkWidgetPrivate
 
   /* Pointer cursor */
   GdkCursor *cursor;
+
+  /* The render nodes of the last snapshot, in widget coordinates,
+   * reused until the widget is queued for a redraw. This may be
+   * %NULL if the widget didn't draw anything.
+   */
+  GskRenderNode *render_node;
+  GskRenderer *render_node_renderer;
 };
 
 GtkCssNode *  gtk_widget_get_css_node       (GtkWidget *widget);
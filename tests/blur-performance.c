@@ -1,6 +1,7 @@
 /* -*- mode: C; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
 
 #include <gsk/gskcairoblurprivate.h>
+#include <stdlib.h>
 
 static void
 init_surface (cairo_t *cr)
@@ -16,38 +17,55 @@ init_surface (cairo_t *cr)
   cairo_fill (cr);
 }
 
+static double
+time_blur (cairo_t      *cr,
+           GTimer       *timer,
+           int           radius,
+           GskBlurFlags  flags)
+{
+  init_surface (cr);
+  g_timer_start (timer);
+  gsk_cairo_blur_surface (cairo_get_target (cr), radius, flags);
+
+  return g_timer_elapsed (timer, NULL) * 1000;
+}
+
 int
 main (int argc, char **argv)
 {
   cairo_surface_t *surface;
   cairo_t *cr;
   GTimer *timer;
-  double msec;
+  double msec, msec_x, msec_y;
   int i, j;
   int size;
 
   timer = g_timer_new ();
 
   size = 2000;
+  if (argc > 1)
+    size = MAX (atoi (argv[1]), 1);
 
   surface = cairo_image_surface_create (CAIRO_FORMAT_A8, size, size);
 
   cr = cairo_create (surface);
 
-  /* We do everything three times, first two as warmup */
+  /* We do everything twice, first as warmup */
   for (j = 0; j < 2; j++)
     {
       for (i = 1; i < 16; i++)
 	{
-	  init_surface (cr);
-	  g_timer_start (timer);
-	  gsk_cairo_blur_surface (surface, i, GSK_BLUR_X | GSK_BLUR_Y);
-	  msec = g_timer_elapsed (timer, NULL) * 1000;
+          msec_x = time_blur (cr, timer, i, GSK_BLUR_X);
+          msec_y = time_blur (cr, timer, i, GSK_BLUR_Y);
+          msec = time_blur (cr, timer, i, GSK_BLUR_X | GSK_BLUR_Y);
 	  if (j == 1)
-	    g_print ("Radius %2d: %.2f msec, %.2f kpixels/msec:\n", i, msec, size*size/(msec*1000));
+	    g_print ("Radius %2d: %.2f msec, %.2f kpixels/msec (x: %.2f msec, y: %.2f msec)\n",
+                     i, msec, size*size/(msec*1000), msec_x, msec_y);
 	}
     }
 
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
   g_timer_destroy (timer);
 
   return 0;
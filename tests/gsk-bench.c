@@ -0,0 +1,732 @@
+/* gsk-bench: Benchmark the GSK renderers on a corpus of node files
+ *
+ * Every node file is rendered with every renderer using
+ * gsk_renderer_render_texture(), and the results are printed as one
+ * JSON object per line, so they can be compared between builds.
+ *
+ * The cost of the node types is measured by rendering subtrees with
+ * their children replaced by plain color nodes, and subtracting the
+ * cost of rendering just those color nodes.
+ *
+ * GDK still needs a display, so on machines without a GPU this is
+ * best run on Xvfb or a headless Wayland compositor using Mesa's
+ * llvmpipe and lavapipe drivers.
+ *
+ * GPU times and texture statistics are only available if GTK was
+ * built with debugging enabled.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gdk/gdk-private.h>
+#include <gsk/gsk.h>
+
+#include "gsk/gskcairorendererprivate.h"
+#include "gsk/gskglrendererprivate.h"
+#include "gsk/gskprofilerprivate.h"
+#include "gsk/gskrendererprivate.h"
+#include "gsk/gskrendernodeprivate.h"
+#ifdef GDK_RENDERING_VULKAN
+#include "gsk/gskvulkanrendererprivate.h"
+#endif
+
+static int runs = 10;
+static int max_samples = 8;
+static char **renderer_names = NULL;
+static char **files = NULL;
+
+static GOptionEntry options[] = {
+  { "runs", 'r', 0, G_OPTION_ARG_INT, &runs, "Render every node file N times", "N" },
+  { "renderer", 'R', 0, G_OPTION_ARG_STRING_ARRAY, &renderer_names, "Only use the given renderer", "RENDERER" },
+  { "samples", 's', 0, G_OPTION_ARG_INT, &max_samples, "Measure up to N nodes of every node type, 0 to not measure node types", "N" },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "NODE-FILE|DIRECTORY…" },
+  { NULL }
+};
+
+typedef struct {
+  const char *name;
+  GType (* get_type) (void);
+  gboolean has_gpu_time;
+  gboolean has_texture_stats;
+} Backend;
+
+static const Backend backends[] = {
+  { "cairo", gsk_cairo_renderer_get_type, FALSE, FALSE },
+  { "opengl", gsk_gl_renderer_get_type, TRUE, TRUE },
+#ifdef GDK_RENDERING_VULKAN
+  { "vulkan", gsk_vulkan_renderer_get_type, FALSE, TRUE },
+#endif
+};
+
+/* All times are in nanoseconds, values of -1 are not available */
+typedef struct {
+  gint64 wall_time;
+  gint64 cpu_time;
+  gint64 gpu_time;
+  gint64 uploads;
+  gint64 upload_bytes;
+  gint64 texture_memory;
+} Sample;
+
+#define N_SAMPLE_VALUES (sizeof (Sample) / sizeof (gint64))
+
+static void
+render_once (const Backend         *backend,
+             GskRenderer           *renderer,
+             GskRenderNode         *node,
+             const graphene_rect_t *viewport,
+             Sample                *sample)
+{
+  GskTexture *texture;
+  clock_t cpu_start;
+  gint64 start;
+#ifdef G_ENABLE_DEBUG
+  GskProfiler *profiler = gsk_renderer_get_profiler (renderer);
+#endif
+
+  cpu_start = clock ();
+  start = g_get_monotonic_time ();
+
+  /* This includes waiting for the GPU, as the texture is downloaded */
+  texture = gsk_renderer_render_texture (renderer, node, viewport);
+
+  sample->wall_time = (g_get_monotonic_time () - start) * 1000;
+  sample->cpu_time = (gint64) ((double) (clock () - cpu_start) * G_GINT64_CONSTANT (1000000000) / CLOCKS_PER_SEC);
+  sample->gpu_time = -1;
+  sample->uploads = -1;
+  sample->upload_bytes = -1;
+  sample->texture_memory = -1;
+
+  g_object_unref (texture);
+
+#ifdef G_ENABLE_DEBUG
+  if (backend->has_gpu_time)
+    sample->gpu_time = gsk_profiler_timer_get (profiler, g_quark_from_static_string ("gpu-time"));
+
+  if (backend->has_texture_stats)
+    {
+      sample->uploads = gsk_profiler_counter_get (profiler, g_quark_from_static_string ("uploads"));
+      sample->upload_bytes = gsk_profiler_counter_get (profiler, g_quark_from_static_string ("upload-bytes"));
+      sample->texture_memory = gsk_profiler_counter_get (profiler, g_quark_from_static_string ("texture-memory"));
+    }
+#endif
+}
+
+static int
+compare_int64 (const void *a,
+               const void *b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Takes the median of every value of @samples separately */
+static void
+samples_get_median (const Sample *samples,
+                    guint         n_samples,
+                    Sample       *median)
+{
+  gint64 *values;
+  guint i, j;
+
+  values = g_new (gint64, n_samples);
+
+  for (i = 0; i < N_SAMPLE_VALUES; i++)
+    {
+      for (j = 0; j < n_samples; j++)
+        values[j] = ((const gint64 *) &samples[j])[i];
+
+      qsort (values, n_samples, sizeof (gint64), compare_int64);
+
+      ((gint64 *) median)[i] = values[n_samples / 2];
+    }
+
+  g_free (values);
+}
+
+/* Renders @node @runs times, the first run is returned separately
+ * in @cold, as it also includes filling the caches of the renderer
+ */
+static void
+render_runs (const Backend         *backend,
+             GskRenderer           *renderer,
+             GskRenderNode         *node,
+             const graphene_rect_t *viewport,
+             Sample                *cold,
+             Sample                *median,
+             gint64                *min_wall_time)
+{
+  Sample *samples;
+  int i;
+
+  samples = g_new (Sample, runs);
+
+  for (i = 0; i < runs; i++)
+    render_once (backend, renderer, node, viewport, &samples[i]);
+
+  if (cold)
+    *cold = samples[0];
+
+  samples_get_median (samples, runs, median);
+
+  if (min_wall_time)
+    {
+      *min_wall_time = samples[0].wall_time;
+      for (i = 1; i < runs; i++)
+        *min_wall_time = MIN (*min_wall_time, samples[i].wall_time);
+    }
+
+  g_free (samples);
+}
+
+static void
+get_children (GskRenderNode *node,
+              GPtrArray     *children)
+{
+  guint i;
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_CONTAINER_NODE:
+      for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+        g_ptr_array_add (children, gsk_container_node_get_child (node, i));
+      break;
+
+    case GSK_TRANSFORM_NODE:
+      g_ptr_array_add (children, gsk_transform_node_get_child (node));
+      break;
+
+    case GSK_OPACITY_NODE:
+      g_ptr_array_add (children, gsk_opacity_node_get_child (node));
+      break;
+
+    case GSK_COLOR_MATRIX_NODE:
+      g_ptr_array_add (children, gsk_color_matrix_node_get_child (node));
+      break;
+
+    case GSK_REPEAT_NODE:
+      g_ptr_array_add (children, gsk_repeat_node_get_child (node));
+      break;
+
+    case GSK_CLIP_NODE:
+      g_ptr_array_add (children, gsk_clip_node_get_child (node));
+      break;
+
+    case GSK_ROUNDED_CLIP_NODE:
+      g_ptr_array_add (children, gsk_rounded_clip_node_get_child (node));
+      break;
+
+    case GSK_SHADOW_NODE:
+      g_ptr_array_add (children, gsk_shadow_node_get_child (node));
+      break;
+
+    case GSK_BLEND_NODE:
+      g_ptr_array_add (children, gsk_blend_node_get_bottom_child (node));
+      g_ptr_array_add (children, gsk_blend_node_get_top_child (node));
+      break;
+
+    case GSK_CROSS_FADE_NODE:
+      g_ptr_array_add (children, gsk_cross_fade_node_get_start_child (node));
+      g_ptr_array_add (children, gsk_cross_fade_node_get_end_child (node));
+      break;
+
+    case GSK_NOT_A_RENDER_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_COLOR_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_TEXTURE_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+    case GSK_TEXT_NODE:
+    default:
+      break;
+    }
+}
+
+/* Collects the nodes of the tree by type, in depth-first order */
+static void
+collect_nodes (GskRenderNode  *node,
+               GPtrArray     **nodes_by_type,
+               guint          *n_nodes)
+{
+  GPtrArray *children;
+  guint i;
+
+  g_ptr_array_add (nodes_by_type[gsk_render_node_get_node_type (node)], node);
+  *n_nodes += 1;
+
+  children = g_ptr_array_new ();
+  get_children (node, children);
+  for (i = 0; i < children->len; i++)
+    collect_nodes (g_ptr_array_index (children, i), nodes_by_type, n_nodes);
+  g_ptr_array_free (children, TRUE);
+}
+
+/* Creates a copy of @node with all children replaced by color nodes
+ * of the same size. @reference is set to a node that just draws the
+ * color nodes, so the difference between the two is the cost of
+ * @node itself.
+ */
+static GskRenderNode *
+create_stub_node (GskRenderNode  *node,
+                  GskRenderNode **reference)
+{
+  static const GdkRGBA gray = { 0.5, 0.5, 0.5, 1.0 };
+  GskRenderNode *result;
+  GPtrArray *children, *stubs;
+  graphene_rect_t bounds;
+  guint i;
+
+  children = g_ptr_array_new ();
+  get_children (node, children);
+
+  stubs = g_ptr_array_new_with_free_func ((GDestroyNotify) gsk_render_node_unref);
+  for (i = 0; i < children->len; i++)
+    {
+      gsk_render_node_get_bounds (g_ptr_array_index (children, i), &bounds);
+      g_ptr_array_add (stubs, gsk_color_node_new (&gray, &bounds));
+    }
+
+#define STUB(i) ((GskRenderNode *) g_ptr_array_index (stubs, i))
+
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_CONTAINER_NODE:
+      result = gsk_container_node_new ((GskRenderNode **) stubs->pdata, stubs->len);
+      break;
+
+    case GSK_TRANSFORM_NODE:
+      {
+        graphene_matrix_t transform;
+
+        gsk_transform_node_get_transform (node, &transform);
+        result = gsk_transform_node_new (STUB (0), &transform);
+      }
+      break;
+
+    case GSK_OPACITY_NODE:
+      result = gsk_opacity_node_new (STUB (0), gsk_opacity_node_get_opacity (node));
+      break;
+
+    case GSK_COLOR_MATRIX_NODE:
+      result = gsk_color_matrix_node_new (STUB (0),
+                                          gsk_color_matrix_node_peek_color_matrix (node),
+                                          gsk_color_matrix_node_peek_color_offset (node));
+      break;
+
+    case GSK_REPEAT_NODE:
+      gsk_render_node_get_bounds (node, &bounds);
+      result = gsk_repeat_node_new (&bounds, STUB (0), gsk_repeat_node_peek_child_bounds (node));
+      break;
+
+    case GSK_CLIP_NODE:
+      result = gsk_clip_node_new (STUB (0), gsk_clip_node_peek_clip (node));
+      break;
+
+    case GSK_ROUNDED_CLIP_NODE:
+      result = gsk_rounded_clip_node_new (STUB (0), gsk_rounded_clip_node_peek_clip (node));
+      break;
+
+    case GSK_SHADOW_NODE:
+      {
+        gsize n_shadows = gsk_shadow_node_get_n_shadows (node);
+        GskShadow *shadows = g_newa (GskShadow, n_shadows);
+
+        for (i = 0; i < n_shadows; i++)
+          shadows[i] = *gsk_shadow_node_peek_shadow (node, i);
+
+        result = gsk_shadow_node_new (STUB (0), shadows, n_shadows);
+      }
+      break;
+
+    case GSK_BLEND_NODE:
+      result = gsk_blend_node_new (STUB (0), STUB (1), gsk_blend_node_get_blend_mode (node));
+      break;
+
+    case GSK_CROSS_FADE_NODE:
+      result = gsk_cross_fade_node_new (STUB (0), STUB (1), gsk_cross_fade_node_get_progress (node));
+      break;
+
+    case GSK_NOT_A_RENDER_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_COLOR_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_TEXTURE_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+    case GSK_TEXT_NODE:
+    default:
+      result = gsk_render_node_ref (node);
+      break;
+    }
+
+#undef STUB
+
+  /* For transform and repeat nodes, this draws the color nodes
+   * untransformed and only once, which is close enough
+   */
+  *reference = gsk_container_node_new ((GskRenderNode **) stubs->pdata, stubs->len);
+
+  g_ptr_array_unref (stubs);
+  g_ptr_array_free (children, TRUE);
+
+  return result;
+}
+
+static void
+append_string (GString    *string,
+               const char *s)
+{
+  g_string_append_c (string, '"');
+  for (; *s; s++)
+    {
+      if (*s == '"' || *s == '\\')
+        g_string_append_printf (string, "\\%c", *s);
+      else if ((guchar) *s < 0x20)
+        g_string_append_printf (string, "\\u%04x", (guchar) *s);
+      else
+        g_string_append_c (string, *s);
+    }
+  g_string_append_c (string, '"');
+}
+
+static void
+append_time (GString    *string,
+             const char *name,
+             gint64      value)
+{
+  if (value < 0)
+    g_string_append_printf (string, "\"%s\": null", name);
+  else
+    g_string_append_printf (string, "\"%s\": %.3f", name, value / 1000.0);
+}
+
+static void
+append_count (GString    *string,
+              const char *name,
+              gint64      value)
+{
+  if (value < 0)
+    g_string_append_printf (string, "\"%s\": null", name);
+  else
+    g_string_append_printf (string, "\"%s\": %" G_GINT64_FORMAT, name, value);
+}
+
+static void
+append_sample (GString      *string,
+               const char   *name,
+               const Sample *sample)
+{
+  g_string_append_printf (string, "\"%s\": { ", name);
+  append_time (string, "wall-us", sample->wall_time);
+  g_string_append (string, ", ");
+  append_time (string, "cpu-us", sample->cpu_time);
+  g_string_append (string, ", ");
+  append_time (string, "gpu-us", sample->gpu_time);
+  g_string_append (string, ", ");
+  append_count (string, "uploads", sample->uploads);
+  g_string_append (string, ", ");
+  append_count (string, "upload-bytes", sample->upload_bytes);
+  g_string_append (string, ", ");
+  append_count (string, "texture-memory", sample->texture_memory);
+  g_string_append (string, " }");
+}
+
+static void
+append_header (GString    *string,
+               const char *kind,
+               const char *filename,
+               const char *renderer)
+{
+  g_string_append_printf (string, "{ \"kind\": \"%s\", \"file\": ", kind);
+  append_string (string, filename);
+  g_string_append_printf (string, ", \"renderer\": \"%s\"", renderer);
+}
+
+static void
+bench_node_types (const Backend  *backend,
+                  GskRenderer    *renderer,
+                  const char     *filename,
+                  GPtrArray     **nodes_by_type)
+{
+  GEnumClass *enum_class;
+  GString *string;
+  guint type, i;
+
+  enum_class = g_type_class_ref (GSK_TYPE_RENDER_NODE_TYPE);
+  string = g_string_new (NULL);
+
+  for (type = 0; type < enum_class->n_values; type++)
+    {
+      GPtrArray *nodes = nodes_by_type[type];
+      gint64 wall_time = 0, cpu_time = 0;
+      guint n_samples = 0;
+
+      for (i = 0; i < nodes->len && n_samples < (guint) max_samples; i++)
+        {
+          GskRenderNode *node = g_ptr_array_index (nodes, i);
+          GskRenderNode *stub, *reference;
+          Sample stub_sample, reference_sample;
+          graphene_rect_t bounds;
+
+          gsk_render_node_get_bounds (node, &bounds);
+          if (bounds.size.width < 1 || bounds.size.height < 1)
+            continue;
+
+          stub = create_stub_node (node, &reference);
+
+          render_runs (backend, renderer, stub, &bounds, NULL, &stub_sample, NULL);
+          render_runs (backend, renderer, reference, &bounds, NULL, &reference_sample, NULL);
+
+          wall_time += stub_sample.wall_time - reference_sample.wall_time;
+          cpu_time += stub_sample.cpu_time - reference_sample.cpu_time;
+          n_samples++;
+
+          gsk_render_node_unref (reference);
+          gsk_render_node_unref (stub);
+        }
+
+      if (n_samples == 0)
+        continue;
+
+      g_string_set_size (string, 0);
+      append_header (string, "node-type", filename, backend->name);
+      g_string_append_printf (string, ", \"node-type\": \"%s\", \"count\": %u, \"samples\": %u, ",
+                              g_enum_get_value (enum_class, type)->value_nick,
+                              nodes->len, n_samples);
+      /* These can be slightly negative for cheap nodes, as they are
+       * differences of noisy measurements
+       */
+      g_string_append_printf (string, "\"self-wall-us\": %.3f, \"self-cpu-us\": %.3f }",
+                              wall_time / 1000.0 / n_samples,
+                              cpu_time / 1000.0 / n_samples);
+      g_print ("%s\n", string->str);
+    }
+
+  g_string_free (string, TRUE);
+  g_type_class_unref (enum_class);
+}
+
+static void
+bench_file (const char *filename,
+            GdkWindow  *window,
+            GList      *selected_backends)
+{
+  GEnumClass *enum_class;
+  GPtrArray **nodes_by_type;
+  GMappedFile *mapped_file;
+  GskRenderNode *node;
+  GError *error = NULL;
+  GBytes *bytes;
+  graphene_rect_t bounds;
+  GString *string;
+  guint i, n_types, n_nodes;
+  GList *l;
+
+  mapped_file = g_mapped_file_new (filename, FALSE, &error);
+  if (mapped_file == NULL)
+    {
+      g_printerr ("Could not open node file: %s\n", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  bytes = g_mapped_file_get_bytes (mapped_file);
+  g_mapped_file_unref (mapped_file);
+
+  node = gsk_render_node_deserialize (bytes, &error);
+  g_bytes_unref (bytes);
+  if (node == NULL)
+    {
+      g_printerr ("Invalid node file %s: %s\n", filename, error->message);
+      g_error_free (error);
+      return;
+    }
+
+  gsk_render_node_get_bounds (node, &bounds);
+
+  enum_class = g_type_class_ref (GSK_TYPE_RENDER_NODE_TYPE);
+  n_types = enum_class->n_values;
+  g_type_class_unref (enum_class);
+
+  nodes_by_type = g_new (GPtrArray *, n_types);
+  for (i = 0; i < n_types; i++)
+    nodes_by_type[i] = g_ptr_array_new ();
+  n_nodes = 0;
+  collect_nodes (node, nodes_by_type, &n_nodes);
+
+  string = g_string_new (NULL);
+
+  for (l = selected_backends; l; l = l->next)
+    {
+      const Backend *backend = l->data;
+      GskRenderer *renderer;
+      Sample cold, median;
+      gint64 min_wall_time;
+
+      /* Use a new renderer for every file, so caches start out empty */
+      renderer = g_object_new (backend->get_type (),
+                               "display", gdk_window_get_display (window),
+                               NULL);
+      if (!gsk_renderer_realize (renderer, window, &error))
+        {
+          g_printerr ("Could not realize the %s renderer: %s\n", backend->name, error->message);
+          g_clear_error (&error);
+          g_object_unref (renderer);
+          continue;
+        }
+
+      render_runs (backend, renderer, node, &bounds, &cold, &median, &min_wall_time);
+
+      g_string_set_size (string, 0);
+      append_header (string, "render", filename, backend->name);
+      g_string_append_printf (string, ", \"width\": %g, \"height\": %g, \"nodes\": %u, \"runs\": %d, ",
+                              bounds.size.width, bounds.size.height, n_nodes, runs);
+      append_time (string, "min-wall-us", min_wall_time);
+      g_string_append (string, ", ");
+      append_sample (string, "cold", &cold);
+      g_string_append (string, ", ");
+      append_sample (string, "median", &median);
+      g_string_append (string, " }");
+      g_print ("%s\n", string->str);
+
+      if (max_samples > 0)
+        bench_node_types (backend, renderer, filename, nodes_by_type);
+
+      gsk_renderer_unrealize (renderer);
+      g_object_unref (renderer);
+    }
+
+  g_string_free (string, TRUE);
+
+  for (i = 0; i < n_types; i++)
+    g_ptr_array_free (nodes_by_type[i], TRUE);
+  g_free (nodes_by_type);
+
+  gsk_render_node_unref (node);
+}
+
+static int
+compare_filenames (gconstpointer a,
+                   gconstpointer b)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+/* Adds @path, or all node files in @path if it is a directory */
+static void
+add_files (GPtrArray  *filenames,
+           const char *path)
+{
+  const char *name;
+  GDir *dir;
+  guint start;
+
+  if (!g_file_test (path, G_FILE_TEST_IS_DIR))
+    {
+      g_ptr_array_add (filenames, g_strdup (path));
+      return;
+    }
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  start = filenames->len;
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      if (g_str_has_suffix (name, ".node"))
+        g_ptr_array_add (filenames, g_build_filename (path, name, NULL));
+    }
+  g_dir_close (dir);
+
+  /* Keep the output in a stable order */
+  g_qsort_with_data (filenames->pdata + start, filenames->len - start,
+                     sizeof (gpointer), (GCompareDataFunc) compare_filenames, NULL);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GList *selected_backends = NULL;
+  GPtrArray *filenames;
+  GdkDisplay *display;
+  GdkWindow *window;
+  guint i, j;
+
+  context = g_option_context_new ("- benchmark the GSK renderers");
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("Option parsing failed: %s\n", error->message);
+      return 1;
+    }
+
+  if (runs < 1)
+    {
+      g_printerr ("Number of runs given with -r/--runs must be at least 1 and not %d.\n", runs);
+      return 1;
+    }
+
+  if (files == NULL)
+    {
+      g_printerr ("Usage: %s [OPTIONS] NODE-FILE|DIRECTORY…\n", argv[0]);
+      return 1;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (backends); i++)
+    {
+      if (renderer_names != NULL && !g_strv_contains ((const char * const *) renderer_names, backends[i].name))
+        continue;
+
+      selected_backends = g_list_append (selected_backends, (gpointer) &backends[i]);
+    }
+
+  for (j = 0; renderer_names != NULL && renderer_names[j] != NULL; j++)
+    {
+      for (i = 0; i < G_N_ELEMENTS (backends); i++)
+        {
+          if (g_str_equal (renderer_names[j], backends[i].name))
+            break;
+        }
+
+      if (i == G_N_ELEMENTS (backends))
+        g_printerr ("Unknown renderer \"%s\", ignoring it.\n", renderer_names[j]);
+    }
+
+  gdk_pre_parse ();
+  display = gdk_display_open_default ();
+  if (display == NULL)
+    {
+      g_printerr ("Could not open a display.\n");
+      return 1;
+    }
+
+  window = gdk_window_new_toplevel (display, 0, 10, 10);
+
+  filenames = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; files[i] != NULL; i++)
+    add_files (filenames, files[i]);
+
+  for (i = 0; i < filenames->len; i++)
+    bench_file (g_ptr_array_index (filenames, i), window, selected_backends);
+
+  g_ptr_array_unref (filenames);
+  gdk_window_destroy (window);
+  g_list_free (selected_backends);
+  g_option_context_free (context);
+
+  return 0;
+}
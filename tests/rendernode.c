@@ -7,7 +7,7 @@ static int runs = 1;
 
 static GOptionEntry options[] = {
   { "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Time operations", NULL },
-  { "dump-variant", 'd', 0, G_OPTION_ARG_NONE, &dump_variant, "Dump GVariant structure", NULL },
+  { "dump-variant", 'd', 0, G_OPTION_ARG_NONE, &dump_variant, "Dump GVariant structure of old node files", NULL },
   { "fallback", '\0', 0, G_OPTION_ARG_NONE, &fallback, "Draw node without a renderer", NULL },
   { "runs", 'r', 0, G_OPTION_ARG_INT, &runs, "Render the test N times", "N" },
   { NULL }
@@ -19,10 +19,9 @@ main(int argc, char **argv)
   cairo_surface_t *surface;
   GskRenderNode *node;
   GError *error = NULL;
+  GMappedFile *mapped_file;
   GBytes *bytes;
   gint64 start, end;
-  char *contents;
-  gsize len;
   int run;
   GOptionContext *context;
 
@@ -47,13 +46,15 @@ main(int argc, char **argv)
       return 1;
     }
 
-  if (!g_file_get_contents (argv[1], &contents, &len, &error))
+  mapped_file = g_mapped_file_new (argv[1], FALSE, &error);
+  if (mapped_file == NULL)
     {
       g_printerr ("Could not open node file: %s\n", error->message);
       return 1;
     }
 
-  bytes = g_bytes_new_take (contents, len);
+  bytes = g_mapped_file_get_bytes (mapped_file);
+  g_mapped_file_unref (mapped_file);
   if (dump_variant)
     {
       GVariant *variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("(suuv)"), bytes, FALSE);
@@ -19,6 +19,7 @@
  */
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 
 static void
 gtk_css_provider_load_data_not_null_terminated (void)
@@ -33,14 +34,98 @@ gtk_css_provider_load_data_not_null_terminated (void)
   g_object_unref (p);
 }
 
+static char *
+get_cache_path (const char *path)
+{
+  char *uri, *checksum, *basename, *cache_path;
+
+  uri = g_filename_to_uri (path, NULL, NULL);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, -1);
+  basename = g_strconcat (checksum, ".cache", NULL);
+  cache_path = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "css", basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+  g_free (uri);
+
+  return cache_path;
+}
+
+/* The second load of a file comes from the cache written by the first
+ * one, and images must keep their location in it.
+ */
+static void
+gtk_css_provider_load_file_cache (void)
+{
+  GtkCssProvider *p;
+  char *dir, *css_path, *image_path, *scaled_path, *cache_path;
+  char *parsed, *cached;
+  GStatBuf written, loaded;
+
+  dir = g_dir_make_tmp ("gtk-css-cache-XXXXXX", NULL);
+  g_assert_nonnull (dir);
+
+  css_path = g_build_filename (dir, "test.css", NULL);
+  image_path = g_build_filename (dir, "image.png", NULL);
+  scaled_path = g_build_filename (dir, "image@2.png", NULL);
+
+  g_assert_true (g_file_set_contents (image_path, "image", -1, NULL));
+  g_assert_true (g_file_set_contents (scaled_path, "scaled", -1, NULL));
+  g_assert_true (g_file_set_contents (css_path,
+                                      "a { background-image: url(\"image.png\"); }\n"
+                                      "b { background-image: -gtk-scaled(url(\"image.png\"), url(\"image@2.png\")); }\n",
+                                      -1, NULL));
+
+  p = gtk_css_provider_new ();
+  gtk_css_provider_load_from_path (p, css_path);
+  parsed = gtk_css_provider_to_string (p);
+  g_object_unref (p);
+
+  cache_path = get_cache_path (css_path);
+  g_assert_cmpint (g_stat (cache_path, &written), ==, 0);
+
+  p = gtk_css_provider_new ();
+  gtk_css_provider_load_from_path (p, css_path);
+  cached = gtk_css_provider_to_string (p);
+  g_object_unref (p);
+
+  /* A cache that fails to load is written again */
+  g_assert_cmpint (g_stat (cache_path, &loaded), ==, 0);
+  g_assert_cmpuint (written.st_ino, ==, loaded.st_ino);
+
+  g_assert_cmpstr (parsed, ==, cached);
+
+  g_unlink (cache_path);
+  g_unlink (css_path);
+  g_unlink (image_path);
+  g_unlink (scaled_path);
+  g_rmdir (dir);
+
+  g_free (parsed);
+  g_free (cached);
+  g_free (cache_path);
+  g_free (scaled_path);
+  g_free (image_path);
+  g_free (css_path);
+  g_free (dir);
+}
 
 int
 main (int argc, char *argv[])
 {
+  char *cache_dir;
+
+  /* Don't use or fill the user's CSS cache */
+  cache_dir = g_dir_make_tmp ("gtk-css-api-XXXXXX", NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+  g_free (cache_dir);
+
   gtk_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/gtk_css_provider_load_data/not_null_terminated",
       gtk_css_provider_load_data_not_null_terminated);
+  g_test_add_func ("/gtk_css_provider_load_file/cache",
+      gtk_css_provider_load_file_cache);
 
   return g_test_run ();
 }
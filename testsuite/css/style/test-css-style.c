@@ -182,6 +182,131 @@ add_test_for_file (GFile *file)
   g_free (path);
 }
 
+/* Optimizations that can be turned off with GTK_DEBUG. Styles have to
+ * come out the same either way.
+ */
+static const struct {
+  const char *name;
+  guint flag;
+} features[] = {
+  { "no-css-sharing", GTK_DEBUG_NO_CSS_SHARING },
+  { "no-css-threads", GTK_DEBUG_NO_CSS_THREADS },
+  { "no-css-index", GTK_DEBUG_NO_CSS_INDEX },
+};
+
+static const char *features_css =
+  "label { color: rgb(1,2,3); }\n"
+  ".odd label.a { color: rgb(255,0,0); font-size: 2em; }\n"
+  ".even > label:not(.b) { background-color: rgb(0,255,0); }\n"
+  "label.a + label { font-size: 20px; }\n"
+  "label.a ~ label.b { margin-left: 3px; }\n"
+  "#special label:not(:first-child):not(:last-child) { padding-top: 4px; }\n"
+  ".outer box:nth-child(odd) > label:last-child { border-top: 2px solid; }\n"
+  "#special ~ box label:not(.a) { font-weight: bold; }\n"
+  "box:not(.outer) { opacity: 0.5; }\n";
+
+/* Many more nodes than a validation needs to match in threads */
+static GtkWidget *
+create_features_window (void)
+{
+  GtkWidget *window, *outer, *box, *label;
+  guint i, j;
+
+  window = gtk_window_new (GTK_WINDOW_POPUP);
+  outer = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  gtk_style_context_add_class (gtk_widget_get_style_context (outer), "outer");
+  gtk_container_add (GTK_CONTAINER (window), outer);
+
+  for (i = 0; i < 8; i++)
+    {
+      box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+      gtk_style_context_add_class (gtk_widget_get_style_context (box), i % 2 ? "odd" : "even");
+      if (i == 3)
+        gtk_widget_set_name (box, "special");
+      gtk_container_add (GTK_CONTAINER (outer), box);
+
+      for (j = 0; j < 10; j++)
+        {
+          label = gtk_label_new ("Hello World!");
+          if (j % 3 == 0)
+            gtk_style_context_add_class (gtk_widget_get_style_context (label), "a");
+          else if (j % 3 == 1)
+            gtk_style_context_add_class (gtk_widget_get_style_context (label), "b");
+          gtk_container_add (GTK_CONTAINER (box), label);
+        }
+    }
+
+  return window;
+}
+
+static char *
+get_features_output (guint flags)
+{
+  GtkCssProvider *provider;
+  GtkWidget *window;
+  char *output;
+  guint old_flags;
+
+  /* Before loading, the selector index is built with the provider */
+  old_flags = gtk_get_debug_flags ();
+  gtk_set_debug_flags (old_flags | flags);
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider, features_css, -1);
+  gtk_style_context_add_provider_for_screen (gdk_screen_get_default (),
+                                             GTK_STYLE_PROVIDER (provider),
+                                             GTK_STYLE_PROVIDER_PRIORITY_FORCE);
+
+  window = create_features_window ();
+
+  /* validates all styles at once */
+  gtk_widget_show (window);
+
+  output = gtk_style_context_to_string (gtk_widget_get_style_context (window),
+                                        GTK_STYLE_CONTEXT_PRINT_RECURSE |
+                                        GTK_STYLE_CONTEXT_PRINT_SHOW_STYLE);
+
+  gtk_widget_destroy (window);
+
+  gtk_style_context_remove_provider_for_screen (gdk_screen_get_default (),
+                                                GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+
+  gtk_set_debug_flags (old_flags);
+
+  return output;
+}
+
+static void
+test_feature (gconstpointer data)
+{
+  guint flag = GPOINTER_TO_UINT (data);
+  char *with, *without;
+
+  with = get_features_output (0);
+  without = get_features_output (flag);
+
+  g_assert_cmpstr (with, ==, without);
+
+  g_free (with);
+  g_free (without);
+}
+
+static void
+add_feature_tests (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (features); i++)
+    {
+      char *path = g_strconcat ("/style/feature/", features[i].name, NULL);
+
+      g_test_add_data_func (path, GUINT_TO_POINTER (features[i].flag), test_feature);
+
+      g_free (path);
+    }
+}
+
 static int
 compare_files (gconstpointer a, gconstpointer b)
 {
@@ -258,6 +383,7 @@ main (int argc, char **argv)
       basedir = g_test_get_dir (G_TEST_DIST);
       dir = g_file_new_for_path (basedir);
       add_tests_for_files_in_directory (dir);
+      add_feature_tests ();
 
       g_object_unref (dir);
     }
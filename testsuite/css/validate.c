@@ -0,0 +1,65 @@
+#include <gtk/gtk.h>
+
+static void
+add_flag_to_parent (GtkWidget *widget)
+{
+  gtk_style_context_add_class (gtk_widget_get_style_context (gtk_widget_get_parent (widget)),
+                               "flag");
+}
+
+/* A style-updated handler changes an ancestor while its children are
+ * validated. Siblings validated after that must see the new class.
+ */
+static void
+test_validate_ancestor_change (void)
+{
+  GtkCssProvider *provider;
+  GtkWidget *window, *box, *first, *second;
+  GdkRGBA color, red = { 1, 0, 0, 1 };
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider,
+                                   "label.first { color: rgb(0,255,0); }\n"
+                                   "label.second { color: rgb(0,0,255); }\n"
+                                   ".flag label.second { color: rgb(255,0,0); }\n",
+                                   -1);
+  gtk_style_context_add_provider_for_screen (gdk_screen_get_default (),
+                                             GTK_STYLE_PROVIDER (provider),
+                                             G_MAXUINT);
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  first = gtk_label_new ("first");
+  second = gtk_label_new ("second");
+  gtk_style_context_add_class (gtk_widget_get_style_context (second), "second");
+  gtk_container_add (GTK_CONTAINER (box), first);
+  gtk_container_add (GTK_CONTAINER (box), second);
+  gtk_container_add (GTK_CONTAINER (window), box);
+
+  g_signal_connect (first, "style-updated", G_CALLBACK (add_flag_to_parent), NULL);
+  gtk_style_context_add_class (gtk_widget_get_style_context (first), "first");
+
+  /* validates the styles */
+  gtk_widget_show (window);
+
+  g_assert_true (gtk_style_context_has_class (gtk_widget_get_style_context (box), "flag"));
+
+  gtk_style_context_get_color (gtk_widget_get_style_context (second), &color);
+  g_assert_true (gdk_rgba_equal (&color, &red));
+
+  gtk_widget_destroy (window);
+
+  gtk_style_context_remove_provider_for_screen (gdk_screen_get_default (),
+                                                GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gtk_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/validate/ancestor-change", test_validate_ancestor_change);
+
+  return g_test_run ();
+}
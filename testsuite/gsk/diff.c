@@ -0,0 +1,154 @@
+#include <gtk/gtk.h>
+#include "gsk/gskrendernodeprivate.h"
+
+static GskRenderNode *
+color_node (float red,
+            float x,
+            float y,
+            float width,
+            float height)
+{
+  GdkRGBA color = { red, 0, 0, 1 };
+
+  return gsk_color_node_new (&color, &GRAPHENE_RECT_INIT (x, y, width, height));
+}
+
+/* container (background, transform (clip (leaf))) */
+static GskRenderNode *
+build_tree (float leaf_red)
+{
+  GskRenderNode *children[2];
+  GskRenderNode *clip, *transform, *leaf, *container;
+  graphene_matrix_t matrix;
+
+  leaf = color_node (leaf_red, 0, 0, 50, 50);
+  clip = gsk_clip_node_new (leaf, &GRAPHENE_RECT_INIT (0, 0, 30, 30));
+  gsk_render_node_unref (leaf);
+
+  graphene_matrix_init_translate (&matrix, &GRAPHENE_POINT3D_INIT (10, 20, 0));
+  transform = gsk_transform_node_new (clip, &matrix);
+  gsk_render_node_unref (clip);
+
+  children[0] = color_node (1, 0, 0, 100, 100);
+  children[1] = transform;
+  container = gsk_container_node_new (children, 2);
+  gsk_render_node_unref (children[0]);
+  gsk_render_node_unref (children[1]);
+
+  return container;
+}
+
+static void
+assert_region (cairo_region_t              *region,
+               const cairo_rectangle_int_t *expected)
+{
+  cairo_region_t *check;
+
+  if (expected)
+    check = cairo_region_create_rectangle (expected);
+  else
+    check = cairo_region_create ();
+
+  g_assert_true (cairo_region_equal (region, check));
+
+  cairo_region_destroy (check);
+}
+
+static void
+test_diff_identical (void)
+{
+  GskRenderNode *node1, *node2;
+  cairo_region_t *region;
+
+  node1 = build_tree (0.5);
+  node2 = build_tree (0.5);
+  region = cairo_region_create ();
+
+  gsk_render_node_diff (node1, node1, region);
+  assert_region (region, NULL);
+
+  gsk_render_node_diff (node1, node2, region);
+  assert_region (region, NULL);
+
+  cairo_region_destroy (region);
+  gsk_render_node_unref (node1);
+  gsk_render_node_unref (node2);
+}
+
+static void
+test_diff_clipped_leaf (void)
+{
+  GskRenderNode *node1, *node2;
+  cairo_region_t *region;
+
+  node1 = build_tree (0.5);
+  node2 = build_tree (0.25);
+  region = cairo_region_create ();
+
+  /* only the visible part of the leaf, moved by the transform */
+  gsk_render_node_diff (node1, node2, region);
+  assert_region (region, &(cairo_rectangle_int_t) { 10, 20, 30, 30 });
+
+  cairo_region_destroy (region);
+  gsk_render_node_unref (node1);
+  gsk_render_node_unref (node2);
+}
+
+static void
+test_diff_container_children (void)
+{
+  GskRenderNode *children[3];
+  GskRenderNode *short_container, *long_container;
+  cairo_region_t *region;
+
+  children[0] = color_node (0.5, 0, 0, 10, 10);
+  children[1] = color_node (0.5, 20, 0, 10, 10);
+  children[2] = color_node (0.5, 40, 0, 10, 10);
+  short_container = gsk_container_node_new (children, 2);
+  long_container = gsk_container_node_new (children, 3);
+
+  /* child appended */
+  region = cairo_region_create ();
+  gsk_render_node_diff (short_container, long_container, region);
+  assert_region (region, &(cairo_rectangle_int_t) { 40, 0, 10, 10 });
+  cairo_region_destroy (region);
+
+  /* child removed */
+  region = cairo_region_create ();
+  gsk_render_node_diff (long_container, short_container, region);
+  assert_region (region, &(cairo_rectangle_int_t) { 40, 0, 10, 10 });
+  cairo_region_destroy (region);
+
+  gsk_render_node_unref (short_container);
+  gsk_render_node_unref (long_container);
+
+  /* child inserted at the front, children are matched by type so the
+   * shifted ones may be reported too, but the new one must be */
+  short_container = gsk_container_node_new (children + 1, 2);
+  long_container = gsk_container_node_new (children, 3);
+
+  region = cairo_region_create ();
+  gsk_render_node_diff (short_container, long_container, region);
+  g_assert_true (cairo_region_contains_rectangle (region,
+                                                  &(cairo_rectangle_int_t) { 0, 0, 10, 10 }) == CAIRO_REGION_OVERLAP_IN);
+  cairo_region_destroy (region);
+
+  gsk_render_node_unref (short_container);
+  gsk_render_node_unref (long_container);
+
+  gsk_render_node_unref (children[0]);
+  gsk_render_node_unref (children[1]);
+  gsk_render_node_unref (children[2]);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/diff/identical", test_diff_identical);
+  g_test_add_func ("/diff/clipped-leaf", test_diff_clipped_leaf);
+  g_test_add_func ("/diff/container-children", test_diff_container_children);
+
+  return g_test_run ();
+}
@@ -89,6 +89,42 @@ inhibit_for_3_frames (GtkWidget *widget)
   return FALSE;
 }
 
+static gboolean
+tick_callback_redraw (GtkWidget     *widget,
+                      GdkFrameClock *frame_clock,
+                      gpointer       data)
+{
+  guint *n_frames = data;
+
+  (*n_frames)++;
+
+  if (*n_frames == 2)
+    {
+      gtk_widget_queue_draw (widget);
+    }
+  else if (*n_frames == 3)
+    {
+      reftest_uninhibit_snapshot ();
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Draws the widget again in the second frame, while all widgets that
+ * didn't change keep the render nodes of the first frame.
+ */
+G_MODULE_EXPORT gboolean
+redraw_after_1_frame (GtkWidget *widget)
+{
+  reftest_inhibit_snapshot ();
+  gtk_widget_add_tick_callback (widget,
+                                tick_callback_redraw,
+                                g_new0 (guint, 1), g_free);
+
+  return FALSE;
+}
+
 G_MODULE_EXPORT gboolean
 add_reference_class_if_no_animation (GtkWidget *widget)
 {